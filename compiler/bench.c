@@ -0,0 +1,2573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/core_names.h>
+#include "crypto.h"
+#include "merkle.h"
+#include "blockstore.h"
+#include "codec.h"
+#include "utxo.h"
+#include "mempool.h"
+#include "net.h"
+#include "seen.h"
+#include "gossip.h"
+#include "sync.h"
+#include "qrcode.h"
+
+// Micro-benchmarks for the runtime libraries, kept out of the compiler
+// binary. Each one checks its fast path against the plain one before
+// reporting a speedup.
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t random_u64(void) {
+    return (uint64_t)rand() << 40 ^ (uint64_t)rand() << 20 ^ (uint64_t)rand();
+}
+
+#define BENCH_MSG_LEN 120
+#define BENCH_SIG_MAX 72
+
+// A fresh secp256k1 key whose public half encodes compressed
+static EVP_PKEY* bench_keygen(void) {
+    EVP_PKEY *key = EVP_PKEY_Q_keygen(NULL, NULL, "EC", "secp256k1");
+    if (key && !EVP_PKEY_set_utf8_string_param(key, OSSL_PKEY_PARAM_EC_POINT_CONVERSION_FORMAT, "compressed")) {
+        EVP_PKEY_free(key);
+        return NULL;
+    }
+    return key;
+}
+
+// DER ECDSA signature over the SHA-256 of the message, as sign_data makes
+static bool bench_evp_sign(EVP_PKEY *key, const unsigned char *msg, size_t len, unsigned char *sig, size_t *sig_len) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    bool ok = ctx && EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key) == 1 &&
+              EVP_DigestSign(ctx, sig, sig_len, msg, len) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+static bool bench_evp_verify(EVP_PKEY *key, const unsigned char *msg, size_t len, const unsigned char *sig, size_t sig_len) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    bool ok = ctx && EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL, key) == 1 &&
+              EVP_DigestVerify(ctx, sig, sig_len, msg, len) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+// EVP_DigestVerify one at a time versus sig_verify_batch, over `count`
+// signatures from `keys` signers. Every 16th signature is corrupted so
+// both paths have rejections to agree on. More than 3072 keys makes the
+// batch outgrow the verifier's initial key cache.
+static int bench_verify(size_t count, int keys, int threads) {
+    EVP_PKEY **signers = malloc(sizeof(EVP_PKEY*) * keys);
+    unsigned char (*points)[SIG_PUBKEY_MAX] = malloc(SIG_PUBKEY_MAX * (size_t)keys);
+    size_t *point_lens = malloc(sizeof(size_t) * keys);
+    unsigned char (*msgs)[BENCH_MSG_LEN] = malloc(BENCH_MSG_LEN * count);
+    unsigned char (*sigs)[BENCH_SIG_MAX] = malloc(BENCH_SIG_MAX * count);
+    SigBatchItem *items = malloc(sizeof(SigBatchItem) * count);
+    uint64_t *results = calloc((count + 63) / 64, sizeof(uint64_t));
+    if (!signers || !points || !point_lens || !msgs || !sigs || !items || !results) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    
+    for (int k = 0; k < keys; k++) {
+        signers[k] = bench_keygen();
+        point_lens[k] = 0;
+        if (!signers[k] || !EVP_PKEY_get_octet_string_param(signers[k], OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY,
+                                                            points[k], SIG_PUBKEY_MAX, &point_lens[k])) {
+            printf("Error: key generation failed\n");
+            return 1;
+        }
+    }
+    
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        int k = i % keys;
+        for (size_t j = 0; j < BENCH_MSG_LEN; j++) msgs[i][j] = rand();
+        size_t sig_len = BENCH_SIG_MAX;
+        if (!bench_evp_sign(signers[k], msgs[i], BENCH_MSG_LEN, sigs[i], &sig_len)) {
+            printf("Error: signing failed\n");
+            return 1;
+        }
+        if (i % 16 == 15) msgs[i][0] ^= 1;
+        items[i] = (SigBatchItem){ points[k], point_lens[k], msgs[i], BENCH_MSG_LEN, sigs[i], sig_len };
+    }
+    
+    double t0 = now_seconds();
+    size_t single_valid = 0;
+    bool agree = true;
+    for (size_t i = 0; i < count; i++) {
+        bool ok = bench_evp_verify(signers[i % keys], msgs[i], BENCH_MSG_LEN, sigs[i], items[i].sig_len);
+        single_valid += ok;
+        if (ok != (i % 16 != 15)) agree = false;
+    }
+    double single = now_seconds() - t0;
+    
+    SigVerifier *v = sig_verifier_create(threads);
+    if (!v) {
+        printf("Error: could not create verifier\n");
+        return 1;
+    }
+    // The first batch also fills the key cache; time a warm one
+    sig_verify_batch(v, items, count, results);
+    t0 = now_seconds();
+    size_t batch_valid = sig_verify_batch(v, items, count, results);
+    double batch = now_seconds() - t0;
+    sig_verifier_destroy(v);
+    
+    for (size_t i = 0; i < count; i++) {
+        bool ok = (results[i / 64] >> (i % 64)) & 1;
+        if (ok != (i % 16 != 15)) agree = false;
+    }
+    
+    if (threads > 0) printf("verify: %zu signatures, %d keys, %d threads\n", count, keys, threads);
+    else printf("verify: %zu signatures, %d keys, all CPUs\n", count, keys);
+    printf("  EVP_DigestVerify: %.3fs, %.0f sigs/s, %zu valid\n", single, count / single, single_valid);
+    printf("  sig_verify_batch: %.3fs, %.0f sigs/s, %zu valid\n", batch, count / batch, batch_valid);
+    printf("  speedup: %.2fx, results %s\n", single / batch, agree ? "match" : "DIFFER");
+    
+    for (int k = 0; k < keys; k++) EVP_PKEY_free(signers[k]);
+    free(signers);
+    free(points);
+    free(point_lens);
+    free(msgs);
+    free(sigs);
+    free(items);
+    free(results);
+    return agree ? 0 : 1;
+}
+
+static void print_latency(const char *name, const LatencyHistogram *h) {
+    printf("  %s latency (us): min %.1f, mean %.1f, p50 <%.1f, p90 <%.1f, p99 <%.1f, max %.1f\n", name,
+           h->min_ns / 1e3, h->count ? h->total_ns / 1e3 / h->count : 0.0, latency_percentile(h, 50) / 1e3,
+           latency_percentile(h, 90) / 1e3, latency_percentile(h, 99) / 1e3, h->max_ns / 1e3);
+}
+
+// EVP_DigestSign one signature at a time versus a persistent Signer,
+// checking every signature from both. Signer throughput includes filling
+// its nonce pool; its latency histogram covers signer_sign alone.
+static int bench_sign(size_t count) {
+    unsigned char (*msgs)[BENCH_MSG_LEN] = malloc(BENCH_MSG_LEN * count);
+    unsigned char (*sigs)[BENCH_SIG_MAX] = malloc(BENCH_SIG_MAX * count);
+    SignItem *items = malloc(sizeof(SignItem) * count);
+    EVP_PKEY *key = bench_keygen();
+    if (!msgs || !sigs || !items || !key) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < BENCH_MSG_LEN; j++) msgs[i][j] = rand();
+    }
+    
+    bool ok = true;
+    LatencyHistogram plain_latency = { { 0 }, 0, 0, 0, 0 };
+    double t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        size_t sig_len = BENCH_SIG_MAX;
+        double start = now_seconds();
+        ok &= bench_evp_sign(key, msgs[i], BENCH_MSG_LEN, sigs[i], &sig_len);
+        latency_record(&plain_latency, (uint64_t)((now_seconds() - start) * 1e9));
+        items[i].sig_len = sig_len;
+    }
+    double single = now_seconds() - t0;
+    for (size_t i = 0; i < count; i++) {
+        ok &= bench_evp_verify(key, msgs[i], BENCH_MSG_LEN, sigs[i], items[i].sig_len);
+    }
+    
+    Signer *signer = signer_create(key);
+    if (!signer) {
+        printf("Error: could not create signer\n");
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        items[i] = (SignItem){ msgs[i], BENCH_MSG_LEN, sigs[i], BENCH_SIG_MAX, false };
+    }
+    t0 = now_seconds();
+    size_t signed_count = signer_sign_many(signer, items, count);
+    double batch = now_seconds() - t0;
+    for (size_t i = 0; i < count; i++) {
+        ok &= items[i].ok && bench_evp_verify(key, msgs[i], BENCH_MSG_LEN, sigs[i], items[i].sig_len);
+    }
+    
+    const LatencyHistogram *h = signer_latency(signer);
+    printf("sign: %zu signatures\n", count);
+    printf("  EVP_DigestSign:   %.3fs, %.0f sigs/s\n", single, count / single);
+    printf("  signer_sign_many: %.3fs, %.0f sigs/s, %zu signed\n", batch, count / batch, signed_count);
+    printf("  speedup: %.2fx, signatures %s\n", single / batch, ok ? "verify" : "FAIL");
+    print_latency("EVP_DigestSign", &plain_latency);
+    print_latency("signer_sign", h);
+    
+    signer_destroy(signer);
+    EVP_PKEY_free(key);
+    free(msgs);
+    free(sigs);
+    free(items);
+    return ok ? 0 : 1;
+}
+
+#define QR_BENCH_LANES 8            // Candidates per hashing batch, as each miner thread keeps
+#define QR_BENCH_MATRICES 400       // Random matrices per packing kernel
+
+// Set and noisy modules counted one module at a time, as the metrics were
+// before rows were packed: a noisy interior module differs from more than
+// 5 of its 8 neighbours
+static void qr_reference_counts(const QRCode *qr, int *set, int *noise) {
+    int n = qr->size;
+    *set = *noise = 0;
+    for (int i = 0; i < n * n; i++) *set += qr->modules[i] != 0;
+    for (int y = 1; y < n - 1; y++) {
+        for (int x = 1; x < n - 1; x++) {
+            bool current = qr->modules[y * n + x];
+            int different = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (dx || dy) different += (bool)qr->modules[(y + dy) * n + x + dx] != current;
+                }
+            }
+            *noise += different > 5;
+        }
+    }
+}
+
+// Packed density and noise against the reference on random matrices of
+// every size, with bytes other than 0 and 1 and with runs that fill whole
+// words
+static bool qr_metrics_agree(uint8_t *modules) {
+    for (int m = 0; m < QR_BENCH_MATRICES; m++) {
+        int version = 1 + m % 40;
+        QRCode qr = { version, qrcode_get_size_for_version(version), QR_ECLEVEL_H, modules, 0.0f, 0.0f };
+        size_t total = (size_t)qr.size * qr.size;
+        int style = m / 40 % 3;
+        for (size_t i = 0; i < total; i++) {
+            if (style == 0) modules[i] = rand() % 2;
+            else if (style == 1) modules[i] = rand() % 4 ? 0 : rand() % 256;
+            else modules[i] = (i / 70 + rand() % 50 / 49) % 2 ? 0xff : 0;
+        }
+        int set, noise;
+        qr_reference_counts(&qr, &set, &noise);
+        if (qrcode_calculate_density(&qr) != (float)set / total ||
+            qrcode_calculate_noise(&qr) != (float)noise / total) return false;
+    }
+    return true;
+}
+
+// Whether `candidate`, patched to `nonce`, is what qrcode_create renders
+// from the header followed by the nonce, and gets the same verdict. Its
+// running counts are also checked against the reference, so a delta bug
+// cannot hide behind a packing bug that qrcode_create shares.
+static bool qr_candidate_matches(const QRTemplate *tpl, const QRCandidate *candidate, uint8_t *data,
+                                 size_t length, uint64_t nonce, const uint8_t *target) {
+    memcpy(data + length, &nonce, sizeof(nonce));
+    QRCode *qr = qrcode_create(data, length + sizeof(nonce), tpl->ecc);
+    if (!qr) return false;
+    int set, noise;
+    qr_reference_counts(&candidate->qr, &set, &noise);
+    bool same = qr->size == candidate->qr.size &&
+                memcmp(qr->modules, candidate->qr.modules, (size_t)qr->size * qr->size) == 0 &&
+                qr->density == candidate->qr.density && qr->noise == candidate->qr.noise &&
+                candidate->set_modules == set && candidate->noise_modules == noise &&
+                qrcode_validate_pow(qr, target) == qrcode_candidate_validate(tpl, candidate, target);
+    qrcode_destroy(qr);
+    return same;
+}
+
+// A fresh candidate stepped through `attempts` nonces, mostly consecutive
+// as the miner steps them with random jumps between
+static bool qr_candidates_agree(const QRTemplate *tpl, uint8_t *data, size_t length, size_t attempts) {
+    QRCandidate candidate;
+    if (!qrcode_candidate_init(&candidate, tpl)) return false;
+    // Half of all hashes pass this target, so both verdicts are compared
+    uint8_t target[SHA256_DIGEST_LENGTH];
+    memset(target, 0xff, sizeof(target));
+    target[0] = 0x7f;
+    bool ok = true;
+    uint64_t nonce = 0;
+    for (size_t i = 0; i < attempts && ok; i++) {
+        nonce = i % 16 == 0 ? random_u64() : nonce + 1;
+        qrcode_template_set_nonce(tpl, &candidate, nonce);
+        ok &= qr_candidate_matches(tpl, &candidate, data, length, nonce, target);
+    }
+    qrcode_candidate_free(&candidate);
+    return ok;
+}
+
+// Every row packing kernel the CPU has against module-at-a-time metrics,
+// and mining candidates patched from a QRTemplate against qrcode_create on
+// the header and nonce. Then the cost of an attempt each way.
+static int bench_qr(size_t attempts, size_t length) {
+    uint8_t *data = malloc(length + sizeof(uint64_t));
+    uint8_t *modules = malloc(QR_MAX_SIZE * QR_MAX_SIZE);
+    if (!data || !modules) {
+        printf("Error: Memory allocation failed\n");
+        free(data);
+        free(modules);
+        return 1;
+    }
+    srand(6);
+    for (size_t i = 0; i < length; i++) data[i] = rand();
+    QRTemplate *tpl = qrcode_template_create(data, length, QR_ECLEVEL_H);
+    QRCandidate candidates[QR_BENCH_LANES];
+    int ready = 0;
+    while (tpl && ready < QR_BENCH_LANES && qrcode_candidate_init(&candidates[ready], tpl)) ready++;
+    if (ready < QR_BENCH_LANES) {
+        printf("Error: Could not build the template\n");
+        while (ready-- > 0) qrcode_candidate_free(&candidates[ready]);
+        qrcode_template_destroy(tpl);
+        free(data);
+        free(modules);
+        return 1;
+    }
+    QRPackKernel chosen = qrcode_pack_kernel();
+    printf("qr: %zu attempts, %zu-byte header, version %d (%d modules square), %d nonce modules, %s chosen\n",
+           attempts, length, tpl->version, tpl->size, tpl->nonce_modules, qrcode_pack_kernel_name(chosen));
+    
+    bool ok = true;
+    for (int k = 0; k < QR_PACK_KERNELS; k++) {
+        if (!qrcode_use_pack_kernel(k)) {
+            printf("  %-8s not supported\n", qrcode_pack_kernel_name(k));
+            continue;
+        }
+        bool metrics = qr_metrics_agree(modules);
+        bool candidates_ok = qr_candidates_agree(tpl, data, length, attempts);
+        printf("  %-8s metrics %s, candidates %s qrcode_create\n", qrcode_pack_kernel_name(k),
+               metrics ? "agree" : "DIFFER", candidates_ok ? "match" : "DIFFER from");
+        ok &= metrics && candidates_ok;
+    }
+    qrcode_use_pack_kernel(chosen);
+    
+    // Timed against a target nothing meets, so every attempt that passes
+    // the metrics is hashed
+    uint8_t target[SHA256_DIGEST_LENGTH] = { 0 };
+    double t0 = now_seconds();
+    for (size_t i = 0; i < attempts; i++) {
+        memcpy(data + length, &i, sizeof(uint64_t));
+        QRCode *qr = qrcode_create(data, length + sizeof(uint64_t), QR_ECLEVEL_H);
+        ok &= qr && !qrcode_validate_pow(qr, target);
+        qrcode_destroy(qr);
+    }
+    double create = now_seconds() - t0;
+    
+    t0 = now_seconds();
+    for (size_t group = 0; group < attempts; group += QR_BENCH_LANES) {
+        int lanes = attempts - group < QR_BENCH_LANES ? (int)(attempts - group) : QR_BENCH_LANES;
+        for (int i = 0; i < lanes; i++) qrcode_template_set_nonce(tpl, &candidates[i], group + i);
+        ok &= qrcode_candidates_first_valid(tpl, candidates, lanes, target) < 0;
+    }
+    double patched = now_seconds() - t0;
+    printf("  qrcode_create: %.2f us/attempt\n", create / attempts * 1e6);
+    printf("  template:      %.2f us/attempt, %.1fx faster\n", patched / attempts * 1e6, create / patched);
+    
+    for (int i = 0; i < QR_BENCH_LANES; i++) qrcode_candidate_free(&candidates[i]);
+    qrcode_template_destroy(tpl);
+    free(data);
+    free(modules);
+    return ok ? 0 : 1;
+}
+
+#define SHA_BENCH_DATA 1024
+#define SHA_BENCH_TAILS 17          // Two full batches of 8 lanes and one left over
+
+// Every SHA-256 kernel the CPU has against OpenSSL: sha256_finish and
+// sha256_finish_many over `cases` random lengths and prefix splits, and
+// sha256_iov over random buffer splits. Then hashing speed for 64-byte
+// tails, the shape of a mining candidate.
+static int bench_sha256(size_t cases, size_t tails) {
+    unsigned char data[SHA_BENCH_DATA + SHA_BENCH_TAILS];
+    size_t slots = tails > SHA_BENCH_TAILS ? tails : SHA_BENCH_TAILS;
+    unsigned char (*many)[SHA256_DIGEST_LENGTH] = malloc(SHA256_DIGEST_LENGTH * slots);
+    const unsigned char **ptrs = malloc(sizeof(unsigned char*) * slots);
+    unsigned char *buffer = malloc(64 * tails);
+    if (!many || !ptrs || !buffer) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    srand(4);
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = rand();
+    for (size_t i = 0; i < 64 * tails; i++) buffer[i] = rand();
+    for (size_t i = 0; i < tails; i++) ptrs[i] = buffer + 64 * i;
+    
+    SHA256Kernel chosen = sha256_kernel();
+    bool all_ok = true;
+    printf("sha256: %zu cases per kernel, %zu tails of 64 bytes, %s chosen\n", cases, tails, sha256_kernel_name(chosen));
+    for (int k = 0; k < SHA256_KERNELS; k++) {
+        if (!sha256_use_kernel(k)) {
+            printf("  %-8s not supported\n", sha256_kernel_name(k));
+            continue;
+        }
+        bool ok = true;
+        srand(5);
+        for (size_t c = 0; c < cases && ok; c++) {
+            // Every length up to 300 first, to cover both padding cases
+            size_t length = c <= 300 ? c : (size_t)rand() % SHA_BENCH_DATA;
+            size_t split = length ? (size_t)rand() % (length + 1) : 0;
+            unsigned char expected[SHA256_DIGEST_LENGTH], got[SHA256_DIGEST_LENGTH];
+            sha256(data, length, expected);
+    
+            SHA256Midstate mid;
+            size_t absorbed = sha256_midstate(data, split, &mid);
+            sha256_finish(&mid, data + absorbed, length - absorbed, got);
+            ok &= memcmp(got, expected, SHA256_DIGEST_LENGTH) == 0;
+    
+            // Tails at successive offsets, each checked on its own
+            size_t count = 1 + c % SHA_BENCH_TAILS;
+            const unsigned char *shifted[SHA_BENCH_TAILS];
+            for (size_t i = 0; i < count; i++) shifted[i] = data + absorbed + i;
+            sha256_finish_many(&mid, shifted, length - absorbed, many, count);
+            for (size_t i = 0; i < count && ok; i++) {
+                unsigned char prefix_then_tail[SHA_BENCH_DATA + SHA_BENCH_TAILS];
+                memcpy(prefix_then_tail, data, absorbed);
+                memcpy(prefix_then_tail + absorbed, shifted[i], length - absorbed);
+                sha256(prefix_then_tail, length, expected);
+                ok &= memcmp(many[i], expected, SHA256_DIGEST_LENGTH) == 0;
+            }
+    
+            struct iovec iov[3];
+            size_t cut = split ? (size_t)rand() % (split + 1) : 0;
+            iov[0] = (struct iovec){ data, cut };
+            iov[1] = (struct iovec){ data + cut, split - cut };
+            iov[2] = (struct iovec){ data + split, length - split };
+            sha256_iov(iov, 3, got);
+            sha256(data, length, expected);
+            ok &= memcmp(got, expected, SHA256_DIGEST_LENGTH) == 0;
+        }
+    
+        SHA256Midstate start;
+        sha256_midstate(NULL, 0, &start);
+        double t0 = now_seconds();
+        sha256_finish_many(&start, ptrs, 64, many, tails);
+        double elapsed = now_seconds() - t0;
+        printf("  %-8s %.1f Mhash/s, %s\n", sha256_kernel_name(k), tails / elapsed / 1e6, ok ? "agrees" : "DIFFERS");
+        all_ok &= ok;
+    }
+    sha256_use_kernel(chosen);
+    
+    free(many);
+    free(ptrs);
+    free(buffer);
+    return all_ok ? 0 : 1;
+}
+
+// Root of `count` leaves the slow way, one level at a time with sha256
+static void naive_merkle_root(const MerkleHash *leaves, size_t count, MerkleHash root) {
+    MerkleHash *level = malloc(sizeof(MerkleHash) * count);
+    unsigned char pair[2 * MERKLE_HASH_SIZE];
+    memcpy(level, leaves, sizeof(MerkleHash) * count);
+    while (count > 1) {
+        for (size_t i = 0; i < (count + 1) / 2; i++) {
+            size_t right = 2 * i + 1 < count ? 2 * i + 1 : 2 * i;
+            memcpy(pair, level[2 * i], MERKLE_HASH_SIZE);
+            memcpy(pair + MERKLE_HASH_SIZE, level[right], MERKLE_HASH_SIZE);
+            sha256(pair, sizeof(pair), level[i]);
+        }
+        count = (count + 1) / 2;
+    }
+    memcpy(root, level[0], MERKLE_HASH_SIZE);
+    free(level);
+}
+
+// Leaf hashing and tree building on one thread versus all CPUs, then
+// append and proof costs. Every root is checked against the naive one and
+// every proof is verified.
+static int bench_merkle_size(size_t count) {
+    unsigned char (*msgs)[BENCH_MSG_LEN] = malloc(BENCH_MSG_LEN * count);
+    struct iovec *items = malloc(sizeof(struct iovec) * count);
+    MerkleHash *leaves = malloc(sizeof(MerkleHash) * count);
+    MerkleTree *tree = merkle_create();
+    MerkleTree *grown = merkle_create();
+    if (!msgs || !items || !leaves || !tree || !grown) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < BENCH_MSG_LEN; j++) msgs[i][j] = rand();
+        items[i] = (struct iovec){ msgs[i], BENCH_MSG_LEN };
+    }
+    
+    double t0 = now_seconds();
+    merkle_hash_leaves(items, count, leaves, 1);
+    double leaves_single = now_seconds() - t0;
+    t0 = now_seconds();
+    merkle_hash_leaves(items, count, leaves, 0);
+    double leaves_parallel = now_seconds() - t0;
+    
+    MerkleHash expected, root;
+    t0 = now_seconds();
+    naive_merkle_root(leaves, count, expected);
+    double naive = now_seconds() - t0;
+    
+    bool ok = true;
+    t0 = now_seconds();
+    ok &= merkle_build(tree, leaves, count, 1);
+    double build_single = now_seconds() - t0;
+    t0 = now_seconds();
+    ok &= merkle_build(tree, leaves, count, 0);
+    double build_parallel = now_seconds() - t0;
+    ok &= merkle_root(tree, root) && memcmp(root, expected, MERKLE_HASH_SIZE) == 0;
+    
+    t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) ok &= merkle_append(grown, leaves[i]);
+    double append = now_seconds() - t0;
+    ok &= merkle_root(grown, root) && memcmp(root, expected, MERKLE_HASH_SIZE) == 0;
+    
+    MerkleHash siblings[MERKLE_MAX_DEPTH];
+    size_t proven = 0;
+    t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        int depth = merkle_proof(tree, i, siblings, MERKLE_MAX_DEPTH);
+        proven += depth >= 0 && merkle_verify(leaves[i], i, siblings, depth, expected);
+    }
+    double proofs = now_seconds() - t0;
+    ok &= proven == count;
+    
+    printf("merkle: %zu leaves, depth %d\n", count, tree->height - 1);
+    printf("  hash leaves: %.2fms on 1 thread, %.2fms on all CPUs\n", leaves_single * 1e3, leaves_parallel * 1e3);
+    printf("  naive root:  %.2fms\n", naive * 1e3);
+    printf("  build:       %.2fms on 1 thread, %.2fms on all CPUs (%.2fx over naive)\n",
+           build_single * 1e3, build_parallel * 1e3, naive / build_parallel);
+    printf("  append:      %.2fus per leaf\n", append / count * 1e6);
+    printf("  proof+verify: %.2fus per leaf, %zu verified\n", proofs / count * 1e6, proven);
+    printf("  roots %s\n", ok ? "match" : "DIFFER");
+    
+    merkle_destroy(tree);
+    merkle_destroy(grown);
+    free(msgs);
+    free(items);
+    free(leaves);
+    return ok ? 0 : 1;
+}
+
+static int bench_merkle(size_t count) {
+    if (count) return bench_merkle_size(count);
+    int status = 0;
+    for (size_t n = 1000; n <= 100000; n *= 10) status |= bench_merkle_size(n);
+    return status;
+}
+
+static void remove_store(const char *dir) {
+    const char *files[] = { "blocks.dat", "heights.idx", "hashes.idx" };
+    char path[4096];
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+// Append `count` encoded blocks with 200-2000 byte sigils, reopen the
+// store, and look blocks up by height and hash against a linear scan of
+// an in-memory array. Then tear the last record and roll back the height index to check
+// that reopening recovers every intact block.
+static int bench_store(size_t count) {
+    char dir[] = "/tmp/chrysalis_store.XXXXXX";
+    uint8_t (*hashes)[BLOCK_HASH_SIZE] = malloc(BLOCK_HASH_SIZE * count);
+    unsigned char *sigil = malloc(2000);
+    unsigned char *block = malloc(2200);
+    if (!mkdtemp(dir) || !hashes || !sigil || !block) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    
+    BlockStore *store = block_store_open(dir);
+    if (!store) return 1;
+    bool ok = true;
+    srand(1);
+    double t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) {
+        size_t length = 200 + rand() % 1801;
+        for (size_t j = 0; j < length; j++) sigil[j] = rand();
+        Block b = { (uint32_t)i, i ? hashes[i - 1] : NULL, 1700000000 + i, NULL, { (const uint8_t*)"nonce", 5 },
+                    { sigil, length }, { 0, NULL, NULL, 0 } };
+        size_t size = codec_encode(&block_schema, &b, block, 2200);
+        ok &= size && block_hash(&b, hashes[i]) && block_store_append(store, hashes[i], block, size);
+    }
+    ok &= block_store_sync(store);
+    double append = now_seconds() - t0;
+    block_store_close(store);
+    
+    t0 = now_seconds();
+    store = block_store_open(dir);
+    double open = now_seconds() - t0;
+    if (!store) return 1;
+    ok &= store->count == count;
+    
+    // Lookups in random order; the scan stands in for an array of blocks
+    size_t lookups = count < 100000 ? count : 100000;
+    size_t scans = lookups < 1000 ? lookups : 1000;
+    size_t *order = malloc(sizeof(size_t) * lookups);
+    for (size_t i = 0; i < lookups; i++) order[i] = (size_t)rand() % count;
+    BlockView view;
+    t0 = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        Block b;
+        ok &= block_store_get(store, order[i], &view) && memcmp(view.hash, hashes[order[i]], BLOCK_HASH_SIZE) == 0 &&
+              codec_decode(&block_schema, view.data, view.length, &b) == view.length && b.index == order[i];
+    }
+    double by_height = now_seconds() - t0;
+    t0 = now_seconds();
+    for (size_t i = 0; i < lookups; i++) {
+        ok &= block_store_find(store, hashes[order[i]], &view) && view.height == order[i];
+    }
+    double by_hash = now_seconds() - t0;
+    t0 = now_seconds();
+    for (size_t i = 0; i < scans; i++) {
+        size_t h = 0;
+        while (h < count && memcmp(hashes[h], hashes[order[i]], BLOCK_HASH_SIZE) != 0) h++;
+        ok &= h == order[i];
+    }
+    double scan = now_seconds() - t0;
+    uint8_t missing[BLOCK_HASH_SIZE] = { 0 };
+    ok &= !block_store_find(store, missing, NULL) && !block_store_append(store, hashes[0], block, 10);
+    block_store_close(store);
+    
+    // Simulate a crash: half a record at the tail, and an index that lags
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/blocks.dat", dir);
+    FILE *f = fopen(path, "ab");
+    BlockRecord torn = { htole32(BLOCK_RECORD_MAGIC), htole32((uint32_t)count), htole32(1000), 0, { 0 } };
+    ok &= f && fwrite(&torn, sizeof(torn), 1, f) == 1 && fwrite(block, 1, 500, f) == 500;
+    if (f) fclose(f);
+    snprintf(path, sizeof(path), "%s/heights.idx", dir);
+    f = fopen(path, "r+b");
+    StoreFileHeader header;
+    ok &= f && fread(&header, sizeof(header), 1, f) == 1;
+    header.count = htole64(count > 10 ? count - 10 : 0);
+    ok &= f && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    if (f) fclose(f);
+    
+    t0 = now_seconds();
+    store = block_store_open(dir);
+    double recover = now_seconds() - t0;
+    if (!store) return 1;
+    ok &= store->count == count;
+    for (size_t i = 0; i < count; i++) {
+        ok &= block_store_find(store, hashes[i], &view) && view.height == i;
+    }
+    ok &= block_store_append(store, missing, block, 10) && block_store_find(store, missing, &view) &&
+          view.height == count;
+    block_store_close(store);
+    remove_store(dir);
+    
+    printf("store: %zu blocks\n", count);
+    printf("  append+sync: %.3fs, %.0f blocks/s\n", append, count / append);
+    printf("  open:        %.3fms\n", open * 1e3);
+    printf("  by height:   %.3fus per lookup\n", by_height / lookups * 1e6);
+    printf("  by hash:     %.3fus per lookup\n", by_hash / lookups * 1e6);
+    printf("  array scan:  %.3fus per lookup\n", scan / scans * 1e6);
+    printf("  recovery:    %.3fms, blocks %s\n", recover * 1e3, ok ? "intact" : "LOST");
+    
+    free(order);
+    free(hashes);
+    free(sigil);
+    free(block);
+    return ok ? 0 : 1;
+}
+
+#define CODEC_MAX_TXS 64
+#define CODEC_MAX_ITEMS 8
+#define CODEC_TX_MAX 1024
+
+// A slice of random length (up to `max`) into `noise`
+static ByteSlice random_slice(const unsigned char *noise, size_t max) {
+    size_t length = rand() % (max + 1);
+    return (ByteSlice){ noise + rand() % 1024, length };
+}
+
+static void random_tx(Transaction *tx, TxInput *inputs, TxOutput *outputs, const unsigned char *noise) {
+    size_t in = rand() % (CODEC_MAX_ITEMS + 1), out = rand() % (CODEC_MAX_ITEMS + 1);
+    for (size_t i = 0; i < in; i++) {
+        inputs[i] = (TxInput){ noise + rand() % 1024, (uint32_t)rand(), random_u64() >> (rand() % 64) };
+    }
+    for (size_t i = 0; i < out; i++) {
+        outputs[i] = (TxOutput){ random_u64() >> (rand() % 64), random_slice(noise, 40) };
+    }
+    *tx = (Transaction){ (uint32_t)rand(), (uint32_t)rand(), { in, inputs, NULL, 0 }, { out, outputs, NULL, 0 },
+                         random_slice(noise, 72) };
+}
+
+// Whether the decoded transaction in `slice` re-encodes to the same bytes
+static bool tx_round_trips(ByteSlice slice, unsigned char *scratch) {
+    Transaction tx;
+    return slice.length && codec_decode(&transaction_schema, slice.data, slice.length, &tx) == slice.length &&
+           codec_encode(&transaction_schema, &tx, scratch, CODEC_TX_MAX) == slice.length &&
+           memcmp(scratch, slice.data, slice.length) == 0;
+}
+
+// Round-trip fuzzing of random blocks of random transactions: every
+// encoding decodes and re-encodes to itself, every strict prefix is
+// rejected, and any mutated buffer that still decodes re-encodes to the
+// bytes it was decoded from. Then encode/decode throughput on a block of
+// `txs` transactions.
+static int bench_codec(size_t iterations, size_t txs) {
+    unsigned char noise[2048];
+    size_t block_max = CODEC_MAX_TXS * CODEC_TX_MAX + 4096;
+    size_t big_max = (txs > CODEC_MAX_TXS ? txs : CODEC_MAX_TXS) * CODEC_TX_MAX + 4096;
+    unsigned char *tx_bytes = malloc(big_max);
+    ByteSlice *slices = malloc(sizeof(ByteSlice) * (txs > CODEC_MAX_TXS ? txs : CODEC_MAX_TXS));
+    unsigned char *buf = malloc(big_max), *copy = malloc(big_max), *scratch = malloc(big_max);
+    if (!tx_bytes || !slices || !buf || !copy || !scratch) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < sizeof(noise); i++) noise[i] = rand();
+    
+    TxInput inputs[CODEC_MAX_ITEMS];
+    TxOutput outputs[CODEC_MAX_ITEMS];
+    size_t bad = 0, mutated_ok = 0;
+    for (size_t it = 0; it < iterations; it++) {
+        // Transactions are encoded first and carried as opaque slices
+        size_t count = rand() % (CODEC_MAX_TXS + 1), used = 0;
+        for (size_t i = 0; i < count; i++) {
+            Transaction tx;
+            random_tx(&tx, inputs, outputs, noise);
+            size_t n = codec_encode(&transaction_schema, &tx, tx_bytes + used, CODEC_TX_MAX);
+            uint8_t h1[CODEC_HASH_SIZE], h2[CODEC_HASH_SIZE];
+            Transaction back;
+            bad += !n || codec_decode(&transaction_schema, tx_bytes + used, n, &back) != n ||
+                   !tx_hash(&tx, h1) || !tx_hash(&back, h2) || memcmp(h1, h2, sizeof(h1)) != 0;
+            slices[i] = (ByteSlice){ tx_bytes + used, n };
+            used += n;
+        }
+        Block block = { (uint32_t)rand(), rand() % 4 ? noise + rand() % 1024 : NULL, random_u64() >> (rand() % 64),
+                        noise + rand() % 1024, random_slice(noise, 300), random_slice(noise, 1000),
+                        { count, slices, NULL, 0 } };
+        size_t size = codec_encode(&block_schema, &block, buf, block_max);
+    
+        Block back;
+        size_t pos = 0, seen = 0;
+        ByteSlice slice;
+        bad += !size || size != codec_size(&block_schema, &block) ||
+               codec_decode(&block_schema, buf, size, &back) != size || back.transactions.count != count ||
+               codec_encode(&block_schema, &back, copy, block_max) != size || memcmp(buf, copy, size) != 0;
+        while (codec_list_next(NULL, &back.transactions, &pos, &slice)) {
+            bad += seen >= count || slice.length != slices[seen].length || !tx_round_trips(slice, scratch) ||
+                   memcmp(slice.data, slices[seen].data, slice.length) != 0;
+            seen++;
+        }
+        bad += seen != count;
+        bad += codec_decode(&block_schema, buf, rand() % size, &back) != 0;
+    
+        // Mutations either fail to decode or decode canonically
+        memcpy(copy, buf, size);
+        for (int m = rand() % 4; m >= 0; m--) copy[rand() % size] ^= 1 << (rand() % 8);
+        size_t n = codec_decode(&block_schema, copy, size, &back);
+        if (n) {
+            mutated_ok++;
+            bad += codec_encode(&block_schema, &back, scratch, big_max) != n || memcmp(scratch, copy, n) != 0;
+            pos = 0;
+            while (codec_list_next(NULL, &back.transactions, &pos, &slice)) {
+                Transaction tx;
+                if (slice.length && codec_decode(&transaction_schema, slice.data, slice.length, &tx) == slice.length) {
+                    bad += !tx_round_trips(slice, scratch);
+                }
+            }
+        }
+    }
+    
+    // Throughput on one large block
+    size_t used = 0;
+    for (size_t i = 0; i < txs; i++) {
+        Transaction tx;
+        random_tx(&tx, inputs, outputs, noise);
+        slices[i] = (ByteSlice){ tx_bytes + used, codec_encode(&transaction_schema, &tx, tx_bytes + used, CODEC_TX_MAX) };
+        used += slices[i].length;
+    }
+    Block block = { 1, noise, 1700000000, noise + 32, { noise, 64 }, { noise, 512 }, { txs, slices, NULL, 0 } };
+    size_t size = 0;
+    int rounds = 0;
+    double t0 = now_seconds(), encode;
+    do {
+        size = codec_encode(&block_schema, &block, buf, big_max);
+        rounds++;
+    } while ((encode = now_seconds() - t0) < 0.2);
+    double encode_rate = size * (double)rounds / encode / 1e6;
+    
+    // Decoding walks the block, then decodes every transaction and input
+    uint64_t total = 0;
+    int decode_rounds = 0;
+    double decode;
+    t0 = now_seconds();
+    do {
+        Block back;
+        Transaction tx;
+        TxInput input;
+        ByteSlice slice;
+        size_t pos = 0;
+        bad += codec_decode(&block_schema, buf, size, &back) != size;
+        while (codec_list_next(NULL, &back.transactions, &pos, &slice)) {
+            size_t in = 0;
+            bad += codec_decode(&transaction_schema, slice.data, slice.length, &tx) != slice.length;
+            while (codec_list_next(&tx_input_schema, &tx.inputs, &in, &input)) total += input.amount;
+        }
+        decode_rounds++;
+    } while ((decode = now_seconds() - t0) < 0.2);
+    double decode_rate = size * (double)decode_rounds / decode / 1e6;
+    
+    printf("codec: %zu fuzz iterations, %zu mutated blocks still decoded\n", iterations, mutated_ok);
+    printf("  round trips: %s (%zu failures)\n", bad ? "FAIL" : "ok", bad);
+    printf("  block of %zu transactions, %zu bytes\n", txs, size);
+    printf("  encode: %.0f MB/s\n", encode_rate);
+    printf("  decode: %.0f MB/s (input total %llu)\n", decode_rate, (unsigned long long)(total & 0xffff));
+    
+    free(tx_bytes);
+    free(slices);
+    free(buf);
+    free(copy);
+    free(scratch);
+    return bad ? 1 : 0;
+}
+
+#define UTXO_OWNERS 16
+
+typedef struct {
+    uint8_t tx_hash[CODEC_HASH_SIZE];
+    uint32_t output_index;
+    uint64_t amount;
+} BenchCoin;
+
+// XOR of a hash per output, independent of order
+static void utxo_digest(const UtxoSet *set, uint8_t *digest) {
+    unsigned char item[CODEC_HASH_SIZE + 12], h[CODEC_HASH_SIZE];
+    size_t cursor = 0;
+    const Utxo *u;
+    memset(digest, 0, CODEC_HASH_SIZE);
+    while ((u = utxo_next(set, &cursor))) {
+        memcpy(item, u->tx_hash, CODEC_HASH_SIZE);
+        memcpy(item + CODEC_HASH_SIZE, &u->output_index, 4);
+        memcpy(item + CODEC_HASH_SIZE + 4, &u->amount, 8);
+        sha256(item, sizeof(item), h);
+        for (int i = 0; i < CODEC_HASH_SIZE; i++) digest[i] ^= h[i];
+    }
+}
+
+static int compare_amounts(const void *a, const void *b) {
+    uint64_t x = (*(const Utxo* const*)a)->amount, y = (*(const Utxo* const*)b)->amount;
+    return x < y ? -1 : x > y;
+}
+
+// Build one block of `txs` transactions spending from `coins`, which is
+// updated to the outputs left afterwards. The first transaction is a
+// coinbase with `coinbase_outputs` outputs; each other one spends two
+// coins into two outputs. With `double_spend` the last transaction
+// re-spends the second one's first input. Returns the encoded size.
+static size_t build_block(uint32_t index, BenchCoin *coins, size_t *coin_count, size_t txs, size_t coinbase_outputs,
+                          bool double_spend, const uint8_t (*owners)[20], unsigned char *out, size_t out_max,
+                          unsigned char *tx_bytes, ByteSlice *slices, TxOutput *outputs) {
+    uint8_t spent_hashes[2][CODEC_HASH_SIZE], first_hash[CODEC_HASH_SIZE];
+    TxInput first_input = { first_hash, 0, 0 };
+    size_t used = 0;
+    for (size_t t = 0; t < txs; t++) {
+        TxInput inputs[2];
+        Transaction tx = { 1, index, { 0, inputs, NULL, 0 }, { 0, outputs, NULL, 0 }, { (const uint8_t*)"sig", 3 } };
+        if (t == 0) {
+            for (size_t o = 0; o < coinbase_outputs; o++) {
+                outputs[o] = (TxOutput){ 1000 + rand() % 1000000, { owners[rand() % UTXO_OWNERS], 20 } };
+            }
+            tx.outputs.count = coinbase_outputs;
+        } else {
+            uint64_t in = 0;
+            for (int k = 0; k < 2; k++) {
+                BenchCoin *c = &coins[rand() % *coin_count];
+                memcpy(spent_hashes[k], c->tx_hash, CODEC_HASH_SIZE);
+                inputs[k] = (TxInput){ spent_hashes[k], c->output_index, c->amount };
+                in += c->amount;
+                *c = coins[--*coin_count];
+            }
+            if (t == 1) {
+                memcpy(first_hash, spent_hashes[0], CODEC_HASH_SIZE);
+                first_input = (TxInput){ first_hash, inputs[0].output_index, inputs[0].amount };
+            }
+            if (double_spend && t == txs - 1) inputs[1] = first_input;
+            uint64_t split = in / 2 - 10;
+            outputs[0] = (TxOutput){ split, { owners[rand() % UTXO_OWNERS], 20 } };
+            outputs[1] = (TxOutput){ in - 20 - split, { owners[rand() % UTXO_OWNERS], 20 } };
+            tx.inputs.count = 2;
+            tx.outputs.count = 2;
+        }
+        slices[t] = (ByteSlice){ tx_bytes + used, codec_encode(&transaction_schema, &tx, tx_bytes + used, out_max - used) };
+        used += slices[t].length;
+    
+        uint8_t txid[CODEC_HASH_SIZE];
+        tx_hash(&tx, txid);
+        for (size_t o = 0; o < tx.outputs.count; o++) {
+            BenchCoin *c = &coins[(*coin_count)++];
+            memcpy(c->tx_hash, txid, CODEC_HASH_SIZE);
+            c->output_index = o;
+            c->amount = outputs[o].amount;
+        }
+    }
+    Block block = { index, NULL, 1700000000 + index, NULL, { NULL, 0 }, { NULL, 0 }, { txs, slices, NULL, 0 } };
+    return codec_encode(&block_schema, &block, out, out_max);
+}
+
+// Apply `blocks` blocks of `txs` transactions to a set seeded with a
+// coinbase of 2 * txs outputs, then undo them all and apply them again,
+// checking the set's contents at each end. A block with a double spend
+// must be rejected without changing the set. Spend checks and coin
+// selection are compared against a linear scan of the same outputs.
+static int bench_utxo(size_t txs, int blocks) {
+    size_t genesis_outputs = 2 * txs;
+    size_t coin_max = genesis_outputs + 2 * txs * (blocks + 1);
+    size_t block_max = (txs + genesis_outputs) * 256 + 4096;
+    BenchCoin *coins = malloc(sizeof(BenchCoin) * coin_max);
+    TxOutput *outputs = malloc(sizeof(TxOutput) * genesis_outputs);
+    ByteSlice *slices = malloc(sizeof(ByteSlice) * txs);
+    unsigned char *tx_bytes = malloc(block_max);
+    unsigned char **encoded = calloc(blocks + 2, sizeof(unsigned char*));
+    size_t *sizes = calloc(blocks + 2, sizeof(size_t));
+    UtxoUndo *undo = calloc(blocks + 2, sizeof(UtxoUndo));
+    UtxoSet *set = utxo_set_create();
+    if (!coins || !outputs || !slices || !tx_bytes || !encoded || !sizes || !undo || !set) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    uint8_t owners[UTXO_OWNERS][20];
+    srand(1);
+    for (int i = 0; i < UTXO_OWNERS; i++) {
+        for (int j = 0; j < 20; j++) owners[i][j] = rand();
+    }
+    
+    // Block 0 seeds the set; blocks 1..blocks are timed; the last is invalid
+    size_t coin_count = 0;
+    for (int b = 0; b <= blocks + 1; b++) {
+        bool invalid = b == blocks + 1;
+        size_t count = b == 0 ? 1 : txs;
+        if (!(encoded[b] = malloc(block_max))) return 1;
+        sizes[b] = build_block(b, coins, &coin_count, count, b == 0 ? genesis_outputs : 1, invalid,
+                               (const uint8_t (*)[20])owners, encoded[b], block_max, tx_bytes, slices, outputs);
+    }
+    
+    bool ok = true;
+    Block block;
+    uint8_t genesis_digest[CODEC_HASH_SIZE], tip_digest[CODEC_HASH_SIZE], digest[CODEC_HASH_SIZE];
+    ok &= codec_decode(&block_schema, encoded[0], sizes[0], &block) == sizes[0] && utxo_apply_block(set, &block, &undo[0]);
+    utxo_digest(set, genesis_digest);
+    
+    double t0 = now_seconds();
+    for (int b = 1; b <= blocks; b++) {
+        ok &= codec_decode(&block_schema, encoded[b], sizes[b], &block) == sizes[b] &&
+              utxo_apply_block(set, &block, &undo[b]);
+    }
+    double apply = now_seconds() - t0;
+    utxo_digest(set, tip_digest);
+    size_t tip_count = utxo_count(set);
+    
+    // The double spend comes last, so everything before it is rolled back
+    ok &= codec_decode(&block_schema, encoded[blocks + 1], sizes[blocks + 1], &block) == sizes[blocks + 1] &&
+          !utxo_apply_block(set, &block, &undo[blocks + 1]);
+    utxo_digest(set, digest);
+    ok &= memcmp(digest, tip_digest, sizeof(digest)) == 0 && utxo_count(set) == tip_count;
+    
+    t0 = now_seconds();
+    for (int b = blocks; b >= 1; b--) ok &= utxo_undo_block(set, &undo[b]);
+    double undo_time = now_seconds() - t0;
+    utxo_digest(set, digest);
+    ok &= memcmp(digest, genesis_digest, sizeof(digest)) == 0;
+    
+    t0 = now_seconds();
+    for (int b = 1; b <= blocks; b++) {
+        ok &= codec_decode(&block_schema, encoded[b], sizes[b], &block) == sizes[b] &&
+              utxo_apply_block(set, &block, &undo[b]);
+    }
+    double reapply = now_seconds() - t0;
+    utxo_digest(set, digest);
+    ok &= memcmp(digest, tip_digest, sizeof(digest)) == 0;
+    
+    // Spend checks against a scan of an array of the same outputs
+    size_t checks = 1000;
+    const Utxo **all = malloc(sizeof(Utxo*) * utxo_count(set));
+    size_t n = 0, cursor = 0;
+    const Utxo *u;
+    while ((u = utxo_next(set, &cursor))) all[n++] = u;
+    t0 = now_seconds();
+    for (size_t i = 0; i < checks; i++) {
+        const Utxo *want = all[rand() % n];
+        ok &= utxo_find(set, want->tx_hash, want->output_index) == want;
+    }
+    double find = now_seconds() - t0;
+    t0 = now_seconds();
+    for (size_t i = 0; i < checks; i++) {
+        const Utxo *want = all[rand() % n];
+        size_t j = 0;
+        while (j < n && !(all[j]->output_index == want->output_index &&
+                          memcmp(all[j]->tx_hash, want->tx_hash, CODEC_HASH_SIZE) == 0)) j++;
+        ok &= j < n;
+    }
+    double scan = now_seconds() - t0;
+    
+    // Coin selection for one owner, or any owner every few checks, against
+    // filtering and sorting a copy
+    const Utxo *picked[64], **mine = malloc(sizeof(Utxo*) * n);
+    uint64_t fast_total = 0, slow_total = 0;
+    double select = 0, sorted = 0;
+    for (size_t i = 0; i < checks; i++) {
+        const uint8_t *owner = i % (UTXO_OWNERS + 1) < UTXO_OWNERS ? owners[i % (UTXO_OWNERS + 1)] : NULL;
+        uint64_t target = 1000 + (uint64_t)rand() % 4000000, got = 0;
+        t0 = now_seconds();
+        size_t k = utxo_select(set, target, owner, 20, picked, 64, &got);
+        select += now_seconds() - t0;
+        fast_total += k ? got : 0;
+    
+        t0 = now_seconds();
+        size_t m = 0;
+        for (size_t j = 0; j < n; j++) {
+            if (!owner || memcmp(all[j]->pubkey_hash, owner, 20) == 0) mine[m++] = all[j];
+        }
+        qsort(mine, m, sizeof(Utxo*), compare_amounts);
+        size_t j = 0;
+        while (j < m && mine[j]->amount < target) j++;
+        if (j < m) {
+            slow_total += mine[j]->amount;
+        } else {
+            uint64_t sum = 0;
+            for (size_t c = 0; c < 64 && c < m && sum < target; c++) sum += mine[m - 1 - c]->amount;
+            slow_total += sum >= target ? sum : 0;
+        }
+        sorted += now_seconds() - t0;
+    }
+    ok &= fast_total == slow_total;
+    
+    printf("utxo: %d blocks of %zu transactions, %zu outputs at the tip\n", blocks, txs, tip_count);
+    printf("  apply:  %.1fms per block, %.0f txs/s\n", apply / blocks * 1e3, blocks * txs / apply);
+    printf("  undo:   %.1fms per block\n", undo_time / blocks * 1e3);
+    printf("  reapply: %.1fms per block\n", reapply / blocks * 1e3);
+    printf("  spend check: %.3fus indexed, %.1fus scanning\n", find / checks * 1e6, scan / checks * 1e6);
+    printf("  coin selection: %.2fus indexed, %.1fus filter and sort\n", select / checks * 1e6, sorted / checks * 1e6);
+    printf("  contents %s\n", ok ? "match" : "DIFFER");
+    
+    for (int b = 0; b <= blocks + 1; b++) {
+        free(encoded[b]);
+        utxo_undo_free(&undo[b]);
+    }
+    utxo_set_destroy(set);
+    free(all);
+    free(mine);
+    free(coins);
+    free(outputs);
+    free(slices);
+    free(tx_bytes);
+    free(encoded);
+    free(sizes);
+    free(undo);
+    return ok ? 0 : 1;
+}
+
+#define MEMPOOL_BLOCK_BYTES (1024 * 1024)
+#define MEMPOOL_SKIPS 1000          // Misfits in a row before a template stops
+
+typedef struct {
+    const uint8_t *txid;
+    uint64_t fee;
+    uint32_t size;
+    size_t order;
+} BenchPending;
+
+// Highest fee rate first, then arrival order
+static int compare_fee_rates(const void *a, const void *b) {
+    const BenchPending *x = a, *y = b;
+    unsigned __int128 rx = (unsigned __int128)x->fee * y->size, ry = (unsigned __int128)y->fee * x->size;
+    if (rx != ry) return rx > ry ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// Fill a pool with `count` random transactions, then compare block
+// template assembly against sorting every pending transaction by fee
+// rate. Also measures adding under a byte limit, where the cheapest
+// transactions are evicted, and age-based expiry.
+static int bench_mempool(size_t count) {
+    unsigned char noise[2048];
+    unsigned char *tx_bytes = malloc(count * CODEC_TX_MAX);
+    ByteSlice *slices = malloc(sizeof(ByteSlice) * count);
+    uint8_t (*txids)[CODEC_HASH_SIZE] = malloc(CODEC_HASH_SIZE * count);
+    uint64_t *fees = malloc(sizeof(uint64_t) * count);
+    BenchPending *pending = malloc(sizeof(BenchPending) * count);
+    const MempoolTx **chosen = malloc(sizeof(MempoolTx*) * count);
+    if (!tx_bytes || !slices || !txids || !fees || !pending || !chosen) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < sizeof(noise); i++) noise[i] = rand();
+    
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        TxInput inputs[3];
+        TxOutput outputs[3];
+        size_t in_count = 1 + rand() % 3, out_count = 1 + rand() % 3;
+        uint64_t in = 0;
+        for (size_t k = 0; k < in_count; k++) {
+            inputs[k] = (TxInput){ noise + rand() % 1024, (uint32_t)rand() % 4, 100000 + rand() % 1000000 };
+            in += inputs[k].amount;
+        }
+        fees[i] = rand() % (in / 10);
+        for (size_t k = 0; k < out_count; k++) {
+            uint64_t share = (in - fees[i]) / out_count;
+            if (k == 0) share += (in - fees[i]) % out_count;
+            outputs[k] = (TxOutput){ share, random_slice(noise, 40) };
+        }
+        Transaction tx = { 1, (uint32_t)i, { in_count, inputs, NULL, 0 }, { out_count, outputs, NULL, 0 },
+                           random_slice(noise, 72) };
+        slices[i] = (ByteSlice){ tx_bytes + used, codec_encode(&transaction_schema, &tx, tx_bytes + used, CODEC_TX_MAX) };
+        used += slices[i].length;
+        tx_hash(&tx, txids[i]);
+    }
+    
+    bool ok = true;
+    Mempool *pool = mempool_create(SIZE_MAX, MEMPOOL_DEFAULT_EXPIRY);
+    if (!pool) return 1;
+    double t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) ok &= mempool_add_tx(pool, slices[i].data, slices[i].length, 0) == MEMPOOL_ADDED;
+    double add = now_seconds() - t0;
+    ok &= mempool_add_tx(pool, slices[0].data, slices[0].length, 0) == MEMPOOL_DUPLICATE;
+    for (size_t i = 0; i < count; i++) {
+        const MempoolTx *tx = mempool_find(pool, txids[i]);
+        ok &= tx && tx->fee == fees[i] && tx->size == slices[i].length;
+    }
+    
+    // Template assembly against a sort of everything pending
+    int rounds = 10;
+    size_t n = 0;
+    t0 = now_seconds();
+    for (int r = 0; r < rounds; r++) n = mempool_template(pool, MEMPOOL_BLOCK_BYTES, chosen, count);
+    double assemble = (now_seconds() - t0) / rounds;
+    
+    size_t m = 0;
+    t0 = now_seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) pending[i] = (BenchPending){ txids[i], fees[i], slices[i].length, i };
+        qsort(pending, count, sizeof(BenchPending), compare_fee_rates);
+        size_t space = MEMPOOL_BLOCK_BYTES, skips = 0;
+        m = 0;
+        for (size_t i = 0; i < count && space && skips < MEMPOOL_SKIPS; i++) {
+            if (pending[i].size > space) {
+                skips++;
+                continue;
+            }
+            space -= pending[i].size;
+            pending[m++] = pending[i];
+            skips = 0;
+        }
+    }
+    double sorted = (now_seconds() - t0) / rounds;
+    ok &= n == m;
+    for (size_t i = 0; i < n && i < m; i++) ok &= memcmp(chosen[i]->txid, pending[i].txid, CODEC_HASH_SIZE) == 0;
+    
+    // Confirming a block removes its transactions
+    size_t confirmed = count < 1000 ? count : 1000;
+    Block block = { 1, NULL, 0, NULL, { NULL, 0 }, { NULL, 0 }, { confirmed, slices, NULL, 0 } };
+    t0 = now_seconds();
+    ok &= mempool_remove_block(pool, &block) == confirmed;
+    double confirm = now_seconds() - t0;
+    ok &= mempool_count(pool) == count - confirmed && !mempool_find(pool, txids[0]);
+    mempool_destroy(pool);
+    
+    // A quarter of the space: cheaper transactions are evicted or refused
+    size_t limit = used / 4, added = 0;
+    pool = mempool_create(limit, MEMPOOL_DEFAULT_EXPIRY);
+    if (!pool) return 1;
+    t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) added += mempool_add_tx(pool, slices[i].data, slices[i].length, 0) == MEMPOOL_ADDED;
+    double evict = now_seconds() - t0;
+    ok &= mempool_bytes(pool) <= limit;
+    size_t evicted = added - mempool_count(pool);
+    mempool_destroy(pool);
+    
+    // Arrivals spread over two hours with a one-hour expiry
+    uint64_t expiry = 3600, span = 7200, width = expiry / MEMPOOL_BUCKETS + 1;
+    pool = mempool_create(SIZE_MAX, expiry);
+    if (!pool) return 1;
+    for (size_t i = 0; i < count; i++) mempool_add_tx(pool, slices[i].data, slices[i].length, i * span / count);
+    mempool_expire(pool, span);
+    size_t aged = count - mempool_count(pool);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t time = i * span / count;
+        const MempoolTx *tx = mempool_find(pool, txids[i]);
+        if (time + expiry >= span) ok &= tx != NULL;
+        else if (time + expiry + width <= span) ok &= tx == NULL;
+    }
+    mempool_destroy(pool);
+    
+    printf("mempool: %zu transactions, %.1f MB\n", count, used / 1e6);
+    printf("  add:      %.0f tx/s, %.0f tx/s at a quarter of the space (%zu evicted)\n", count / add, count / evict,
+           evicted);
+    printf("  template: %zu transactions in %.3fms, %.1fms sorting every transaction\n", n, assemble * 1e3,
+           sorted * 1e3);
+    printf("  confirm:  %zu transactions in %.3fms\n", confirmed, confirm * 1e3);
+    printf("  expire:   %zu of %zu aged out over two hours\n", aged, count);
+    printf("  contents %s\n", ok ? "match" : "DIFFER");
+    
+    free(tx_bytes);
+    free(slices);
+    free(txids);
+    free(fees);
+    free(pending);
+    free(chosen);
+    return ok ? 0 : 1;
+}
+
+#define NET_WINDOW 8                // Frames each simulated peer keeps in flight
+#define NET_PAYLOAD_MAX 2048
+#define NET_LARGE_FRAME (256 * 1024)    // Sent first by every hundredth peer
+#define NET_FLOOD_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+    size_t index;
+    size_t sent;
+    size_t received;
+} BenchPeer;
+
+typedef struct {
+    NetReactor *server;
+    NetReactor *client;
+    BenchPeer *peers;
+    size_t peer_count;
+    size_t messages;
+    atomic_size_t done;
+    atomic_size_t closed;
+    atomic_size_t bad;
+} NetBench;
+
+static size_t bench_frame_length(size_t index, size_t seq) {
+    if (seq == 0 && index % 100 == 0) return NET_LARGE_FRAME;
+    return 8 + (index * 7 + seq * 13) % NET_PAYLOAD_MAX;
+}
+
+// Payload identifying the peer and sequence number, so echoes can be checked
+static size_t bench_frame(size_t index, size_t seq, uint8_t *out) {
+    size_t length = bench_frame_length(index, seq);
+    uint32_t head[2] = { (uint32_t)index, (uint32_t)seq };
+    memcpy(out, head, sizeof(head));
+    for (size_t i = sizeof(head); i < length; i++) out[i] = (uint8_t)(index * 31 + seq + i);
+    return length;
+}
+
+static void bench_net_send(NetPeer *peer, BenchPeer *p) {
+    static __thread uint8_t frame[NET_LARGE_FRAME];
+    size_t length = bench_frame(p->index, p->sent++, frame);
+    net_send(peer, NET_MSG_PING, frame, length);
+}
+
+static void echo_frame(NetPeer *peer, uint8_t type, const uint8_t *payload, size_t length, void *user) {
+    NetBench *b = user;
+    if (type != NET_MSG_PING || !net_send(peer, NET_MSG_PONG, payload, length)) atomic_fetch_add(&b->bad, 1);
+}
+
+static void client_open(NetPeer *peer, void *user) {
+    NetBench *b = user;
+    BenchPeer *p = net_peer_context(peer);
+    while (p->sent < b->messages && p->sent < NET_WINDOW) bench_net_send(peer, p);
+}
+
+static void client_frame(NetPeer *peer, uint8_t type, const uint8_t *payload, size_t length, void *user) {
+    NetBench *b = user;
+    BenchPeer *p = net_peer_context(peer);
+    static __thread uint8_t expected[NET_LARGE_FRAME];
+    size_t n = bench_frame(p->index, p->received++, expected);
+    if (type != NET_MSG_PONG || length != n || memcmp(payload, expected, n) != 0) atomic_fetch_add(&b->bad, 1);
+    if (p->sent < b->messages) bench_net_send(peer, p);
+    if (p->received == b->messages) {
+        atomic_fetch_add(&b->done, 1);
+        net_close(peer);
+    }
+}
+
+static void client_close(NetPeer *peer, void *user) {
+    NetBench *b = user;
+    BenchPeer *p = net_peer_context(peer);
+    if (p->received != b->messages) atomic_fetch_add(&b->bad, 1);
+    if (atomic_fetch_add(&b->closed, 1) + 1 == b->peer_count) net_reactor_stop(b->client);
+}
+
+static void *run_reactor(void *arg) {
+    net_reactor_run(arg);
+    return NULL;
+}
+
+// Write frames without reading any replies until the server stops taking
+// them, then read every echo back. Returns the frames echoed, or 0 if
+// any reply was wrong.
+static size_t flood(uint16_t port, size_t *queued) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return 0;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    
+    // Frames of 64KB: 8-byte header, zero payload, checksum of zeros
+    size_t payload = 65536 - NET_HEADER_SIZE;
+    uint8_t *frame = calloc(1, NET_HEADER_SIZE + payload), digest[CODEC_HASH_SIZE];
+    sha256(frame + NET_HEADER_SIZE, payload, digest);
+    uint8_t header[NET_HEADER_SIZE] = { NET_MSG_PING, (uint8_t)payload, (uint8_t)(payload >> 8), (uint8_t)(payload >> 16),
+                                        digest[0], digest[1], digest[2], digest[3] };
+    memcpy(frame, header, sizeof(header));
+    
+    size_t frames = 0, offset = 0, stalls = 0;
+    *queued = 0;
+    while (*queued < NET_FLOOD_BYTES && stalls < 50) {
+        ssize_t n = write(fd, frame + offset, NET_HEADER_SIZE + payload - offset);
+        if (n < 0) {
+            stalls++;
+            usleep(2000);
+            continue;
+        }
+        stalls = 0;
+        *queued += n;
+        offset += n;
+        if (offset == NET_HEADER_SIZE + payload) {
+            offset = 0;
+            frames++;
+        }
+    }
+    // Read the echoes, finishing the partial frame as the server drains
+    size_t total = frames + (offset ? 1 : 0), echoed = 0, got = 0;
+    uint8_t *reply = malloc(NET_HEADER_SIZE + payload);
+    while (echoed < total) {
+        struct pollfd pfd = { fd, POLLIN | (offset ? POLLOUT : 0), 0 };
+        if (poll(&pfd, 1, 5000) <= 0) break;
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = write(fd, frame + offset, NET_HEADER_SIZE + payload - offset);
+            if (n > 0 && (offset += n) == NET_HEADER_SIZE + payload) offset = 0;
+        }
+        if (pfd.revents & POLLIN) {
+            ssize_t n = read(fd, reply + got, NET_HEADER_SIZE + payload - got);
+            if (n <= 0) break;
+            if ((got += n) < NET_HEADER_SIZE + payload) continue;
+            if (reply[0] != NET_MSG_PONG || memcmp(reply + 1, frame + 1, NET_HEADER_SIZE - 1 + payload) != 0) break;
+            echoed++;
+            got = 0;
+        }
+    }
+    close(fd);
+    free(frame);
+    free(reply);
+    return echoed == total ? total : 0;
+}
+
+// Echo server and clients on loopback: `peers` simulated peers each
+// exchange `messages` frames with NET_WINDOW in flight, every hundredth
+// starting with a large frame. Then one raw socket writes without reading
+// to show the server stops reading a peer it cannot write to.
+static int bench_net(size_t peers, size_t messages, int loops) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 2 * peers + 64) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < 2 * peers + 64) {
+            printf("Error: %zu peers need %zu file descriptors\n", peers, 2 * peers + 64);
+            return 1;
+        }
+    }
+    
+    NetBench b = { .peer_count = peers, .messages = messages };
+    NetHandlers server_handlers = { NULL, echo_frame, NULL, &b };
+    NetHandlers client_handlers = { client_open, client_frame, client_close, &b };
+    b.server = net_reactor_create(loops, &server_handlers);
+    b.client = net_reactor_create(loops, &client_handlers);
+    b.peers = calloc(peers, sizeof(BenchPeer));
+    uint16_t port = b.server ? net_listen(b.server, "127.0.0.1", 0) : 0;
+    if (!b.client || !b.peers || !port) return 1;
+    
+    pthread_t server_thread;
+    if (pthread_create(&server_thread, NULL, run_reactor, b.server) != 0) return 1;
+    for (size_t i = 0; i < peers; i++) {
+        b.peers[i].index = i;
+        if (!net_connect(b.client, "127.0.0.1", port, &b.peers[i])) {
+            printf("Error: Failed to connect peer %zu\n", i);
+            return 1;
+        }
+    }
+    double t0 = now_seconds();
+    net_reactor_run(b.client);
+    double elapsed = now_seconds() - t0;
+    
+    NetStats client, server;
+    net_reactor_stats(b.client, &client);
+    size_t queued = 0;
+    size_t flooded = flood(port, &queued);
+    net_reactor_stop(b.server);
+    pthread_join(server_thread, NULL);
+    net_reactor_stats(b.server, &server);
+    
+    bool ok = atomic_load(&b.done) == peers && atomic_load(&b.bad) == 0 && server.accepted == peers + 1 &&
+              server.errors == 0 && flooded && server.paused > 0;
+    uint64_t round_trips = (uint64_t)peers * messages;
+    printf("net: %zu peers x %zu round trips, %d loop%s each side\n", peers, messages, loops, loops == 1 ? "" : "s");
+    printf("  echo:  %.0f round trips/s, %.1f MB/s each way, %.2fs\n", round_trips / elapsed,
+           client.bytes_out / elapsed / 1e6, elapsed);
+    printf("  flood: %.1f MB written before the server stopped reading, %zu frames echoed, %llu pauses\n",
+           queued / 1e6, flooded, (unsigned long long)server.paused);
+    printf("  %llu frames in, %llu out at the server; %s\n", (unsigned long long)server.frames_in,
+           (unsigned long long)server.frames_out, ok ? "all echoes match" : "ECHOES DIFFER");
+    
+    net_reactor_destroy(b.client);
+    net_reactor_destroy(b.server);
+    free(b.peers);
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    NetReactor *server;
+    NetReactor *client;
+    bool shared;
+    size_t peer_count;
+    size_t messages;
+    size_t size;
+    uint8_t *payload;
+    
+    // Server loop
+    NetPeer **peers;
+    size_t opened;
+    size_t acks;
+    size_t seq;
+    double start;
+    double elapsed;
+    atomic_bool finished;
+    
+    // Client loop
+    size_t *received;
+    atomic_size_t closed;
+    atomic_size_t bad;
+} BroadcastBench;
+
+// Send message `seq` to every peer, either framing it for each or once
+static void broadcast_round(BroadcastBench *b) {
+    memcpy(b->payload, &b->seq, sizeof(b->seq));
+    NetBuffer *buffer = b->shared ? net_buffer_create(NET_MSG_BLOCK, b->payload, b->size) : NULL;
+    for (size_t i = 0; i < b->peer_count; i++) {
+        bool queued = b->shared ? net_send_buffer(b->peers[i], buffer) :
+                                  net_send(b->peers[i], NET_MSG_BLOCK, b->payload, b->size);
+        if (!queued) atomic_fetch_add(&b->bad, 1);
+    }
+    net_buffer_release(buffer);
+}
+
+static void broadcast_open(NetPeer *peer, void *user) {
+    BroadcastBench *b = user;
+    b->peers[b->opened++] = peer;
+    if (b->opened == b->peer_count) {
+        b->start = now_seconds();
+        broadcast_round(b);
+    }
+}
+
+// Every peer acknowledges each message; the next goes out once all have
+static void broadcast_ack(NetPeer *peer, uint8_t type, const uint8_t *payload, size_t length, void *user) {
+    BroadcastBench *b = user;
+    (void)peer;
+    (void)payload;
+    if (type != NET_MSG_PONG || length != sizeof(size_t)) atomic_fetch_add(&b->bad, 1);
+    if (++b->acks < b->peer_count) return;
+    b->acks = 0;
+    if (++b->seq < b->messages) {
+        broadcast_round(b);
+    } else {
+        b->elapsed = now_seconds() - b->start;
+        atomic_store(&b->finished, true);
+    }
+}
+
+static void receiver_frame(NetPeer *peer, uint8_t type, const uint8_t *payload, size_t length, void *user) {
+    BroadcastBench *b = user;
+    size_t *received = net_peer_context(peer);
+    if (type == NET_MSG_PING) {
+        net_close(peer);
+        return;
+    }
+    size_t seq;
+    memcpy(&seq, payload, sizeof(seq));
+    if (type != NET_MSG_BLOCK || length != b->size || seq != (*received)++) atomic_fetch_add(&b->bad, 1);
+    net_send(peer, NET_MSG_PONG, &seq, sizeof(seq));
+}
+
+static void receiver_close(NetPeer *peer, void *user) {
+    BroadcastBench *b = user;
+    size_t *received = net_peer_context(peer);
+    if (*received != b->messages) atomic_fetch_add(&b->bad, 1);
+    if (atomic_fetch_add(&b->closed, 1) + 1 == b->peer_count) net_reactor_stop(b->client);
+}
+
+// One sender broadcasting `messages` payloads of `size` bytes to `peers`
+// receivers, framing each payload per peer or once for all of them. A
+// final message goes out through net_broadcast from another thread and
+// closes the receivers.
+static bool broadcast_run(size_t peers, size_t messages, size_t size, bool shared, BroadcastBench *b) {
+    *b = (BroadcastBench){ .shared = shared, .peer_count = peers, .messages = messages, .size = size };
+    NetHandlers sender = { broadcast_open, broadcast_ack, NULL, b };
+    NetHandlers receiver = { NULL, receiver_frame, receiver_close, b };
+    b->server = net_reactor_create(1, &sender);
+    b->client = net_reactor_create(1, &receiver);
+    b->payload = malloc(size);
+    b->peers = malloc(sizeof(NetPeer*) * peers);
+    b->received = calloc(peers, sizeof(size_t));
+    uint16_t port = b->server ? net_listen(b->server, "127.0.0.1", 0) : 0;
+    if (!b->client || !b->payload || !b->peers || !b->received || !port) return false;
+    for (size_t i = 0; i < size; i++) b->payload[i] = (uint8_t)(i * 131);
+    for (size_t i = 0; i < peers; i++) {
+        if (!net_connect(b->client, "127.0.0.1", port, &b->received[i])) return false;
+    }
+    
+    pthread_t server_thread, client_thread;
+    if (pthread_create(&server_thread, NULL, run_reactor, b->server) != 0 ||
+        pthread_create(&client_thread, NULL, run_reactor, b->client) != 0) {
+        return false;
+    }
+    while (!atomic_load(&b->finished)) usleep(1000);
+    NetBuffer *bye = net_buffer_create(NET_MSG_PING, NULL, 0);
+    bool posted = bye && net_broadcast(b->server, bye, NULL);
+    net_buffer_release(bye);
+    if (posted) pthread_join(client_thread, NULL);
+    net_reactor_stop(b->server);
+    pthread_join(server_thread, NULL);
+    
+    net_reactor_destroy(b->client);
+    net_reactor_destroy(b->server);
+    free(b->payload);
+    free(b->peers);
+    free(b->received);
+    return posted && atomic_load(&b->bad) == 0;
+}
+
+static int bench_broadcast(size_t peers, size_t messages, size_t size) {
+    BroadcastBench copy, shared;
+    bool ok = broadcast_run(peers, messages, size, false, &copy);
+    ok &= broadcast_run(peers, messages, size, true, &shared);
+    double total = (double)peers * messages * size, frame = NET_HEADER_SIZE + size;
+    printf("broadcast: %zu messages of %zu KB to %zu peers\n", messages, size / 1024, peers);
+    printf("  framed per peer: %.2fs, %.0f MB/s delivered, %.1f MB framed per broadcast\n", copy.elapsed,
+           total / copy.elapsed / 1e6, peers * frame / 1e6);
+    printf("  framed once:     %.2fs, %.0f MB/s delivered, %.1f MB framed per broadcast\n", shared.elapsed,
+           total / shared.elapsed / 1e6, frame / 1e6);
+    printf("  deliveries %s\n", ok ? "match" : "DIFFER");
+    return ok ? 0 : 1;
+}
+
+#define SEEN_RECENT 2000            // Repeats are drawn from the latest new IDs
+#define SEEN_RATE 50                // Messages per second
+#define SEEN_CHECKED 200000         // Messages checked against the array
+
+typedef struct {
+    const uint8_t *id;
+    uint64_t time;
+} BenchSeen;
+
+// The message_cache array in gossip_protocol.cry, kept in recency order
+// so it evicts the same IDs as the set: a linear scan per lookup and a
+// shift per move or removal
+typedef struct {
+    BenchSeen *items;
+    size_t count;
+    size_t capacity;
+    uint64_t expiry;
+    uint64_t width;
+    uint64_t cutoff;
+    SeenStats stats;
+} NaiveSeen;
+
+static bool naive_seen_check(NaiveSeen *n, const uint8_t *id, uint64_t now) {
+    uint64_t cutoff = now >= n->expiry ? (now - n->expiry) / n->width : 0;
+    if (cutoff > n->cutoff) {
+        size_t kept = 0;
+        for (size_t i = 0; i < n->count; i++) {
+            if (n->items[i].time / n->width >= cutoff) n->items[kept++] = n->items[i];
+        }
+        n->stats.expired += n->count - kept;
+        n->count = kept;
+        n->cutoff = cutoff;
+    }
+    for (size_t i = 0; i < n->count; i++) {
+        if (memcmp(n->items[i].id, id, SEEN_ID_SIZE) == 0) {
+            BenchSeen hit = n->items[i];
+            memmove(n->items + i, n->items + i + 1, sizeof(BenchSeen) * (n->count - i - 1));
+            n->items[n->count - 1] = hit;
+            n->stats.hits++;
+            return true;
+        }
+    }
+    n->stats.misses++;
+    if (n->count == n->capacity) {
+        memmove(n->items, n->items + 1, sizeof(BenchSeen) * --n->count);
+        n->stats.evicted++;
+    }
+    n->items[n->count++] = (BenchSeen){ id, now };
+    return false;
+}
+
+// Check `count` messages with both the set and the array; false if any
+// answer or counter differs
+static bool seen_matches(const BenchSeen *stream, size_t count, size_t capacity, uint64_t expiry, size_t filter_bits,
+                         double *array_seconds) {
+    SeenSet *set = seen_create(capacity, expiry, filter_bits);
+    NaiveSeen naive = { malloc(sizeof(BenchSeen) * capacity), 0, capacity, expiry, expiry / SEEN_BUCKETS + 1, 0, { 0 } };
+    bool *answers = malloc(count);
+    if (!set || !naive.items || !answers) {
+        printf("Error: Memory allocation failed\n");
+        seen_destroy(set);
+        free(naive.items);
+        free(answers);
+        return false;
+    }
+    double t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) answers[i] = naive_seen_check(&naive, stream[i].id, stream[i].time);
+    if (array_seconds) *array_seconds = now_seconds() - t0;
+    
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) ok &= seen_check(set, stream[i].id, stream[i].time) == answers[i];
+    SeenStats stats;
+    seen_stats(set, &stats);
+    ok &= stats.hits == naive.stats.hits && stats.misses == naive.stats.misses;
+    ok &= stats.evicted == naive.stats.evicted && stats.expired == naive.stats.expired;
+    ok &= seen_count(set) == naive.count;
+    for (size_t i = 0; i < naive.count; i++) ok &= seen_contains(set, naive.items[i].id);
+    seen_destroy(set);
+    free(naive.items);
+    free(answers);
+    return ok;
+}
+
+static double seen_run(const BenchSeen *stream, size_t count, size_t capacity, size_t filter_bits, SeenStats *stats) {
+    SeenSet *set = seen_create(capacity, SEEN_DEFAULT_EXPIRY, filter_bits);
+    if (!set) return 0;
+    double t0 = now_seconds();
+    for (size_t i = 0; i < count; i++) seen_check(set, stream[i].id, stream[i].time);
+    double elapsed = now_seconds() - t0;
+    seen_stats(set, stats);
+    seen_destroy(set);
+    return elapsed;
+}
+
+// Gossip dedup: a quarter of the messages are new and the rest repeats of
+// recent ones, as a node hears each message from several peers
+static int bench_seen(size_t count, size_t capacity) {
+    uint8_t (*ids)[SEEN_ID_SIZE] = malloc(SEEN_ID_SIZE * (count / 4 + 1));
+    BenchSeen *stream = malloc(sizeof(BenchSeen) * count);
+    if (!ids || !stream) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+    srand(1);
+    size_t fresh = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Halfway through the node is idle for two hours
+        uint64_t time = i / SEEN_RATE + (i >= count / 2 ? 2 * SEEN_DEFAULT_EXPIRY : 0);
+        if (fresh == 0 || (rand() % 4 == 0 && fresh <= count / 4)) {
+            for (int k = 0; k < SEEN_ID_SIZE; k += 8) {
+                uint64_t r = random_u64();
+                memcpy(ids[fresh] + k, &r, 8);
+            }
+            stream[i] = (BenchSeen){ ids[fresh++], time };
+        } else {
+            size_t recent = fresh < SEEN_RECENT ? fresh : SEEN_RECENT;
+            stream[i] = (BenchSeen){ ids[fresh - 1 - rand() % recent], time };
+        }
+    }
+    
+    // Against the array, bound by capacity and then by a one-minute expiry
+    size_t checked = count < SEEN_CHECKED ? count : SEEN_CHECKED;
+    size_t bits = capacity * 10;
+    double array = 0;
+    bool ok = seen_matches(stream, checked, capacity, SEEN_DEFAULT_EXPIRY, 0, &array);
+    ok &= seen_matches(stream, checked, capacity, SEEN_DEFAULT_EXPIRY, bits, NULL);
+    ok &= seen_matches(stream, checked, capacity, 60, 0, NULL);
+    ok &= seen_matches(stream, checked, capacity, 60, bits, NULL);
+    
+    SeenStats plain, filtered;
+    double table = seen_run(stream, count, capacity, 0, &plain);
+    double front = seen_run(stream, count, capacity, bits, &filtered);
+    printf("seen: %zu messages, %zu new, capacity %zu\n", count, fresh, capacity);
+    printf("  array:  %.0f ns/message over the first %zu\n", array / checked * 1e9, checked);
+    printf("  table:  %.0f ns/message, %llu hits, %llu evicted, %llu expired\n", table / count * 1e9,
+           (unsigned long long)plain.hits, (unsigned long long)plain.evicted, (unsigned long long)plain.expired);
+    printf("  filter: %.0f ns/message, %.1f%% of misses answered by %zu KB of filter\n", front / count * 1e9,
+           filtered.misses ? 100.0 * filtered.filtered / filtered.misses : 0.0, bits / 4 / 1024);
+    printf("  answers %s\n", ok ? "match" : "DIFFER");
+    free(ids);
+    free(stream);
+    return ok ? 0 : 1;
+}
+
+#define SIM_LINKS 16                // Links each node opens; others open links to it too
+#define SIM_MAX_PEERS 64
+#define SIM_LATENCY_MIN 20.0        // One-way link latency, ms
+#define SIM_LATENCY_SPREAD 60.0
+#define SIM_UPLINK 12500.0          // Bytes per ms, 100 Mbit/s
+#define SIM_FRAME_OVERHEAD 48       // Frame header plus TCP/IP
+#define SIM_DRAIN 30000.0           // Simulated ms after the last message
+#define SIM_SEEN 2048
+#define SIM_BATCH_BYTES (256 * 1024)
+
+enum { SIM_INJECT, SIM_TICK, SIM_DELIVER, SIM_READY };
+
+typedef struct {
+    double time;
+    uint32_t kind;
+    uint32_t node;
+    uint32_t from;                  // Sender's index among the receiver's peers
+    uint32_t message;               // Per-message sends and injections
+    uint8_t *frame;                 // Batches
+    size_t length;
+} SimEvent;
+
+typedef struct {
+    uint32_t peers[SIM_MAX_PEERS];
+    uint32_t back[SIM_MAX_PEERS];   // Our index among each peer's peers
+    double latency[SIM_MAX_PEERS];
+    uint32_t degree;
+    GossipScheduler *gossip;
+    SeenSet *seen;
+    double uplink_free;             // When the node's last frame has left
+    // Per-message forwarding: messages waiting, and their senders
+    uint32_t *jobs;
+    uint32_t *job_from;
+    size_t job_head;
+    size_t job_count;
+    size_t job_capacity;
+    bool busy;
+} SimNode;
+
+typedef struct {
+    uint8_t type;
+    uint32_t length;
+    uint8_t *payload;
+    double sent;
+} SimMessage;
+
+typedef struct {
+    SimNode *nodes;
+    size_t node_count;
+    SimMessage *messages;
+    size_t message_count;
+    SimEvent *events;               // Min-heap by time
+    size_t event_count;
+    size_t event_capacity;
+    double now;
+    bool batched;
+    uint32_t sender;                // Node whose batches gossip_tick is sending
+    double *latencies;              // One per first receipt
+    size_t receipts;
+    double *block_latencies;
+    size_t block_receipts;
+    uint64_t frames;
+    uint64_t bytes;
+    bool bad;
+} GossipSim;
+
+static bool sim_push(GossipSim *s, SimEvent e) {
+    if (s->event_count == s->event_capacity) {
+        size_t capacity = s->event_capacity ? s->event_capacity * 2 : 1024;
+        SimEvent *events = realloc(s->events, sizeof(SimEvent) * capacity);
+        if (!events) return false;
+        s->events = events;
+        s->event_capacity = capacity;
+    }
+    size_t i = s->event_count++;
+    while (i > 0 && s->events[(i - 1) / 2].time > e.time) {
+        s->events[i] = s->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->events[i] = e;
+    return true;
+}
+
+static SimEvent sim_pop(GossipSim *s) {
+    SimEvent top = s->events[0], last = s->events[--s->event_count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= s->event_count) break;
+        if (child + 1 < s->event_count && s->events[child + 1].time < s->events[child].time) child++;
+        if (s->events[child].time >= last.time) break;
+        s->events[i] = s->events[child];
+        i = child;
+    }
+    if (s->event_count) s->events[i] = last;
+    return top;
+}
+
+// Serialize a frame onto the sender's uplink, then across the link
+static double sim_arrival(GossipSim *s, SimNode *n, uint32_t peer, size_t length) {
+    double start = n->uplink_free > s->now ? n->uplink_free : s->now;
+    n->uplink_free = start + (length + SIM_FRAME_OVERHEAD) / SIM_UPLINK;
+    s->frames++;
+    s->bytes += length + SIM_FRAME_OVERHEAD;
+    return n->uplink_free + n->latency[peer];
+}
+
+static bool sim_send(size_t peer, const uint8_t *frame, size_t length, void *user) {
+    GossipSim *s = user;
+    SimNode *n = &s->nodes[s->sender];
+    uint8_t *copy = malloc(length);
+    if (!copy) return false;
+    memcpy(copy, frame, length);
+    double arrival = sim_arrival(s, n, (uint32_t)peer, length);
+    return sim_push(s, (SimEvent){ arrival, SIM_DELIVER, n->peers[peer], n->back[peer], 0, copy, length });
+}
+
+// Per-message forwarding as gossip_protocol.cry does it: one message at
+// a time, each send followed by PROPAGATION_DELAY
+static void sim_next_job(GossipSim *s, uint32_t node) {
+    SimNode *n = &s->nodes[node];
+    if (n->busy || n->job_count == 0) return;
+    uint32_t message = n->jobs[n->job_head], from = n->job_from[n->job_head];
+    n->job_head = (n->job_head + 1) % n->job_capacity;
+    n->job_count--;
+    size_t chosen[GOSSIP_FANOUT];
+    size_t count = gossip_sample(n->gossip, from, chosen, GOSSIP_FANOUT);
+    double now = s->now;
+    for (size_t i = 0; i < count; i++) {
+        s->now = now + i * GOSSIP_TICK_MS;
+        double arrival = sim_arrival(s, n, (uint32_t)chosen[i], GOSSIP_RECORD_HEADER + s->messages[message].length);
+        s->bad |= !sim_push(s, (SimEvent){ arrival, SIM_DELIVER, n->peers[chosen[i]], n->back[chosen[i]], message,
+                                           NULL, 0 });
+    }
+    s->now = now;
+    n->busy = true;
+    s->bad |= !sim_push(s, (SimEvent){ now + count * GOSSIP_TICK_MS, SIM_READY, node, 0, 0, NULL, 0 });
+}
+
+static void sim_receive(GossipSim *s, uint32_t node, uint32_t from, uint8_t type, const uint8_t *payload,
+                        size_t length) {
+    SimNode *n = &s->nodes[node];
+    uint32_t message;
+    memcpy(&message, payload + SEEN_ID_SIZE, sizeof(message));
+    if (length < SEEN_ID_SIZE + 4 || message >= s->message_count || s->messages[message].length != length ||
+        memcmp(s->messages[message].payload, payload, length) != 0) {
+        s->bad = true;
+        return;
+    }
+    if (seen_check(n->seen, payload, (uint64_t)(s->now / 1000))) return;
+    if (from != UINT32_MAX) {
+        double latency = s->now - s->messages[message].sent;
+        s->latencies[s->receipts++] = latency;
+        if (type == GOSSIP_BLOCK) s->block_latencies[s->block_receipts++] = latency;
+    }
+    size_t except = from == UINT32_MAX ? GOSSIP_NO_PEER : from;
+    if (s->batched) {
+        gossip_forward(n->gossip, type, payload, length, except);
+        return;
+    }
+    if (n->job_count == n->job_capacity) {
+        size_t capacity = n->job_capacity ? n->job_capacity * 2 : 64;
+        uint32_t *jobs = malloc(sizeof(uint32_t) * capacity), *job_from = malloc(sizeof(uint32_t) * capacity);
+        if (!jobs || !job_from) {
+            s->bad = true;
+            free(jobs);
+            free(job_from);
+            return;
+        }
+        for (size_t i = 0; i < n->job_count; i++) {
+            jobs[i] = n->jobs[(n->job_head + i) % n->job_capacity];
+            job_from[i] = n->job_from[(n->job_head + i) % n->job_capacity];
+        }
+        free(n->jobs);
+        free(n->job_from);
+        n->jobs = jobs;
+        n->job_from = job_from;
+        n->job_head = 0;
+        n->job_capacity = capacity;
+    }
+    size_t tail = (n->job_head + n->job_count++) % n->job_capacity;
+    n->jobs[tail] = message;
+    n->job_from[tail] = (uint32_t)except;
+    sim_next_job(s, node);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p) {
+    return count ? sorted[(size_t)(p * (count - 1))] : 0;
+}
+
+// Random graph: every node links to SIM_LINKS others, links carry traffic
+// both ways, and each direction has the same latency
+static bool sim_topology(GossipSim *s) {
+    srand(7);
+    for (uint32_t a = 0; a < s->node_count; a++) {
+        for (int tries = 0, links = 0; links < SIM_LINKS && tries < 1000; tries++) {
+            uint32_t b = (uint32_t)(rand() % s->node_count);
+            SimNode *x = &s->nodes[a], *y = &s->nodes[b];
+            bool linked = a == b || x->degree == SIM_MAX_PEERS || y->degree == SIM_MAX_PEERS;
+            for (uint32_t i = 0; i < x->degree && !linked; i++) linked = x->peers[i] == b;
+            if (linked) continue;
+            double latency = SIM_LATENCY_MIN + SIM_LATENCY_SPREAD * rand() / RAND_MAX;
+            x->peers[x->degree] = b;
+            x->back[x->degree] = y->degree;
+            x->latency[x->degree++] = latency;
+            y->peers[y->degree] = a;
+            y->back[y->degree] = x->degree - 1;
+            y->latency[y->degree++] = latency;
+            links++;
+        }
+    }
+    for (uint32_t a = 0; a < s->node_count; a++) {
+        SimNode *n = &s->nodes[a];
+        n->gossip = gossip_create(SIM_MAX_PEERS, GOSSIP_FANOUT, SIM_BATCH_BYTES, a + 1);
+        n->seen = seen_create(SIM_SEEN, SEEN_DEFAULT_EXPIRY, 0);
+        if (!n->gossip || !n->seen) return false;
+        for (uint32_t i = 0; i < n->degree; i++) gossip_set_active(n->gossip, i, true);
+    }
+    return true;
+}
+
+// Inject `rate` messages a second for `seconds`, at random nodes, and run
+// until they have spread or SIM_DRAIN has passed
+static bool gossip_simulate(GossipSim *s, size_t nodes, double rate, double seconds, bool batched) {
+    memset(s, 0, sizeof(GossipSim));
+    s->node_count = nodes;
+    s->batched = batched;
+    s->message_count = (size_t)(rate * seconds);
+    s->nodes = calloc(nodes, sizeof(SimNode));
+    s->messages = calloc(s->message_count, sizeof(SimMessage));
+    s->latencies = malloc(sizeof(double) * s->message_count * nodes + 1);
+    s->block_latencies = malloc(sizeof(double) * s->message_count * nodes + 1);
+    if (!s->nodes || !s->messages || !s->latencies || !s->block_latencies || !sim_topology(s)) return false;
+    
+    // One block in a hundred, most of the rest transactions
+    for (size_t i = 0; i < s->message_count; i++) {
+        SimMessage *m = &s->messages[i];
+        int r = rand() % 100;
+        m->type = r == 0 ? GOSSIP_BLOCK : r < 80 ? GOSSIP_TRANSACTION : GOSSIP_HEARTBEAT;
+        m->length = m->type == GOSSIP_BLOCK ? 8192 : m->type == GOSSIP_TRANSACTION ? 250 : 64;
+        m->payload = malloc(m->length);
+        if (!m->payload) return false;
+        for (size_t k = 0; k < m->length; k++) m->payload[k] = (uint8_t)rand();
+        uint32_t index = (uint32_t)i;
+        memcpy(m->payload + SEEN_ID_SIZE, &index, sizeof(index));
+        m->sent = i * 1000.0 / rate;
+        s->bad |= !sim_push(s, (SimEvent){ m->sent, SIM_INJECT, (uint32_t)(rand() % nodes), 0, index, NULL, 0 });
+    }
+    if (batched) {
+        // Each node ticks on its own phase
+        for (uint32_t a = 0; a < nodes; a++) {
+            double phase = GOSSIP_TICK_MS * (rand() / (double)RAND_MAX);
+            s->bad |= !sim_push(s, (SimEvent){ phase, SIM_TICK, a, 0, 0, NULL, 0 });
+        }
+    }
+    
+    double end = seconds * 1000 + SIM_DRAIN;
+    size_t expected = s->message_count * (nodes - 1);
+    while (s->event_count && !s->bad && s->receipts < expected) {
+        SimEvent e = sim_pop(s);
+        if (e.time > end) break;
+        s->now = e.time;
+        SimNode *n = &s->nodes[e.node];
+        if (e.kind == SIM_INJECT) {
+            SimMessage *m = &s->messages[e.message];
+            sim_receive(s, e.node, UINT32_MAX, m->type, m->payload, m->length);
+        } else if (e.kind == SIM_TICK) {
+            s->sender = e.node;
+            gossip_tick(n->gossip, sim_send, s);
+            e.time += GOSSIP_TICK_MS;
+            s->bad |= !sim_push(s, e);
+        } else if (e.kind == SIM_READY) {
+            n->busy = false;
+            sim_next_job(s, e.node);
+        } else if (e.frame) {
+            size_t pos = 0, length;
+            uint8_t type;
+            const uint8_t *payload;
+            while (gossip_batch_next(e.frame, e.length, &pos, &type, &payload, &length)) {
+                sim_receive(s, e.node, e.from, type, payload, length);
+            }
+            s->bad |= pos != e.length;
+            free(e.frame);
+        } else {
+            SimMessage *m = &s->messages[e.message];
+            sim_receive(s, e.node, e.from, m->type, m->payload, m->length);
+        }
+    }
+    return !s->bad;
+}
+
+static void gossip_sim_free(GossipSim *s) {
+    for (size_t i = 0; i < s->event_count; i++) free(s->events[i].frame);
+    for (size_t i = 0; s->nodes && i < s->node_count; i++) {
+        gossip_destroy(s->nodes[i].gossip);
+        seen_destroy(s->nodes[i].seen);
+        free(s->nodes[i].jobs);
+        free(s->nodes[i].job_from);
+    }
+    for (size_t i = 0; s->messages && i < s->message_count; i++) free(s->messages[i].payload);
+    free(s->events);
+    free(s->nodes);
+    free(s->messages);
+    free(s->latencies);
+    free(s->block_latencies);
+}
+
+static void gossip_report(const char *name, GossipSim *s) {
+    qsort(s->latencies, s->receipts, sizeof(double), compare_doubles);
+    qsort(s->block_latencies, s->block_receipts, sizeof(double), compare_doubles);
+    size_t expected = s->message_count * (s->node_count - 1);
+    printf("  %s p50 %5.0f  p90 %5.0f  p99 %5.0f ms", name, percentile(s->latencies, s->receipts, 0.5),
+           percentile(s->latencies, s->receipts, 0.9), percentile(s->latencies, s->receipts, 0.99));
+    if (s->block_receipts) printf(", blocks p99 %5.0f ms", percentile(s->block_latencies, s->block_receipts, 0.99));
+    printf(", %.1f%% reached, %llu frames of %.0f bytes\n", expected ? 100.0 * s->receipts / expected : 0,
+           (unsigned long long)s->frames, s->frames ? (double)s->bytes / s->frames : 0);
+}
+
+// The sampler against the uniform distribution: picks from 32 peers,
+// never the excluded one, with a chi-squared statistic near its 30
+// degrees of freedom
+static bool sampler_uniform(double *chi) {
+    *chi = 0;
+    GossipScheduler *g = gossip_create(32, GOSSIP_FANOUT, SIM_BATCH_BYTES, 1);
+    if (!g) return false;
+    for (size_t i = 0; i < 32; i++) gossip_set_active(g, i, true);
+    uint64_t counts[32] = { 0 };
+    size_t rounds = 1000000, chosen[GOSSIP_FANOUT];
+    bool ok = true;
+    for (size_t r = 0; r < rounds; r++) {
+        size_t n = gossip_sample(g, 5, chosen, GOSSIP_FANOUT);
+        ok &= n == GOSSIP_FANOUT && chosen[0] != chosen[1] && chosen[1] != chosen[2] && chosen[0] != chosen[2];
+        for (size_t i = 0; i < n; i++) counts[chosen[i]]++;
+    }
+    gossip_destroy(g);
+    double expected = (double)rounds * GOSSIP_FANOUT / 31;
+    for (int i = 0; i < 32; i++) {
+        if (i != 5) *chi += (counts[i] - expected) * (counts[i] - expected) / expected;
+    }
+    return ok && counts[5] == 0 && *chi < 70;
+}
+
+// Multi-node propagation: the same traffic forwarded per message with
+// PROPAGATION_DELAY after each send, then in batches every tick
+static int bench_gossip(size_t nodes, double rate, double seconds) {
+    double chi;
+    bool ok = sampler_uniform(&chi);
+    printf("gossip: %zu nodes, about %d peers each, fanout %d, %d ms ticks\n", nodes, 2 * SIM_LINKS, GOSSIP_FANOUT,
+           GOSSIP_TICK_MS);
+    printf("  sampler chi-squared %.1f over 30 degrees of freedom\n", chi);
+    
+    double light = rate < 2 ? rate : 2;
+    double loads[] = { light, rate };
+    for (int l = 0; l < (rate > light ? 2 : 1); l++) {
+        printf("  %.0f messages/s for %.0fs:\n", loads[l], seconds);
+        for (int batched = 0; batched < 2; batched++) {
+            GossipSim sim;
+            double t0 = now_seconds();
+            ok &= gossip_simulate(&sim, nodes, loads[l], seconds, batched);
+            double elapsed = now_seconds() - t0;
+            gossip_report(batched ? "batched    " : "per message", &sim);
+            if (batched) {
+                GossipStats total = { 0 }, stats;
+                for (size_t i = 0; i < nodes; i++) {
+                    gossip_stats(sim.nodes[i].gossip, &stats);
+                    total.records += stats.records;
+                    total.batches += stats.batches;
+                    total.dropped += stats.dropped;
+                }
+                printf("              %.1f messages per batch, %llu dropped, simulated in %.1fs\n",
+                       total.batches ? (double)total.records / total.batches : 0,
+                       (unsigned long long)total.dropped, elapsed);
+            }
+            gossip_sim_free(&sim);
+        }
+    }
+    printf("  messages %s\n", ok ? "match" : "DIFFER");
+    return ok ? 0 : 1;
+}
+
+#define SYNC_BLOCK_TXS 32
+#define SYNC_BLOCK_MAX (SYNC_BLOCK_TXS * CODEC_TX_MAX + 1024)
+#define SYNC_BASELINE_WINDOW 100    // Batch size in node.cry fetch_blocks
+#define SYNC_STALL_TIMEOUT 500
+#define SYNC_RECV_CAPACITY (2 * (NET_HEADER_SIZE + NET_MAX_FRAME))
+#define SYNC_REQUESTS_MAX 256
+
+typedef struct {
+    uint8_t **blocks;
+    size_t *lengths;
+    uint8_t (*hashes)[CODEC_HASH_SIZE];
+    size_t count;
+} BenchChain;
+
+// A stand-in peer on one end of a socket pair, answering MSG_GET_BLOCKS
+// after `latency` ms from its copy of the chain
+typedef struct {
+    const BenchChain *chain;
+    int fd;
+    double latency;
+    bool corrupt;                   // Damages the first block it sends
+    bool stall;                     // Only answers its first request
+    pthread_t thread;
+} StandInPeer;
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    double due;
+} StandInRequest;
+
+static bool write_frame(int fd, uint8_t type, const uint8_t *payload, size_t length) {
+    uint8_t header[NET_HEADER_SIZE], digest[CODEC_HASH_SIZE];
+    sha256(payload, length, digest);
+    header[0] = type;
+    header[1] = (uint8_t)length;
+    header[2] = (uint8_t)(length >> 8);
+    header[3] = (uint8_t)(length >> 16);
+    memcpy(header + 4, digest, 4);
+    struct iovec iov[2] = { { header, NET_HEADER_SIZE }, { (void*)payload, length } };
+    size_t left = NET_HEADER_SIZE + length;
+    while (left) {
+        ssize_t n = writev(fd, iov, 2);
+        if (n <= 0) return false;
+        left -= n;
+        for (int i = 0; i < 2; i++) {
+            size_t step = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+            iov[i].iov_base = (uint8_t*)iov[i].iov_base + step;
+            iov[i].iov_len -= step;
+            n -= step;
+        }
+    }
+    return true;
+}
+
+// Length of the complete, checksummed frame at the start of `buffer`: 0
+// if more bytes are needed, -1 if it is corrupt
+static long read_frame(const uint8_t *buffer, size_t length) {
+    if (length < NET_HEADER_SIZE) return 0;
+    size_t payload = buffer[1] | (size_t)buffer[2] << 8 | (size_t)buffer[3] << 16;
+    if (length < NET_HEADER_SIZE + payload) return 0;
+    uint8_t digest[CODEC_HASH_SIZE];
+    sha256(buffer + NET_HEADER_SIZE, payload, digest);
+    return memcmp(digest, buffer + 4, 4) == 0 ? (long)(NET_HEADER_SIZE + payload) : -1;
+}
+
+static void* stand_in_main(void *arg) {
+    StandInPeer *p = arg;
+    uint8_t *buffer = malloc(SYNC_RECV_CAPACITY), *damaged = malloc(SYNC_BLOCK_MAX);
+    StandInRequest requests[SYNC_REQUESTS_MAX];
+    size_t used = 0, pending = 0, answered = 0;
+    bool open = buffer && damaged;
+    while (open) {
+        int timeout = -1;
+        double now = now_seconds() * 1e3;
+        if (pending) timeout = requests[0].due > now ? (int)(requests[0].due - now) + 1 : 0;
+        struct pollfd pfd = { p->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout) < 0) break;
+        if (pfd.revents) {
+            ssize_t n = read(p->fd, buffer + used, SYNC_RECV_CAPACITY - used);
+            if (n <= 0) break;
+            used += n;
+            long frame;
+            while ((frame = read_frame(buffer, used)) > 0) {
+                uint32_t start, count;
+                memcpy(&start, buffer + NET_HEADER_SIZE, 4);
+                memcpy(&count, buffer + NET_HEADER_SIZE + 4, 4);
+                if (buffer[0] == NET_MSG_GET_BLOCKS && pending < SYNC_REQUESTS_MAX && !(p->stall && answered)) {
+                    requests[pending++] = (StandInRequest){ start, count, now_seconds() * 1e3 + p->latency };
+                    answered++;
+                }
+                memmove(buffer, buffer + frame, used - frame);
+                used -= frame;
+            }
+            if (frame < 0) break;
+        }
+        // Requests are answered in arrival order, each after the latency
+        while (open && pending && requests[0].due <= now_seconds() * 1e3) {
+            for (uint32_t h = requests[0].start; open && h - requests[0].start < requests[0].count; h++) {
+                if (h >= p->chain->count) break;
+                const uint8_t *block = p->chain->blocks[h];
+                size_t length = p->chain->lengths[h];
+                if (p->corrupt) {
+                    p->corrupt = false;
+                    Block view;
+                    memcpy(damaged, block, length);
+                    if (codec_decode(&block_schema, damaged, length, &view)) {
+                        damaged[view.merkle_root - damaged] ^= 1;
+                    }
+                    block = damaged;
+                }
+                open = write_frame(p->fd, NET_MSG_BLOCK, block, length);
+            }
+            memmove(requests, requests + 1, sizeof(StandInRequest) * --pending);
+        }
+    }
+    free(buffer);
+    free(damaged);
+    return NULL;
+}
+
+typedef struct {
+    const BenchChain *chain;
+    int fds[SYNC_MAX_PEERS];        // -1 once closed
+    uint8_t *buffers[SYNC_MAX_PEERS];
+    size_t used[SYNC_MAX_PEERS];
+    int peer_count;
+    atomic_bool mismatch;
+} SyncBench;
+
+static bool sync_request(int peer, uint32_t start, uint32_t count, void *user) {
+    SyncBench *b = user;
+    uint8_t payload[8];
+    memcpy(payload, &start, 4);
+    memcpy(payload + 4, &count, 4);
+    return b->fds[peer] >= 0 && write_frame(b->fds[peer], NET_MSG_GET_BLOCKS, payload, sizeof(payload));
+}
+
+static bool sync_apply(uint32_t height, const uint8_t *hash, const uint8_t *data, size_t length, void *user) {
+    SyncBench *b = user;
+    if (height >= b->chain->count || length != b->chain->lengths[height] ||
+        memcmp(hash, b->chain->hashes[height], CODEC_HASH_SIZE) != 0) {
+        atomic_store(&b->mismatch, true);
+    }
+    (void)data;
+    return true;
+}
+
+static void sync_drop(int peer, void *user) {
+    SyncBench *b = user;
+    if (b->fds[peer] >= 0) shutdown(b->fds[peer], SHUT_RDWR);
+}
+
+// Download the whole chain from `peer_count` stand-in peers; returns the
+// seconds taken, or 0 if it did not complete or differs from the chain
+static double sync_run(const BenchChain *chain, const SyncConfig *config, int peer_count, double latency,
+                       int corrupt, int stall, SyncStats *stats) {
+    SyncBench b = { chain, { 0 }, { NULL }, { 0 }, peer_count, false };
+    StandInPeer peers[SYNC_MAX_PEERS];
+    SyncHandlers handlers = { sync_request, sync_apply, sync_drop, &b };
+    SyncPipeline *sync = sync_create(config, &handlers, 0, NULL, (uint32_t)chain->count);
+    int started = 0;
+    bool ok = sync != NULL;
+    for (int i = 0; ok && i < peer_count; i++) {
+        int pair[2];
+        b.buffers[i] = malloc(SYNC_RECV_CAPACITY);
+        ok = b.buffers[i] && socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0;
+        if (!ok) break;
+        b.fds[i] = pair[0];
+        peers[i] = (StandInPeer){ chain, pair[1], latency, i == corrupt, i == stall, 0 };
+        ok = pthread_create(&peers[i].thread, NULL, stand_in_main, &peers[i]) == 0;
+        if (!ok) {
+            close(pair[1]);
+            break;
+        }
+        started++;
+        sync_add_peer(sync, i);
+    }
+    
+    double t0 = now_seconds(), elapsed = 0;
+    while (ok && !sync_done(sync) && now_seconds() - t0 < 60) {
+        uint64_t now = (uint64_t)(now_seconds() * 1e3);
+        sync_schedule(sync, now);
+        struct pollfd pfds[SYNC_MAX_PEERS];
+        int polled[SYNC_MAX_PEERS], n = 0;
+        for (int i = 0; i < started; i++) {
+            if (b.fds[i] < 0) continue;
+            pfds[n] = (struct pollfd){ b.fds[i], POLLIN, 0 };
+            polled[n++] = i;
+        }
+        if (poll(pfds, n, 2) < 0) break;
+        for (int k = 0; k < n; k++) {
+            int i = polled[k];
+            if (!pfds[k].revents) continue;
+            ssize_t got = read(b.fds[i], b.buffers[i] + b.used[i], SYNC_RECV_CAPACITY - b.used[i]);
+            if (got <= 0) {
+                sync_remove_peer(sync, i);
+                close(b.fds[i]);
+                b.fds[i] = -1;
+                continue;
+            }
+            b.used[i] += got;
+            long frame;
+            size_t pos = 0;
+            while ((frame = read_frame(b.buffers[i] + pos, b.used[i] - pos)) > 0) {
+                if (b.buffers[i][pos] == NET_MSG_BLOCK) {
+                    sync_block(sync, i, b.buffers[i] + pos + NET_HEADER_SIZE, frame - NET_HEADER_SIZE, now);
+                }
+                pos += frame;
+            }
+            memmove(b.buffers[i], b.buffers[i] + pos, b.used[i] - pos);
+            b.used[i] -= pos;
+        }
+    }
+    if (ok && sync_done(sync)) elapsed = now_seconds() - t0;
+    
+    if (sync) sync_stats(sync, stats);
+    sync_destroy(sync);
+    for (int i = 0; i < started; i++) {
+        if (b.fds[i] >= 0) close(b.fds[i]);
+        pthread_join(peers[i].thread, NULL);
+        close(peers[i].fd);
+    }
+    for (int i = 0; i < peer_count; i++) free(b.buffers[i]);
+    return atomic_load(&b.mismatch) ? 0 : elapsed;
+}
+
+// A chain of blocks of random transactions, each linked to the last and
+// mined against `target`
+static bool sync_chain(BenchChain *chain, size_t count, const uint8_t *target) {
+    unsigned char noise[2048];
+    srand(3);
+    for (size_t i = 0; i < sizeof(noise); i++) noise[i] = rand();
+    chain->blocks = calloc(count, sizeof(uint8_t*));
+    chain->lengths = malloc(sizeof(size_t) * count);
+    chain->hashes = malloc(CODEC_HASH_SIZE * count);
+    chain->count = count;
+    uint8_t *tx_bytes = malloc(SYNC_BLOCK_TXS * CODEC_TX_MAX);
+    ByteSlice slices[SYNC_BLOCK_TXS];
+    MerkleHash leaves[SYNC_BLOCK_TXS], root;
+    MerkleTree *tree = merkle_create();
+    if (!chain->blocks || !chain->lengths || !chain->hashes || !tx_bytes || !tree) return false;
+    
+    for (size_t h = 0; h < count; h++) {
+        size_t used = 0;
+        for (int i = 0; i < SYNC_BLOCK_TXS; i++) {
+            Transaction tx;
+            TxInput inputs[CODEC_MAX_ITEMS];
+            TxOutput outputs[CODEC_MAX_ITEMS];
+            random_tx(&tx, inputs, outputs, noise);
+            slices[i] = (ByteSlice){ tx_bytes + used, codec_encode(&transaction_schema, &tx, tx_bytes + used,
+                                                                   CODEC_TX_MAX) };
+            used += slices[i].length;
+            tx_hash(&tx, leaves[i]);
+        }
+        merkle_build(tree, leaves, SYNC_BLOCK_TXS, 1);
+        merkle_root(tree, root);
+    
+        uint8_t header[1024], nonce[SYNC_QR_NONCE_SIZE];
+        Block block = { (uint32_t)h, h ? chain->hashes[h - 1] : NULL, 1700000000 + h * 600, root,
+                        { NULL, 0 }, { noise, 64 }, { SYNC_BLOCK_TXS, slices, NULL, 0 } };
+        size_t header_length = sync_pow_header(&block, header, sizeof(header));
+        QRMiningStats mined;
+        if (!header_length || !qrcode_mine_parallel(header, header_length, target, 1, 1000000, &mined)) return false;
+        memcpy(nonce, &mined.nonce, sizeof(nonce));
+        block.qr_nonce = (ByteSlice){ nonce, sizeof(nonce) };
+    
+        chain->blocks[h] = malloc(SYNC_BLOCK_MAX);
+        if (!chain->blocks[h]) return false;
+        chain->lengths[h] = codec_encode(&block_schema, &block, chain->blocks[h], SYNC_BLOCK_MAX);
+        if (!chain->lengths[h] || !block_hash(&block, chain->hashes[h])) return false;
+    }
+    merkle_destroy(tree);
+    free(tx_bytes);
+    return true;
+}
+
+static void sync_chain_free(BenchChain *chain) {
+    for (size_t h = 0; chain->blocks && h < chain->count; h++) free(chain->blocks[h]);
+    free(chain->blocks);
+    free(chain->lengths);
+    free(chain->hashes);
+}
+
+// Initial sync from stand-in peers: one peer, 100-block batches validated
+// inline as node.cry fetches them, against windows from every peer with
+// validation on worker threads
+static int bench_sync(size_t count, int peers, double latency) {
+    uint8_t target[CODEC_HASH_SIZE];
+    memset(target, 0xff, sizeof(target));
+    target[0] = 0x0f;
+    BenchChain chain = { NULL, NULL, NULL, 0 };
+    double t0 = now_seconds();
+    if (!sync_chain(&chain, count, target)) {
+        printf("Error: Could not build the chain\n");
+        sync_chain_free(&chain);
+        return 1;
+    }
+    double mined = now_seconds() - t0;
+    
+    // Validation alone, on this thread
+    bool ok = true;
+    t0 = now_seconds();
+    for (size_t h = 0; h < count; h++) {
+        uint8_t hash[CODEC_HASH_SIZE];
+        ok &= sync_validate_block(chain.blocks[h], chain.lengths[h], target, hash, NULL) &&
+              memcmp(hash, chain.hashes[h], CODEC_HASH_SIZE) == 0;
+    }
+    double validate = now_seconds() - t0;
+    
+    SyncConfig sequential, parallel, hostile;
+    sync_config_default(&sequential);
+    memcpy(sequential.target, target, sizeof(target));
+    sequential.window = sequential.buffer = SYNC_BASELINE_WINDOW;
+    sequential.in_flight = 1;
+    sequential.threads = 1;
+    sync_config_default(&parallel);
+    memcpy(parallel.target, target, sizeof(target));
+    hostile = parallel;
+    hostile.timeout = SYNC_STALL_TIMEOUT;
+    
+    SyncStats one, many, bad;
+    double slow = sync_run(&chain, &sequential, 1, latency, -1, -1, &one);
+    double fast = sync_run(&chain, &parallel, peers, latency, -1, -1, &many);
+    // Peer 1 damages a block and peer 2 stops answering
+    double rough = peers > 2 ? sync_run(&chain, &hostile, peers, latency, 1, 2, &bad) : fast;
+    ok &= slow > 0 && fast > 0 && rough > 0;
+    if (peers > 2) ok &= bad.invalid >= 1 && bad.timeouts >= 1;
+    
+    printf("sync: %zu blocks of %d transactions, %d peers, %.0f ms latency\n", count, SYNC_BLOCK_TXS, peers, latency);
+    printf("  mined in %.1fs; validation alone %.0f blocks/s on one thread\n", mined, count / validate);
+    printf("  one peer, inline:     %.0f blocks/s\n", slow > 0 ? count / slow : 0);
+    printf("  %2d peers, pipelined:  %.0f blocks/s, %llu requested\n", peers, fast > 0 ? count / fast : 0,
+           (unsigned long long)many.requested);
+    if (peers > 2) {
+        printf("  with a bad block and a stalled peer: %.0f blocks/s, %llu invalid, %llu timed out, %llu re-requested\n",
+               rough > 0 ? count / rough : 0, (unsigned long long)bad.invalid, (unsigned long long)bad.timeouts,
+               (unsigned long long)(bad.requested - count));
+    }
+    printf("  chain %s\n", ok ? "matches" : "DIFFERS");
+    sync_chain_free(&chain);
+    return ok ? 0 : 1;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s verify [signatures] [keys] [threads]\n", prog);
+    printf("       %s sign [signatures]\n", prog);
+    printf("       %s qr [attempts] [header bytes]\n", prog);
+    printf("       %s sha256 [cases] [tails]\n", prog);
+    printf("       %s merkle [leaves]\n", prog);
+    printf("       %s store [blocks]\n", prog);
+    printf("       %s codec [iterations] [transactions]\n", prog);
+    printf("       %s utxo [transactions] [blocks]\n", prog);
+    printf("       %s mempool [transactions]\n", prog);
+    printf("       %s net [peers] [round trips] [loops]\n", prog);
+    printf("       %s broadcast [peers] [messages] [KB]\n", prog);
+    printf("       %s seen [messages] [capacity]\n", prog);
+    printf("       %s gossip [nodes] [messages/s] [seconds]\n", prog);
+    printf("       %s sync [blocks] [peers] [latency ms]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    int status;
+    if (strcmp(argv[1], "verify") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000;
+        int keys = argc > 3 ? atoi(argv[3]) : 100;
+        int threads = argc > 4 ? atoi(argv[4]) : 0;
+        if (count == 0 || keys <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_verify(count, keys, threads);
+    } else if (strcmp(argv[1], "sign") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000;
+        if (count == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_sign(count);
+    } else if (strcmp(argv[1], "qr") == 0) {
+        size_t attempts = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+        size_t length = argc > 3 ? strtoul(argv[3], NULL, 10) : 80;
+        if (attempts == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_qr(attempts, length);
+    } else if (strcmp(argv[1], "sha256") == 0) {
+        size_t cases = argc > 2 ? strtoul(argv[2], NULL, 10) : 3000;
+        size_t tails = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000000;
+        if (tails == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_sha256(cases, tails);
+    } else if (strcmp(argv[1], "merkle") == 0) {
+        // Without a count, runs 1k, 10k and 100k leaves
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+        status = bench_merkle(count);
+    } else if (strcmp(argv[1], "store") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        if (count == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_store(count);
+    } else if (strcmp(argv[1], "codec") == 0) {
+        size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+        size_t txs = argc > 3 ? strtoul(argv[3], NULL, 10) : 2000;
+        status = bench_codec(iterations, txs);
+    } else if (strcmp(argv[1], "utxo") == 0) {
+        size_t txs = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+        int blocks = argc > 3 ? atoi(argv[3]) : 10;
+        if (txs < 2 || blocks <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_utxo(txs, blocks);
+    } else if (strcmp(argv[1], "mempool") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+        if (count == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_mempool(count);
+    } else if (strcmp(argv[1], "net") == 0) {
+        size_t peers = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+        size_t messages = argc > 3 ? strtoul(argv[3], NULL, 10) : 100;
+        int loops = argc > 4 ? atoi(argv[4]) : 1;
+        if (peers == 0 || messages == 0 || loops <= 0 || loops > NET_MAX_LOOPS) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_net(peers, messages, loops);
+    } else if (strcmp(argv[1], "broadcast") == 0) {
+        size_t peers = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+        size_t messages = argc > 3 ? strtoul(argv[3], NULL, 10) : 20;
+        size_t kb = argc > 4 ? strtoul(argv[4], NULL, 10) : 1024;
+        if (peers == 0 || messages == 0 || kb == 0 || kb * 1024 > NET_MAX_FRAME) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_broadcast(peers, messages, kb * 1024);
+    } else if (strcmp(argv[1], "seen") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+        size_t capacity = argc > 3 ? strtoul(argv[3], NULL, 10) : SEEN_DEFAULT_CAPACITY;
+        if (count == 0 || capacity == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_seen(count, capacity);
+    } else if (strcmp(argv[1], "gossip") == 0) {
+        size_t nodes = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+        double rate = argc > 3 ? atof(argv[3]) : 200;
+        double seconds = argc > 4 ? atof(argv[4]) : 10;
+        if (nodes < 2 || rate <= 0 || seconds <= 0 || rate * seconds < 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_gossip(nodes, rate, seconds);
+    } else if (strcmp(argv[1], "sync") == 0) {
+        size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000;
+        int peers = argc > 3 ? atoi(argv[3]) : 8;
+        double latency = argc > 4 ? atof(argv[4]) : 50;
+        if (count < 2 || peers <= 0 || peers > SYNC_MAX_PEERS || latency < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        status = bench_sync(count, peers, latency);
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    return status;
+}
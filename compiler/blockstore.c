@@ -0,0 +1,333 @@
+#include "blockstore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SEGMENT_GROWTH (1 << 20)
+#define INDEX_MIN_ENTRIES 1024
+// The segment is mapped with room to grow so most appends don't remap
+#define SEGMENT_RESERVE (64u << 20)
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+static size_t record_size(uint32_t length) {
+    return align_up(sizeof(BlockRecord) + length, 8);
+}
+
+static StoreFileHeader* file_header(const StoreFile *f) {
+    return (StoreFileHeader*)f->map;
+}
+
+static bool file_open(StoreFile *f, const char *dir, const char *name, const char *magic, size_t min_size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (f->fd < 0) {
+        printf("Error: Could not open file %s\n", path);
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(f->fd, &st) != 0) return false;
+    bool created = st.st_size == 0;
+    f->file_size = st.st_size;
+    if (f->file_size < min_size) {
+        if (ftruncate(f->fd, min_size) != 0) {
+            printf("Error: Could not grow file %s\n", path);
+            return false;
+        }
+        f->file_size = min_size;
+    }
+    f->map_size = f->file_size;
+    f->map = mmap(NULL, f->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (f->map == MAP_FAILED) {
+        f->map = NULL;
+        printf("Error: Could not map file %s\n", path);
+        return false;
+    }
+    
+    StoreFileHeader *header = file_header(f);
+    if (created) {
+        memcpy(header->magic, magic, sizeof(header->magic));
+        header->version = htole32(BLOCK_STORE_VERSION);
+    }
+    if (memcmp(header->magic, magic, sizeof(header->magic)) != 0 || le32toh(header->version) != BLOCK_STORE_VERSION) {
+        printf("Error: %s is not a block store file\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void file_close(StoreFile *f) {
+    if (f->map) munmap(f->map, f->map_size);
+    if (f->fd >= 0) close(f->fd);
+}
+
+// Set the file's size, remapping it with at least `reserve` bytes when it
+// outgrows the current mapping
+static bool file_resize(StoreFile *f, size_t size, size_t reserve) {
+    if (ftruncate(f->fd, size) != 0) {
+        printf("Error: Could not resize block store file\n");
+        return false;
+    }
+    f->file_size = size;
+    if (size <= f->map_size) return true;
+    
+    if (reserve < size) reserve = size;
+    void *map = mmap(NULL, reserve, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Error: Could not map block store file\n");
+        return false;
+    }
+    munmap(f->map, f->map_size);
+    f->map = map;
+    f->map_size = reserve;
+    return true;
+}
+
+static const BlockRecord* record_at(const BlockStore *s, uint64_t offset) {
+    return (const BlockRecord*)(s->segment.map + offset);
+}
+
+static uint64_t* height_offsets(const BlockStore *s) {
+    return (uint64_t*)(s->heights.map + sizeof(StoreFileHeader));
+}
+
+// Segment offset of the block at `height`
+static uint64_t height_offset(const BlockStore *s, uint64_t height) {
+    return le64toh(height_offsets(s)[height]);
+}
+
+static uint64_t header_count(const StoreFile *f) {
+    return le64toh(file_header(f)->count);
+}
+
+static void set_header_count(StoreFile *f, uint64_t count) {
+    file_header(f)->count = htole64(count);
+}
+
+static uint64_t height_capacity(const BlockStore *s) {
+    return (s->heights.file_size - sizeof(StoreFileHeader)) / sizeof(uint64_t);
+}
+
+static BlockHashSlot* hash_slots(const BlockStore *s) {
+    return (BlockHashSlot*)(s->hashes.map + sizeof(StoreFileHeader));
+}
+
+// Block hashes from proof of work tend to start with zeros, so the key is
+// taken from the other end, read as a little-endian number
+static uint64_t hash_key(const uint8_t *hash) {
+    uint64_t key;
+    memcpy(&key, hash + BLOCK_HASH_SIZE - sizeof(key), sizeof(key));
+    return le64toh(key);
+}
+
+// The first four digest bytes, compared as stored. Height and length are
+// hashed in their encoded form.
+static uint32_t record_checksum(const BlockRecord *rec, const void *data) {
+    struct iovec iov[3] = {
+        { (void*)&rec->height, sizeof(rec->height) + sizeof(rec->length) },
+        { (void*)rec->hash, BLOCK_HASH_SIZE },
+        { (void*)data, le32toh(rec->length) },
+    };
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    uint32_t checksum;
+    sha256_iov(iov, 3, digest);
+    memcpy(&checksum, digest, sizeof(checksum));
+    return checksum;
+}
+
+// Whether a complete, intact record for `height` starts at `offset`
+static bool record_valid(const BlockStore *s, uint64_t offset, uint64_t height) {
+    size_t size = s->segment.file_size;
+    if (offset < sizeof(StoreFileHeader) || offset % 8 || size < sizeof(BlockRecord) ||
+        offset > size - sizeof(BlockRecord)) return false;
+    const BlockRecord *rec = record_at(s, offset);
+    uint32_t length = le32toh(rec->length);
+    return le32toh(rec->magic) == BLOCK_RECORD_MAGIC && le32toh(rec->height) == height &&
+           length <= size - offset - sizeof(BlockRecord) && record_size(length) <= size - offset &&
+           rec->checksum == record_checksum(rec, rec + 1);
+}
+
+static bool height_reserve(BlockStore *s, uint64_t count) {
+    uint64_t capacity = height_capacity(s);
+    if (count <= capacity) return true;
+    while (capacity < count) capacity *= 2;
+    size_t size = sizeof(StoreFileHeader) + capacity * sizeof(uint64_t);
+    return file_resize(&s->heights, size, size);
+}
+
+static void hash_insert(BlockStore *s, const uint8_t *hash, uint64_t height) {
+    BlockHashSlot *slots = hash_slots(s);
+    uint64_t key = hash_key(hash);
+    uint64_t mask = s->hash_capacity - 1;
+    uint64_t i = key & mask;
+    while (slots[i].entry) i = (i + 1) & mask;
+    slots[i].key = htole64(key);
+    slots[i].entry = htole64(height + 1);
+}
+
+// Reindex every block into a table of `capacity` slots. The count is
+// cleared first so a crash part way through forces another rebuild.
+static bool hash_rebuild(BlockStore *s, uint64_t capacity) {
+    size_t size = sizeof(StoreFileHeader) + capacity * sizeof(BlockHashSlot);
+    if (!file_resize(&s->hashes, size, size)) return false;
+    s->hash_capacity = capacity;
+    set_header_count(&s->hashes, 0);
+    memset(hash_slots(s), 0, capacity * sizeof(BlockHashSlot));
+    for (uint64_t h = 0; h < s->count; h++) {
+        hash_insert(s, record_at(s, height_offset(s, h))->hash, h);
+    }
+    set_header_count(&s->hashes, s->count);
+    return true;
+}
+
+static bool store_recover(BlockStore *s) {
+    uint64_t n = header_count(&s->heights);
+    if (n > height_capacity(s)) n = height_capacity(s);
+    
+    // Drop indexed blocks whose records did not reach the segment
+    while (n > 0 && !record_valid(s, height_offset(s, n - 1), n - 1)) n--;
+    uint64_t end = sizeof(StoreFileHeader);
+    if (n > 0) {
+        uint64_t last = height_offset(s, n - 1);
+        end = last + record_size(le32toh(record_at(s, last)->length));
+    }
+    
+    // Index records appended after the height index was last updated
+    while (record_valid(s, end, n)) {
+        if (!height_reserve(s, n + 1)) return false;
+        height_offsets(s)[n++] = htole64(end);
+        end += record_size(le32toh(record_at(s, end)->length));
+    }
+    
+    // Anything after the last intact record is a torn write
+    if (end != s->segment.file_size && !file_resize(&s->segment, end, s->segment.map_size)) return false;
+    s->end = end;
+    s->count = n;
+    set_header_count(&s->heights, n);
+    
+    uint64_t capacity = (s->hashes.file_size - sizeof(StoreFileHeader)) / sizeof(BlockHashSlot);
+    bool usable = capacity >= INDEX_MIN_ENTRIES && (capacity & (capacity - 1)) == 0 && n * 2 <= capacity &&
+                  s->hashes.file_size == sizeof(StoreFileHeader) + capacity * sizeof(BlockHashSlot);
+    s->hash_capacity = capacity;
+    if (usable && header_count(&s->hashes) == n) return true;
+    if (!usable) {
+        capacity = 2 * INDEX_MIN_ENTRIES;
+        while (capacity < n * 2) capacity *= 2;
+    }
+    return hash_rebuild(s, capacity);
+}
+
+BlockStore* block_store_open(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Error: Could not create directory %s\n", dir);
+        return NULL;
+    }
+    
+    BlockStore *s = calloc(1, sizeof(BlockStore));
+    if (!s) return NULL;
+    s->segment.fd = s->heights.fd = s->hashes.fd = -1;
+    
+    if (!file_open(&s->segment, dir, "blocks.dat", BLOCK_SEGMENT_MAGIC, sizeof(StoreFileHeader)) ||
+        !file_open(&s->heights, dir, "heights.idx", BLOCK_HEIGHTS_MAGIC,
+                   sizeof(StoreFileHeader) + INDEX_MIN_ENTRIES * sizeof(uint64_t)) ||
+        !file_open(&s->hashes, dir, "hashes.idx", BLOCK_HASHES_MAGIC,
+                   sizeof(StoreFileHeader) + 2 * INDEX_MIN_ENTRIES * sizeof(BlockHashSlot)) ||
+        !store_recover(s)) {
+        block_store_close(s);
+        return NULL;
+    }
+    return s;
+}
+
+void block_store_close(BlockStore *store) {
+    if (store) {
+        // Drop the preallocated tail so the file ends at the last record
+        if (store->segment.map && store->end) {
+            if (ftruncate(store->segment.fd, store->end) != 0) printf("Error: Could not truncate block segment\n");
+        }
+        file_close(&store->segment);
+        file_close(&store->heights);
+        file_close(&store->hashes);
+        free(store);
+    }
+}
+
+bool block_store_append(BlockStore *s, const uint8_t *hash, const void *data, size_t length) {
+    if (length > UINT32_MAX - sizeof(BlockRecord) || s->count >= UINT32_MAX) {
+        printf("Error: block too large for the store\n");
+        return false;
+    }
+    if (block_store_find(s, hash, NULL)) {
+        printf("Error: block already stored\n");
+        return false;
+    }
+    
+    // Make room in all three files before writing anything
+    size_t size = record_size(length);
+    if (s->end + size > s->segment.file_size) {
+        size_t growth = s->segment.file_size / 4 > SEGMENT_GROWTH ? s->segment.file_size / 4 : SEGMENT_GROWTH;
+        size_t file_size = s->end + (size > growth ? size : growth);
+        size_t reserve = s->segment.map_size;
+        while (reserve < file_size) reserve = reserve < SEGMENT_RESERVE ? SEGMENT_RESERVE : reserve * 2;
+        if (!file_resize(&s->segment, file_size, reserve)) return false;
+    }
+    if (!height_reserve(s, s->count + 1)) return false;
+    if ((s->count + 1) * 2 > s->hash_capacity && !hash_rebuild(s, s->hash_capacity * 2)) return false;
+    
+    BlockRecord rec = { htole32(BLOCK_RECORD_MAGIC), htole32((uint32_t)s->count), htole32((uint32_t)length), 0, { 0 } };
+    memcpy(rec.hash, hash, BLOCK_HASH_SIZE);
+    rec.checksum = record_checksum(&rec, data);
+    unsigned char *dest = s->segment.map + s->end;
+    memcpy(dest, &rec, sizeof(rec));
+    memcpy(dest + sizeof(rec), data, length);
+    memset(dest + sizeof(rec) + length, 0, size - sizeof(rec) - length);
+    
+    // Index only after the record is in place
+    height_offsets(s)[s->count] = htole64(s->end);
+    set_header_count(&s->heights, s->count + 1);
+    hash_insert(s, hash, s->count);
+    set_header_count(&s->hashes, s->count + 1);
+    s->end += size;
+    s->count++;
+    return true;
+}
+
+bool block_store_get(const BlockStore *s, uint64_t height, BlockView *view) {
+    if (height >= s->count) return false;
+    const BlockRecord *rec = record_at(s, height_offset(s, height));
+    if (view) *view = (BlockView){ le32toh(rec->height), rec->hash, (const uint8_t*)(rec + 1), le32toh(rec->length) };
+    return true;
+}
+
+bool block_store_find(const BlockStore *s, const uint8_t *hash, BlockView *view) {
+    const BlockHashSlot *slots = hash_slots(s);
+    uint64_t key = hash_key(hash);
+    uint64_t mask = s->hash_capacity - 1;
+    
+    for (uint64_t i = key & mask; slots[i].entry; i = (i + 1) & mask) {
+        if (le64toh(slots[i].key) != key) continue;
+        uint64_t height = le64toh(slots[i].entry) - 1;
+        const BlockRecord *rec = record_at(s, height_offset(s, height));
+        if (memcmp(rec->hash, hash, BLOCK_HASH_SIZE) == 0) return block_store_get(s, height, view);
+    }
+    return false;
+}
+
+bool block_store_sync(BlockStore *store) {
+    // Records before indexes: a crash between the two is recovered on open
+    bool ok = msync(store->segment.map, store->end, MS_SYNC) == 0;
+    ok = ok && msync(store->heights.map, store->heights.file_size, MS_SYNC) == 0;
+    ok = ok && msync(store->hashes.map, store->hashes.file_size, MS_SYNC) == 0;
+    if (!ok) printf("Error: Could not sync block store\n");
+    return ok;
+}
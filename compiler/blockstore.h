@@ -0,0 +1,90 @@
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "crypto.h"
+
+// Append-only block store
+//
+// A directory holds three files, each starting with a StoreFileHeader:
+//   blocks.dat   serialized blocks, one BlockRecord each, 8-byte aligned
+//   heights.idx  the segment offset of each block, indexed by height
+//   hashes.idx   open-addressed table from block hash to height
+//
+// All three are mapped shared, so opening a store maps files instead of
+// replaying the chain. Blocks are written to the segment before either
+// index, and a record carries its own checksum; on open, records past the
+// last one the height index knows are validated and indexed, a torn
+// record at the tail is dropped, and the hash index is rebuilt if its
+// count disagrees. The structs below are the on-disk layout, read in place
+// from the mappings; every integer field in them is stored little-endian
+// and converted on access, so a store moves between hosts unchanged.
+#define BLOCK_SEGMENT_MAGIC "CRYS"
+#define BLOCK_HEIGHTS_MAGIC "CRYH"
+#define BLOCK_HASHES_MAGIC "CRYX"
+#define BLOCK_STORE_VERSION 1
+#define BLOCK_RECORD_MAGIC 0x4b4c4243   // "CBLK"
+#define BLOCK_HASH_SIZE SHA256_DIGEST_LENGTH
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;                     // Entries committed (indexes only)
+} StoreFileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t height;
+    uint32_t length;                    // Payload bytes following the record
+    uint32_t checksum;                  // First 4 bytes of SHA-256 of height, length, hash and payload
+    uint8_t hash[BLOCK_HASH_SIZE];
+} BlockRecord;
+
+typedef struct {
+    uint64_t key;                       // Last 8 bytes of the block hash
+    uint64_t entry;                     // Height + 1; 0 for an empty slot
+} BlockHashSlot;
+
+typedef struct {
+    int fd;
+    unsigned char *map;
+    size_t map_size;
+    size_t file_size;
+} StoreFile;
+
+typedef struct {
+    StoreFile segment;
+    StoreFile heights;
+    StoreFile hashes;
+    uint64_t end;                       // Segment bytes in use
+    uint64_t count;                     // Blocks stored
+    uint64_t hash_capacity;             // Slots in the hash index
+} BlockStore;
+
+// A stored block; the pointers are into the segment mapping and stay
+// valid until the next append
+typedef struct {
+    uint32_t height;
+    const uint8_t *hash;
+    const uint8_t *data;
+    size_t length;
+} BlockView;
+
+// Open or create the store in `dir`, recovering from an interrupted
+// append; NULL on error
+BlockStore* block_store_open(const char *dir);
+void block_store_close(BlockStore *store);
+
+// Store a block at the next height; false if the hash is already stored
+bool block_store_append(BlockStore *store, const uint8_t *hash, const void *data, size_t length);
+
+// O(1) lookups; false if there is no such block
+bool block_store_get(const BlockStore *store, uint64_t height, BlockView *view);
+bool block_store_find(const BlockStore *store, const uint8_t *hash, BlockView *view);
+
+// Flush the segment, then the indexes, to disk
+bool block_store_sync(BlockStore *store);
+
+#endif /* BLOCKSTORE_H */
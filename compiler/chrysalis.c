@@ -2,8 +2,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
 #include "crypto.h"
 #include "qrcode.h"
+#include "image.h"
+#include "merkle.h"
+#include "mempool.h"
 
 // Extended instruction set
 enum {
@@ -28,7 +36,37 @@ enum {
     OP_QR_VERIFY = 0x13,
     OP_CONCAT = 0x14,
     OP_DUP = 0x15,
-    OP_SWAP = 0x16
+    OP_SWAP = 0x16,
+    OP_LOAD_ABS = 0x17,     // LOAD from an immediate address
+    OP_STORE_ABS = 0x18,    // STORE to an immediate address
+    
+    // Superinstructions produced by the optimizer
+    OP_ADDI = 0x19,         // PUSH imm, ADD
+    OP_MULI = 0x1A,         // PUSH imm, MUL
+    OP_PRINT_ABS = 0x1B,    // LOAD_ABS addr, PRINT
+    
+    // String arena
+    OP_ARENA_MARK = 0x1C,   // Push the current arena top
+    OP_ARENA_RESET = 0x1D,  // Pop a mark and free everything allocated since
+    OP_STRLEN = 0x1E,       // Replace a string address with its length
+    
+    OP_DISPOSE = 0x1F,      // Pop an object handle and free its object
+    
+    // Incremental SHA-256
+    OP_HASH_BEGIN = 0x20,   // Push a hashing context
+    OP_HASH_UPDATE = 0x21,  // ctx data -> ctx, absorbing a string or hash
+    OP_HASH_END = 0x22,     // ctx -> hash; the context becomes the digest
+    
+    // Merkle trees
+    OP_MERKLE_CREATE = 0x23,
+    OP_MERKLE_ADD = 0x24,   // tree leaf -> tree
+    OP_MERKLE_ROOT = 0x25,  // tree -> hash
+    
+    // Transaction pool
+    OP_MEMPOOL_CREATE = 0x26,
+    OP_MEMPOOL_ADD = 0x27,  // pool tx -> pool
+    OP_MEMPOOL_PRUNE = 0x28,  // pool -> pool, dropping expired transactions
+    OP_BLOCK_TEMPLATE = 0x29  // pool max_bytes -> tree of the chosen txids
 };
 
 // Stack implementation
@@ -36,9 +74,37 @@ enum {
 #define VM_MEMORY_SIZE (1024 * 1024)  // 1MB total memory
 #define STRING_POOL_SIZE 4096         // 4KB for string pool
 #define STRING_POOL_START 65536       // Start strings at 64KB
-#define STRING_MARKER 0xFF            // Marker for string values
+#define ARENA_START (STRING_POOL_START + STRING_POOL_SIZE)  // Arena runs from here to the end of memory
+#define ARENA_ALIGN 8
+
+// String objects, both in the string pool and in the arena, are preceded by
+// a header so their length is known without scanning. A string's address
+// is that of its first byte; the bytes are followed by a NUL for builtins
+// that take C strings.
+#define STRING_MAGIC 0x52545343u      // "CSTR"
+typedef struct {
+    uint32_t length;
+    uint32_t magic;
+} StringHeader;
+
+// Stack slots and memory words are 64 bits wide
+typedef int64_t Value;
+
+// A string value is its byte address plus STRING_TAG, which keeps it clear
+// of plain numbers, memory addresses and object handles so PRINT can tell
+// it apart. Builtins that take a string also take an untagged address.
+#define STRING_TAG ((Value)1 << 40)
+
+static inline bool is_string(Value v) {
+    return v >= STRING_TAG && v < 2 * STRING_TAG;
+}
+
+static inline Value string_addr(Value v) {
+    return is_string(v) ? v - STRING_TAG : v;
+}
+
 typedef struct {
-    int data[STACK_SIZE];
+    Value data[STACK_SIZE];
     int top;
 } Stack;
 
@@ -48,7 +114,7 @@ void stack_init(Stack *s) {
 }
 
 // Push value to stack
-bool stack_push(Stack *s, int value) {
+bool stack_push(Stack *s, Value value) {
     if (s->top < STACK_SIZE - 1) {
         s->data[++s->top] = value;
         return true;
@@ -57,7 +123,7 @@ bool stack_push(Stack *s, int value) {
 }
 
 // Pop value from stack
-bool stack_pop(Stack *s, int *value) {
+bool stack_pop(Stack *s, Value *value) {
     if (s->top >= 0) {
         *value = s->data[s->top--];
         return true;
@@ -65,14 +131,66 @@ bool stack_pop(Stack *s, int *value) {
     return false;
 }
 
+// Call frame pushed by OP_CALL
+#define CALL_STACK_SIZE 1024
+#define NO_RETURN_INSN UINT32_MAX
+typedef struct {
+    uint32_t return_pc;     // Bytecode offset to resume at
+    uint32_t return_insn;   // Decoded instruction to resume at, or NO_RETURN_INSN
+} Frame;
+
+// Host objects referenced from the stack by handle. A handle is
+// HANDLE_BASE plus the object's slot and the slot's generation, which keeps
+// handles clear of every memory address, so builtins can take either.
+// Slots are reused after DISPOSE, and each reuse bumps the generation, so
+// a handle kept past DISPOSE resolves to nothing rather than to whatever
+// took its slot (until the 16-bit generation wraps).
+#define HANDLE_BASE ((Value)1 << 32)
+#define OBJECT_SLOT_BITS 16
+#define MAX_OBJECTS (1 << OBJECT_SLOT_BITS)
+#define HANDLE_LIMIT (HANDLE_BASE + ((Value)1 << (OBJECT_SLOT_BITS + 16)))
+#define NO_OBJECT UINT32_MAX
+
+typedef enum {
+    OBJ_FREE,
+    OBJ_QR,                 // Owned QRCode from qrcode_create
+    OBJ_HASH,               // SHA-256 digest
+    OBJ_HASHER,             // Hash in progress
+    OBJ_MERKLE,             // Merkle tree being built
+    OBJ_MEMPOOL             // Pending transactions
+} ObjectKind;
+
+typedef struct {
+    uint8_t kind;
+    uint16_t generation;    // Bumped each time the slot is freed
+    uint32_t next_free;     // Free list link while kind is OBJ_FREE
+    union {
+        QRCode *qr;
+        uint8_t hash[SHA256_DIGEST_LENGTH];
+        HashContext hasher;
+        MerkleTree *merkle;
+        Mempool *mempool;
+    };
+} Object;
+
 // Chrysalis VM
 typedef struct {
     Stack stack;
     unsigned char *memory;
     size_t mem_size;
-    int *call_stack;
+    Frame *call_stack;
     int call_stack_ptr;
     bool running;
+    int mine_threads;   // Worker threads for OP_QR_MINE, 0 = all CPUs
+    uint64_t ops_executed;
+    size_t arena_base;  // Bump arena for strings built at run time
+    size_t arena_top;
+    size_t arena_high;  // High-water mark of arena_top
+    Object *objects;
+    uint32_t object_count;  // Slots in use or on the free list
+    uint32_t object_capacity;
+    uint32_t object_live;
+    uint32_t free_object;   // Head of the free list, or NO_OBJECT
 } VM;
 
 // Initialize VM
@@ -81,364 +199,2583 @@ VM* vm_init(size_t mem_size) {
     if (!vm) return NULL;
     
     stack_init(&vm->stack);
-    vm->memory = calloc(mem_size, 1);
-    if (!vm->memory) {
+    // Page-aligned and lazily zeroed, so an image's string pool can be
+    // mapped into it
+    vm->memory = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vm->memory == MAP_FAILED) {
         free(vm);
         return NULL;
     }
     
     vm->mem_size = mem_size;
-    vm->call_stack = malloc(sizeof(int) * 1024);
+    vm->call_stack = malloc(sizeof(Frame) * CALL_STACK_SIZE);
     if (!vm->call_stack) {
-        free(vm->memory);
+        munmap(vm->memory, mem_size);
         free(vm);
         return NULL;
     }
     
     vm->call_stack_ptr = 0;
     vm->running = true;
+    vm->mine_threads = 0;
+    vm->ops_executed = 0;
+    vm->arena_base = vm->arena_top = vm->arena_high = mem_size > ARENA_START ? ARENA_START : mem_size;
+    vm->objects = NULL;
+    vm->object_count = vm->object_capacity = vm->object_live = 0;
+    vm->free_object = NO_OBJECT;
     
     return vm;
 }
 
-// Execute Chrysalis bytecode
-void vm_execute(VM *vm, unsigned char *bytecode, size_t length) {
-    size_t pc = 0;
-    int a, b;
+static void object_clear(Object *obj) {
+    if (obj->kind == OBJ_QR) qrcode_destroy(obj->qr);
+    if (obj->kind == OBJ_HASHER) hash_free(&obj->hasher);
+    if (obj->kind == OBJ_MERKLE) merkle_destroy(obj->merkle);
+    if (obj->kind == OBJ_MEMPOOL) mempool_destroy(obj->mempool);
+    obj->kind = OBJ_FREE;
+}
+
+void vm_free(VM *vm) {
+    if (vm) {
+        for (uint32_t i = 0; i < vm->object_count; i++) object_clear(&vm->objects[i]);
+        free(vm->objects);
+        munmap(vm->memory, vm->mem_size);
+        free(vm->call_stack);
+        free(vm);
+    }
+}
+
+// LOAD and STORE address memory in words: address n is the native-endian
+// word at byte offset n * sizeof(Value). Builtins take byte addresses.
+static bool mem_load(const VM *vm, Value addr, Value *value) {
+    if (addr < 0 || (uint64_t)addr >= vm->mem_size / sizeof(Value)) return false;
+    memcpy(value, &vm->memory[addr * sizeof(Value)], sizeof(Value));
+    return true;
+}
+
+static bool mem_store(VM *vm, Value addr, Value value) {
+    if (addr < 0 || (uint64_t)addr >= vm->mem_size / sizeof(Value)) return false;
+    memcpy(&vm->memory[addr * sizeof(Value)], &value, sizeof(Value));
+    return true;
+}
+
+// Arithmetic wraps around in two's complement, as on 64-bit hardware;
+// divisor must be nonzero
+static inline Value value_div(Value a, Value b) {
+    return b == -1 ? (Value)(0 - (uint64_t)a) : a / b;
+}
+
+// Bytes at a byte address, or NULL unless all `length` of them are in memory
+static unsigned char* vm_bytes(const VM *vm, Value addr, size_t length) {
+    addr = string_addr(addr);
+    if (addr < 0 || (uint64_t)addr > vm->mem_size || length > vm->mem_size - addr) return NULL;
+    return &vm->memory[addr];
+}
+
+// String at a byte address. Strings with a header have their length read
+// in O(1); other addresses fall back to a scan bounded by the end of memory.
+// Returns NULL for an address outside memory.
+static const char* vm_string(const VM *vm, Value addr, size_t *length) {
+    addr = string_addr(addr);
+    if (addr < 0 || (uint64_t)addr >= vm->mem_size) return NULL;
+    StringHeader header;
+    if ((size_t)addr >= sizeof(header)) {
+        memcpy(&header, &vm->memory[addr - sizeof(header)], sizeof(header));
+        if (header.magic == STRING_MAGIC && header.length < vm->mem_size - addr &&
+            vm->memory[addr + header.length] == '\0') {
+            *length = header.length;
+            return (const char*)&vm->memory[addr];
+        }
+    }
+    *length = strnlen((const char*)&vm->memory[addr], vm->mem_size - addr);
+    return (const char*)&vm->memory[addr];
+}
+
+// Allocate an object slot of the given kind; returns its handle, or 0 when
+// the table is full
+static Value object_new(VM *vm, ObjectKind kind, Object **obj) {
+    uint32_t slot = vm->free_object;
+    if (slot != NO_OBJECT) {
+        vm->free_object = vm->objects[slot].next_free;
+    } else {
+        if (vm->object_count == vm->object_capacity) {
+            uint32_t capacity = vm->object_capacity ? vm->object_capacity * 2 : 64;
+            Object *objects = capacity <= MAX_OBJECTS ? realloc(vm->objects, sizeof(Object) * capacity) : NULL;
+            if (!objects) {
+                printf("Error: VM object table full (%u objects)\n", vm->object_live);
+                return 0;
+            }
+            vm->objects = objects;
+            vm->object_capacity = capacity;
+        }
+        slot = vm->object_count++;
+        vm->objects[slot].generation = 0;
+    }
+    vm->object_live++;
+    *obj = &vm->objects[slot];
+    (*obj)->kind = kind;
+    return HANDLE_BASE + ((Value)(*obj)->generation << OBJECT_SLOT_BITS) + slot;
+}
+
+// Live object behind a handle of the current generation, or NULL
+static Object* object_lookup(const VM *vm, Value handle) {
+    if (handle < HANDLE_BASE || handle >= HANDLE_LIMIT) return NULL;
+    uint32_t slot = (handle - HANDLE_BASE) & (MAX_OBJECTS - 1);
+    uint16_t generation = (uint16_t)((handle - HANDLE_BASE) >> OBJECT_SLOT_BITS);
+    if (slot >= vm->object_count) return NULL;
+    Object *obj = &vm->objects[slot];
+    return obj->kind != OBJ_FREE && obj->generation == generation ? obj : NULL;
+}
+
+// Object behind a handle, or NULL if it is not a live object of that kind
+static Object* object_get(const VM *vm, Value handle, ObjectKind kind) {
+    Object *obj = object_lookup(vm, handle);
+    return obj && obj->kind == kind ? obj : NULL;
+}
+
+// Free a live object of any kind and put its slot on the free list
+static void object_release(VM *vm, Value handle) {
+    Object *obj = object_lookup(vm, handle);
+    if (!obj) return;
+    object_clear(obj);
+    obj->generation++;
+    obj->next_free = vm->free_object;
+    vm->free_object = (uint32_t)(obj - vm->objects);
+    vm->object_live--;
+}
+
+// 32-byte PoW target: a hash object or 32 bytes of VM memory
+static const uint8_t* vm_target(const VM *vm, Value v) {
+    Object *obj = object_get(vm, v, OBJ_HASH);
+    return obj ? obj->hash : vm_bytes(vm, v, 32);
+}
+
+// Allocate `size` bytes from the arena; returns their address, or 0 when
+// the arena is exhausted (the arena never starts at address 0)
+static Value arena_alloc(VM *vm, size_t size) {
+    size_t start = vm->arena_top;
+    if (size > vm->mem_size - start) {
+        printf("Error: VM arena exhausted (%zu of %zu bytes in use)\n",
+               start - vm->arena_base, vm->mem_size - vm->arena_base);
+        return 0;
+    }
+    size_t end = start + size;
+    end = end + ARENA_ALIGN - 1 < vm->mem_size ? (end + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN : vm->mem_size;
+    vm->arena_top = end;
+    if (end > vm->arena_high) vm->arena_high = end;
+    return (Value)start;
+}
+
+// Allocate a string object of `length` bytes plus its terminator; the
+// caller fills in the bytes
+static Value arena_string(VM *vm, size_t length) {
+    if (length >= UINT32_MAX) return 0;
+    Value at = arena_alloc(vm, sizeof(StringHeader) + length + 1);
+    if (!at) return 0;
+    StringHeader header = { (uint32_t)length, STRING_MAGIC };
+    memcpy(&vm->memory[at], &header, sizeof(header));
+    at += sizeof(header);
+    vm->memory[at + length] = '\0';
+    return at;
+}
+
+// Strings print as text, hash objects as their hex digest, and anything
+// else as a number. Values are signed words whatever tag their literal
+// had, so one past INT64_MAX prints as negative, the same as the
+// arithmetic that produced it treats it. A number in the string tag range
+// that points outside memory is printed as a number.
+static void print_value(const VM *vm, Value v) {
+    Object *digest = object_get(vm, v, OBJ_HASH);
+    size_t length;
+    const char *str = is_string(v) ? vm_string(vm, v, &length) : NULL;
+    if (str) {
+        printf("%.*s\n", (int)length, str);
+    } else if (digest) {
+        for (size_t i = 0; i < sizeof(digest->hash); i++) printf("%02x", digest->hash[i]);
+        printf("\n");
+    } else {
+        printf("%" PRId64 "\n", v);
+    }
+}
+
+// Builtin operations shared by both execution engines. Each one works on
+// vm->stack directly and tolerates a short stack the way the original
+// interpreter did. Strings and targets are read in place from VM memory;
+// strings they build go in the arena and host objects in the object table.
+static void op_qr_mine(VM *vm) {
+    Value a;
+    
+    // Get target from stack
+    const uint8_t *target = NULL;
+    if (stack_pop(&vm->stack, &a)) {
+        target = vm_target(vm, a);
+    }
+    
+    // Get block header from stack
+    const char *header = NULL;
+    size_t header_len = 0;
+    if (stack_pop(&vm->stack, &a)) {
+        header = vm_string(vm, a, &header_len);
+    }
+    
+    // Mine for valid QR code
+    QRMiningStats stats;
+    if (target && header && qrcode_mine_parallel((const uint8_t*)header, header_len, target,
+                                                 vm->mine_threads, 0, &stats)) {
+        printf("Found valid nonce: %lu (%.0f H/s on %d threads)\n",
+               (unsigned long)stats.nonce, stats.hashes_per_sec, stats.threads);
+        // Push nonce to stack
+        stack_push(&vm->stack, (Value)stats.nonce);
+    } else {
+        stack_push(&vm->stack, 0);
+    }
+}
+
+static void op_qr_generate(VM *vm) {
+    Value a;
+    
+    // Get data from stack
+    const char *data = "";
+    size_t data_len = 0;
+    if (stack_pop(&vm->stack, &a)) {
+        data = vm_string(vm, a, &data_len);
+    }
+    
+    // The QR code stays where qrcode_create put it; the stack gets a handle
+    QRCode *qr = data ? qrcode_create((const uint8_t*)data, data_len, QR_ECLEVEL_H) : NULL;
+    Value handle = 0;
+    Object *obj;
+    if (qr && (handle = object_new(vm, OBJ_QR, &obj))) {
+        obj->qr = qr;
+    } else {
+        qrcode_destroy(qr);
+    }
+    stack_push(&vm->stack, handle);
+}
+
+static void op_qr_print(VM *vm) {
+    Value a;
+    
+    // Get QR code from stack
+    if (stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_QR);
+        if (obj) qrcode_print(obj->qr);
+    }
+}
+
+static void op_qr_verify(VM *vm) {
+    Value a, b;
+    
+    // Get QR code and target from stack
+    Object *obj = NULL;
+    const uint8_t *target = NULL;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        obj = object_get(vm, a, OBJ_QR);
+    }
+    if (stack_pop(&vm->stack, &b)) {
+        target = vm_target(vm, b);
+    }
+    
+    if (obj && target) {
+        bool valid = qrcode_validate_pow(obj->qr, target);
+        stack_push(&vm->stack, valid ? 1 : 0);
+    } else {
+        stack_push(&vm->stack, 0);
+    }
+}
+
+// SHA-256 of a string, as a hash object
+static void op_hash(VM *vm) {
+    Value a;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        size_t length;
+        const char *str = vm_string(vm, a, &length);
+        Value handle = 0;
+        Object *obj;
+        if (str && (handle = object_new(vm, OBJ_HASH, &obj))) {
+            sha256((const unsigned char*)str, length, obj->hash);
+        }
+        stack_push(&vm->stack, handle);
+    }
+}
+
+static void op_hash_begin(VM *vm) {
+    Value handle;
+    Object *obj;
+    if ((handle = object_new(vm, OBJ_HASHER, &obj)) && !hash_init(&obj->hasher, HASH_SHA256)) {
+        object_release(vm, handle);
+        handle = 0;
+    }
+    stack_push(&vm->stack, handle);
+}
+
+// Absorb a hash object's digest or a string, in place
+static void op_hash_update(VM *vm) {
+    Value a, b;
+    
+    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_HASHER);
+        Object *digest = object_get(vm, b, OBJ_HASH);
+        if (obj && digest) {
+            hash_update(&obj->hasher, digest->hash, sizeof(digest->hash));
+        } else if (obj) {
+            size_t length;
+            const char *str = vm_string(vm, b, &length);
+            if (str) hash_update(&obj->hasher, str, length);
+        }
+        stack_push(&vm->stack, a);
+    }
+}
+
+static void op_hash_end(VM *vm) {
+    Value a;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_HASHER);
+        if (obj) {
+            uint8_t digest[HASH_MAX_SIZE];
+            size_t length = hash_final(&obj->hasher, digest);
+            hash_free(&obj->hasher);
+            obj->kind = OBJ_HASH;
+            memcpy(obj->hash, digest, sizeof(obj->hash));
+            if (!length) memset(obj->hash, 0, sizeof(obj->hash));
+        }
+        stack_push(&vm->stack, obj ? a : 0);
+    }
+}
+
+static void op_merkle_create(VM *vm) {
+    MerkleTree *tree = merkle_create();
+    Value handle = 0;
+    Object *obj;
+    if (tree && (handle = object_new(vm, OBJ_MERKLE, &obj))) {
+        obj->merkle = tree;
+    } else {
+        merkle_destroy(tree);
+    }
+    stack_push(&vm->stack, handle);
+}
+
+// Append a leaf: a hash object as is, or the SHA-256 of a string
+static void op_merkle_add(VM *vm) {
+    Value a, b;
+    
+    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_MERKLE);
+        Object *digest = object_get(vm, b, OBJ_HASH);
+        if (obj && digest) {
+            merkle_append(obj->merkle, digest->hash);
+        } else if (obj) {
+            size_t length;
+            const char *str = vm_string(vm, b, &length);
+            MerkleHash leaf;
+            if (str) {
+                sha256((const unsigned char*)str, length, leaf);
+                merkle_append(obj->merkle, leaf);
+            }
+        }
+        stack_push(&vm->stack, a);
+    }
+}
+
+static void op_merkle_root(VM *vm) {
+    Value a;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_MERKLE);
+        MerkleHash root;
+        Value handle = 0;
+        Object *digest;
+        // Allocation may move the table, so the tree is read first
+        if (obj && merkle_root(obj->merkle, root) && (handle = object_new(vm, OBJ_HASH, &digest))) {
+            memcpy(digest->hash, root, sizeof(root));
+        }
+        stack_push(&vm->stack, handle);
+    }
+}
+
+static void op_mempool_create(VM *vm) {
+    Mempool *pool = mempool_create(MEMPOOL_DEFAULT_BYTES, MEMPOOL_DEFAULT_EXPIRY);
+    Value handle = 0;
+    Object *obj;
+    if (pool && (handle = object_new(vm, OBJ_MEMPOOL, &obj))) {
+        obj->mempool = pool;
+    } else {
+        mempool_destroy(pool);
+    }
+    stack_push(&vm->stack, handle);
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decode `length` hex digits into length / 2 bytes; false on an odd
+// length or a character that is not a digit
+static bool hex_decode(const char *hex, size_t length, uint8_t *out) {
+    if (length % 2) return false;
+    for (size_t i = 0; i < length; i += 2) {
+        int hi = hex_digit(hex[i]), lo = hex_digit(hex[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i / 2] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+// Add a transaction given as the hex of its encoding, since the encoding
+// itself holds bytes a string literal cannot. It is decoded, identified by
+// tx_hash like the transactions of a block, and pays inputs minus outputs;
+// strings that are not transactions are ignored.
+static void op_mempool_add(VM *vm) {
+    Value a, b;
     
-    while (pc < length && vm->running) {
+    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_MEMPOOL);
+        size_t length;
+        const char *str = vm_string(vm, b, &length);
+        uint8_t *data = obj && str ? malloc(length / 2 + 1) : NULL;
+        if (data && hex_decode(str, length, data)) {
+            mempool_add_tx(obj->mempool, data, length / 2, (uint64_t)time(NULL));
+        }
+        free(data);
+        stack_push(&vm->stack, a);
+    }
+}
+
+static void op_mempool_prune(VM *vm) {
+    Value a;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_MEMPOOL);
+        if (obj) mempool_expire(obj->mempool, (uint64_t)time(NULL));
+        stack_push(&vm->stack, a);
+    }
+}
+
+// Merkle tree of the best-paying transactions that fit in a block
+static void op_block_template(VM *vm) {
+    Value a, b;
+    
+    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
+        Object *obj = object_get(vm, a, OBJ_MEMPOOL);
+        Value handle = 0;
+        if (obj && b > 0) {
+            Mempool *pool = obj->mempool;
+            size_t max = mempool_count(pool);
+            const MempoolTx **chosen = malloc(sizeof(MempoolTx*) * (max ? max : 1));
+            MerkleTree *tree = chosen ? merkle_create() : NULL;
+            Object *result;
+            if (tree && (handle = object_new(vm, OBJ_MERKLE, &result))) {
+                size_t n = mempool_template(pool, (size_t)b, chosen, max);
+                for (size_t i = 0; i < n; i++) merkle_append(tree, chosen[i]->txid);
+                result->merkle = tree;
+            } else {
+                merkle_destroy(tree);
+            }
+            free(chosen);
+        }
+        stack_push(&vm->stack, handle);
+    }
+}
+
+static void op_dispose(VM *vm) {
+    Value a;
+    
+    if (stack_pop(&vm->stack, &a)) {
+        object_release(vm, a);
+    }
+}
+
+// Concatenate two strings into a new arena string, pushed as a string
+// value (0 when the arena is exhausted)
+static void op_concat(VM *vm) {
+    Value a, b;
+    
+    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
+        size_t len_a = 0, len_b = 0;
+        const char *str_a = vm_string(vm, a, &len_a);
+        const char *str_b = vm_string(vm, b, &len_b);
+        if (!str_a) len_a = 0;
+        if (!str_b) len_b = 0;
+        Value at = arena_string(vm, len_a + len_b);
+        if (at) {
+            // Sources may overlap freed arena space the result reuses
+            // A non-string operand has no bytes and a NULL source, which
+            // memmove may not be given even for a zero length
+            if (len_b) memmove(&vm->memory[at + len_a], str_b, len_b);
+            if (len_a) memmove(&vm->memory[at], str_a, len_a);
+        }
+        stack_push(&vm->stack, at ? STRING_TAG + at : 0);
+    }
+}
+
+static void op_arena_mark(VM *vm) {
+    stack_push(&vm->stack, (Value)vm->arena_top);
+}
+
+// Free everything allocated after a mark. Marks outside the live part of
+// the arena are ignored.
+static void op_arena_reset(VM *vm) {
+    Value a;
+    if (stack_pop(&vm->stack, &a) && a >= (Value)vm->arena_base && a <= (Value)vm->arena_top) {
+        vm->arena_top = a;
+    }
+}
+
+static void op_strlen(VM *vm) {
+    Value a;
+    if (stack_pop(&vm->stack, &a)) {
+        size_t length = 0;
+        vm_string(vm, a, &length);
+        stack_push(&vm->stack, (Value)length);
+    }
+}
+
+// Control-flow operands are signed 32-bit little-endian offsets, relative
+// to the end of the instruction
+#define REL32_SIZE 4
+
+static int32_t read_rel32(const unsigned char *p) {
+    return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+static void write_rel32(unsigned char *p, int32_t value) {
+    for (int i = 0; i < REL32_SIZE; i++) p[i] = (uint32_t)value >> (8 * i);
+}
+
+// Whether the control-flow instruction at pc has its full operand
+static bool has_rel32(size_t pc, size_t length) {
+    return pc + 1 + REL32_SIZE <= length;
+}
+
+// PUSH immediates are signed LEB128 and direct LOAD/STORE addresses are
+// unsigned LEB128, so small constants stay one byte and any 64-bit value
+// fits in at most LEB128_MAX bytes
+#define LEB128_MAX 10
+
+// Decode a LEB128 value from at most avail bytes. Returns the bytes used,
+// or 0 if the encoding is truncated or too long.
+static size_t read_leb128(const unsigned char *p, size_t avail, bool is_signed, uint64_t *value) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < avail && i < LEB128_MAX; i++) {
+        int shift = 7 * i;
+        result |= (uint64_t)(p[i] & 0x7F) << shift;
+        if (!(p[i] & 0x80)) {
+            if (is_signed && shift + 7 < 64 && (p[i] & 0x40)) {
+                result |= ~(uint64_t)0 << (shift + 7);
+            }
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t write_leb128(unsigned char *p, uint64_t value, bool is_signed) {
+    size_t n = 0;
+    for (;;) {
+        uint8_t byte = value & 0x7F;
+        // Arithmetic shift keeps the sign of signed values
+        value = is_signed ? (uint64_t)((int64_t)value >> 7) : value >> 7;
+        bool done = is_signed ? (value == 0 && !(byte & 0x40)) || (value == UINT64_MAX && (byte & 0x40))
+                              : value == 0;
+        p[n++] = done ? byte : byte | 0x80;
+        if (done) return n;
+    }
+}
+
+static bool push_frame(VM *vm, size_t return_pc, uint32_t return_insn) {
+    if (vm->call_stack_ptr >= CALL_STACK_SIZE) {
+        fprintf(stderr, "Error: call stack overflow\n");
+        vm->running = false;
+        return false;
+    }
+    vm->call_stack[vm->call_stack_ptr++] = (Frame){ return_pc, return_insn };
+    return true;
+}
+
+// LEB128 operand carried by an opcode
+typedef enum {
+    IMM_NONE,
+    IMM_SIGNED,
+    IMM_UNSIGNED
+} ImmKind;
+
+static ImmKind imm_kind(uint8_t op) {
+    switch (op) {
+        case OP_PUSH:
+        case OP_ADDI:
+        case OP_MULI: return IMM_SIGNED;
+        case OP_LOAD_ABS:
+        case OP_STORE_ABS:
+        case OP_PRINT_ABS: return IMM_UNSIGNED;
+        default: return IMM_NONE;
+    }
+}
+
+static void op_print(VM *vm) {
+    Value a;
+    if (stack_pop(&vm->stack, &a)) print_value(vm, a);
+}
+
+// Run bytecode from pc while it stays inside [lo, hi) and return where it
+// left off. RET with no caller halts the VM.
+static size_t vm_run(VM *vm, const unsigned char *bytecode, size_t length, size_t pc, size_t lo, size_t hi) {
+    Value a, b;
+    uint64_t imm;
+    size_t n;
+    
+    while (pc >= lo && pc < hi && pc < length && vm->running) {
+        vm->ops_executed++;
         switch (bytecode[pc]) {
+            case OP_JMP:
+                if (has_rel32(pc, length)) {
+                    pc += 1 + REL32_SIZE + read_rel32(&bytecode[pc + 1]);
+                    continue;
+                }
+                break;
+    
+            case OP_JZ:
+                if (has_rel32(pc, length)) {
+                    size_t next = pc + 1 + REL32_SIZE;
+                    pc = stack_pop(&vm->stack, &a) && a == 0 ? next + read_rel32(&bytecode[pc + 1]) : next;
+                    continue;
+                }
+                break;
+    
+            case OP_CALL:
+                if (has_rel32(pc, length)) {
+                    size_t next = pc + 1 + REL32_SIZE;
+                    if (!push_frame(vm, next, NO_RETURN_INSN)) return pc;
+                    pc = next + read_rel32(&bytecode[pc + 1]);
+                    continue;
+                }
+                break;
+    
+            case OP_RET:
+                if (vm->call_stack_ptr == 0) {
+                    vm->running = false;
+                    return pc;
+                }
+                pc = vm->call_stack[--vm->call_stack_ptr].return_pc;
+                continue;
+    
             case OP_PUSH:
-                pc++;
-                if (pc < length) {
-                    stack_push(&vm->stack, bytecode[pc]);
+                // A truncated immediate leaves PUSH a one-byte no-op
+                if ((n = read_leb128(&bytecode[pc + 1], length - pc - 1, true, &imm))) {
+                    stack_push(&vm->stack, (Value)imm);
+                    pc += n;
                 }
                 break;
-                
+    
             case OP_POP:
                 stack_pop(&vm->stack, &a);
                 break;
-                
+    
             case OP_ADD:
                 if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
-                    stack_push(&vm->stack, a + b);
+                    stack_push(&vm->stack, (Value)((uint64_t)a + (uint64_t)b));
                 }
                 break;
-                
+    
             case OP_SUB:
                 if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
-                    stack_push(&vm->stack, a - b);
+                    stack_push(&vm->stack, (Value)((uint64_t)a - (uint64_t)b));
                 }
                 break;
-                
+    
             case OP_MUL:
                 if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
-                    stack_push(&vm->stack, a * b);
+                    stack_push(&vm->stack, (Value)((uint64_t)a * (uint64_t)b));
                 }
                 break;
-                
+    
             case OP_DIV:
                 if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
                     if (b != 0) {
-                        stack_push(&vm->stack, a / b);
+                        stack_push(&vm->stack, value_div(a, b));
                     }
                 }
                 break;
-                
+    
             case OP_STORE:
                 if (stack_pop(&vm->stack, &a) && stack_pop(&vm->stack, &b)) {
-                    if ((size_t)b < vm->mem_size) {
-                        vm->memory[b] = a;
-                    }
+                    mem_store(vm, b, a);
                 }
                 break;
-                
+    
             case OP_LOAD:
                 if (stack_pop(&vm->stack, &a)) {
-                    if ((size_t)a < vm->mem_size) {
-                        stack_push(&vm->stack, vm->memory[a]);
+                    if (mem_load(vm, a, &b)) {
+                        stack_push(&vm->stack, b);
                     }
                 }
                 break;
-                
-            case OP_QR_MINE:
-                {
-                    // Get target from stack
-                    uint8_t target[32];
-                    if (stack_pop(&vm->stack, &a)) {
-                        memcpy(target, &vm->memory[a], 32);
-                    }
-                    
-                    // Get block header from stack
-                    uint8_t header[64];
-                    size_t header_len = 0;
+    
+            case OP_STORE_ABS:
+                if ((n = read_leb128(&bytecode[pc + 1], length - pc - 1, false, &imm))) {
                     if (stack_pop(&vm->stack, &a)) {
-                        header_len = strlen((char*)&vm->memory[a]);
-                        memcpy(header, &vm->memory[a], header_len);
-                    }
-                    
-                    // Mine for valid QR code
-                    uint8_t *nonce = qrcode_generate_pow_nonce(header, header_len, target);
-                    if (nonce) {
-                        // Push nonce to stack
-                        stack_push(&vm->stack, *(int*)nonce);
-                        free(nonce);
-                    } else {
-                        stack_push(&vm->stack, 0);
+                        mem_store(vm, (Value)imm, a);
                     }
+                    pc += n;
                 }
                 break;
-                
-            case OP_QR_GENERATE:
-                {
-                    // Get data from stack
-                    uint8_t data[128];
-                    size_t data_len = 0;
-                    if (stack_pop(&vm->stack, &a)) {
-                        data_len = strlen((char*)&vm->memory[a]);
-                        memcpy(data, &vm->memory[a], data_len);
-                    }
-                    
-                    // Generate QR code
-                    QRCode *qr = qrcode_create(data, data_len, QR_ECLEVEL_H);
-                    if (qr) {
-                        // Store QR code in memory
-                        size_t qr_size = sizeof(QRCode) + qr->size * qr->size;
-                        memcpy(&vm->memory[vm->mem_size - qr_size], qr, qr_size);
-                        stack_push(&vm->stack, vm->mem_size - qr_size);
-                        qrcode_destroy(qr);
-                    } else {
-                        stack_push(&vm->stack, 0);
+    
+            case OP_LOAD_ABS:
+                if ((n = read_leb128(&bytecode[pc + 1], length - pc - 1, false, &imm))) {
+                    if (mem_load(vm, (Value)imm, &a)) {
+                        stack_push(&vm->stack, a);
                     }
+                    pc += n;
                 }
                 break;
-                
+    
+            case OP_QR_MINE:
+                op_qr_mine(vm);
+                break;
+    
+            case OP_QR_GENERATE:
+                op_qr_generate(vm);
+                break;
+    
             case OP_QR_PRINT:
-                {
-                    // Get QR code from stack
-                    if (stack_pop(&vm->stack, &a)) {
-                        QRCode *qr = (QRCode*)&vm->memory[a];
-                        qrcode_print(qr);
-                    }
-                }
+                op_qr_print(vm);
                 break;
-                
+    
             case OP_QR_VERIFY:
-                {
-                    // Get QR code and target from stack
-                    QRCode *qr = NULL;
-                    uint8_t target[32];
-                    
-                    if (stack_pop(&vm->stack, &a)) {
-                        qr = (QRCode*)&vm->memory[a];
-                    }
-                    if (stack_pop(&vm->stack, &b)) {
-                        memcpy(target, &vm->memory[b], 32);
-                    }
-                    
-                    if (qr) {
-                        bool valid = qrcode_validate_pow(qr, target);
-                        stack_push(&vm->stack, valid ? 1 : 0);
-                    } else {
-                        stack_push(&vm->stack, 0);
-                    }
-                }
+                op_qr_verify(vm);
                 break;
-                
+    
             case OP_CONCAT:
-                {
-                    char combined[256];
-                    if (stack_pop(&vm->stack, &b) && stack_pop(&vm->stack, &a)) {
-                        strcpy(combined, (char*)&vm->memory[a]);
-                        strcat(combined, (char*)&vm->memory[b]);
-                        size_t new_loc = vm->mem_size - strlen(combined) - 1;
-                        strcpy((char*)&vm->memory[new_loc], combined);
-                        stack_push(&vm->stack, new_loc);
-                    }
-                }
+                op_concat(vm);
                 break;
-                
-            case OP_DUP:
-                if (vm->stack.top >= 0) {
-                    stack_push(&vm->stack, vm->stack.data[vm->stack.top]);
-                }
+    
+            case OP_ARENA_MARK:
+                op_arena_mark(vm);
                 break;
-                
-            case OP_SWAP:
-                if (vm->stack.top >= 1) {
-                    int temp = vm->stack.data[vm->stack.top];
-                    vm->stack.data[vm->stack.top] = vm->stack.data[vm->stack.top - 1];
-                    vm->stack.data[vm->stack.top - 1] = temp;
-                }
+    
+            case OP_ARENA_RESET:
+                op_arena_reset(vm);
                 break;
-                
-            case OP_PRINT:
-                if (stack_pop(&vm->stack, &a)) {
-                    if (a == STRING_MARKER) {
-                        if (stack_pop(&vm->stack, &a)) {
-                            printf("%s\n", (char*)&vm->memory[a]);
-                        }
-                    } else {
-                        printf("%d\n", a);
-                    }
-                }
+    
+            case OP_STRLEN:
+                op_strlen(vm);
                 break;
-        }
-        pc++;
-    }
-}
-
-// Compile Chrysalis source to bytecode
-unsigned char* compile(const char *source, size_t *length) {
-    unsigned char *bytecode = calloc(1, VM_MEMORY_SIZE);
-    if (!bytecode) return NULL;
     
-    *length = 0;
-    static size_t str_offset = 0;
-    str_offset = 0; // Reset string offset for each compilation
-    char token[256];
-    const char *p = source;
-    
-    while (*p) {
-        // Skip whitespace and comments
-        while (*p && ((*p == ' ' || *p == '\n' || *p == '\t') || (*p == '#'))) {
-            if (*p == '#') {
+            case OP_HASH:
+                op_hash(vm);
+                break;
+    
+            case OP_DISPOSE:
+                op_dispose(vm);
+                break;
+    
+            case OP_HASH_BEGIN:
+                op_hash_begin(vm);
+                break;
+    
+            case OP_HASH_UPDATE:
+                op_hash_update(vm);
+                break;
+    
+            case OP_HASH_END:
+                op_hash_end(vm);
+                break;
+    
+            case OP_MERKLE_CREATE:
+                op_merkle_create(vm);
+                break;
+    
+            case OP_MERKLE_ADD:
+                op_merkle_add(vm);
+                break;
+    
+            case OP_MERKLE_ROOT:
+                op_merkle_root(vm);
+                break;
+    
+            case OP_MEMPOOL_CREATE:
+                op_mempool_create(vm);
+                break;
+    
+            case OP_MEMPOOL_ADD:
+                op_mempool_add(vm);
+                break;
+    
+            case OP_MEMPOOL_PRUNE:
+                op_mempool_prune(vm);
+                break;
+    
+            case OP_BLOCK_TEMPLATE:
+                op_block_template(vm);
+                break;
+    
+            case OP_DUP:
+                if (vm->stack.top >= 0) {
+                    stack_push(&vm->stack, vm->stack.data[vm->stack.top]);
+                }
+                break;
+    
+            case OP_SWAP:
+                if (vm->stack.top >= 1) {
+                    Value temp = vm->stack.data[vm->stack.top];
+                    vm->stack.data[vm->stack.top] = vm->stack.data[vm->stack.top - 1];
+                    vm->stack.data[vm->stack.top - 1] = temp;
+                }
+                break;
+    
+            case OP_PRINT:
+                op_print(vm);
+                break;
+    
+            // Superinstructions behave exactly like the pairs they replace
+            case OP_ADDI:
+            case OP_MULI:
+                if ((n = read_leb128(&bytecode[pc + 1], length - pc - 1, true, &imm))) {
+                    if (stack_pop(&vm->stack, &a)) {
+                        stack_push(&vm->stack, bytecode[pc] == OP_ADDI ? (Value)((uint64_t)a + imm)
+                                                                      : (Value)((uint64_t)a * imm));
+                    }
+                    pc += n;
+                }
+                break;
+    
+            case OP_PRINT_ABS:
+                if ((n = read_leb128(&bytecode[pc + 1], length - pc - 1, false, &imm))) {
+                    if (mem_load(vm, (Value)imm, &a)) {
+                        stack_push(&vm->stack, a);
+                    }
+                    op_print(vm);
+                    pc += n;
+                }
+                break;
+        }
+        pc++;
+    }
+    
+    return pc;
+}
+
+// Execute Chrysalis bytecode
+void vm_execute(VM *vm, const unsigned char *bytecode, size_t length) {
+    vm_run(vm, bytecode, length, 0, 0, length);
+}
+
+// Pre-decoded program for the threaded engine. Bytecode is decoded once
+// into fixed-size instructions with their operands in place, and split
+// into basic blocks that each start with an OP_BLOCK pseudo-instruction
+// carrying the block's stack requirements. Blocks begin at every jump or
+// call target and after every control transfer, so control only ever
+// enters a block at its header.
+#define OP_BLOCK 0xF0
+#define OP_HALT 0xF1
+#define BLOCK_MAX_INSNS 64
+
+typedef struct {
+    const void *handler;    // Label address in vm_execute_threaded
+    Value operand;          // Immediate, target instruction or block index
+    uint8_t op;
+} Insn;
+
+typedef struct {
+    int need;               // Stack depth required on entry
+    int grow;               // Highest depth above entry reached inside the block
+    uint32_t start;         // Bytecode range covered, for the checked fallback
+    uint32_t end;
+    size_t first;           // Instruction index of this block's header
+    size_t next;            // Instruction index of the following block
+    int ops;                // Real instructions in the block
+} BasicBlock;
+
+typedef struct {
+    Insn *code;
+    size_t count;
+    BasicBlock *blocks;
+    size_t block_count;
+    size_t halt;            // Index of the terminating OP_HALT
+    const unsigned char *bytecode;
+    size_t length;
+} Program;
+
+// Static stack effect of each opcode the threaded engine executes
+typedef struct {
+    int pops;
+    int pushes;
+} StackEffect;
+
+static bool stack_effect(uint8_t op, StackEffect *effect) {
+    switch (op) {
+        case OP_PUSH: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_POP: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_STORE: *effect = (StackEffect){ 2, 0 }; return true;
+        case OP_LOAD: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_STORE_ABS: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_LOAD_ABS: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_ADDI:
+        case OP_MULI: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_PRINT_ABS: *effect = (StackEffect){ 0, 0 }; return true;
+        case OP_CALL:
+        case OP_RET:
+        case OP_JMP: *effect = (StackEffect){ 0, 0 }; return true;
+        case OP_JZ: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_QR_MINE: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_QR_GENERATE: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_QR_PRINT: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_QR_VERIFY: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_CONCAT: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_ARENA_MARK: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_ARENA_RESET: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_STRLEN: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_HASH: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_DISPOSE: *effect = (StackEffect){ 1, 0 }; return true;
+        case OP_HASH_BEGIN: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_HASH_UPDATE: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_HASH_END: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_MERKLE_CREATE: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_MERKLE_ADD: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_MERKLE_ROOT: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_MEMPOOL_CREATE: *effect = (StackEffect){ 0, 1 }; return true;
+        case OP_MEMPOOL_ADD: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_MEMPOOL_PRUNE: *effect = (StackEffect){ 1, 1 }; return true;
+        case OP_BLOCK_TEMPLATE: *effect = (StackEffect){ 2, 1 }; return true;
+        case OP_DUP: *effect = (StackEffect){ 1, 2 }; return true;
+        case OP_SWAP: *effect = (StackEffect){ 2, 2 }; return true;
+        case OP_PRINT: *effect = (StackEffect){ 1, 0 }; return true;
+        default: return false;  // No-op in the reference engine
+    }
+}
+
+static bool is_branch(uint8_t op) {
+    return op == OP_JMP || op == OP_JZ || op == OP_CALL;
+}
+
+void program_free(Program *prog) {
+    if (prog) {
+        free(prog->code);
+        free(prog->blocks);
+        free(prog);
+    }
+}
+
+static const void **threaded_labels;
+void vm_execute_threaded(VM *vm, Program *prog);
+
+// Length of the instruction at pc, or 0 if the reference engine ignores it
+static size_t insn_length(const unsigned char *bytecode, size_t length, size_t pc) {
+    StackEffect effect;
+    uint64_t imm;
+    if (!stack_effect(bytecode[pc], &effect)) return 0;
+    if (imm_kind(bytecode[pc]) != IMM_NONE) {
+        size_t n = read_leb128(&bytecode[pc + 1], length - pc - 1, imm_kind(bytecode[pc]) == IMM_SIGNED, &imm);
+        return n ? 1 + n : 0;
+    }
+    if (is_branch(bytecode[pc])) return has_rel32(pc, length) ? 1 + REL32_SIZE : 0;
+    return 1;
+}
+
+// Branch target of the instruction at pc, or length when it leaves the program
+static size_t branch_target(const unsigned char *bytecode, size_t length, size_t pc) {
+    int64_t target = (int64_t)(pc + 1 + REL32_SIZE) + read_rel32(&bytecode[pc + 1]);
+    return target < 0 || (uint64_t)target > length ? length : (size_t)target;
+}
+
+// Block whose bytecode range starts exactly at pc, or NULL
+static const BasicBlock *block_at(const Program *prog, size_t pc) {
+    size_t lo = 0, hi = prog->block_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (prog->blocks[mid].start < pc) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < prog->block_count && prog->blocks[lo].start == pc ? &prog->blocks[lo] : NULL;
+}
+
+#define PC_INSN 1       // First byte of an instruction
+#define PC_OPERAND 2    // Inside an instruction's operand
+#define PC_LEADER 4     // Starts a basic block
+
+// Decode bytecode into a Program. Opcodes the reference engine ignores are
+// dropped here so they cost nothing at run time. Returns NULL if a branch
+// lands inside another instruction's operand, which only the reference
+// engine can follow.
+Program* program_decode(const unsigned char *bytecode, size_t length) {
+    // Calling the engine without a VM publishes its label table
+    if (!threaded_labels) vm_execute_threaded(NULL, NULL);
+    
+    uint8_t *flags = calloc(length + 1, 1);
+    if (!flags) return NULL;
+    
+    // First pass finds instruction boundaries and block leaders
+    size_t insns = 0;
+    for (size_t pc = 0; pc < length; ) {
+        size_t len = insn_length(bytecode, length, pc);
+        if (!len) {
+            pc++;
+            continue;
+        }
+        flags[pc] |= PC_INSN;
+        for (size_t i = 1; i < len; i++) flags[pc + i] |= PC_OPERAND;
+        if (is_branch(bytecode[pc]) || bytecode[pc] == OP_RET) flags[pc + len] |= PC_LEADER;
+        insns++;
+        pc += len;
+    }
+    size_t leaders = 1;
+    for (size_t pc = 0; pc < length; pc++) {
+        if (!(flags[pc] & PC_INSN) || !is_branch(bytecode[pc])) continue;
+        size_t target = branch_target(bytecode, length, pc);
+        if (flags[target] & PC_OPERAND) {
+            free(flags);
+            return NULL;
+        }
+        flags[target] |= PC_LEADER;
+    }
+    for (size_t pc = 0; pc < length; pc++) {
+        if (flags[pc] & PC_LEADER) leaders++;
+    }
+    size_t max_blocks = leaders + insns / BLOCK_MAX_INSNS + 1;
+    
+    Program *prog = calloc(1, sizeof(Program));
+    if (!prog) {
+        free(flags);
+        return NULL;
+    }
+    prog->code = malloc(sizeof(Insn) * (insns + max_blocks + 1));
+    prog->blocks = malloc(sizeof(BasicBlock) * max_blocks);
+    if (!prog->code || !prog->blocks) {
+        free(flags);
+        program_free(prog);
+        return NULL;
+    }
+    prog->bytecode = bytecode;
+    prog->length = length;
+    
+    BasicBlock *block = NULL;
+    int depth = 0;
+    size_t pc = 0;
+    
+    while (pc < length) {
+        size_t len = insn_length(bytecode, length, pc);
+    
+        if (!block || (flags[pc] & PC_LEADER) || (len && block->ops == BLOCK_MAX_INSNS)) {
+            if (block) {
+                block->end = pc;
+                block->next = prog->count;
+            }
+            block = &prog->blocks[prog->block_count];
+            *block = (BasicBlock){ 0, 0, pc, 0, prog->count, 0, 0 };
+            depth = 0;
+            prog->code[prog->count++] = (Insn){ threaded_labels[OP_BLOCK], (Value)prog->block_count, OP_BLOCK };
+            prog->block_count++;
+        }
+        if (!len) {
+            pc++;
+            continue;
+        }
+        uint8_t op = bytecode[pc];
+    
+        // Branch operands hold the target pc until resolved below
+        Value operand = 0;
+        uint64_t imm;
+        if (imm_kind(op) != IMM_NONE) {
+            read_leb128(&bytecode[pc + 1], length - pc - 1, imm_kind(op) == IMM_SIGNED, &imm);
+            operand = (Value)imm;
+        }
+        else if (is_branch(op)) operand = (Value)branch_target(bytecode, length, pc);
+        prog->code[prog->count++] = (Insn){ threaded_labels[op], operand, op };
+        pc += len;
+        block->ops++;
+    
+        // Track depth relative to block entry
+        StackEffect effect;
+        stack_effect(op, &effect);
+        depth -= effect.pops;
+        if (-depth > block->need) block->need = -depth;
+        depth += effect.pushes;
+        if (depth > block->grow) block->grow = depth;
+    }
+    free(flags);
+    
+    if (block) {
+        block->end = length;
+        block->next = prog->count;
+    }
+    prog->halt = prog->count;
+    prog->code[prog->count++] = (Insn){ threaded_labels[OP_HALT], 0, OP_HALT };
+    
+    // Every in-range target is a leader, so it starts a block
+    for (size_t i = 0; i < prog->count; i++) {
+        Insn *insn = &prog->code[i];
+        if (!is_branch(insn->op)) continue;
+        const BasicBlock *target = block_at(prog, insn->operand);
+        insn->operand = target ? (Value)target->first : (Value)prog->halt;
+    }
+    
+    return prog;
+}
+
+// Byte offset of instruction `index` within a block (index 0 is the first
+// real instruction after the OP_BLOCK header)
+static size_t block_offset(const Program *prog, const BasicBlock *block, size_t index) {
+    size_t pc = block->start;
+    while (pc < block->end) {
+        size_t len = insn_length(prog->bytecode, prog->length, pc);
+        if (len) {
+            if (index == 0) break;
+            index--;
+        }
+        pc += len ? len : 1;
+    }
+    return pc;
+}
+
+// Execute a decoded program with computed-goto dispatch. The top of stack
+// lives in a local; the rest stays in vm->stack.data[0 .. depth - 2].
+// Stack bounds are checked once per block: a block whose requirements are
+// not met runs on the reference engine instead, and an instruction whose
+// effect turns out to differ from its static effect (division by zero,
+// out-of-range LOAD, PRINT of a string) hands the rest of its block to the
+// reference engine too. Both engines therefore behave identically.
+void vm_execute_threaded(VM *vm, Program *prog) {
+    static const void *labels[256];
+    if (!threaded_labels) {
+        labels[OP_BLOCK] = &&do_block;
+        labels[OP_HALT] = &&do_halt;
+        labels[OP_PUSH] = &&do_push;
+        labels[OP_POP] = &&do_pop;
+        labels[OP_ADD] = &&do_add;
+        labels[OP_SUB] = &&do_sub;
+        labels[OP_MUL] = &&do_mul;
+        labels[OP_DIV] = &&do_div;
+        labels[OP_STORE] = &&do_store;
+        labels[OP_LOAD] = &&do_load;
+        labels[OP_STORE_ABS] = &&do_store_abs;
+        labels[OP_LOAD_ABS] = &&do_load_abs;
+        labels[OP_CALL] = &&do_call;
+        labels[OP_RET] = &&do_ret;
+        labels[OP_JMP] = &&do_jmp;
+        labels[OP_JZ] = &&do_jz;
+        labels[OP_QR_MINE] = &&do_builtin;
+        labels[OP_QR_GENERATE] = &&do_builtin;
+        labels[OP_QR_PRINT] = &&do_builtin;
+        labels[OP_QR_VERIFY] = &&do_builtin;
+        labels[OP_CONCAT] = &&do_builtin;
+        labels[OP_ARENA_MARK] = &&do_builtin;
+        labels[OP_ARENA_RESET] = &&do_builtin;
+        labels[OP_STRLEN] = &&do_builtin;
+        labels[OP_HASH] = &&do_builtin;
+        labels[OP_DISPOSE] = &&do_builtin;
+        labels[OP_HASH_BEGIN] = &&do_builtin;
+        labels[OP_HASH_UPDATE] = &&do_builtin;
+        labels[OP_HASH_END] = &&do_builtin;
+        labels[OP_MERKLE_CREATE] = &&do_builtin;
+        labels[OP_MERKLE_ADD] = &&do_builtin;
+        labels[OP_MERKLE_ROOT] = &&do_builtin;
+        labels[OP_MEMPOOL_CREATE] = &&do_builtin;
+        labels[OP_MEMPOOL_ADD] = &&do_builtin;
+        labels[OP_MEMPOOL_PRUNE] = &&do_builtin;
+        labels[OP_BLOCK_TEMPLATE] = &&do_builtin;
+        labels[OP_DUP] = &&do_dup;
+        labels[OP_SWAP] = &&do_swap;
+        labels[OP_PRINT] = &&do_print;
+        labels[OP_ADDI] = &&do_addi;
+        labels[OP_MULI] = &&do_muli;
+        labels[OP_PRINT_ABS] = &&do_print_abs;
+        threaded_labels = labels;
+    }
+    if (!vm) return;
+    
+    Value *base = vm->stack.data;
+    int depth = vm->stack.top + 1;
+    Value tos = depth > 0 ? base[depth - 1] : 0;
+    const Insn *ip = prog->code;
+    const BasicBlock *block = NULL;
+    size_t pc;
+    Value a;
+    
+#define DISPATCH() goto *(++ip)->handler
+#define JUMP(index) do { ip = &prog->code[index]; goto *ip->handler; } while (0)
+#define SPILL() (base[depth > 0 ? depth - 1 : 0] = tos)
+#define SYNC_OUT() do { SPILL(); vm->stack.top = depth - 1; } while (0)
+#define SYNC_IN() do { depth = vm->stack.top + 1; tos = depth > 0 ? base[depth - 1] : 0; } while (0)
+    
+    goto *ip->handler;
+    
+do_block:
+    block = &prog->blocks[ip->operand];
+    if (!vm->running) goto do_halt;
+    if (depth < block->need || depth + block->grow > STACK_SIZE) {
+        // Not provably in bounds: run this block with per-op checks
+        SYNC_OUT();
+        pc = vm_run(vm, prog->bytecode, prog->length, block->start, block->start, block->end);
+        SYNC_IN();
+        goto resume;
+    }
+    vm->ops_executed += block->ops;
+    DISPATCH();
+    
+do_push:
+    SPILL();
+    depth++;
+    tos = ip->operand;
+    DISPATCH();
+    
+do_pop:
+    depth--;
+    tos = base[depth > 0 ? depth - 1 : 0];
+    DISPATCH();
+    
+do_add:
+    depth--;
+    tos = (Value)((uint64_t)base[depth - 1] + (uint64_t)tos);
+    DISPATCH();
+    
+do_sub:
+    depth--;
+    tos = (Value)((uint64_t)base[depth - 1] - (uint64_t)tos);
+    DISPATCH();
+    
+do_mul:
+    depth--;
+    tos = (Value)((uint64_t)base[depth - 1] * (uint64_t)tos);
+    DISPATCH();
+    
+do_div:
+    if (tos == 0) {
+        // Reference drops both operands and pushes nothing
+        depth -= 2;
+        tos = base[depth > 0 ? depth - 1 : 0];
+        goto bail;
+    }
+    depth--;
+    tos = value_div(base[depth - 1], tos);
+    DISPATCH();
+    
+do_store:
+    mem_store(vm, base[depth - 2], tos);
+    depth -= 2;
+    tos = base[depth > 0 ? depth - 1 : 0];
+    DISPATCH();
+    
+do_load:
+    if (!mem_load(vm, tos, &a)) {
+        // Reference pops the address and pushes nothing
+        depth--;
+        tos = base[depth > 0 ? depth - 1 : 0];
+        goto bail;
+    }
+    tos = a;
+    DISPATCH();
+    
+do_store_abs:
+    mem_store(vm, ip->operand, tos);
+    depth--;
+    tos = base[depth > 0 ? depth - 1 : 0];
+    DISPATCH();
+    
+do_load_abs:
+    // Out of range pushes nothing
+    if (!mem_load(vm, ip->operand, &a)) goto bail;
+    SPILL();
+    depth++;
+    tos = a;
+    DISPATCH();
+    
+do_jmp:
+    JUMP(ip->operand);
+    
+do_jz:
+    a = tos;
+    depth--;
+    tos = base[depth > 0 ? depth - 1 : 0];
+    if (a == 0) JUMP(ip->operand);
+    DISPATCH();
+    
+do_call:
+    // A call always ends its block, so the next block is the return point
+    if (!push_frame(vm, block->end, block->next)) goto do_halt;
+    JUMP(ip->operand);
+    
+do_ret:
+    if (vm->call_stack_ptr == 0) {
+        vm->running = false;
+        goto do_halt;
+    }
+    {
+        Frame frame = vm->call_stack[--vm->call_stack_ptr];
+        if (frame.return_insn != NO_RETURN_INSN) JUMP(frame.return_insn);
+        pc = frame.return_pc;
+    }
+    goto resume;
+    
+do_dup:
+    SPILL();
+    depth++;
+    DISPATCH();
+    
+do_swap:
+    a = base[depth - 2];
+    base[depth - 2] = tos;
+    tos = a;
+    DISPATCH();
+    
+do_print:
+    print_value(vm, tos);
+    depth--;
+    tos = base[depth > 0 ? depth - 1 : 0];
+    DISPATCH();
+    
+do_addi:
+    tos = (Value)((uint64_t)tos + (uint64_t)ip->operand);
+    DISPATCH();
+    
+do_muli:
+    tos = (Value)((uint64_t)tos * (uint64_t)ip->operand);
+    DISPATCH();
+    
+do_print_abs:
+    if (!mem_load(vm, ip->operand, &a) || depth >= STACK_SIZE) {
+        // Prints from the stack instead; stack effect differs
+        SYNC_OUT();
+        if (mem_load(vm, ip->operand, &a)) {
+            stack_push(&vm->stack, a);
+        }
+        op_print(vm);
+        SYNC_IN();
+        goto bail;
+    }
+    print_value(vm, a);
+    DISPATCH();
+    
+do_builtin:
+    SYNC_OUT();
+    switch (ip->op) {
+        case OP_QR_MINE: op_qr_mine(vm); break;
+        case OP_QR_GENERATE: op_qr_generate(vm); break;
+        case OP_QR_PRINT: op_qr_print(vm); break;
+        case OP_QR_VERIFY: op_qr_verify(vm); break;
+        case OP_CONCAT: op_concat(vm); break;
+        case OP_ARENA_MARK: op_arena_mark(vm); break;
+        case OP_ARENA_RESET: op_arena_reset(vm); break;
+        case OP_STRLEN: op_strlen(vm); break;
+        case OP_HASH: op_hash(vm); break;
+        case OP_DISPOSE: op_dispose(vm); break;
+        case OP_HASH_BEGIN: op_hash_begin(vm); break;
+        case OP_HASH_UPDATE: op_hash_update(vm); break;
+        case OP_HASH_END: op_hash_end(vm); break;
+        case OP_MERKLE_CREATE: op_merkle_create(vm); break;
+        case OP_MERKLE_ADD: op_merkle_add(vm); break;
+        case OP_MERKLE_ROOT: op_merkle_root(vm); break;
+        case OP_MEMPOOL_CREATE: op_mempool_create(vm); break;
+        case OP_MEMPOOL_ADD: op_mempool_add(vm); break;
+        case OP_MEMPOOL_PRUNE: op_mempool_prune(vm); break;
+        case OP_BLOCK_TEMPLATE: op_block_template(vm); break;
+    }
+    SYNC_IN();
+    DISPATCH();
+    
+bail:
+    // Finish the current block on the reference engine
+    SYNC_OUT();
+    {
+        const Insn *first = &prog->code[block->first + 1];
+        size_t resume_pc = block_offset(prog, block, ip - first + 1);
+        vm->ops_executed -= &prog->code[block->next] - ip - 1;
+        pc = vm_run(vm, prog->bytecode, prog->length, resume_pc, block->start, block->end);
+    }
+    SYNC_IN();
+    
+resume:
+    // Continue threaded execution at bytecode offset pc, which is always a
+    // block start when reached through fallthrough, a branch or a return
+    if (!vm->running || pc >= prog->length) goto do_halt;
+    block = block_at(prog, pc);
+    if (!block) {
+        SYNC_OUT();
+        vm_run(vm, prog->bytecode, prog->length, pc, 0, prog->length);
+        return;
+    }
+    JUMP(block->first);
+    
+do_halt:
+    SYNC_OUT();
+    
+#undef DISPATCH
+#undef JUMP
+#undef SPILL
+#undef SYNC_OUT
+#undef SYNC_IN
+}
+
+// Lexer. A token is a run of non-blank characters or a double-quoted
+// string; '#' starts a comment that runs to the end of the line. Each
+// character's role comes from a lookup table, so scanning a word is one
+// table load per byte.
+enum {
+    CC_WORD = 0,
+    CC_END,
+    CC_SPACE,
+    CC_NEWLINE,
+    CC_COMMENT,
+    CC_QUOTE
+};
+
+static const uint8_t char_class[256] = {
+    ['\0'] = CC_END,
+    [' '] = CC_SPACE,
+    ['\t'] = CC_SPACE,
+    ['\r'] = CC_SPACE,
+    ['\n'] = CC_NEWLINE,
+    ['#'] = CC_COMMENT,
+    ['"'] = CC_QUOTE
+};
+
+typedef enum {
+    TOK_EOF,
+    TOK_WORD,
+    TOK_STRING
+} TokenKind;
+
+typedef struct {
+    TokenKind kind;
+    const char *text;       // Word, or the contents of a string
+    size_t len;
+    int line;               // 1-based position of the first character
+    int column;
+    bool line_start;        // First token on its line
+} Token;
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *line_begin;
+    int line;
+    bool line_start;
+    Token peeked;
+    bool has_peek;
+} Lexer;
+
+static void lex_init(Lexer *lx, const char *source) {
+    lx->p = (const unsigned char*)source;
+    lx->line_begin = lx->p;
+    lx->line = 1;
+    lx->line_start = true;
+    lx->has_peek = false;
+}
+
+static void lex_next(Lexer *lx, Token *tok) {
+    if (lx->has_peek) {
+        *tok = lx->peeked;
+        lx->has_peek = false;
+        return;
+    }
+    
+    const unsigned char *p = lx->p;
+    for (;;) {
+        switch (char_class[*p]) {
+            case CC_SPACE:
+                p++;
+                continue;
+            case CC_NEWLINE:
+                p++;
+                lx->line++;
+                lx->line_begin = p;
+                lx->line_start = true;
+                continue;
+            case CC_COMMENT:
                 while (*p && *p != '\n') p++;
+                continue;
+        }
+        break;
+    }
+    
+    tok->line = lx->line;
+    tok->column = p - lx->line_begin + 1;
+    tok->line_start = lx->line_start;
+    lx->line_start = false;
+    
+    if (!*p) {
+        tok->kind = TOK_EOF;
+        tok->text = (const char*)p;
+        tok->len = 0;
+    } else if (*p == '"') {
+        tok->kind = TOK_STRING;
+        tok->text = (const char*)++p;
+        while (*p && *p != '"') {
+            if (*p == '\n') {
+                lx->line++;
+                lx->line_begin = p + 1;
+            }
+            p++;
+        }
+        tok->len = (const char*)p - tok->text;
+        if (*p == '"') p++;
+    } else {
+        tok->kind = TOK_WORD;
+        tok->text = (const char*)p;
+        while (char_class[*p] == CC_WORD) p++;
+        tok->len = (const char*)p - tok->text;
+    }
+    lx->p = p;
+}
+
+static const Token* lex_peek(Lexer *lx) {
+    if (!lx->has_peek) {
+        lex_next(lx, &lx->peeked);
+        lx->has_peek = true;
+    }
+    return &lx->peeked;
+}
+
+// Take the next token if it is on the same line as the previous one
+static bool lex_operand(Lexer *lx, Token *tok) {
+    const Token *next = lex_peek(lx);
+    if (next->kind == TOK_EOF || next->line_start) return false;
+    lex_next(lx, tok);
+    return true;
+}
+
+// Mnemonics and builtin names, placed by a perfect hash of their first,
+// middle and last characters and length. The slots were found offline; a
+// new word needs a free slot or new multipliers.
+typedef enum {
+    KW_NONE,
+    KW_OP,                  // Emits `op` with no operand
+    KW_PUSH,
+    KW_MEMORY,              // LOAD / STORE, with an optional direct address
+    KW_BRANCH,              // CALL / JMP / JZ label
+    KW_RETURN,
+    KW_IF,
+    KW_WHILE,
+    KW_ELSE,
+    KW_END_IF,
+    KW_BREAK,
+    KW_END_WHILE,
+    KW_BUILTIN              // Target of CALL that maps to an opcode
+} KeywordKind;
+
+typedef struct {
+    const char *name;
+    uint8_t len;
+    uint8_t kind;
+    uint8_t op;
+} Keyword;
+
+#define KEYWORD_SLOTS 128
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    [41] = { "PUSH", 4, KW_PUSH, OP_PUSH },
+    [28] = { "POP", 3, KW_OP, OP_POP },
+    [40] = { "ADD", 3, KW_OP, OP_ADD },
+    [45] = { "SUB", 3, KW_OP, OP_SUB },
+    [59] = { "MUL", 3, KW_OP, OP_MUL },
+    [114] = { "DIV", 3, KW_OP, OP_DIV },
+    [11] = { "STORE", 5, KW_MEMORY, OP_STORE },
+    [31] = { "LOAD", 4, KW_MEMORY, OP_LOAD },
+    [115] = { "CALL", 4, KW_BRANCH, OP_CALL },
+    [8] = { "JMP", 3, KW_BRANCH, OP_JMP },
+    [118] = { "JZ", 2, KW_BRANCH, OP_JZ },
+    [96] = { "RET", 3, KW_OP, OP_RET },
+    [71] = { "RETURN", 6, KW_RETURN, OP_RET },
+    [65] = { "IF", 2, KW_IF, 0 },
+    [24] = { "ELSE", 4, KW_ELSE, 0 },
+    [112] = { "END_IF", 6, KW_END_IF, 0 },
+    [101] = { "WHILE", 5, KW_WHILE, 0 },
+    [64] = { "BREAK", 5, KW_BREAK, 0 },
+    [57] = { "END_WHILE", 9, KW_END_WHILE, 0 },
+    [70] = { "CONCAT", 6, KW_OP, OP_CONCAT },
+    [122] = { "ARENA_MARK", 10, KW_OP, OP_ARENA_MARK },
+    [13] = { "ARENA_RESET", 11, KW_OP, OP_ARENA_RESET },
+    [9] = { "STRLEN", 6, KW_OP, OP_STRLEN },
+    [33] = { "HASH", 4, KW_OP, OP_HASH },
+    [60] = { "HASH_BEGIN", 10, KW_OP, OP_HASH_BEGIN },
+    [48] = { "HASH_UPDATE", 11, KW_OP, OP_HASH_UPDATE },
+    [113] = { "HASH_END", 8, KW_OP, OP_HASH_END },
+    [5] = { "DISPOSE", 7, KW_OP, OP_DISPOSE },
+    [58] = { "DUP", 3, KW_OP, OP_DUP },
+    [62] = { "SWAP", 4, KW_OP, OP_SWAP },
+    [124] = { "PRINT", 5, KW_OP, OP_PRINT },
+    [61] = { "qr_mine", 7, KW_BUILTIN, OP_QR_MINE },
+    [72] = { "qr_generate", 11, KW_BUILTIN, OP_QR_GENERATE },
+    [127] = { "qr_print", 8, KW_BUILTIN, OP_QR_PRINT },
+    [47] = { "qr_verify", 9, KW_BUILTIN, OP_QR_VERIFY },
+    [93] = { "merkle_create", 13, KW_BUILTIN, OP_MERKLE_CREATE },
+    [2] = { "merkle_add", 10, KW_BUILTIN, OP_MERKLE_ADD },
+    [35] = { "merkle_root", 11, KW_BUILTIN, OP_MERKLE_ROOT },
+    [94] = { "mempool_create", 14, KW_BUILTIN, OP_MEMPOOL_CREATE },
+    [73] = { "mempool_add", 11, KW_BUILTIN, OP_MEMPOOL_ADD },
+    [56] = { "mempool_prune", 13, KW_BUILTIN, OP_MEMPOOL_PRUNE },
+    [125] = { "block_template", 14, KW_BUILTIN, OP_BLOCK_TEMPLATE }
+};
+
+static const Keyword* keyword_lookup(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char*)s;
+    const Keyword *kw = &keywords[(u[0] + 2u * u[len - 1] + 7u * u[len / 2] + len) % KEYWORD_SLOTS];
+    return kw->len == len && memcmp(kw->name, s, len) == 0 ? kw : NULL;
+}
+
+// Compiler state for labels and structured control flow
+#define MAX_NESTING 64
+#define MAX_BREAKS 64
+#define MAX_LABEL_LEN 64
+
+typedef struct {
+    char name[MAX_LABEL_LEN];
+    size_t pc;
+} Label;
+
+// Labels indexed by an open-addressed hash of their names, kept at most
+// half full
+typedef struct {
+    Label *labels;
+    int count;
+    int *slots;             // Label index + 1, 0 if empty
+    size_t slot_count;      // Power of two; labels has room for half of it
+} LabelTable;
+
+typedef struct {
+    char name[MAX_LABEL_LEN];
+    size_t at;              // Offset of the branch opcode to patch
+    int line;
+    int column;
+} Fixup;
+
+typedef enum {
+    CTRL_IF,
+    CTRL_WHILE
+} ControlKind;
+
+// exit_at of an IF that tests nothing
+#define NO_BRANCH SIZE_MAX
+
+typedef struct {
+    ControlKind kind;
+    size_t head;            // WHILE: offset of the condition
+    size_t exit_at;         // Pending JZ (or ELSE's JMP) to patch at the end, or NO_BRANCH
+    bool has_else;
+    size_t breaks[MAX_BREAKS];
+    int break_count;
+} Control;
+
+// Innermost open construct of `kind`, or -1
+static int control_find(const Control *controls, int depth, ControlKind kind) {
+    int j = depth - 1;
+    while (j >= 0 && controls[j].kind != kind) j--;
+    return j;
+}
+
+// Condition words that open an IF on the value already on the stack. The
+// body runs when the value is zero for these, and when it is nonzero for
+// IF_ERR; other IF_ words open an IF that tests nothing.
+static const char *const if_zero_words[] = { "IF_ZERO", "IF_NOT", "IF_SUCCESS", "IF_EMPTY" };
+
+static bool word_is(const Token *tok, const char *word) {
+    return tok->len == strlen(word) && memcmp(tok->text, word, tok->len) == 0;
+}
+
+static uint32_t label_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+// Slot holding `name`, or the empty slot where it would go
+static int *label_slot(LabelTable *table, const char *name, size_t len) {
+    for (uint32_t h = label_hash(name, len); ; h++) {
+        int *slot = &table->slots[h & (table->slot_count - 1)];
+        if (!*slot) return slot;
+        const char *existing = table->labels[*slot - 1].name;
+        if (strncmp(existing, name, len) == 0 && existing[len] == '\0') return slot;
+    }
+}
+
+static bool label_table_init(LabelTable *table) {
+    table->count = 0;
+    table->slot_count = 256;
+    table->labels = malloc(sizeof(Label) * table->slot_count / 2);
+    table->slots = calloc(table->slot_count, sizeof(int));
+    return table->labels && table->slots;
+}
+
+static void label_table_free(LabelTable *table) {
+    free(table->labels);
+    free(table->slots);
+}
+
+// Double the table and rehash once it is half full
+static bool label_table_reserve(LabelTable *table) {
+    if ((size_t)table->count < table->slot_count / 2) return true;
+    
+    size_t slot_count = table->slot_count * 2;
+    Label *labels = realloc(table->labels, sizeof(Label) * slot_count / 2);
+    if (!labels) return false;
+    table->labels = labels;
+    int *slots = calloc(slot_count, sizeof(int));
+    if (!slots) return false;
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+    for (int i = 0; i < table->count; i++) {
+        *label_slot(table, labels[i].name, strlen(labels[i].name)) = i + 1;
+    }
+    return true;
+}
+
+// Emit a branch and return its opcode offset; the target is patched later
+static size_t emit_branch(unsigned char *bytecode, size_t *length, uint8_t op) {
+    size_t at = *length;
+    bytecode[(*length)++] = op;
+    *length += REL32_SIZE;
+    return at;
+}
+
+static void patch_branch(unsigned char *bytecode, size_t at, size_t target) {
+    write_rel32(&bytecode[at + 1], (int32_t)(target - (at + 1 + REL32_SIZE)));
+}
+
+// Parse a whole token as an integer literal: decimal or 0x hex,
+// optionally negative or with a width tag such as "u64:"
+static bool parse_number(const char *p, size_t len, Value *value) {
+    const char *end = p + len;
+    if (len > 1 && (*p == 'u' || *p == 'i') && p[1] >= '0' && p[1] <= '9') {
+        const char *q = p + 1;
+        while (q < end && *q >= '0' && *q <= '9') q++;
+        if (q < end && *q == ':') p = q + 1;
+    }
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    int base = end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') ? 16 : 10;
+    if (base == 16) p += 2;
+    if (p == end) return false;
+    
+    uint64_t result = 0;
+    for (; p < end; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9') digit = *p - '0';
+        else if (base == 16 && *p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+        else if (base == 16 && *p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+        else return false;
+        result = result * base + digit;
+    }
+    
+    *value = (Value)(negative ? -result : result);
+    return true;
+}
+
+// Emit an instruction with a LEB128 operand
+static void emit_imm(unsigned char *bytecode, size_t *length, uint8_t op, Value value) {
+    bytecode[(*length)++] = op;
+    *length += write_leb128(&bytecode[*length], (uint64_t)value, imm_kind(op) == IMM_SIGNED);
+}
+
+static void compile_error(const Token *tok, const char *fmt, ...) {
+    va_list args;
+    printf("Error: line %d, column %d: ", tok->line, tok->column);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+// Most bytes a single token can emit (a string push plus a pending JZ)
+#define MAX_TOKEN_CODE (2 * (1 + LEB128_MAX) + 2 * (1 + REL32_SIZE))
+
+// Compile Chrysalis source to bytecode
+//
+// Control flow: ":name" defines a label; "CALL name", "JMP name" and
+// "JZ name" branch to it; "RET" or "RETURN [n]" returns from a CALL (or
+// halts at top level). "IF ... [ELSE ...] END_IF" and
+// "WHILE ... [BREAK] END_WHILE" pop a condition and skip their body when
+// it is zero. Words after IF or WHILE on the same line compute the
+// condition; for WHILE they are re-evaluated on every iteration.
+// "IF_ZERO", "IF_ERR" and the other IF_ words open an IF on the value
+// already on the stack.
+//
+// Strings are copied into `pool` as string objects (STRING_POOL_SIZE bytes,
+// loaded at STRING_POOL_START); their total size is stored in *pool_length.
+unsigned char* compile(const char *source, size_t *length, unsigned char *pool, size_t *pool_length) {
+    size_t capacity = 4096;
+    unsigned char *bytecode = malloc(capacity);
+    LabelTable table;
+    LabelTable *labels = &table;
+    bool have_labels = label_table_init(labels);
+    size_t fixup_capacity = 256, fixup_count = 0;
+    Fixup *fixups = malloc(sizeof(Fixup) * fixup_capacity);
+    Control *controls = malloc(sizeof(Control) * MAX_NESTING);
+    if (!bytecode || !have_labels || !fixups || !controls) goto fail;
+    
+    int depth = 0;
+    bool pending_cond = false;  // IF/WHILE waiting for its condition's line to end
+    size_t str_offset = 0;
+    Value value;
+    Lexer lx;
+    Token tok, arg;
+    
+    *length = 0;
+    lex_init(&lx, source);
+    
+    for (;;) {
+        lex_next(&lx, &tok);
+    
+        if (*length + MAX_TOKEN_CODE > capacity) {
+            unsigned char *grown = realloc(bytecode, capacity * 2);
+            if (!grown) goto fail;
+            bytecode = grown;
+            capacity *= 2;
+        }
+    
+        const Keyword *kw = tok.kind == TOK_WORD ? keyword_lookup(tok.text, tok.len) : NULL;
+        KeywordKind kind = kw ? kw->kind : KW_NONE;
+    
+        // The condition of an IF/WHILE ends with its line, or at a control
+        // keyword on the same line
+        if (pending_cond && (tok.line_start || tok.kind == TOK_EOF || kind == KW_ELSE ||
+                             kind == KW_END_IF || kind == KW_BREAK || kind == KW_END_WHILE)) {
+            controls[depth - 1].exit_at = emit_branch(bytecode, length, OP_JZ);
+            pending_cond = false;
+        }
+        if (tok.kind == TOK_EOF) break;
+    
+        switch (kind) {
+            case KW_OP:
+                bytecode[(*length)++] = kw->op;
+                break;
+    
+            case KW_PUSH:
+                if (!lex_operand(&lx, &arg)) {
+                    emit_imm(bytecode, length, OP_PUSH, 0);
+                } else if (arg.kind == TOK_STRING) {
+                    if (str_offset + sizeof(StringHeader) + arg.len + 1 > STRING_POOL_SIZE) {
+                        compile_error(&arg, "string pool full");
+                        goto fail;
+                    }
+                    StringHeader header = { (uint32_t)arg.len, STRING_MAGIC };
+                    memcpy(&pool[str_offset], &header, sizeof(header));
+                    str_offset += sizeof(header);
+                    size_t str_loc = STRING_POOL_START + str_offset;
+                    memcpy(&pool[str_offset], arg.text, arg.len);
+                    pool[str_offset + arg.len] = '\0';
+                    str_offset += arg.len + 1;
+    
+                    emit_imm(bytecode, length, OP_PUSH, STRING_TAG + (Value)str_loc);
+                } else if (parse_number(arg.text, arg.len, &value)) {
+                    emit_imm(bytecode, length, OP_PUSH, value);
+                } else {
+                    // Symbolic operands are not resolved yet
+                    emit_imm(bytecode, length, OP_PUSH, 0);
+                }
+                break;
+    
+            case KW_MEMORY: {
+                // "STORE addr" and "LOAD addr" use the direct-address forms
+                bool is_store = kw->op == OP_STORE;
+                const Token *next = lex_peek(&lx);
+                if (next->kind == TOK_WORD && !next->line_start &&
+                    parse_number(next->text, next->len, &value) && value >= 0) {
+                    lex_next(&lx, &arg);
+                    emit_imm(bytecode, length, is_store ? OP_STORE_ABS : OP_LOAD_ABS, value);
+                } else {
+                    bytecode[(*length)++] = kw->op;
+                }
+                break;
             }
-            if (*p) p++;
-        }
-        if (!*p) break;
-        
-        // Read token
-        int i = 0;
-        while (*p && *p != ' ' && *p != '\n' && *p != '\t' && *p != '#' && i < 255) {
-            token[i++] = *p++;
-        }
-        token[i] = '\0';
-        
-        // Parse token
-        if (strcmp(token, "PUSH") == 0) {
-            bytecode[(*length)++] = OP_PUSH;
-            while (*p && (*p == ' ' || *p == '\t')) p++;
-            if (*p == '"') {
-                p++; // Skip opening quote
-                static size_t str_offset = 0;
-                size_t str_loc = STRING_POOL_START + str_offset;
-                i = 0;
-                
-                // Store string in memory pool
-                while (*p && *p != '"') {
-                    bytecode[str_loc + i] = *p++;
-                    i++;
+    
+            case KW_BRANCH: {
+                if (!lex_operand(&lx, &arg) || arg.kind != TOK_WORD) {
+                    compile_error(&tok, "%.*s needs a label", (int)tok.len, tok.text);
+                    goto fail;
                 }
-                bytecode[str_loc + i] = '\0';
-                if (*p == '"') p++;
-                
-                // Push string marker and location
-                bytecode[(*length)++] = OP_PUSH;
-                bytecode[(*length)++] = STRING_MARKER;
-                bytecode[(*length)++] = OP_PUSH;
-                bytecode[(*length)++] = str_loc;
-                
-                str_offset += i + 1;
-            } else {
-                bytecode[(*length)++] = atoi(p);
-                while (*p && *p >= '0' && *p <= '9') p++;
+                const Keyword *target = keyword_lookup(arg.text, arg.len);
+                if (kw->op == OP_CALL && target && target->kind == KW_BUILTIN) {
+                    bytecode[(*length)++] = target->op;
+                    break;
+                }
+                if (arg.len >= MAX_LABEL_LEN) {
+                    compile_error(&arg, "label too long");
+                    goto fail;
+                }
+                if (fixup_count == fixup_capacity) {
+                    Fixup *grown = realloc(fixups, sizeof(Fixup) * fixup_capacity * 2);
+                    if (!grown) goto fail;
+                    fixups = grown;
+                    fixup_capacity *= 2;
+                }
+                Fixup *fixup = &fixups[fixup_count++];
+                memcpy(fixup->name, arg.text, arg.len);
+                fixup->name[arg.len] = '\0';
+                fixup->line = arg.line;
+                fixup->column = arg.column;
+                fixup->at = emit_branch(bytecode, length, kw->op);
+                break;
             }
-        }
-        else if (strcmp(token, "POP") == 0) bytecode[(*length)++] = OP_POP;
-        else if (strcmp(token, "ADD") == 0) bytecode[(*length)++] = OP_ADD;
-        else if (strcmp(token, "SUB") == 0) bytecode[(*length)++] = OP_SUB;
-        else if (strcmp(token, "MUL") == 0) bytecode[(*length)++] = OP_MUL;
-        else if (strcmp(token, "DIV") == 0) bytecode[(*length)++] = OP_DIV;
-        else if (strcmp(token, "STORE") == 0) bytecode[(*length)++] = OP_STORE;
-        else if (strcmp(token, "LOAD") == 0) bytecode[(*length)++] = OP_LOAD;
-        else if (strcmp(token, "CALL") == 0) {
-            bytecode[(*length)++] = OP_CALL;
-            while (*p && (*p == ' ' || *p == '\t')) p++;
-            if (strncmp(p, "qr_mine", 7) == 0) {
-                bytecode[(*length)++] = OP_QR_MINE;
-                p += 7;
+    
+            case KW_RETURN: {
+                const Token *next = lex_peek(&lx);
+                if (next->kind == TOK_WORD && !next->line_start && parse_number(next->text, next->len, &value)) {
+                    lex_next(&lx, &arg);
+                    emit_imm(bytecode, length, OP_PUSH, value);
+                }
+                bytecode[(*length)++] = OP_RET;
+                break;
             }
-            else if (strncmp(p, "qr_generate", 11) == 0) {
-                bytecode[(*length)++] = OP_QR_GENERATE;
-                p += 11;
+    
+            case KW_IF:
+            case KW_WHILE: {
+                if (depth == MAX_NESTING || pending_cond) {
+                    compile_error(&tok, "%.*s nested too deeply", (int)tok.len, tok.text);
+                    goto fail;
+                }
+                Control *ctrl = &controls[depth++];
+                ctrl->kind = kind == KW_IF ? CTRL_IF : CTRL_WHILE;
+                ctrl->head = *length;
+                ctrl->has_else = false;
+                ctrl->break_count = 0;
+                pending_cond = true;
+                break;
             }
-            else if (strncmp(p, "qr_print", 8) == 0) {
-                bytecode[(*length)++] = OP_QR_PRINT;
-                p += 8;
+    
+            // A closing word with no opener of its kind is skipped like any
+            // other unknown word, since sources use openers (LOOP, FOREACH)
+            // that are not part of the instruction set yet
+            case KW_ELSE: {
+                if (control_find(controls, depth, CTRL_IF) < 0) break;
+                if (controls[depth - 1].kind != CTRL_IF || controls[depth - 1].has_else) {
+                    compile_error(&tok, "ELSE without IF");
+                    goto fail;
+                }
+                Control *ctrl = &controls[depth - 1];
+                size_t skip = emit_branch(bytecode, length, OP_JMP);
+                if (ctrl->exit_at != NO_BRANCH) patch_branch(bytecode, ctrl->exit_at, *length);
+                ctrl->exit_at = skip;
+                ctrl->has_else = true;
+                break;
             }
-            else if (strncmp(p, "qr_verify", 9) == 0) {
-                bytecode[(*length)++] = OP_QR_VERIFY;
-                p += 9;
+    
+            case KW_END_IF:
+                if (control_find(controls, depth, CTRL_IF) < 0) break;
+                if (controls[depth - 1].kind != CTRL_IF) {
+                    compile_error(&tok, "END_IF without IF");
+                    goto fail;
+                }
+                if (controls[--depth].exit_at != NO_BRANCH) patch_branch(bytecode, controls[depth].exit_at, *length);
+                break;
+    
+            case KW_BREAK: {
+                int j = control_find(controls, depth, CTRL_WHILE);
+                if (j < 0) break;
+                if (controls[j].break_count == MAX_BREAKS) {
+                    compile_error(&tok, "too many BREAKs");
+                    goto fail;
+                }
+                controls[j].breaks[controls[j].break_count++] = emit_branch(bytecode, length, OP_JMP);
+                break;
             }
+    
+            case KW_END_WHILE: {
+                if (control_find(controls, depth, CTRL_WHILE) < 0) break;
+                if (controls[depth - 1].kind != CTRL_WHILE) {
+                    compile_error(&tok, "END_WHILE without WHILE");
+                    goto fail;
+                }
+                Control *ctrl = &controls[--depth];
+                patch_branch(bytecode, emit_branch(bytecode, length, OP_JMP), ctrl->head);
+                patch_branch(bytecode, ctrl->exit_at, *length);
+                for (int j = 0; j < ctrl->break_count; j++) {
+                    patch_branch(bytecode, ctrl->breaks[j], *length);
+                }
+                break;
+            }
+    
+            default:
+                if (tok.kind == TOK_WORD && tok.text[0] == ':' && tok.len > 1) {
+                    const char *name = tok.text + 1;
+                    size_t len = tok.len - 1;
+                    if (len >= MAX_LABEL_LEN) {
+                        compile_error(&tok, "label too long");
+                        goto fail;
+                    }
+                    if (!label_table_reserve(labels)) goto fail;
+                    int *slot = label_slot(labels, name, len);
+                    if (*slot) {
+                        compile_error(&tok, "duplicate label %.*s", (int)len, name);
+                        goto fail;
+                    }
+                    Label *label = &labels->labels[labels->count++];
+                    memcpy(label->name, name, len);
+                    label->name[len] = '\0';
+                    label->pc = *length;
+                    *slot = labels->count;
+                } else if (tok.kind == TOK_WORD && tok.len > 3 && memcmp(tok.text, "IF_", 3) == 0) {
+                    if (depth == MAX_NESTING || pending_cond) {
+                        compile_error(&tok, "%.*s nested too deeply", (int)tok.len, tok.text);
+                        goto fail;
+                    }
+                    Control *ctrl = &controls[depth++];
+                    ctrl->kind = CTRL_IF;
+                    ctrl->has_else = false;
+                    ctrl->break_count = 0;
+                    ctrl->exit_at = NO_BRANCH;
+                    bool when_zero = false;
+                    for (size_t i = 0; i < sizeof(if_zero_words) / sizeof(if_zero_words[0]); i++) {
+                        when_zero |= word_is(&tok, if_zero_words[i]);
+                    }
+                    if (when_zero) {
+                        // Jump over the exit when the value is zero
+                        size_t test = emit_branch(bytecode, length, OP_JZ);
+                        ctrl->exit_at = emit_branch(bytecode, length, OP_JMP);
+                        patch_branch(bytecode, test, *length);
+                    } else if (word_is(&tok, "IF_ERR")) {
+                        ctrl->exit_at = emit_branch(bytecode, length, OP_JZ);
+                    }
+                }
+                // Other words are not part of the instruction set yet
+                break;
+        }
+    }
+    
+    if (depth) {
+        compile_error(&tok, "unterminated %s", controls[depth - 1].kind == CTRL_IF ? "IF" : "WHILE");
+        goto fail;
+    }
+    
+    // Resolve forward and backward references to labels. A CALL to a label
+    // this source does not define, such as "module:name" in a module that
+    // is not linked in, does nothing, as it did before labels existed.
+    for (size_t i = 0; i < fixup_count; i++) {
+        int index = *label_slot(labels, fixups[i].name, strlen(fixups[i].name));
+        if (!index && bytecode[fixups[i].at] == OP_CALL) {
+            bytecode[fixups[i].at] = OP_JMP;
+            patch_branch(bytecode, fixups[i].at, fixups[i].at + 1 + REL32_SIZE);
+            continue;
+        }
+        if (!index) {
+            printf("Error: line %d, column %d: undefined label %s\n",
+                   fixups[i].line, fixups[i].column, fixups[i].name);
+            goto fail;
         }
-        else if (strcmp(token, "CONCAT") == 0) bytecode[(*length)++] = OP_CONCAT;
-        else if (strcmp(token, "DUP") == 0) bytecode[(*length)++] = OP_DUP;
-        else if (strcmp(token, "SWAP") == 0) bytecode[(*length)++] = OP_SWAP;
-        else if (strcmp(token, "PRINT") == 0) bytecode[(*length)++] = OP_PRINT;
+        patch_branch(bytecode, fixups[i].at, labels->labels[index - 1].pc);
     }
     
+    label_table_free(labels);
+    free(fixups);
+    free(controls);
+    *pool_length = str_offset;
     return bytecode;
+    
+fail:
+    free(bytecode);
+    label_table_free(labels);
+    free(fixups);
+    free(controls);
+    return NULL;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s <source_file>\n", argv[0]);
-        return 1;
+// Bytecode optimizer, run between compile and execution (or image
+// output). Bytecode is decoded into an instruction list, rewritten by
+// peephole passes until nothing changes, and re-encoded with branch
+// offsets relocated.
+//
+//   -O1  constant folding, no-op pairs (DUP POP, SWAP SWAP, PUSH 0 ADD,
+//        PUSH x POP, JMP to the next instruction) and dead direct stores
+//   -O2  also fuses PUSH+ADD/SUB into ADDI, PUSH+MUL into MULI and
+//        LOAD addr+PRINT into PRINT_ABS
+//
+// No pattern spans a branch target. Rewrites assume the program does not
+// overflow the stack, since a PUSH that fails on a full stack cannot be
+// folded into its consumer.
+typedef struct {
+    uint8_t op;
+    bool leader;            // A branch lands here
+    bool dead;
+    Value imm;              // Immediate, or target instruction index for branches
+} OptInsn;
+
+typedef struct {
+    size_t insns_before;
+    size_t insns_after;
+    size_t bytes_before;
+    size_t bytes_after;
+    size_t folded;          // Constant expressions evaluated
+    size_t removed;         // No-ops and dead stores dropped
+    size_t fused;           // Superinstructions formed
+} OptStats;
+
+// Next live instruction after i, or count
+static size_t opt_next(const OptInsn *insns, size_t count, size_t i) {
+    do i++; while (i < count && insns[i].dead);
+    return i;
+}
+
+// Whether instruction j can join a pattern started earlier in its block
+static bool opt_joinable(const OptInsn *insns, size_t count, size_t j) {
+    return j < count && !insns[j].leader;
+}
+
+// Drop instruction i; branches to it now land on the next live one
+static void opt_kill(OptInsn *insns, size_t count, size_t i) {
+    insns[i].dead = true;
+    size_t next = opt_next(insns, count, i);
+    if (insns[i].leader && next < count) insns[next].leader = true;
+}
+
+static bool opt_is_const_binop(uint8_t op) {
+    return op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV;
+}
+
+// Whether the direct store at i is overwritten before anything can read it
+static bool opt_dead_store(const OptInsn *insns, size_t count, size_t i) {
+    for (size_t j = opt_next(insns, count, i); opt_joinable(insns, count, j); j = opt_next(insns, count, j)) {
+        switch (insns[j].op) {
+            case OP_STORE_ABS:
+                if (insns[j].imm == insns[i].imm) return true;
+                break;
+            case OP_LOAD_ABS:
+                if (insns[j].imm == insns[i].imm) return false;
+                break;
+            case OP_PUSH:
+            case OP_POP:
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_DUP:
+            case OP_SWAP:
+            case OP_ADDI:
+            case OP_MULI:
+                break;
+            default:
+                // Memory may be read, or control may leave the block
+                return false;
+        }
     }
+    return false;
+}
 
-    FILE *f = fopen(argv[1], "r");
-    if (!f) {
-        printf("Error: Could not open file %s\n", argv[1]);
-        return 1;
+// One sweep of peephole rewrites; returns whether anything changed
+static bool opt_pass(OptInsn *insns, size_t count, int level, OptStats *stats) {
+    bool changed = false;
+    
+    for (size_t i = 0; i < count; i++) {
+        OptInsn *a = &insns[i];
+        if (a->dead) continue;
+        size_t j = opt_next(insns, count, i);
+        OptInsn *b = opt_joinable(insns, count, j) ? &insns[j] : NULL;
+        size_t k = b ? opt_next(insns, count, j) : count;
+        OptInsn *c = b && opt_joinable(insns, count, k) ? &insns[k] : NULL;
+    
+        // PUSH x, PUSH y, op -> PUSH (x op y)
+        if (c && a->op == OP_PUSH && b->op == OP_PUSH && opt_is_const_binop(c->op) &&
+            !(c->op == OP_DIV && b->imm == 0)) {
+            uint64_t x = a->imm, y = b->imm;
+            switch (c->op) {
+                case OP_ADD: a->imm = (Value)(x + y); break;
+                case OP_SUB: a->imm = (Value)(x - y); break;
+                case OP_MUL: a->imm = (Value)(x * y); break;
+                case OP_DIV: a->imm = value_div(a->imm, b->imm); break;
+            }
+            opt_kill(insns, count, j);
+            opt_kill(insns, count, k);
+            stats->folded++;
+            changed = true;
+            continue;
+        }
+        if (!b) {
+            // JMP to the next instruction
+            if (a->op == OP_JMP && (size_t)a->imm == j) {
+                opt_kill(insns, count, i);
+                stats->removed++;
+                changed = true;
+            }
+            goto single;
+        }
+    
+        // Pairs that leave the stack as it was
+        if ((a->op == OP_DUP && b->op == OP_POP) ||
+            (a->op == OP_SWAP && b->op == OP_SWAP) ||
+            (a->op == OP_PUSH && b->op == OP_POP) ||
+            (a->op == OP_PUSH && a->imm == 0 && (b->op == OP_ADD || b->op == OP_SUB)) ||
+            (a->op == OP_PUSH && a->imm == 1 && (b->op == OP_MUL || b->op == OP_DIV))) {
+            opt_kill(insns, count, i);
+            opt_kill(insns, count, j);
+            stats->removed += 2;
+            changed = true;
+            continue;
+        }
+        if (a->op == OP_JMP && (size_t)a->imm == j) {
+            opt_kill(insns, count, i);
+            stats->removed++;
+            changed = true;
+            continue;
+        }
+    
+        if (level >= 2) {
+            if (a->op == OP_PUSH && (b->op == OP_ADD || b->op == OP_SUB || b->op == OP_MUL)) {
+                a->op = b->op == OP_MUL ? OP_MULI : OP_ADDI;
+                if (b->op == OP_SUB) a->imm = (Value)(0 - (uint64_t)a->imm);
+                opt_kill(insns, count, j);
+                stats->fused++;
+                changed = true;
+                continue;
+            }
+            if (a->op == OP_ADDI && b->op == OP_ADDI) {
+                a->imm = (Value)((uint64_t)a->imm + (uint64_t)b->imm);
+                opt_kill(insns, count, j);
+                stats->folded++;
+                changed = true;
+                continue;
+            }
+            if (a->op == OP_MULI && b->op == OP_MULI) {
+                a->imm = (Value)((uint64_t)a->imm * (uint64_t)b->imm);
+                opt_kill(insns, count, j);
+                stats->folded++;
+                changed = true;
+                continue;
+            }
+            if (a->op == OP_LOAD_ABS && b->op == OP_PRINT) {
+                a->op = OP_PRINT_ABS;
+                opt_kill(insns, count, j);
+                stats->fused++;
+                changed = true;
+                continue;
+            }
+        }
+    
+    single:
+        if ((a->op == OP_ADDI && a->imm == 0) || (a->op == OP_MULI && a->imm == 1)) {
+            opt_kill(insns, count, i);
+            stats->removed++;
+            changed = true;
+        } else if (a->op == OP_STORE_ABS && opt_dead_store(insns, count, i)) {
+            // Still consumes its value
+            a->op = OP_POP;
+            a->imm = 0;
+            stats->removed++;
+            changed = true;
+        }
     }
+    
+    return changed;
+}
 
+// Optimize compiled bytecode in place. Bytecode the optimizer cannot
+// fully decode is left untouched.
+bool optimize(unsigned char **bytecode, size_t *length, int level, OptStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes_before = stats->bytes_after = *length;
+    
+    const unsigned char *code = *bytecode;
+    size_t len = *length;
+    
+    // Decode, mapping each instruction start to its index
+    size_t *index_at = malloc(sizeof(size_t) * (len + 1));
+    OptInsn *insns = malloc(sizeof(OptInsn) * (len + 1));
+    if (!index_at || !insns) {
+        free(index_at);
+        free(insns);
+        return false;
+    }
+    size_t count = 0;
+    for (size_t pc = 0; pc < len; pc++) index_at[pc] = SIZE_MAX;
+    for (size_t pc = 0; pc < len; ) {
+        size_t n = insn_length(code, len, pc);
+        if (!n) goto unchanged;
+        uint64_t imm = 0;
+        if (imm_kind(code[pc]) != IMM_NONE) {
+            read_leb128(&code[pc + 1], len - pc - 1, imm_kind(code[pc]) == IMM_SIGNED, &imm);
+        } else if (is_branch(code[pc])) {
+            int64_t target = (int64_t)(pc + n) + read_rel32(&code[pc + 1]);
+            if (target < 0 || (uint64_t)target > len) goto unchanged;
+            imm = (uint64_t)target;
+        }
+        index_at[pc] = count;
+        insns[count++] = (OptInsn){ code[pc], false, false, (Value)imm };
+        pc += n;
+    }
+    index_at[len] = count;
+    stats->insns_before = count;
+    
+    // Resolve branch targets to instruction indexes and mark leaders
+    for (size_t i = 0; i < count; i++) {
+        if (!is_branch(insns[i].op)) continue;
+        size_t target = index_at[insns[i].imm];
+        if (target == SIZE_MAX) goto unchanged;
+        insns[i].imm = (Value)target;
+        if (target < count) insns[target].leader = true;
+    }
+    // Code after a control transfer starts a new block too
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (is_branch(insns[i].op) || insns[i].op == OP_RET) insns[i + 1].leader = true;
+    }
+    
+    while (level > 0 && opt_pass(insns, count, level, stats)) {
+    }
+    
+    // Lay out surviving instructions; a branch to a removed instruction
+    // goes to the next survivor
+    unsigned char scratch[LEB128_MAX];
+    size_t pc = 0;
+    for (size_t i = 0; i < count; i++) {
+        index_at[i] = pc;
+        if (insns[i].dead) continue;
+        ImmKind kind = imm_kind(insns[i].op);
+        pc += 1 + (kind != IMM_NONE ? write_leb128(scratch, insns[i].imm, kind == IMM_SIGNED)
+                                    : is_branch(insns[i].op) ? REL32_SIZE : 0);
+    }
+    index_at[count] = pc;
+    
+    unsigned char *out = malloc(pc ? pc : 1);
+    if (!out) {
+        free(index_at);
+        free(insns);
+        return false;
+    }
+    size_t out_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (insns[i].dead) continue;
+        uint8_t op = insns[i].op;
+        ImmKind kind = imm_kind(op);
+        if (kind != IMM_NONE) {
+            emit_imm(out, &out_len, op, insns[i].imm);
+        } else if (is_branch(op)) {
+            patch_branch(out, emit_branch(out, &out_len, op), index_at[insns[i].imm]);
+        } else {
+            out[out_len++] = op;
+        }
+        stats->insns_after++;
+    }
+    
+    free(*bytecode);
+    *bytecode = out;
+    *length = out_len;
+    stats->bytes_after = out_len;
+    free(index_at);
+    free(insns);
+    return true;
+    
+unchanged:
+    stats->insns_before = stats->insns_after = 0;
+    free(index_at);
+    free(insns);
+    return true;
+}
+
+// Read a whole source file into a NUL-terminated buffer
+static char* read_source(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("Error: Could not open file %s\n", path);
+        return NULL;
+    }
+    
     fseek(f, 0, SEEK_END);
     long size = ftell(f);
     fseek(f, 0, SEEK_SET);
-
+    
     char *source = malloc(size + 1);
     if (!source) {
         fclose(f);
-        return 1;
+        return NULL;
     }
     
     size_t bytes_read = fread(source, 1, size, f);
+    fclose(f);
     if (bytes_read != (size_t)size) {
         free(source);
-        fclose(f);
-        return 1;
+        return NULL;
     }
     source[size] = '\0';
-    fclose(f);
+    return source;
+}
 
-    size_t bytecode_length;
-    unsigned char *bytecode = compile(source, &bytecode_length);
-    if (!bytecode) {
-        free(source);
-        return 1;
+static double elapsed_seconds(const struct timespec *t0, const struct timespec *t1) {
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// Compile the same source `runs` times and report throughput
+static void compile_benchmark(const char *source, int runs) {
+    unsigned char pool[STRING_POOL_SIZE];
+    size_t length, pool_length, bytes = strlen(source), lines = 0;
+    for (const char *p = source; *p; p++) {
+        if (*p == '\n') lines++;
     }
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < runs; i++) {
+        free(compile(source, &length, pool, &pool_length));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    double per_run = elapsed_seconds(&t0, &t1) / runs;
+    printf("compile: %d runs, %zu lines, %zu bytes -> %zu bytes of code, %.6fs/run, %.1f MB/s, %.0f lines/s\n",
+           runs, lines, bytes, length, per_run, bytes / per_run / 1e6, lines / per_run);
+}
 
+int main(int argc, char **argv) {
+    int mine_threads = 0;
+    const char *output = NULL;
+    int bench_runs = 0;
+    int opt_level = 2;
+    bool dump_opt = false;
+    bool threaded = true;
+    bool show_stats = false;
+    bool usage_error = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:e:sc:b:O:d")) != -1) {
+        switch (opt) {
+            case 't':
+                mine_threads = atoi(optarg);
+                break;
+            case 'e':
+                if (strcmp(optarg, "threaded") == 0) threaded = true;
+                else if (strcmp(optarg, "switch") == 0) threaded = false;
+                else usage_error = true;
+                break;
+            case 's':
+                show_stats = true;
+                break;
+            case 'c':
+                output = optarg;
+                break;
+            case 'b':
+                bench_runs = atoi(optarg);
+                break;
+            case 'O':
+                opt_level = atoi(optarg);
+                if (opt_level < 0 || opt_level > 2) usage_error = true;
+                break;
+            case 'd':
+                dump_opt = true;
+                break;
+            default:
+                usage_error = true;
+                break;
+        }
+    }
+    
+    if (usage_error || optind >= argc) {
+        printf("Usage: %s [-t mining_threads] [-e threaded|switch] [-s] [-c image_out] [-b runs] [-O 0|1|2] [-d] <source_file|image>\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    
+    // Precompiled images run in place from a read-only mapping; anything
+    // else is compiled from source
+    Image *img = NULL;
+    unsigned char *bytecode = NULL;
+    unsigned char pool_buffer[STRING_POOL_SIZE];
+    const unsigned char *code, *pool;
+    size_t code_length, pool_length;
+    if (!output && image_probe(path)) {
+        img = image_open(path);
+        if (!img) return 1;
+        code = img->code;
+        code_length = img->code_length;
+        pool = img->pool;
+        pool_length = img->pool_length;
+    } else {
+        char *source = read_source(path);
+        if (!source) return 1;
+        bytecode = compile(source, &code_length, pool_buffer, &pool_length);
+        if (bytecode && bench_runs > 0) {
+            compile_benchmark(source, bench_runs);
+            free(bytecode);
+            free(source);
+            return 0;
+        }
+        free(source);
+        if (!bytecode) return 1;
+    
+        OptStats ostats;
+        if (!optimize(&bytecode, &code_length, opt_level, &ostats)) {
+            printf("Error: Memory allocation failed\n");
+            free(bytecode);
+            return 1;
+        }
+        if (dump_opt) {
+            fprintf(stderr, "optimize -O%d: %zu -> %zu instructions, %zu -> %zu bytes, "
+                    "%zu folded, %zu removed, %zu fused\n", opt_level,
+                    ostats.insns_before, ostats.insns_after, ostats.bytes_before, ostats.bytes_after,
+                    ostats.folded, ostats.removed, ostats.fused);
+        }
+        code = bytecode;
+        pool = pool_buffer;
+    }
+    
+    if (output) {
+        bool ok = image_write(output, code, code_length, pool, pool_length, STRING_POOL_START);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (show_stats) {
+            fprintf(stderr, "compile: %.6fs, code: %zu bytes, pool: %zu bytes\n",
+                    elapsed_seconds(&t0, &t1), code_length, pool_length);
+        }
+        free(bytecode);
+        return ok ? 0 : 1;
+    }
+    
     VM *vm = vm_init(VM_MEMORY_SIZE);
     if (!vm) {
-        free(source);
         free(bytecode);
+        image_close(img);
         return 1;
     }
+    vm->mine_threads = mine_threads;
+    
+    // Place the string pool in VM memory
+    if (img) {
+        if (!image_map_pool(img, vm->memory, vm->mem_size)) {
+            vm_free(vm);
+            image_close(img);
+            return 1;
+        }
+    } else {
+        memcpy(vm->memory + STRING_POOL_START, pool, pool_length);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double load_time = elapsed_seconds(&t0, &t1);
+    
+    double decode_time = 0;
+    t0 = t1;
+    Program *prog = NULL;
+    if (threaded) {
+        prog = program_decode(code, code_length);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        decode_time = elapsed_seconds(&t0, &t1);
+        t0 = t1;
+        // Bytecode the decoder cannot represent runs on the switch engine
+        threaded = prog != NULL;
+    }
+    if (prog) {
+        vm_execute_threaded(vm, prog);
+        program_free(prog);
+    } else {
+        vm_execute(vm, code, code_length);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    if (show_stats) {
+        double elapsed = elapsed_seconds(&t0, &t1);
+        fprintf(stderr, "%s: %.6fs, engine: %s, decode: %.6fs, ops: %lu, time: %.6fs, ops/sec: %.0f\n",
+                img ? "load" : "compile", load_time, threaded ? "threaded" : "switch", decode_time,
+                (unsigned long)vm->ops_executed, elapsed, elapsed > 0 ? vm->ops_executed / elapsed : 0.0);
+        fprintf(stderr, "arena: %zu bytes in use, high water: %zu bytes, capacity: %zu bytes\n",
+                vm->arena_top - vm->arena_base, vm->arena_high - vm->arena_base, vm->mem_size - vm->arena_base);
+        fprintf(stderr, "objects: %u live, %u slots\n", vm->object_live, vm->object_count);
+    }
     
-    // Copy string pool to VM memory
-    memcpy(vm->memory + STRING_POOL_START, 
-           bytecode + STRING_POOL_START, 
-           STRING_POOL_SIZE);
-
-    vm_execute(vm, bytecode, bytecode_length);
-
-    free(source);
     free(bytecode);
-    free(vm->memory);
-    free(vm->call_stack);
-    free(vm);
-
+    image_close(img);
+    vm_free(vm);
+    
     return 0;
 }
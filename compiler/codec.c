@@ -0,0 +1,303 @@
+#include "codec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FIELD(type, member, kind, element) { #member, kind, offsetof(type, member), element }
+
+static const Field block_fields[] = {
+    FIELD(Block, index, FIELD_U32, NULL),
+    FIELD(Block, prev_hash, FIELD_BYTES32, NULL),
+    FIELD(Block, timestamp, FIELD_U64, NULL),
+    FIELD(Block, merkle_root, FIELD_BYTES32, NULL),
+    FIELD(Block, qr_nonce, FIELD_BYTES, NULL),
+    FIELD(Block, fractal_sigil, FIELD_BYTES, NULL),
+    FIELD(Block, transactions, FIELD_LIST, NULL),
+};
+
+static const Field tx_input_fields[] = {
+    FIELD(TxInput, tx_hash, FIELD_BYTES32, NULL),
+    FIELD(TxInput, output_index, FIELD_U32, NULL),
+    FIELD(TxInput, amount, FIELD_U64, NULL),
+};
+
+static const Field tx_output_fields[] = {
+    FIELD(TxOutput, amount, FIELD_U64, NULL),
+    FIELD(TxOutput, address, FIELD_BYTES, NULL),
+};
+
+static const Field transaction_fields[] = {
+    FIELD(Transaction, version, FIELD_U32, NULL),
+    FIELD(Transaction, timestamp, FIELD_U32, NULL),
+    FIELD(Transaction, inputs, FIELD_LIST, &tx_input_schema),
+    FIELD(Transaction, outputs, FIELD_LIST, &tx_output_schema),
+    FIELD(Transaction, signature, FIELD_BYTES, NULL),
+};
+
+static const Field utxo_fields[] = {
+    FIELD(UTXO, tx_hash, FIELD_BYTES32, NULL),
+    FIELD(UTXO, output_index, FIELD_U32, NULL),
+    FIELD(UTXO, amount, FIELD_U64, NULL),
+    FIELD(UTXO, pubkey_hash, FIELD_BYTES, NULL),
+};
+
+#define FIELD_COUNT(fields) (int)(sizeof(fields) / sizeof(fields[0]))
+
+// The header and unsigned schemas are prefixes of the full ones
+const Schema block_schema = { "Block", block_fields, FIELD_COUNT(block_fields), sizeof(Block) };
+const Schema block_header_schema = { "BlockHeader", block_fields, FIELD_COUNT(block_fields) - 1, sizeof(Block) };
+const Schema transaction_schema = { "Transaction", transaction_fields, FIELD_COUNT(transaction_fields), sizeof(Transaction) };
+const Schema tx_unsigned_schema = { "TxUnsigned", transaction_fields, FIELD_COUNT(transaction_fields) - 1, sizeof(Transaction) };
+const Schema tx_input_schema = { "TxInput", tx_input_fields, FIELD_COUNT(tx_input_fields), sizeof(TxInput) };
+const Schema tx_output_schema = { "TxOutput", tx_output_fields, FIELD_COUNT(tx_output_fields), sizeof(TxOutput) };
+const Schema utxo_schema = { "UTXO", utxo_fields, FIELD_COUNT(utxo_fields), sizeof(UTXO) };
+
+static const size_t fixed_width[] = {
+    [FIELD_U8] = 1, [FIELD_U16] = 2, [FIELD_U32] = 4, [FIELD_U64] = 8, [FIELD_BYTES32] = 32,
+};
+
+size_t codec_varint_put(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+size_t codec_varint_get(const uint8_t *in, size_t len, uint64_t *v) {
+    uint64_t result = 0;
+    for (size_t n = 0; n < len && n < CODEC_VARINT_MAX; n++) {
+        uint64_t byte = in[n];
+        // The tenth byte may only hold the top bit of a 64-bit value
+        if (n == CODEC_VARINT_MAX - 1 && byte > 1) return 0;
+        result |= (byte & 0x7f) << (7 * n);
+        if (!(byte & 0x80)) {
+            // A zero final byte means a shorter encoding existed
+            if (byte == 0 && n > 0) return 0;
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static uint64_t get_uint(const void *p, FieldType type) {
+    switch (type) {
+        case FIELD_U8: return *(const uint8_t*)p;
+        case FIELD_U16: return *(const uint16_t*)p;
+        case FIELD_U32: return *(const uint32_t*)p;
+        default: return *(const uint64_t*)p;
+    }
+}
+
+static void set_uint(void *p, FieldType type, uint64_t v) {
+    switch (type) {
+        case FIELD_U8: *(uint8_t*)p = (uint8_t)v; break;
+        case FIELD_U16: *(uint16_t*)p = (uint16_t)v; break;
+        case FIELD_U32: *(uint32_t*)p = (uint32_t)v; break;
+        default: *(uint64_t*)p = v; break;
+    }
+}
+
+size_t codec_size(const Schema *schema, const void *obj) {
+    const char *base = obj;
+    size_t size = 0;
+    
+    for (int i = 0; i < schema->field_count; i++) {
+        const Field *f = &schema->fields[i];
+        const void *p = base + f->offset;
+        if (f->type == FIELD_BYTES) {
+            const ByteSlice *b = p;
+            size += varint_size(b->length) + b->length;
+        } else if (f->type == FIELD_LIST) {
+            const CodecList *list = p;
+            size += varint_size(list->count);
+            if (!list->items) {
+                size += list->length;
+            } else if (f->element) {
+                for (size_t j = 0; j < list->count; j++) {
+                    size += codec_size(f->element, (const char*)list->items + j * f->element->size);
+                }
+            } else {
+                const ByteSlice *items = list->items;
+                for (size_t j = 0; j < list->count; j++) size += varint_size(items[j].length) + items[j].length;
+            }
+        } else {
+            size += fixed_width[f->type];
+        }
+    }
+    return size;
+}
+
+// Encode into a buffer already known to be large enough
+static size_t encode_fields(const Schema *schema, const void *obj, uint8_t *out) {
+    const char *base = obj;
+    uint8_t *start = out;
+    
+    for (int i = 0; i < schema->field_count; i++) {
+        const Field *f = &schema->fields[i];
+        const void *p = base + f->offset;
+        switch (f->type) {
+            case FIELD_U8:
+            case FIELD_U16:
+            case FIELD_U32:
+            case FIELD_U64: {
+                uint64_t v = get_uint(p, f->type);
+                for (size_t j = 0; j < fixed_width[f->type]; j++) *out++ = (uint8_t)(v >> (8 * j));
+                break;
+            }
+            case FIELD_BYTES32: {
+                const uint8_t *hash = *(const uint8_t* const*)p;
+                if (hash) memcpy(out, hash, 32);
+                else memset(out, 0, 32);
+                out += 32;
+                break;
+            }
+            case FIELD_BYTES: {
+                const ByteSlice *b = p;
+                out += codec_varint_put(out, b->length);
+                if (b->length) memcpy(out, b->data, b->length);
+                out += b->length;
+                break;
+            }
+            case FIELD_LIST: {
+                const CodecList *list = p;
+                out += codec_varint_put(out, list->count);
+                if (!list->items) {
+                    if (list->length) memcpy(out, list->data, list->length);
+                    out += list->length;
+                } else if (f->element) {
+                    for (size_t j = 0; j < list->count; j++) {
+                        out += encode_fields(f->element, (const char*)list->items + j * f->element->size, out);
+                    }
+                } else {
+                    const ByteSlice *items = list->items;
+                    for (size_t j = 0; j < list->count; j++) {
+                        out += codec_varint_put(out, items[j].length);
+                        if (items[j].length) memcpy(out, items[j].data, items[j].length);
+                        out += items[j].length;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    return out - start;
+}
+
+size_t codec_encode(const Schema *schema, const void *obj, uint8_t *out, size_t capacity) {
+    if (codec_size(schema, obj) > capacity) return 0;
+    return encode_fields(schema, obj, out);
+}
+
+// Read a varint length and check that many bytes follow
+static size_t get_length(const uint8_t *in, size_t len, uint64_t *length) {
+    size_t n = codec_varint_get(in, len, length);
+    if (!n || *length > len - n) return 0;
+    return n;
+}
+
+size_t codec_decode(const Schema *schema, const uint8_t *in, size_t len, void *obj) {
+    char *base = obj;
+    size_t pos = 0;
+    
+    for (int i = 0; i < schema->field_count; i++) {
+        const Field *f = &schema->fields[i];
+        void *p = base ? base + f->offset : NULL;
+        uint64_t n;
+        size_t used;
+        switch (f->type) {
+            case FIELD_U8:
+            case FIELD_U16:
+            case FIELD_U32:
+            case FIELD_U64: {
+                size_t width = fixed_width[f->type];
+                if (len - pos < width) return 0;
+                uint64_t v = 0;
+                for (size_t j = 0; j < width; j++) v |= (uint64_t)in[pos + j] << (8 * j);
+                if (p) set_uint(p, f->type, v);
+                pos += width;
+                break;
+            }
+            case FIELD_BYTES32:
+                if (len - pos < 32) return 0;
+                if (p) *(const uint8_t**)p = in + pos;
+                pos += 32;
+                break;
+            case FIELD_BYTES:
+                if (!(used = get_length(in + pos, len - pos, &n))) return 0;
+                if (p) *(ByteSlice*)p = (ByteSlice){ in + pos + used, n };
+                pos += used + n;
+                break;
+            case FIELD_LIST: {
+                if (!(used = codec_varint_get(in + pos, len - pos, &n))) return 0;
+                pos += used;
+                // Every element takes at least one byte
+                if (n > len - pos) return 0;
+                size_t start = pos;
+                for (uint64_t j = 0; j < n; j++) {
+                    uint64_t item;
+                    if (f->element) {
+                        if (!(used = codec_decode(f->element, in + pos, len - pos, NULL))) return 0;
+                        pos += used;
+                    } else {
+                        if (!(used = get_length(in + pos, len - pos, &item))) return 0;
+                        pos += used + item;
+                    }
+                }
+                if (p) *(CodecList*)p = (CodecList){ n, NULL, in + start, pos - start };
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+bool codec_list_next(const Schema *element, const CodecList *list, size_t *pos, void *out) {
+    if (*pos >= list->length) return false;
+    size_t used;
+    if (element) {
+        used = codec_decode(element, list->data + *pos, list->length - *pos, out);
+    } else {
+        uint64_t n;
+        used = get_length(list->data + *pos, list->length - *pos, &n);
+        if (!used) return false;
+        *(ByteSlice*)out = (ByteSlice){ list->data + *pos + used, n };
+        used += n;
+    }
+    if (!used) return false;
+    *pos += used;
+    return true;
+}
+
+bool codec_hash(const Schema *schema, const void *obj, uint8_t *hash) {
+    uint8_t stack[1024];
+    size_t size = codec_size(schema, obj);
+    uint8_t *buffer = size <= sizeof(stack) ? stack : malloc(size);
+    if (!buffer) return false;
+    encode_fields(schema, obj, buffer);
+    sha256(buffer, size, hash);
+    if (buffer != stack) free(buffer);
+    return true;
+}
+
+// A block is identified by its header; the transactions are committed to
+// through merkle_root
+bool block_hash(const Block *block, uint8_t *hash) {
+    return codec_hash(&block_header_schema, block, hash);
+}
+
+// The signature signs this hash, so it cannot be part of it
+bool tx_hash(const Transaction *tx, uint8_t *hash) {
+    return codec_hash(&tx_unsigned_schema, tx, hash);
+}
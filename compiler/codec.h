@@ -0,0 +1,130 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "crypto.h"
+
+// Binary encoding for chain structures
+//
+// A struct is encoded as its fields in schema order with no padding or
+// tags: integers are fixed-width little-endian, bytes32 is 32 raw bytes,
+// bytes is a varint length and the bytes, and a list is a varint count
+// followed by its elements. Varints are unsigned LEB128 and must be
+// minimal, so every value has exactly one encoding and a decoded buffer
+// re-encodes to the same bytes.
+//
+// This one format is the MSG_BLOCK/MSG_TX payload, the block store record
+// and, restricted to the header fields, the hash preimage.
+#define CODEC_VARINT_MAX 10
+#define CODEC_HASH_SIZE SHA256_DIGEST_LENGTH
+
+typedef enum {
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_U64,
+    FIELD_BYTES32,      // const uint8_t*; NULL encodes as zeros
+    FIELD_BYTES,        // ByteSlice
+    FIELD_LIST          // CodecList of `element` structs, or of ByteSlices
+} FieldType;
+
+typedef struct Schema Schema;
+
+typedef struct {
+    const char *name;
+    FieldType type;
+    size_t offset;
+    const Schema *element;
+} Field;
+
+struct Schema {
+    const char *name;
+    const Field *fields;
+    int field_count;
+    size_t size;        // sizeof the C struct
+};
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+} ByteSlice;
+
+// When encoding, `items` points at `count` elements. A decoded list has
+// no items; `data` then spans its encoded elements, which are read with
+// codec_list_next and re-encoded by copying.
+typedef struct {
+    size_t count;
+    const void *items;
+    const uint8_t *data;
+    size_t length;
+} CodecList;
+
+// Decoded structs are views: their pointers and slices point into the
+// buffer they were decoded from
+typedef struct {
+    uint32_t index;
+    const uint8_t *prev_hash;
+    uint64_t timestamp;
+    const uint8_t *merkle_root;
+    ByteSlice qr_nonce;
+    ByteSlice fractal_sigil;
+    CodecList transactions;     // Encoded transactions (ByteSlices)
+} Block;
+
+typedef struct {
+    const uint8_t *tx_hash;
+    uint32_t output_index;
+    uint64_t amount;
+} TxInput;
+
+typedef struct {
+    uint64_t amount;
+    ByteSlice address;
+} TxOutput;
+
+typedef struct {
+    uint32_t version;
+    uint32_t timestamp;
+    CodecList inputs;           // TxInput
+    CodecList outputs;          // TxOutput
+    ByteSlice signature;
+} Transaction;
+
+typedef struct {
+    const uint8_t *tx_hash;
+    uint32_t output_index;
+    uint64_t amount;
+    ByteSlice pubkey_hash;
+} UTXO;
+
+extern const Schema block_schema;
+extern const Schema block_header_schema;    // Block without its transactions
+extern const Schema transaction_schema;
+extern const Schema tx_unsigned_schema;     // Transaction without its signature
+extern const Schema tx_input_schema;
+extern const Schema tx_output_schema;
+extern const Schema utxo_schema;
+
+size_t codec_varint_put(uint8_t *out, uint64_t v);
+// Bytes read, or 0 if truncated, too long or not minimal
+size_t codec_varint_get(const uint8_t *in, size_t len, uint64_t *v);
+
+// Encoded size of `obj`
+size_t codec_size(const Schema *schema, const void *obj);
+// Bytes written, or 0 if `capacity` is too small
+size_t codec_encode(const Schema *schema, const void *obj, uint8_t *out, size_t capacity);
+// Bytes consumed, or 0 if the buffer is not a valid encoding
+size_t codec_decode(const Schema *schema, const uint8_t *in, size_t len, void *obj);
+
+// Read the element at *pos (start at 0) into `out`, a struct of `element`
+// or a ByteSlice when `element` is NULL; false at the end of the list
+bool codec_list_next(const Schema *element, const CodecList *list, size_t *pos, void *out);
+
+// SHA-256 of the encoding
+bool codec_hash(const Schema *schema, const void *obj, uint8_t *hash);
+bool block_hash(const Block *block, uint8_t *hash);
+bool tx_hash(const Transaction *tx, uint8_t *hash);
+
+#endif /* CODEC_H */
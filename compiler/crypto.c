@@ -1,6 +1,17 @@
 #include "crypto.h"
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 #include <openssl/err.h>
+#include <openssl/core_names.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define CRYPTO_HAVE_X86 1
+#endif
 
 void sha256(const unsigned char *data, size_t len, unsigned char *hash) {
     SHA256_CTX sha256;
@@ -26,6 +37,387 @@ void hash160(const unsigned char *data, size_t len, unsigned char *hash) {
     ripemd160(sha256_hash, SHA256_DIGEST_LENGTH, hash);
 }
 
+bool hash_init(HashContext *h, HashKind kind) {
+    h->kind = kind;
+    h->ctx = EVP_MD_CTX_new();
+    if (!h->ctx) return false;
+    if (!hash_reset(h)) {
+        EVP_MD_CTX_free(h->ctx);
+        h->ctx = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool hash_reset(HashContext *h) {
+    const EVP_MD *md = h->kind == HASH_RIPEMD160 ? EVP_ripemd160() : EVP_sha256();
+    return EVP_DigestInit_ex(h->ctx, md, NULL) == 1;
+}
+
+bool hash_update(HashContext *h, const void *data, size_t len) {
+    return EVP_DigestUpdate(h->ctx, data, len) == 1;
+}
+
+size_t hash_final(HashContext *h, unsigned char *out) {
+    unsigned int len = 0;
+    if (EVP_DigestFinal_ex(h->ctx, out, &len) != 1) return 0;
+    if (h->kind == HASH_HASH160) {
+        unsigned char inner[SHA256_DIGEST_LENGTH];
+        memcpy(inner, out, sizeof(inner));
+        ripemd160(inner, sizeof(inner), out);
+        len = RIPEMD160_DIGEST_LENGTH;
+    }
+    return hash_reset(h) ? len : 0;
+}
+
+void hash_free(HashContext *h) {
+    EVP_MD_CTX_free(h->ctx);
+    h->ctx = NULL;
+}
+
+// SHA-256 core used for midstate and multi-buffer hashing. OpenSSL does not
+// expose its compression function, so the rounds live here with scalar,
+// SHA-NI, SSE2 (4 lanes) and AVX2 (8 lanes) variants. The variant is picked
+// from CPUID on first use; `chrysalis_bench sha256` checks every variant
+// the CPU has against OpenSSL.
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define SHA256_LANES 8
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static uint32_t load_be32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void sha256_compress_scalar(uint32_t *state, const unsigned char *data, size_t blocks) {
+    uint32_t w[64];
+    
+    while (blocks--) {
+        for (int t = 0; t < 16; t++) w[t] = load_be32(data + 4 * t);
+        for (int t = 16; t < 64; t++) {
+            uint32_t s0 = ROTR32(w[t - 15], 7) ^ ROTR32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROTR32(w[t - 2], 17) ^ ROTR32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+    
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[t] + w[t];
+            uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+    
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef CRYPTO_HAVE_X86
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_shani(uint32_t *state, const unsigned char *data, size_t blocks) {
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    
+    // Rearrange A..H into the ABEF / CDGH register layout the rounds use
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    
+    while (blocks--) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+    
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            __m128i msg;
+            if (g < 4) {
+                msg = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), shuffle);
+            } else {
+                msg = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                msg = _mm_sha256msg2_epu32(msg, w[(g + 3) & 3]);
+            }
+            w[g & 3] = msg;
+    
+            msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i *)&sha256_k[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+    
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+    
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+// Lane-parallel rounds: vector element i carries the state of buffer i.
+// `state` is word-major (state[word][lane]) and blocks[i] is lane i's input.
+#define SHA256_LANE_ROUNDS(VEC, ADD, XOR, AND, ANDNOT, OR, SRLI, SLLI, SET1, LANE_LOAD, LANES) \
+    VEC w[16], s[8];                                                                          \
+    for (int i = 0; i < 8; i++) s[i] = LANE_LOAD(state[i]);                                   \
+    for (int t = 0; t < 16; t++) {                                                            \
+        uint32_t words[LANES];                                                                \
+        for (int l = 0; l < LANES; l++) words[l] = load_be32(blocks[l] + 4 * t);              \
+        w[t] = LANE_LOAD(words);                                                              \
+    }                                                                                         \
+    VEC a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];       \
+    for (int t = 0; t < 64; t++) {                                                            \
+        if (t >= 16) {                                                                        \
+            VEC w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];                                 \
+            VEC s0 = XOR(XOR(ROT(w15, 7), ROT(w15, 18)), SRLI(w15, 3));                      \
+            VEC s1 = XOR(XOR(ROT(w2, 17), ROT(w2, 19)), SRLI(w2, 10));                       \
+            w[t & 15] = ADD(ADD(w[t & 15], s0), ADD(w[(t - 7) & 15], s1));                    \
+        }                                                                                     \
+        VEC t1 = ADD(ADD(h, XOR(XOR(ROT(e, 6), ROT(e, 11)), ROT(e, 25))),                     \
+                     ADD(XOR(AND(e, f), ANDNOT(e, g)), ADD(SET1(sha256_k[t]), w[t & 15])));  \
+        VEC t2 = ADD(XOR(XOR(ROT(a, 2), ROT(a, 13)), ROT(a, 22)),                             \
+                     XOR(XOR(AND(a, b), AND(a, c)), AND(b, c)));                              \
+        h = g; g = f; f = e; e = ADD(d, t1);                                                  \
+        d = c; c = b; b = a; a = ADD(t1, t2);                                                 \
+    }                                                                                         \
+    s[0] = ADD(s[0], a); s[1] = ADD(s[1], b); s[2] = ADD(s[2], c); s[3] = ADD(s[3], d);       \
+    s[4] = ADD(s[4], e); s[5] = ADD(s[5], f); s[6] = ADD(s[6], g); s[7] = ADD(s[7], h);
+
+__attribute__((target("sse2")))
+static void sha256_compress_x4_sse2(uint32_t state[8][SHA256_LANES], const unsigned char *const *blocks) {
+#define ROT(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define LOAD4(p) _mm_loadu_si128((const __m128i *)(p))
+    SHA256_LANE_ROUNDS(__m128i, _mm_add_epi32, _mm_xor_si128, _mm_and_si128, _mm_andnot_si128,
+                       _mm_or_si128, _mm_srli_epi32, _mm_slli_epi32, _mm_set1_epi32, LOAD4, 4)
+    for (int i = 0; i < 8; i++) _mm_storeu_si128((__m128i *)state[i], s[i]);
+#undef LOAD4
+#undef ROT
+}
+
+__attribute__((target("avx2")))
+static void sha256_compress_x8_avx2(uint32_t state[8][SHA256_LANES], const unsigned char *const *blocks) {
+#define ROT(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define LOAD8(p) _mm256_loadu_si256((const __m256i *)(p))
+    SHA256_LANE_ROUNDS(__m256i, _mm256_add_epi32, _mm256_xor_si256, _mm256_and_si256, _mm256_andnot_si256,
+                       _mm256_or_si256, _mm256_srli_epi32, _mm256_slli_epi32, _mm256_set1_epi32, LOAD8, 8)
+    for (int i = 0; i < 8; i++) _mm256_storeu_si256((__m256i *)state[i], s[i]);
+#undef LOAD8
+#undef ROT
+}
+#endif
+
+typedef void (*sha256_compress_fn)(uint32_t *state, const unsigned char *data, size_t blocks);
+typedef void (*sha256_lanes_fn)(uint32_t state[8][SHA256_LANES], const unsigned char *const *blocks);
+
+static sha256_compress_fn sha256_compress = sha256_compress_scalar;
+static sha256_lanes_fn sha256_compress_lanes = NULL;
+static int sha256_lane_count = 1;
+static SHA256Kernel sha256_active_kernel = SHA256_KERNEL_SCALAR;
+static pthread_once_t sha256_kernel_once = PTHREAD_ONCE_INIT;
+
+static bool sha256_kernel_supported(SHA256Kernel kernel) {
+#ifdef CRYPTO_HAVE_X86
+    __builtin_cpu_init();
+    if (kernel == SHA256_KERNEL_SHANI) {
+        unsigned int eax, ebx = 0, ecx, edx;
+        __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+        return (ebx & bit_SHA) && __builtin_cpu_supports("sse4.1");
+    }
+    if (kernel == SHA256_KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+    if (kernel == SHA256_KERNEL_SSE2) return __builtin_cpu_supports("sse2");
+#endif
+    return kernel == SHA256_KERNEL_SCALAR;
+}
+
+static void sha256_set_kernel(SHA256Kernel kernel) {
+    sha256_compress = sha256_compress_scalar;
+    sha256_compress_lanes = NULL;
+    sha256_lane_count = 1;
+#ifdef CRYPTO_HAVE_X86
+    if (kernel == SHA256_KERNEL_SHANI) {
+        sha256_compress = sha256_compress_shani;
+    } else if (kernel == SHA256_KERNEL_AVX2) {
+        sha256_compress_lanes = sha256_compress_x8_avx2;
+        sha256_lane_count = 8;
+    } else if (kernel == SHA256_KERNEL_SSE2) {
+        sha256_compress_lanes = sha256_compress_x4_sse2;
+        sha256_lane_count = 4;
+    }
+#endif
+    sha256_active_kernel = kernel;
+}
+
+// SHA-NI beats lane-parallel hashing, so it is used per buffer when present
+static void sha256_select_kernel(void) {
+    static const SHA256Kernel preference[] = { SHA256_KERNEL_SHANI, SHA256_KERNEL_AVX2, SHA256_KERNEL_SSE2 };
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        if (sha256_kernel_supported(preference[i])) {
+            sha256_set_kernel(preference[i]);
+            return;
+        }
+    }
+}
+
+SHA256Kernel sha256_kernel(void) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    return sha256_active_kernel;
+}
+
+bool sha256_use_kernel(SHA256Kernel kernel) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    if (kernel >= SHA256_KERNELS || !sha256_kernel_supported(kernel)) return false;
+    sha256_set_kernel(kernel);
+    return true;
+}
+
+const char* sha256_kernel_name(SHA256Kernel kernel) {
+    static const char *names[SHA256_KERNELS] = { "scalar", "sha-ni", "sse2 x4", "avx2 x8" };
+    return kernel < SHA256_KERNELS ? names[kernel] : "unknown";
+}
+
+size_t sha256_midstate(const unsigned char *prefix, size_t len, SHA256Midstate *mid) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    memcpy(mid->h, sha256_iv, sizeof(sha256_iv));
+    size_t blocks = prefix ? len / 64 : 0;
+    if (blocks) sha256_compress(mid->h, prefix, blocks);
+    mid->length = blocks * 64;
+    return mid->length;
+}
+
+// Build the final one or two padded blocks for a tail whose whole blocks
+// have already been absorbed; returns the number of padded blocks
+static size_t sha256_pad(const unsigned char *rest, size_t rest_len, uint64_t total_len, unsigned char *pad) {
+    size_t pad_blocks = rest_len < 56 ? 1 : 2;
+    memset(pad, 0, pad_blocks * 64);
+    memcpy(pad, rest, rest_len);
+    pad[rest_len] = 0x80;
+    uint64_t bits = total_len * 8;
+    for (int i = 0; i < 8; i++) {
+        pad[pad_blocks * 64 - 1 - i] = bits >> (8 * i);
+    }
+    return pad_blocks;
+}
+
+void sha256_finish(const SHA256Midstate *mid, const unsigned char *tail, size_t tail_len, unsigned char *hash) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    uint32_t state[8];
+    unsigned char pad[128];
+    memcpy(state, mid->h, sizeof(state));
+    
+    size_t blocks = tail_len / 64;
+    if (blocks) sha256_compress(state, tail, blocks);
+    size_t pad_blocks = sha256_pad(tail + blocks * 64, tail_len % 64, mid->length + tail_len, pad);
+    sha256_compress(state, pad, pad_blocks);
+    
+    for (int i = 0; i < 8; i++) store_be32(hash + 4 * i, state[i]);
+}
+
+void sha256_iov(const struct iovec *iov, int iovcnt, unsigned char *hash) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    uint32_t state[8];
+    unsigned char block[128];
+    size_t fill = 0;
+    uint64_t total = 0;
+    memcpy(state, sha256_iv, sizeof(state));
+    
+    for (int i = 0; i < iovcnt; i++) {
+        const unsigned char *p = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        total += len;
+    
+        // Top up a partial block left by earlier buffers first
+        if (fill) {
+            size_t take = len < 64 - fill ? len : 64 - fill;
+            memcpy(block + fill, p, take);
+            fill += take;
+            p += take;
+            len -= take;
+            if (fill < 64) continue;
+            sha256_compress(state, block, 1);
+            fill = 0;
+        }
+    
+        size_t blocks = len / 64;
+        if (blocks) sha256_compress(state, p, blocks);
+        fill = len % 64;
+        memcpy(block, p + blocks * 64, fill);
+    }
+    
+    unsigned char rest[64];
+    memcpy(rest, block, fill);
+    size_t pad_blocks = sha256_pad(rest, fill, total, block);
+    sha256_compress(state, block, pad_blocks);
+    for (int i = 0; i < 8; i++) store_be32(hash + 4 * i, state[i]);
+}
+
+void sha256_finish_many(const SHA256Midstate *mid, const unsigned char *const *tails, size_t tail_len,
+                        unsigned char (*hashes)[SHA256_DIGEST_LENGTH], size_t count) {
+    pthread_once(&sha256_kernel_once, sha256_select_kernel);
+    if (!sha256_compress_lanes) {
+        for (size_t i = 0; i < count; i++) sha256_finish(mid, tails[i], tail_len, hashes[i]);
+        return;
+    }
+    
+    size_t blocks = tail_len / 64;
+    uint64_t total_len = mid->length + tail_len;
+    
+    for (size_t base = 0; base < count; base += sha256_lane_count) {
+        size_t lanes = count - base < (size_t)sha256_lane_count ? count - base : (size_t)sha256_lane_count;
+        uint32_t state[8][SHA256_LANES];
+        unsigned char pad[SHA256_LANES][128];
+        const unsigned char *ptrs[SHA256_LANES];
+        size_t pad_blocks = 0;
+    
+        for (int w = 0; w < 8; w++) {
+            for (int l = 0; l < SHA256_LANES; l++) state[w][l] = mid->h[w];
+        }
+        // Unused lanes repeat the first buffer and are discarded
+        for (int l = 0; l < sha256_lane_count; l++) {
+            const unsigned char *tail = tails[base + ((size_t)l < lanes ? (size_t)l : 0)];
+            pad_blocks = sha256_pad(tail + blocks * 64, tail_len % 64, total_len, pad[l]);
+        }
+    
+        for (size_t b = 0; b < blocks; b++) {
+            for (int l = 0; l < sha256_lane_count; l++) {
+                ptrs[l] = tails[base + ((size_t)l < lanes ? (size_t)l : 0)] + b * 64;
+            }
+            sha256_compress_lanes(state, ptrs);
+        }
+        for (size_t b = 0; b < pad_blocks; b++) {
+            for (int l = 0; l < sha256_lane_count; l++) ptrs[l] = pad[l] + b * 64;
+            sha256_compress_lanes(state, ptrs);
+        }
+    
+        for (size_t l = 0; l < lanes; l++) {
+            for (int w = 0; w < 8; w++) store_be32(hashes[base + l] + 4 * w, state[w][l]);
+        }
+    }
+}
+
 EC_KEY* generate_key_pair(void) {
     EC_KEY *key = EC_KEY_new_by_curve_name(NID_secp256k1);
     if (key == NULL) {
@@ -40,6 +432,20 @@ EC_KEY* generate_key_pair(void) {
     return key;
 }
 
+// DER-encode a signature straight into the caller's buffer. Fails if it
+// does not fit.
+static int encode_signature(const ECDSA_SIG *signature, unsigned char *sig, size_t *sig_len) {
+    int der_len = i2d_ECDSA_SIG(signature, NULL);
+    if (der_len <= 0 || (size_t)der_len > *sig_len) {
+        return 0;
+    }
+    
+    unsigned char *der = sig;
+    i2d_ECDSA_SIG(signature, &der);
+    *sig_len = der_len;
+    return 1;
+}
+
 int sign_data(EC_KEY *key, const unsigned char *data, size_t len, unsigned char *sig, size_t *sig_len) {
     unsigned char hash[SHA256_DIGEST_LENGTH];
     sha256(data, len, hash);
@@ -49,27 +455,182 @@ int sign_data(EC_KEY *key, const unsigned char *data, size_t len, unsigned char
         return 0;
     }
     
-    const BIGNUM *r, *s;
-    ECDSA_SIG_get0(signature, &r, &s);
+    int ok = encode_signature(signature, sig, sig_len);
+    ECDSA_SIG_free(signature);
+    return ok;
+}
+
+void latency_record(LatencyHistogram *h, uint64_t ns) {
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    h->buckets[bucket]++;
+    if (h->count == 0 || ns < h->min_ns) h->min_ns = ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+    h->count++;
+    h->total_ns += ns;
+}
+
+uint64_t latency_percentile(const LatencyHistogram *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count);
+    if (rank >= h->count) rank = h->count - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            // Upper edge of the bucket, clamped to what was observed
+            uint64_t edge = i == 63 ? UINT64_MAX : ((uint64_t)2 << i) - 1;
+            return edge < h->max_ns ? edge : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// A signature's cost is almost all in the nonce setup: the scalar
+// multiplication k*G (a constant-time ladder, which generator tables do not
+// speed up) and the inversion of k. Both depend only on k, so the signer
+// keeps a pool of (k^-1, r) pairs computed ahead of time and each signature
+// consumes one. A pair is never used twice. Without a ready pair it signs
+// through an EVP_PKEY_CTX that is initialized once per signer.
+//
+// The contexts and the pool are allocated up front, but ECDSA_do_sign_ex
+// still allocates its ECDSA_SIG on every call. Avoiding that would mean
+// computing s = k^-1 (z + r d) with our own BIGNUM arithmetic, outside
+// OpenSSL's constant-time signing code, which is not worth one allocation.
+struct Signer {
+    EVP_PKEY *key;
+    EVP_PKEY_CTX *sign_ctx;         // Signs digests when the pool is empty
+    EC_KEY *nonce_key;              // Legacy view of the key, for the pool
+    BN_CTX *bn_ctx;
+    BIGNUM *kinv[SIGNER_NONCES];
+    BIGNUM *r[SIGNER_NONCES];
+    size_t nonces;                  // Precomputed pairs available
+    LatencyHistogram latency;
+};
+
+// Legacy nonce pool. OpenSSL 3 has no EVP call that signs with a given
+// (k^-1, r) pair, so the pool goes through the deprecated EC_KEY and ECDSA
+// functions. They are confined to this block, the only place in this file
+// where their deprecation warnings are silenced.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+static EC_KEY* nonce_key_get(EVP_PKEY *key) {
+    return EVP_PKEY_get1_EC_KEY(key);
+}
+
+static void nonce_key_free(EC_KEY *key) {
+    EC_KEY_free(key);
+}
+
+static bool nonce_setup(Signer *signer, BIGNUM **kinv, BIGNUM **r) {
+    return ECDSA_sign_setup(signer->nonce_key, signer->bn_ctx, kinv, r) == 1;
+}
+
+static ECDSA_SIG* nonce_sign(Signer *signer, const unsigned char *hash, size_t n) {
+    return ECDSA_do_sign_ex(hash, SHA256_DIGEST_LENGTH, signer->kinv[n], signer->r[n], signer->nonce_key);
+}
+
+#pragma GCC diagnostic pop
+
+Signer* signer_create(EVP_PKEY *key) {
+    if (!key || !EVP_PKEY_is_a(key, "EC")) return NULL;
     
-    // Convert signature to DER format
-    unsigned char *der = NULL;
-    int der_len = i2d_ECDSA_SIG(signature, &der);
-    if (der_len < 0) {
-        ECDSA_SIG_free(signature);
+    Signer *signer = calloc(1, sizeof(Signer));
+    if (!signer) return NULL;
+    if (!EVP_PKEY_up_ref(key)) {
+        free(signer);
+        return NULL;
+    }
+    signer->key = key;
+    signer->sign_ctx = EVP_PKEY_CTX_new(key, NULL);
+    signer->nonce_key = nonce_key_get(key);
+    signer->bn_ctx = BN_CTX_new();
+    if (!signer->sign_ctx || EVP_PKEY_sign_init(signer->sign_ctx) != 1 || !signer->nonce_key ||
+        !signer->bn_ctx) {
+        signer_destroy(signer);
+        return NULL;
+    }
+    return signer;
+}
+
+void signer_destroy(Signer *signer) {
+    if (signer) {
+        for (size_t i = 0; i < signer->nonces; i++) {
+            BN_clear_free(signer->kinv[i]);
+            BN_clear_free(signer->r[i]);
+        }
+        BN_CTX_free(signer->bn_ctx);
+        nonce_key_free(signer->nonce_key);
+        EVP_PKEY_CTX_free(signer->sign_ctx);
+        EVP_PKEY_free(signer->key);
+        free(signer);
+    }
+}
+
+size_t signer_precompute(Signer *signer, size_t count) {
+    while (count-- > 0 && signer->nonces < SIGNER_NONCES) {
+        BIGNUM *kinv = NULL, *r = NULL;
+        if (!nonce_setup(signer, &kinv, &r)) break;
+        signer->kinv[signer->nonces] = kinv;
+        signer->r[signer->nonces] = r;
+        signer->nonces++;
+    }
+    return signer->nonces;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// EVP_PKEY_sign needs room for the largest signature
+static int signer_sign_digest(Signer *signer, const unsigned char *hash, unsigned char *sig, size_t *sig_len) {
+    int max_len = EVP_PKEY_get_size(signer->key);
+    if (max_len <= 0 || *sig_len < (size_t)max_len) {
         return 0;
     }
+    return EVP_PKEY_sign(signer->sign_ctx, sig, sig_len, hash, SHA256_DIGEST_LENGTH) == 1;
+}
+
+int signer_sign(Signer *signer, const unsigned char *data, size_t len, unsigned char *sig, size_t *sig_len) {
+    uint64_t start = monotonic_ns();
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    sha256(data, len, hash);
     
-    // Copy signature to output buffer
-    if ((size_t)der_len <= *sig_len) {
-        memcpy(sig, der, der_len);
-        *sig_len = der_len;
+    int ok;
+    if (signer->nonces == 0) {
+        ok = signer_sign_digest(signer, hash, sig, sig_len);
+    } else {
+        size_t n = --signer->nonces;
+        ECDSA_SIG *signature = nonce_sign(signer, hash, n);
+        ok = signature && encode_signature(signature, sig, sig_len);
+        ECDSA_SIG_free(signature);
+        BN_clear_free(signer->kinv[n]);
+        BN_clear_free(signer->r[n]);
+        // The only failure with given values is s == 0; sign afresh
+        if (!ok) ok = signer_sign_digest(signer, hash, sig, sig_len);
     }
-    
-    OPENSSL_free(der);
-    ECDSA_SIG_free(signature);
-    
-    return 1;
+    latency_record(&signer->latency, monotonic_ns() - start);
+    return ok;
+}
+
+size_t signer_sign_many(Signer *signer, SignItem *items, size_t count) {
+    size_t signed_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (signer->nonces == 0) signer_precompute(signer, count - i);
+        items[i].ok = signer_sign(signer, items[i].msg, items[i].msg_len, items[i].sig, &items[i].sig_len);
+        signed_count += items[i].ok;
+    }
+    return signed_count;
+}
+
+const LatencyHistogram* signer_latency(const Signer *signer) {
+    return &signer->latency;
+}
+
+void signer_reset_latency(Signer *signer) {
+    memset(&signer->latency, 0, sizeof(signer->latency));
 }
 
 int verify_signature(EC_KEY *key, const unsigned char *data, size_t len, const unsigned char *sig, size_t sig_len) {
@@ -90,6 +651,336 @@ int verify_signature(EC_KEY *key, const unsigned char *data, size_t len, const u
     return result;
 }
 
+// Batch verification. The calling thread resolves every public key through
+// a cache of parsed EVP_PKEYs, then items are verified in chunks of 64 by
+// the pool workers and the caller together. Each chunk fills exactly one
+// result word, so workers never share a word. Every verifying thread keeps
+// an EVP_PKEY_CTX per cached key, initialized for verification once.
+//
+// Items refer to keys by cache slot, so the cache is never flushed while a
+// batch is being resolved. Before resolving, a batch that might not fit in
+// what is left of the cache flushes it, and one with more keys than the
+// cache holds grows it.
+#define SIG_CHUNK 64
+#define KEY_CACHE_SLOTS 4096        // Initial size, a power of two; kept at most 3/4 full
+#define NO_KEY UINT32_MAX
+
+typedef struct {
+    unsigned char point[SIG_PUBKEY_MAX];
+    uint8_t len;                    // 0 for an empty slot
+    EVP_PKEY *pkey;
+} KeyCacheEntry;
+
+typedef struct {
+    struct SigVerifier *verifier;
+    EVP_PKEY_CTX **ctx;             // Per key cache slot, NULL until first use
+    uint32_t generation;            // Cache generation the contexts belong to
+} VerifyThread;
+
+struct SigVerifier {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t *workers;
+    int worker_count;
+    int thread_count;
+    VerifyThread *threads;          // One per worker, the caller's last
+    uint64_t batch;                 // Incremented to start a batch
+    int finished;                   // Workers done with the current batch
+    bool stop;
+    
+    // Current batch
+    const SigBatchItem *items;
+    const uint32_t *slots;          // Key cache slot of each item
+    size_t count;
+    uint64_t *results;
+    atomic_size_t next_chunk;
+    atomic_size_t valid;
+    
+    KeyCacheEntry *cache;
+    size_t cache_slots;
+    size_t cache_used;
+    uint32_t generation;
+    uint32_t *slot_buffer;
+    size_t slot_capacity;
+};
+
+static uint64_t fnv1a(const unsigned char *p, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static EVP_PKEY* parse_public_key(const unsigned char *point, size_t len) {
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, "secp256k1", 0),
+        OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, (void*)point, len),
+        OSSL_PARAM_END
+    };
+    EVP_PKEY *pkey = NULL;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+    if (ctx && EVP_PKEY_fromdata_init(ctx) > 0) {
+        if (EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0) pkey = NULL;
+    }
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+static void key_cache_flush(SigVerifier *v) {
+    for (size_t i = 0; i < v->cache_slots; i++) {
+        EVP_PKEY_free(v->cache[i].pkey);
+        v->cache[i].pkey = NULL;
+        v->cache[i].len = 0;
+    }
+    v->cache_used = 0;
+    v->generation++;
+}
+
+static void verify_thread_reset(VerifyThread *t) {
+    for (size_t i = 0; i < t->verifier->cache_slots; i++) {
+        EVP_PKEY_CTX_free(t->ctx[i]);
+        t->ctx[i] = NULL;
+    }
+}
+
+// Make room for `count` more keys without evicting any during the batch:
+// flush if they might not fit, and grow the cache (and every thread's
+// context table with it) if they could not fit even when it is empty
+static bool key_cache_reserve(SigVerifier *v, size_t count) {
+    if (v->cache_used + count <= v->cache_slots / 4 * 3) return true;
+    key_cache_flush(v);
+    size_t slots = v->cache_slots;
+    while (count > slots / 4 * 3) slots *= 2;
+    if (slots == v->cache_slots) return true;
+    
+    KeyCacheEntry *cache = calloc(slots, sizeof(KeyCacheEntry));
+    EVP_PKEY_CTX ***ctx = calloc(v->thread_count, sizeof(EVP_PKEY_CTX**));
+    bool ok = cache && ctx;
+    for (int i = 0; ok && i < v->thread_count; i++) {
+        ctx[i] = calloc(slots, sizeof(EVP_PKEY_CTX*));
+        ok = ctx[i] != NULL;
+    }
+    if (!ok) {
+        for (int i = 0; ctx && i < v->thread_count; i++) free(ctx[i]);
+        free(ctx);
+        free(cache);
+        return false;
+    }
+    // Workers are idle between batches, so their tables can be swapped
+    for (int i = 0; i < v->thread_count; i++) {
+        verify_thread_reset(&v->threads[i]);
+        free(v->threads[i].ctx);
+        v->threads[i].ctx = ctx[i];
+    }
+    free(ctx);
+    free(v->cache);
+    v->cache = cache;
+    v->cache_slots = slots;
+    return true;
+}
+
+// Cache slot holding the parsed key, or NO_KEY if it does not parse. The
+// caller has reserved room with key_cache_reserve.
+static uint32_t key_cache_lookup(SigVerifier *v, const unsigned char *point, size_t len) {
+    if (len == 0 || len > SIG_PUBKEY_MAX) return NO_KEY;
+    size_t mask = v->cache_slots - 1;
+    size_t i = fnv1a(point, len) & mask;
+    for (;; i = (i + 1) & mask) {
+        KeyCacheEntry *e = &v->cache[i];
+        if (e->len == 0) break;
+        if (e->len == len && memcmp(e->point, point, len) == 0) return e->pkey ? (uint32_t)i : NO_KEY;
+    }
+    
+    // Keys that fail to parse are cached too, with a NULL pkey
+    KeyCacheEntry *e = &v->cache[i];
+    memcpy(e->point, point, len);
+    e->len = len;
+    e->pkey = parse_public_key(point, len);
+    v->cache_used++;
+    return e->pkey ? (uint32_t)i : NO_KEY;
+}
+
+static bool verify_item(SigVerifier *v, VerifyThread *t, const SigBatchItem *item, uint32_t slot) {
+    if (slot == NO_KEY) return false;
+    EVP_PKEY_CTX *ctx = t->ctx[slot];
+    if (!ctx) {
+        ctx = EVP_PKEY_CTX_new(v->cache[slot].pkey, NULL);
+        if (!ctx) return false;
+        if (EVP_PKEY_verify_init(ctx) <= 0) {
+            EVP_PKEY_CTX_free(ctx);
+            return false;
+        }
+        t->ctx[slot] = ctx;
+    }
+    
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    sha256(item->msg, item->msg_len, hash);
+    return EVP_PKEY_verify(ctx, item->sig, item->sig_len, hash, sizeof(hash)) == 1;
+}
+
+// Claim and verify chunks until the batch is exhausted
+static void verify_chunks(SigVerifier *v, VerifyThread *t) {
+    if (t->generation != v->generation) {
+        verify_thread_reset(t);
+        t->generation = v->generation;
+    }
+    
+    size_t chunks = (v->count + SIG_CHUNK - 1) / SIG_CHUNK;
+    size_t valid = 0;
+    for (;;) {
+        size_t chunk = atomic_fetch_add(&v->next_chunk, 1);
+        if (chunk >= chunks) break;
+        size_t start = chunk * SIG_CHUNK;
+        size_t end = start + SIG_CHUNK < v->count ? start + SIG_CHUNK : v->count;
+        uint64_t word = 0;
+        for (size_t i = start; i < end; i++) {
+            if (verify_item(v, t, &v->items[i], v->slots[i])) {
+                word |= (uint64_t)1 << (i - start);
+                valid++;
+            }
+        }
+        v->results[chunk] = word;
+    }
+    atomic_fetch_add(&v->valid, valid);
+    
+    // Errors from rejected signatures would otherwise pile up per thread
+    ERR_clear_error();
+}
+
+static void* verify_worker(void *arg) {
+    VerifyThread *t = arg;
+    SigVerifier *v = t->verifier;
+    uint64_t seen = 0;
+    
+    pthread_mutex_lock(&v->lock);
+    for (;;) {
+        while (!v->stop && v->batch == seen) pthread_cond_wait(&v->work, &v->lock);
+        if (v->stop) break;
+        seen = v->batch;
+        pthread_mutex_unlock(&v->lock);
+    
+        verify_chunks(v, t);
+    
+        pthread_mutex_lock(&v->lock);
+        if (++v->finished == v->worker_count) pthread_cond_signal(&v->done);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+SigVerifier* sig_verifier_create(int threads) {
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    
+    SigVerifier *v = calloc(1, sizeof(SigVerifier));
+    if (!v) return NULL;
+    v->cache = calloc(KEY_CACHE_SLOTS, sizeof(KeyCacheEntry));
+    v->cache_slots = KEY_CACHE_SLOTS;
+    v->threads = calloc(threads, sizeof(VerifyThread));
+    v->workers = malloc(sizeof(pthread_t) * threads);
+    if (!v->cache || !v->threads || !v->workers) {
+        free(v->cache);
+        free(v->threads);
+        free(v->workers);
+        free(v);
+        return NULL;
+    }
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_cond_init(&v->work, NULL);
+    pthread_cond_init(&v->done, NULL);
+    
+    // Set before the tables are allocated, so destroying after a failed
+    // allocation frees the ones that succeeded
+    v->thread_count = threads;
+    
+    // The caller verifies too, so threads - 1 workers are started
+    for (int i = 0; i < threads; i++) {
+        v->threads[i].verifier = v;
+        v->threads[i].ctx = calloc(KEY_CACHE_SLOTS, sizeof(EVP_PKEY_CTX*));
+        if (!v->threads[i].ctx) {
+            sig_verifier_destroy(v);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&v->workers[i], NULL, verify_worker, &v->threads[i]) != 0) break;
+        v->worker_count++;
+    }
+    
+    return v;
+}
+
+void sig_verifier_destroy(SigVerifier *v) {
+    if (!v) return;
+    
+    pthread_mutex_lock(&v->lock);
+    v->stop = true;
+    pthread_cond_broadcast(&v->work);
+    pthread_mutex_unlock(&v->lock);
+    for (int i = 0; i < v->worker_count; i++) pthread_join(v->workers[i], NULL);
+    
+    for (int i = 0; i < v->thread_count; i++) {
+        if (v->threads[i].ctx) verify_thread_reset(&v->threads[i]);
+        free(v->threads[i].ctx);
+    }
+    key_cache_flush(v);
+    pthread_mutex_destroy(&v->lock);
+    pthread_cond_destroy(&v->work);
+    pthread_cond_destroy(&v->done);
+    free(v->cache);
+    free(v->threads);
+    free(v->workers);
+    free(v->slot_buffer);
+    free(v);
+}
+
+size_t sig_verify_batch(SigVerifier *v, const SigBatchItem *items, size_t count, uint64_t *results) {
+    if (count == 0) return 0;
+    
+    if (count > v->slot_capacity) {
+        uint32_t *slots = realloc(v->slot_buffer, sizeof(uint32_t) * count);
+        if (slots) {
+            v->slot_buffer = slots;
+            v->slot_capacity = count;
+        }
+    }
+    if (count > v->slot_capacity || !key_cache_reserve(v, count)) {
+        memset(results, 0, sizeof(uint64_t) * ((count + SIG_CHUNK - 1) / SIG_CHUNK));
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        v->slot_buffer[i] = key_cache_lookup(v, items[i].pubkey, items[i].pubkey_len);
+    }
+    
+    v->items = items;
+    v->slots = v->slot_buffer;
+    v->count = count;
+    v->results = results;
+    atomic_store(&v->next_chunk, 0);
+    atomic_store(&v->valid, 0);
+    
+    // A single chunk is not worth waking the pool for
+    bool parallel = v->worker_count > 0 && count > SIG_CHUNK;
+    if (parallel) {
+        pthread_mutex_lock(&v->lock);
+        v->finished = 0;
+        v->batch++;
+        pthread_cond_broadcast(&v->work);
+        pthread_mutex_unlock(&v->lock);
+    }
+    
+    verify_chunks(v, &v->threads[v->thread_count - 1]);
+    
+    if (parallel) {
+        pthread_mutex_lock(&v->lock);
+        while (v->finished < v->worker_count) pthread_cond_wait(&v->done, &v->lock);
+        pthread_mutex_unlock(&v->lock);
+    }
+    return atomic_load(&v->valid);
+}
+
 // Initialize OpenSSL
 __attribute__((constructor))
 void init_crypto(void) {
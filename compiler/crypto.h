@@ -8,16 +8,155 @@
 #include <openssl/evp.h>
 #include <openssl/err.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
 
 // Hash functions
 void sha256(const unsigned char *data, size_t len, unsigned char *hash);
 void ripemd160(const unsigned char *data, size_t len, unsigned char *hash);
 void hash160(const unsigned char *data, size_t len, unsigned char *hash);
 
-// Key generation and signing
+// Incremental hashing through an EVP digest context, for messages built from
+// several pieces. hash_final leaves the context reset for the next message.
+typedef enum {
+    HASH_SHA256,
+    HASH_RIPEMD160,
+    HASH_HASH160            // RIPEMD-160 of SHA-256, as hash160()
+} HashKind;
+
+#define HASH_MAX_SIZE SHA256_DIGEST_LENGTH
+
+typedef struct {
+    EVP_MD_CTX *ctx;
+    HashKind kind;
+} HashContext;
+
+bool hash_init(HashContext *h, HashKind kind);
+bool hash_update(HashContext *h, const void *data, size_t len);
+// Write the digest (HASH_MAX_SIZE bytes at most) and return its length,
+// or 0 on failure
+size_t hash_final(HashContext *h, unsigned char *out);
+bool hash_reset(HashContext *h);
+void hash_free(HashContext *h);
+
+// SHA-256 of the concatenation of `iovcnt` buffers, without copying them
+void sha256_iov(const struct iovec *iov, int iovcnt, unsigned char *hash);
+
+// SHA-256 state after absorbing the whole 64-byte blocks of a fixed prefix
+typedef struct {
+    uint32_t h[8];
+    uint64_t length;    // Bytes absorbed, always a multiple of 64
+} SHA256Midstate;
+
+// Absorb the whole blocks of `prefix` and return how many bytes that was;
+// any remainder must be passed again as the start of the tail. A NULL
+// prefix (or len < 64) gives the initial state.
+size_t sha256_midstate(const unsigned char *prefix, size_t len, SHA256Midstate *mid);
+// Finish the hash of prefix || tail. Digests are identical to sha256().
+void sha256_finish(const SHA256Midstate *mid, const unsigned char *tail, size_t tail_len, unsigned char *hash);
+// Finish `count` hashes sharing one midstate and tail length, several
+// candidates at a time (SHA-NI per buffer, or 8-lane AVX2 / 4-lane SSE2)
+void sha256_finish_many(const SHA256Midstate *mid, const unsigned char *const *tails, size_t tail_len,
+                        unsigned char (*hashes)[SHA256_DIGEST_LENGTH], size_t count);
+
+// Compression kernels behind the functions above. The fastest one the CPU
+// has is picked on first use; sha256_use_kernel switches to another so
+// they can be compared, and must not race with hashing on other threads.
+typedef enum {
+    SHA256_KERNEL_SCALAR,
+    SHA256_KERNEL_SHANI,
+    SHA256_KERNEL_SSE2,
+    SHA256_KERNEL_AVX2,
+    SHA256_KERNELS
+} SHA256Kernel;
+
+SHA256Kernel sha256_kernel(void);
+bool sha256_use_kernel(SHA256Kernel kernel);    // False if the CPU lacks it
+const char* sha256_kernel_name(SHA256Kernel kernel);
+
+// Key generation and signing. sign_data fails if the signature does not
+// fit in *sig_len bytes, and otherwise sets it to the signature's length.
 EC_KEY* generate_key_pair(void);
 int sign_data(EC_KEY *key, const unsigned char *data, size_t len, unsigned char *sig, size_t *sig_len);
 int verify_signature(EC_KEY *key, const unsigned char *data, size_t len, const unsigned char *sig, size_t sig_len);
+// Latency histogram with power-of-two buckets: bucket i counts samples in
+// [2^i, 2^(i+1)) nanoseconds (bucket 0 also holds 0)
+#define LATENCY_BUCKETS 64
+
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} LatencyHistogram;
+
+void latency_record(LatencyHistogram *h, uint64_t ns);
+// Upper bound of the bucket holding the p-th percentile (0-100)
+uint64_t latency_percentile(const LatencyHistogram *h, double p);
+
+// Persistent signer for a secp256k1 EVP_PKEY. It holds a reference to the
+// key and a pool of precomputed per-signature nonces, writes DER signatures
+// over the SHA-256 of the message into the caller's buffer (at least
+// EVP_PKEY_get_size bytes, 72 for secp256k1) and records how long each
+// signature took. Signatures verify with EVP_DigestVerify (SHA-256) or
+// sig_verify_batch. A signer must not be used from several threads at once.
+//
+// Signing is not allocation-free. OpenSSL returns each signature as a
+// fresh ECDSA_SIG with two BIGNUMs, which the signer encodes and frees, and
+// the nonce pair it consumed is freed with it. Precomputing allocates the
+// pairs, and a signature made without a ready pair allocates inside
+// EVP_PKEY_sign.
+#define SIGNER_NONCES 256
+
+typedef struct Signer Signer;
+
+typedef struct {
+    const unsigned char *msg;
+    size_t msg_len;
+    unsigned char *sig;
+    size_t sig_len;                 // In: buffer size; out: signature length
+    bool ok;
+} SignItem;
+
+Signer* signer_create(EVP_PKEY *key);
+void signer_destroy(Signer *signer);
+// Precompute up to `count` nonces, e.g. while idle, so later signatures
+// skip the expensive part; returns how many are ready
+size_t signer_precompute(Signer *signer, size_t count);
+int signer_sign(Signer *signer, const unsigned char *data, size_t len, unsigned char *sig, size_t *sig_len);
+// Sign every item, refilling the nonce pool as needed; returns how many
+// succeeded
+size_t signer_sign_many(Signer *signer, SignItem *items, size_t count);
+const LatencyHistogram* signer_latency(const Signer *signer);
+void signer_reset_latency(Signer *signer);
+
+// Batch signature verification. Each item is checked exactly as
+// verify_signature does (SHA-256 of the message, DER signature), against a
+// SEC1-encoded secp256k1 public key. Parsed keys and their verify contexts
+// are cached across batches, so repeated signers are cheap.
+#define SIG_PUBKEY_MAX 65
+
+typedef struct {
+    const unsigned char *pubkey;
+    size_t pubkey_len;
+    const unsigned char *msg;
+    size_t msg_len;
+    const unsigned char *sig;
+    size_t sig_len;
+} SigBatchItem;
+
+typedef struct SigVerifier SigVerifier;
+
+// Verifier using `threads` threads including the caller (<= 0 uses all
+// online CPUs)
+SigVerifier* sig_verifier_create(int threads);
+void sig_verifier_destroy(SigVerifier *v);
+// Verify `count` items, setting bit i % 64 of results[i / 64] for each
+// valid one (results holds (count + 63) / 64 words). Returns the number of
+// valid signatures. Not safe to call on one verifier from several threads.
+size_t sig_verify_batch(SigVerifier *v, const SigBatchItem *items, size_t count, uint64_t *results);
 
 // OpenSSL initialization and cleanup
 void init_crypto(void);
@@ -0,0 +1,64 @@
+#include "expiry.h"
+#include <stdlib.h>
+
+bool expiry_init(ExpiryRing *r, uint64_t expiry, size_t buckets, ExpiryLinkOf link, void *owner) {
+    *r = (ExpiryRing){ 0 };
+    r->expiry = expiry;
+    r->width = expiry / buckets + 1;
+    r->ring = buckets + 2;
+    r->heads = calloc(r->ring, sizeof(uint32_t));
+    r->tails = calloc(r->ring, sizeof(uint32_t));
+    r->link = link;
+    r->owner = owner;
+    if (!r->heads || !r->tails) {
+        expiry_free(r);
+        return false;
+    }
+    return true;
+}
+
+void expiry_free(ExpiryRing *r) {
+    free(r->heads);
+    free(r->tails);
+    r->heads = r->tails = NULL;
+}
+
+uint64_t expiry_advance(ExpiryRing *r, uint64_t now) {
+    if (now > r->latest) r->latest = now;
+    return r->latest;
+}
+
+static size_t bucket_of(const ExpiryRing *r, uint64_t time) {
+    return time / r->width % r->ring;
+}
+
+void expiry_append(ExpiryRing *r, uint32_t id, uint64_t time) {
+    ExpiryLink *x = r->link(r->owner, id);
+    size_t b = bucket_of(r, time);
+    x->prev = r->tails[b];
+    x->next = 0;
+    if (x->prev) r->link(r->owner, x->prev)->next = id;
+    else r->heads[b] = id;
+    r->tails[b] = id;
+}
+
+void expiry_unlink(ExpiryRing *r, uint32_t id, uint64_t time) {
+    ExpiryLink *x = r->link(r->owner, id);
+    size_t b = bucket_of(r, time);
+    if (x->prev) r->link(r->owner, x->prev)->next = x->next;
+    else r->heads[b] = x->next;
+    if (x->next) r->link(r->owner, x->next)->prev = x->prev;
+    else r->tails[b] = x->prev;
+}
+
+uint32_t expiry_stale(ExpiryRing *r) {
+    // Epochs before the cutoff ended more than `expiry` seconds ago
+    uint64_t cutoff = r->latest >= r->expiry ? (r->latest - r->expiry) / r->width : 0;
+    // After a long gap every bucket is stale; visit each once
+    if (cutoff > r->oldest_epoch + r->ring) r->oldest_epoch = cutoff - r->ring;
+    for (; r->oldest_epoch < cutoff; r->oldest_epoch++) {
+        uint32_t head = r->heads[r->oldest_epoch % r->ring];
+        if (head) return head;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef EXPIRY_H
+#define EXPIRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Arrival-time buckets over entries kept elsewhere
+//
+// Times fall into epochs of expiry / buckets + 1 seconds, and each entry
+// is linked into the bucket of the epoch it arrived in. The ring holds a
+// bucket for each epoch of the expiry plus the partial ones at either
+// end, so expiring only visits the buckets that have aged out rather than
+// every entry. An entry goes between expiry and expiry plus one bucket
+// after it arrived.
+//
+// Entries carry their own ExpiryLink, found through the owner's callback.
+// Ids start at 1 so 0 can mean none.
+typedef struct {
+    uint32_t prev;
+    uint32_t next;
+} ExpiryLink;
+
+typedef ExpiryLink* (*ExpiryLinkOf)(void *owner, uint32_t id);
+
+typedef struct {
+    uint64_t expiry;
+    uint64_t width;                 // Seconds per epoch
+    uint64_t latest;                // Latest time seen
+    uint64_t oldest_epoch;          // Oldest epoch that may still have entries
+    size_t ring;                    // Buckets in the ring
+    uint32_t *heads;
+    uint32_t *tails;
+    ExpiryLinkOf link;
+    void *owner;
+} ExpiryRing;
+
+bool expiry_init(ExpiryRing *r, uint64_t expiry, size_t buckets, ExpiryLinkOf link, void *owner);
+void expiry_free(ExpiryRing *r);
+// Move the clock to `now`. Times must not go backwards: an earlier `now`
+// is treated as the latest time seen, which is returned.
+uint64_t expiry_advance(ExpiryRing *r, uint64_t now);
+// `time` is the entry's arrival, at most the latest time seen
+void expiry_append(ExpiryRing *r, uint32_t id, uint64_t time);
+void expiry_unlink(ExpiryRing *r, uint32_t id, uint64_t time);
+// An entry in a bucket that has aged out, or 0 when none is left. The
+// caller removes it, unlinking it from the ring, before asking again.
+uint32_t expiry_stale(ExpiryRing *r);
+
+#endif /* EXPIRY_H */
@@ -0,0 +1,300 @@
+#include "gossip.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define GOSSIP_PRIORITIES 3
+#define GOSSIP_QUEUE_MIN 16         // Power of two
+
+// One copy of a message, shared by every queue it is on
+typedef struct {
+    uint32_t refs;
+    uint8_t type;
+    uint32_t length;
+    uint8_t data[];
+} GossipMessage;
+
+// Ring of message references; positions only grow and are taken modulo
+// the capacity
+typedef struct {
+    GossipMessage **items;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t tail;
+} GossipQueue;
+
+typedef struct {
+    GossipQueue queues[GOSSIP_PRIORITIES];
+    size_t bytes;                   // Queued records, headers included
+    uint32_t pos;                   // Index in `active`, or UINT32_MAX
+    bool dirty;                     // In the `dirty` list
+} GossipPeer;
+
+struct GossipScheduler {
+    GossipPeer *peers;
+    size_t peer_count;
+    uint32_t *active;               // Sampling pool, in no particular order
+    size_t active_count;
+    uint32_t *dirty;                // Peers that may have messages queued
+    size_t dirty_count;
+    
+    int fanout;
+    size_t batch_bytes;
+    uint8_t *frame;                 // Batch being built
+    size_t *chosen;                 // Peers picked for the message being forwarded
+    uint64_t rng[4];
+    GossipStats stats;
+};
+
+static const int priority_of[GOSSIP_TYPES] = {
+    [GOSSIP_ALERT] = 0,
+    [GOSSIP_BLOCK] = 0,
+    [GOSSIP_TRANSACTION] = 1,
+    [GOSSIP_HEARTBEAT] = 2,
+    [GOSSIP_PEER_DISCOVERY] = 2
+};
+
+static void message_release(GossipMessage *m) {
+    if (--m->refs == 0) free(m);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return x << k | x >> (64 - k);
+}
+
+// xoshiro256**
+static uint64_t rng_next(GossipScheduler *g) {
+    uint64_t *s = g->rng;
+    uint64_t result = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// Uniform in [0, n) by multiplying up and rejecting the few low products
+// that would bias it, so there is no division on the usual path
+static uint64_t rng_below(GossipScheduler *g, uint64_t n) {
+    unsigned __int128 m = (unsigned __int128)rng_next(g) * n;
+    if ((uint64_t)m < n) {
+        uint64_t threshold = -n % n;
+        while ((uint64_t)m < threshold) m = (unsigned __int128)rng_next(g) * n;
+    }
+    return (uint64_t)(m >> 64);
+}
+
+static void active_swap(GossipScheduler *g, size_t i, size_t j) {
+    uint32_t a = g->active[i], b = g->active[j];
+    g->active[i] = b;
+    g->active[j] = a;
+    g->peers[a].pos = (uint32_t)j;
+    g->peers[b].pos = (uint32_t)i;
+}
+
+static bool queue_push(GossipQueue *q, GossipMessage *m) {
+    if (q->tail - q->head == q->capacity) {
+        uint32_t capacity = q->capacity ? q->capacity * 2 : GOSSIP_QUEUE_MIN;
+        GossipMessage **items = malloc(sizeof(GossipMessage*) * capacity);
+        if (!items) return false;
+        for (uint32_t i = q->head; i != q->tail; i++) items[i - q->head] = q->items[i & (q->capacity - 1)];
+        free(q->items);
+        q->items = items;
+        q->tail -= q->head;
+        q->head = 0;
+        q->capacity = capacity;
+    }
+    q->items[q->tail++ & (q->capacity - 1)] = m;
+    return true;
+}
+
+static void peer_drop(GossipScheduler *g, GossipPeer *p) {
+    for (int i = 0; i < GOSSIP_PRIORITIES; i++) {
+        GossipQueue *q = &p->queues[i];
+        for (; q->head != q->tail; q->head++) {
+            message_release(q->items[q->head & (q->capacity - 1)]);
+            g->stats.dropped++;
+        }
+    }
+    p->bytes = 0;
+}
+
+GossipScheduler* gossip_create(size_t peers, int fanout, size_t batch_bytes, uint64_t seed) {
+    if (peers == 0 || peers >= UINT32_MAX || fanout <= 0 || batch_bytes == 0 || batch_bytes > NET_MAX_FRAME) {
+        return NULL;
+    }
+    GossipScheduler *g = calloc(1, sizeof(GossipScheduler));
+    if (!g) return NULL;
+    g->peers = calloc(peers, sizeof(GossipPeer));
+    g->active = malloc(sizeof(uint32_t) * peers);
+    g->dirty = malloc(sizeof(uint32_t) * peers);
+    g->frame = malloc(NET_MAX_FRAME);
+    g->chosen = malloc(sizeof(size_t) * fanout);
+    g->peer_count = peers;
+    g->fanout = fanout;
+    g->batch_bytes = batch_bytes;
+    if (!g->peers || !g->active || !g->dirty || !g->frame || !g->chosen) {
+        gossip_destroy(g);
+        return NULL;
+    }
+    for (size_t i = 0; i < peers; i++) g->peers[i].pos = UINT32_MAX;
+    // splitmix64 to spread the seed over the state
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        g->rng[i] = z ^ (z >> 31);
+    }
+    return g;
+}
+
+void gossip_destroy(GossipScheduler *gossip) {
+    if (!gossip) return;
+    if (gossip->peers) {
+        for (size_t i = 0; i < gossip->peer_count; i++) {
+            peer_drop(gossip, &gossip->peers[i]);
+            for (int k = 0; k < GOSSIP_PRIORITIES; k++) free(gossip->peers[i].queues[k].items);
+        }
+    }
+    free(gossip->peers);
+    free(gossip->active);
+    free(gossip->dirty);
+    free(gossip->frame);
+    free(gossip->chosen);
+    free(gossip);
+}
+
+void gossip_set_active(GossipScheduler *gossip, size_t peer, bool active) {
+    GossipPeer *p = &gossip->peers[peer];
+    if (active && p->pos == UINT32_MAX) {
+        p->pos = (uint32_t)gossip->active_count;
+        gossip->active[gossip->active_count++] = (uint32_t)peer;
+    } else if (!active && p->pos != UINT32_MAX) {
+        active_swap(gossip, p->pos, gossip->active_count - 1);
+        gossip->active_count--;
+        p->pos = UINT32_MAX;
+        peer_drop(gossip, p);
+    }
+}
+
+size_t gossip_sample(GossipScheduler *gossip, size_t except, size_t *out, size_t count) {
+    size_t n = gossip->active_count;
+    // Move the excluded peer out of the range drawn from
+    if (except < gossip->peer_count && gossip->peers[except].pos != UINT32_MAX) {
+        active_swap(gossip, gossip->peers[except].pos, --n);
+    }
+    if (count > n) count = n;
+    // The first `count` steps of a Fisher-Yates shuffle; the pool is left
+    // permuted, which is as good a starting order as any
+    for (size_t i = 0; i < count; i++) {
+        active_swap(gossip, i, i + rng_below(gossip, n - i));
+        out[i] = gossip->active[i];
+    }
+    return count;
+}
+
+size_t gossip_forward(GossipScheduler *gossip, uint8_t type, const void *payload, size_t length, size_t from) {
+    if (type >= GOSSIP_TYPES || length > GOSSIP_MAX_PAYLOAD) return 0;
+    gossip->stats.forwarded++;
+    size_t *chosen = gossip->chosen;
+    size_t count = gossip_sample(gossip, from, chosen, gossip->fanout);
+    if (count == 0) return 0;
+    GossipMessage *m = malloc(sizeof(GossipMessage) + length);
+    if (!m) return 0;
+    m->refs = 1;
+    m->type = type;
+    m->length = (uint32_t)length;
+    memcpy(m->data, payload, length);
+    
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++) {
+        GossipPeer *p = &gossip->peers[chosen[i]];
+        if (p->bytes + GOSSIP_RECORD_HEADER + length > GOSSIP_PEER_LIMIT ||
+            !queue_push(&p->queues[priority_of[type]], m)) {
+            gossip->stats.dropped++;
+            continue;
+        }
+        m->refs++;
+        p->bytes += GOSSIP_RECORD_HEADER + length;
+        if (!p->dirty) {
+            p->dirty = true;
+            gossip->dirty[gossip->dirty_count++] = (uint32_t)chosen[i];
+        }
+        queued++;
+    }
+    gossip->stats.queued += queued;
+    message_release(m);
+    return queued;
+}
+
+size_t gossip_tick(GossipScheduler *gossip, GossipSend send, void *user) {
+    size_t batches = 0, kept = 0;
+    for (size_t i = 0; i < gossip->dirty_count; i++) {
+        uint32_t peer = gossip->dirty[i];
+        GossipPeer *p = &gossip->peers[peer];
+    
+        // Strict priority: stop at the first message that does not fit,
+        // so nothing overtakes a large block
+        size_t length = 0, records = 0;
+        bool full = false;
+        for (int k = 0; k < GOSSIP_PRIORITIES && !full; k++) {
+            GossipQueue *q = &p->queues[k];
+            while (q->head != q->tail) {
+                GossipMessage *m = q->items[q->head & (q->capacity - 1)];
+                size_t size = GOSSIP_RECORD_HEADER + m->length;
+                if (length && length + size > gossip->batch_bytes) {
+                    full = true;
+                    break;
+                }
+                uint8_t *r = gossip->frame + length;
+                r[0] = m->type;
+                r[1] = (uint8_t)m->length;
+                r[2] = (uint8_t)(m->length >> 8);
+                r[3] = (uint8_t)(m->length >> 16);
+                memcpy(r + GOSSIP_RECORD_HEADER, m->data, m->length);
+                length += size;
+                records++;
+                q->head++;
+                message_release(m);
+            }
+        }
+    
+        if (records) {
+            p->bytes -= length;
+            if (send(peer, gossip->frame, length, user)) {
+                gossip->stats.batches++;
+                gossip->stats.records += records;
+                gossip->stats.bytes += length;
+                batches++;
+            } else {
+                gossip->stats.dropped += records;
+            }
+        }
+        if (p->bytes) gossip->dirty[kept++] = peer;
+        else p->dirty = false;
+    }
+    gossip->dirty_count = kept;
+    return batches;
+}
+
+size_t gossip_pending(const GossipScheduler *gossip, size_t peer) {
+    return gossip->peers[peer].bytes;
+}
+
+void gossip_stats(const GossipScheduler *gossip, GossipStats *stats) {
+    *stats = gossip->stats;
+}
+
+bool gossip_batch_next(const uint8_t *frame, size_t length, size_t *pos, uint8_t *type, const uint8_t **payload,
+                       size_t *payload_length) {
+    if (*pos > length || length - *pos < GOSSIP_RECORD_HEADER) return false;
+    const uint8_t *r = frame + *pos;
+    size_t size = r[1] | (size_t)r[2] << 8 | (size_t)r[3] << 16;
+    if (r[0] >= GOSSIP_TYPES || size > length - *pos - GOSSIP_RECORD_HEADER) return false;
+    *type = r[0];
+    *payload = r + GOSSIP_RECORD_HEADER;
+    *payload_length = size;
+    *pos += GOSSIP_RECORD_HEADER + size;
+    return true;
+}
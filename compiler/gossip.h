@@ -0,0 +1,80 @@
+#ifndef GOSSIP_H
+#define GOSSIP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "net.h"
+
+// Gossip forwarding
+//
+// Instead of sending each message to each chosen peer with a delay after
+// every send, a scheduler queues a reference to the message on every peer
+// chosen for it and, once per tick, sends each peer with anything queued
+// a single batch frame. Inside a batch, alerts and blocks go before
+// transactions, which go before heartbeats and peer announcements. A
+// batch is sent as one NET_MSG_GOSSIP frame holding records of
+//
+//   type (1) | payload length (3, little-endian) | payload
+//
+// Fanout peers are drawn uniformly from the active peers other than the
+// one a message came from, with a partial Fisher-Yates shuffle in
+// O(fanout). A scheduler belongs to one thread, normally the loop that
+// owns its peers.
+#define GOSSIP_FANOUT 3             // FANOUT in gossip_protocol.cry
+#define GOSSIP_TICK_MS 100          // PROPAGATION_DELAY
+#define GOSSIP_RECORD_HEADER 4
+#define GOSSIP_MAX_PAYLOAD (NET_MAX_FRAME - GOSSIP_RECORD_HEADER)
+#define GOSSIP_PEER_LIMIT NET_WRITE_HIGH    // Queued bytes past which a peer is skipped
+#define GOSSIP_NO_PEER SIZE_MAX
+
+// MessageType in gossip_protocol.cry
+enum {
+    GOSSIP_BLOCK,
+    GOSSIP_TRANSACTION,
+    GOSSIP_HEARTBEAT,
+    GOSSIP_PEER_DISCOVERY,
+    GOSSIP_ALERT,
+    GOSSIP_TYPES
+};
+
+typedef struct {
+    uint64_t forwarded;             // Messages passed to gossip_forward
+    uint64_t queued;                // Message and peer pairs queued
+    uint64_t dropped;               // Pairs dropped: peer over its limit, gone or refusing
+    uint64_t batches;
+    uint64_t records;               // Messages sent inside batches
+    uint64_t bytes;                 // Batch bytes sent
+} GossipStats;
+
+typedef struct GossipScheduler GossipScheduler;
+
+// Sends a batch to a peer; the frame is valid until it returns. False
+// counts the batch's messages as dropped.
+typedef bool (*GossipSend)(size_t peer, const uint8_t *frame, size_t length, void *user);
+
+// Peers are numbered 0 to peers - 1 and start inactive. A batch holds up
+// to `batch_bytes` (at most NET_MAX_FRAME); a larger message goes alone.
+GossipScheduler* gossip_create(size_t peers, int fanout, size_t batch_bytes, uint64_t seed);
+void gossip_destroy(GossipScheduler *gossip);
+// Only active peers are chosen; deactivating one drops what is queued for it
+void gossip_set_active(GossipScheduler *gossip, size_t peer, bool active);
+
+// Pick up to `count` distinct active peers other than `except`, uniformly
+size_t gossip_sample(GossipScheduler *gossip, size_t except, size_t *out, size_t count);
+// Copy a message once and queue it for up to fanout peers other than
+// `from` (GOSSIP_NO_PEER for a message of our own). Returns how many
+// peers it was queued for.
+size_t gossip_forward(GossipScheduler *gossip, uint8_t type, const void *payload, size_t length, size_t from);
+// Send every peer with queued messages one batch, highest priority first.
+// Whatever does not fit waits for the next tick. Returns batches sent.
+size_t gossip_tick(GossipScheduler *gossip, GossipSend send, void *user);
+size_t gossip_pending(const GossipScheduler *gossip, size_t peer);   // Queued bytes
+void gossip_stats(const GossipScheduler *gossip, GossipStats *stats);
+
+// Read the record at `*pos` in a received batch and advance past it.
+// False at the end or on a malformed record.
+bool gossip_batch_next(const uint8_t *frame, size_t length, size_t *pos, uint8_t *type, const uint8_t **payload,
+                       size_t *payload_length);
+
+#endif /* GOSSIP_H */
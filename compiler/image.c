@@ -0,0 +1,200 @@
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+static void put_le16(unsigned char *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static uint16_t get_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void header_encode(const ImageHeader *h, unsigned char *p) {
+    memcpy(p, h->magic, 4);
+    put_le16(p + 4, h->version);
+    put_le16(p + 6, h->header_size);
+    put_le32(p + 8, h->code_offset);
+    put_le32(p + 12, h->code_length);
+    put_le32(p + 16, h->pool_offset);
+    put_le32(p + 20, h->pool_length);
+    put_le32(p + 24, h->pool_address);
+    put_le32(p + 28, h->file_size);
+    memcpy(p + IMAGE_CHECKSUM_OFFSET, h->checksum, SHA256_DIGEST_LENGTH);
+}
+
+static void header_decode(const unsigned char *p, ImageHeader *h) {
+    memcpy(h->magic, p, 4);
+    h->version = get_le16(p + 4);
+    h->header_size = get_le16(p + 6);
+    h->code_offset = get_le32(p + 8);
+    h->code_length = get_le32(p + 12);
+    h->pool_offset = get_le32(p + 16);
+    h->pool_length = get_le32(p + 20);
+    h->pool_address = get_le32(p + 24);
+    h->file_size = get_le32(p + 28);
+    memcpy(h->checksum, p + IMAGE_CHECKSUM_OFFSET, SHA256_DIGEST_LENGTH);
+}
+
+// SHA-256 of the file with the checksum field read as zeros
+static void image_checksum(const unsigned char *file, size_t size, unsigned char *checksum) {
+    static const unsigned char zeros[SHA256_DIGEST_LENGTH];
+    struct iovec iov[3] = {
+        { (void*)file, IMAGE_CHECKSUM_OFFSET },
+        { (void*)zeros, sizeof(zeros) },
+        { (void*)(file + IMAGE_HEADER_SIZE), size - IMAGE_HEADER_SIZE }
+    };
+    sha256_iov(iov, 3, checksum);
+}
+
+bool image_write(const char *path, const unsigned char *code, size_t code_length,
+                 const unsigned char *pool, size_t pool_length, uint32_t pool_address) {
+    size_t code_offset = IMAGE_HEADER_SIZE;
+    size_t pool_offset = align_up(code_offset + code_length, IMAGE_PAGE_SIZE);
+    size_t file_size = align_up(pool_offset + pool_length, IMAGE_PAGE_SIZE);
+    if (file_size > UINT32_MAX) {
+        printf("Error: image too large\n");
+        return false;
+    }
+    
+    unsigned char *buffer = calloc(1, file_size);
+    if (!buffer) return false;
+    
+    ImageHeader header = { { 0 }, IMAGE_VERSION, IMAGE_HEADER_SIZE, code_offset, code_length, pool_offset,
+                           pool_length, pool_address, file_size, { 0 } };
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header_encode(&header, buffer);
+    memcpy(buffer + code_offset, code, code_length);
+    if (pool_length) memcpy(buffer + pool_offset, pool, pool_length);
+    image_checksum(buffer, file_size, buffer + IMAGE_CHECKSUM_OFFSET);
+    
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("Error: Could not create file %s\n", path);
+        free(buffer);
+        return false;
+    }
+    bool ok = fwrite(buffer, 1, file_size, f) == file_size;
+    ok = fclose(f) == 0 && ok;
+    free(buffer);
+    if (!ok) printf("Error: Could not write file %s\n", path);
+    return ok;
+}
+
+bool image_probe(const char *path) {
+    char magic[4];
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    bool match = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                 memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return match;
+}
+
+Image* image_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open file %s\n", path);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < IMAGE_HEADER_SIZE) {
+        printf("Error: %s is not a bytecode image\n", path);
+        close(fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Error: Could not map file %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    
+    // Validate the header before trusting any offsets
+    ImageHeader header;
+    header_decode(map, &header);
+    const char *problem = NULL;
+    if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) problem = "bad magic";
+    else if (header.version != IMAGE_VERSION) problem = "unsupported version";
+    else if (header.header_size != IMAGE_HEADER_SIZE || header.file_size != size) problem = "bad header";
+    else if (header.code_offset < IMAGE_HEADER_SIZE || header.pool_offset < IMAGE_HEADER_SIZE ||
+             (uint64_t)header.code_offset + header.code_length > size ||
+             (uint64_t)header.pool_offset + header.pool_length > size) problem = "section out of range";
+    else {
+        unsigned char checksum[SHA256_DIGEST_LENGTH];
+        image_checksum(map, size, checksum);
+        if (memcmp(checksum, header.checksum, sizeof(checksum)) != 0) problem = "checksum mismatch";
+    }
+    if (problem) {
+        printf("Error: invalid image %s: %s\n", path, problem);
+        munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+    
+    Image *img = malloc(sizeof(Image));
+    if (!img) {
+        munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+    img->fd = fd;
+    img->map = map;
+    img->map_size = size;
+    img->code = (const unsigned char*)map + header.code_offset;
+    img->code_length = header.code_length;
+    img->pool = (const unsigned char*)map + header.pool_offset;
+    img->pool_length = header.pool_length;
+    img->pool_address = header.pool_address;
+    img->pool_offset = header.pool_offset;
+    
+    return img;
+}
+
+void image_close(Image *img) {
+    if (img) {
+        munmap(img->map, img->map_size);
+        close(img->fd);
+        free(img);
+    }
+}
+
+bool image_map_pool(const Image *img, unsigned char *memory, size_t mem_size) {
+    if (img->pool_address > mem_size || img->pool_length > mem_size - img->pool_address) {
+        printf("Error: image string pool does not fit in VM memory\n");
+        return false;
+    }
+    if (!img->pool_length) return true;
+    
+    unsigned char *dest = memory + img->pool_address;
+    size_t span = align_up(img->pool_length, IMAGE_PAGE_SIZE);
+    if ((uintptr_t)dest % IMAGE_PAGE_SIZE == 0 && img->pool_offset % IMAGE_PAGE_SIZE == 0 &&
+        img->pool_address + span <= mem_size && sysconf(_SC_PAGESIZE) == IMAGE_PAGE_SIZE) {
+        // Padding after the pool makes the last page fully backed by the file
+        void *pages = mmap(dest, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                           img->fd, img->pool_offset);
+        if (pages != MAP_FAILED) return true;
+    }
+    memcpy(dest, img->pool, img->pool_length);
+    return true;
+}
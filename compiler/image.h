@@ -0,0 +1,68 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "crypto.h"
+
+// Precompiled bytecode image
+//
+// Layout: header, then the code section, then the string pool. The pool
+// starts on a page boundary and is padded to one, so it can be mapped
+// straight into VM memory. The header is IMAGE_HEADER_SIZE bytes, its
+// fields in the order below and little-endian, with no padding. The
+// checksum is the SHA-256 of the whole file with the checksum field
+// zeroed. The pool is a copy of VM memory, so the string headers in it
+// are in the byte order of the machine that wrote the image.
+#define IMAGE_MAGIC "CRYB"
+#define IMAGE_VERSION 2
+#define IMAGE_PAGE_SIZE 4096
+#define IMAGE_HEADER_SIZE 64
+#define IMAGE_CHECKSUM_OFFSET 32
+
+// Decoded header
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t code_offset;
+    uint32_t code_length;
+    uint32_t pool_offset;
+    uint32_t pool_length;
+    uint32_t pool_address;                  // VM memory address of the pool
+    uint32_t file_size;
+    uint8_t checksum[SHA256_DIGEST_LENGTH];
+} ImageHeader;
+
+// A loaded image; code and pool point into a read-only mapping of the file
+typedef struct {
+    int fd;
+    void *map;
+    size_t map_size;
+    const unsigned char *code;
+    size_t code_length;
+    const unsigned char *pool;
+    size_t pool_length;
+    uint32_t pool_address;
+    uint32_t pool_offset;
+} Image;
+
+// Write an image holding `code` and a string pool to be placed at
+// `pool_address` in VM memory
+bool image_write(const char *path, const unsigned char *code, size_t code_length,
+                 const unsigned char *pool, size_t pool_length, uint32_t pool_address);
+
+// Whether the file at `path` starts with the image magic
+bool image_probe(const char *path);
+
+// Map and validate an image; NULL on error
+Image* image_open(const char *path);
+void image_close(Image *img);
+
+// Place the string pool in VM memory. When the memory and pool are page
+// aligned the pool's pages are mapped copy-on-write from the file instead
+// of copied.
+bool image_map_pool(const Image *img, unsigned char *memory, size_t mem_size);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,374 @@
+#include "mempool.h"
+#include "slots.h"
+#include "expiry.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMPOOL_MIN_SLOTS 1024      // Grown past 3/4 full
+#define MEMPOOL_MIN_ENTRIES 256
+// A template stops after this many transactions in a row did not fit
+#define MEMPOOL_MAX_SKIPS 1000
+
+// Entry ids start at 1 so 0 can mean none
+typedef struct {
+    MempoolTx tx;
+    uint32_t best_pos;              // Positions in the two heaps
+    uint32_t worst_pos;
+    ExpiryLink link;                // Bucket list; `link.next` links free entries
+    uint32_t hash;
+    bool live;
+} MempoolEntry;
+
+struct Mempool {
+    MempoolEntry *entries;
+    uint32_t used;                  // Ids handed out so far
+    uint32_t capacity;
+    uint32_t free_entry;
+    
+    SlotTable index;
+    size_t count;
+    
+    uint32_t *best;                 // Max-heap by fee rate
+    uint32_t *worst;                // Min-heap by fee rate
+    uint32_t *evicting;             // Popped from `worst` while making room
+    
+    size_t bytes;
+    size_t max_bytes;
+    
+    ExpiryRing ring;
+};
+
+static MempoolEntry* entry(const Mempool *p, uint32_t id) {
+    return &p->entries[id - 1];
+}
+
+static uint32_t entry_alloc(Mempool *p) {
+    if (p->free_entry) {
+        uint32_t id = p->free_entry;
+        p->free_entry = entry(p, id)->link.next;
+        return id;
+    }
+    if (p->used == p->capacity) {
+        if (p->capacity > UINT32_MAX / 2) return 0;
+        uint32_t capacity = p->capacity * 2;
+        MempoolEntry *entries = realloc(p->entries, sizeof(MempoolEntry) * capacity);
+        if (!entries) return 0;
+        p->entries = entries;
+        uint32_t **heaps[] = { &p->best, &p->worst, &p->evicting };
+        for (int i = 0; i < 3; i++) {
+            uint32_t *heap = realloc(*heaps[i], sizeof(uint32_t) * capacity);
+            if (!heap) return 0;
+            *heaps[i] = heap;
+        }
+        p->capacity = capacity;
+    }
+    p->entries[p->used].live = false;
+    return ++p->used;
+}
+
+// txids come from peers, who can grind them to collide on any fixed bytes,
+// so the table hashes all of one with its seed
+static uint32_t txid_hash(const Mempool *p, const uint8_t *txid) {
+    return slot_hash(&p->index, txid, CODEC_HASH_SIZE, 0);
+}
+
+static bool txid_match(const void *owner, uint32_t id, const void *txid) {
+    return memcmp(entry(owner, id)->tx.txid, txid, CODEC_HASH_SIZE) == 0;
+}
+
+static ExpiryLink* entry_link(void *owner, uint32_t id) {
+    return &entry(owner, id)->link;
+}
+
+// Fee rate order, compared without division. Ties go to the earlier
+// arrival and then the lower id, so the order is total.
+static bool rate_above(const Mempool *p, uint32_t a, uint32_t b) {
+    const MempoolTx *x = &entry(p, a)->tx, *y = &entry(p, b)->tx;
+    unsigned __int128 rx = (unsigned __int128)x->fee * y->size, ry = (unsigned __int128)y->fee * x->size;
+    if (rx != ry) return rx > ry;
+    if (x->time != y->time) return x->time < y->time;
+    return a < b;
+}
+
+// `best` keeps the highest rate at its root and `worst` the lowest
+static bool heap_before(const Mempool *p, bool best, uint32_t a, uint32_t b) {
+    return best ? rate_above(p, a, b) : rate_above(p, b, a);
+}
+
+static void heap_set(Mempool *p, bool best, uint32_t pos, uint32_t id) {
+    uint32_t *heap = best ? p->best : p->worst;
+    heap[pos] = id;
+    if (best) entry(p, id)->best_pos = pos;
+    else entry(p, id)->worst_pos = pos;
+}
+
+static void heap_up(Mempool *p, bool best, uint32_t pos) {
+    uint32_t *heap = best ? p->best : p->worst;
+    uint32_t id = heap[pos];
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (!heap_before(p, best, id, heap[parent])) break;
+        heap_set(p, best, pos, heap[parent]);
+        pos = parent;
+    }
+    heap_set(p, best, pos, id);
+}
+
+static void heap_down(Mempool *p, bool best, uint32_t pos, size_t count) {
+    uint32_t *heap = best ? p->best : p->worst;
+    uint32_t id = heap[pos];
+    for (;;) {
+        size_t child = 2 * (size_t)pos + 1;
+        if (child >= count) break;
+        if (child + 1 < count && heap_before(p, best, heap[child + 1], heap[child])) child++;
+        if (!heap_before(p, best, heap[child], id)) break;
+        heap_set(p, best, pos, heap[child]);
+        pos = child;
+    }
+    heap_set(p, best, pos, id);
+}
+
+// Remove the element at `pos` from a heap of `count` elements
+static void heap_remove(Mempool *p, bool best, uint32_t pos, size_t count) {
+    uint32_t *heap = best ? p->best : p->worst;
+    uint32_t last = heap[count - 1];
+    if (pos == count - 1) return;
+    heap_set(p, best, pos, last);
+    if (pos > 0 && heap_before(p, best, last, heap[(pos - 1) / 2])) heap_up(p, best, pos);
+    else heap_down(p, best, pos, count - 1);
+}
+
+// Unlink an entry from everything but the worst heap, and free it
+static void entry_drop(Mempool *p, uint32_t id) {
+    MempoolEntry *e = entry(p, id);
+    heap_remove(p, true, e->best_pos, p->count);
+    slot_remove(&p->index, slot_find(&p->index, e->hash, txid_match, p, e->tx.txid));
+    expiry_unlink(&p->ring, id, e->tx.time);
+    p->count--;
+    p->bytes -= e->tx.size;
+    free((void*)e->tx.data);
+    e->tx.data = NULL;
+    e->live = false;
+    e->link.next = p->free_entry;
+    p->free_entry = id;
+}
+
+static void entry_remove(Mempool *p, uint32_t id) {
+    heap_remove(p, false, entry(p, id)->worst_pos, p->count);
+    entry_drop(p, id);
+}
+
+Mempool* mempool_create(size_t max_bytes, uint64_t expiry) {
+    Mempool *p = calloc(1, sizeof(Mempool));
+    if (!p) return NULL;
+    p->capacity = MEMPOOL_MIN_ENTRIES;
+    p->entries = malloc(sizeof(MempoolEntry) * p->capacity);
+    p->best = malloc(sizeof(uint32_t) * p->capacity);
+    p->worst = malloc(sizeof(uint32_t) * p->capacity);
+    p->evicting = malloc(sizeof(uint32_t) * p->capacity);
+    p->max_bytes = max_bytes;
+    if (!p->entries || !p->best || !p->worst || !p->evicting || !slot_table_init(&p->index, MEMPOOL_MIN_SLOTS) ||
+        !expiry_init(&p->ring, expiry, MEMPOOL_BUCKETS, entry_link, p)) {
+        mempool_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+void mempool_destroy(Mempool *pool) {
+    if (!pool) return;
+    for (uint32_t id = 1; id <= pool->used; id++) {
+        if (entry(pool, id)->live) free((void*)entry(pool, id)->tx.data);
+    }
+    free(pool->entries);
+    free(pool->best);
+    free(pool->worst);
+    free(pool->evicting);
+    slot_table_free(&pool->index);
+    expiry_free(&pool->ring);
+    free(pool);
+}
+
+size_t mempool_count(const Mempool *pool) {
+    return pool->count;
+}
+
+size_t mempool_bytes(const Mempool *pool) {
+    return pool->bytes;
+}
+
+const MempoolTx* mempool_find(const Mempool *pool, const uint8_t *txid) {
+    size_t i = slot_find(&pool->index, txid_hash(pool, txid), txid_match, pool, txid);
+    return i != SLOT_NONE ? &entry(pool, pool->index.slots[i].id)->tx : NULL;
+}
+
+size_t mempool_expire(Mempool *pool, uint64_t now) {
+    expiry_advance(&pool->ring, now);
+    size_t dropped = 0;
+    for (uint32_t id; (id = expiry_stale(&pool->ring)); dropped++) entry_remove(pool, id);
+    return dropped;
+}
+
+MempoolResult mempool_add(Mempool *pool, const uint8_t *txid, const uint8_t *data, size_t size, uint64_t fee,
+                          uint64_t now) {
+    mempool_expire(pool, now);
+    if (size == 0 || size > UINT32_MAX) return MEMPOOL_INVALID;
+    uint32_t hash = txid_hash(pool, txid);
+    if (slot_find(&pool->index, hash, txid_match, pool, txid) != SLOT_NONE) return MEMPOOL_DUPLICATE;
+    if (size > pool->max_bytes) return MEMPOOL_FULL;
+    
+    uint8_t *copy = NULL;
+    uint32_t id;
+    if (data && !(copy = malloc(size))) return MEMPOOL_FULL;
+    if (!slot_reserve(&pool->index, pool->count + 1) || !(id = entry_alloc(pool))) {
+        free(copy);
+        return MEMPOOL_FULL;
+    }
+    
+    // Take the cheapest transactions off the worst heap until there is
+    // room, putting them back if one pays at least as much as this one
+    size_t evicted = 0, freed = 0;
+    while (pool->bytes - freed + size > pool->max_bytes) {
+        uint32_t cheapest = pool->worst[0];
+        const MempoolTx *w = &entry(pool, cheapest)->tx;
+        if ((unsigned __int128)fee * w->size <= (unsigned __int128)w->fee * size) {
+            for (size_t i = 0; i < evicted; i++) {
+                heap_set(pool, false, pool->count - evicted + i, pool->evicting[i]);
+                heap_up(pool, false, pool->count - evicted + i);
+            }
+            entry(pool, id)->link.next = pool->free_entry;
+            pool->free_entry = id;
+            free(copy);
+            return MEMPOOL_FULL;
+        }
+        heap_remove(pool, false, 0, pool->count - evicted);
+        pool->evicting[evicted++] = cheapest;
+        freed += w->size;
+    }
+    for (size_t i = 0; i < evicted; i++) entry_drop(pool, pool->evicting[i]);
+    
+    if (copy) memcpy(copy, data, size);
+    MempoolEntry *e = entry(pool, id);
+    memcpy(e->tx.txid, txid, CODEC_HASH_SIZE);
+    e->tx.fee = fee;
+    e->tx.size = (uint32_t)size;
+    e->tx.time = pool->ring.latest;
+    e->tx.data = copy;
+    e->hash = hash;
+    e->live = true;
+    
+    slot_insert(&pool->index, id, hash);
+    heap_set(pool, true, pool->count, id);
+    heap_up(pool, true, pool->count);
+    heap_set(pool, false, pool->count, id);
+    heap_up(pool, false, pool->count);
+    expiry_append(&pool->ring, id, e->tx.time);
+    pool->count++;
+    pool->bytes += size;
+    return MEMPOOL_ADDED;
+}
+
+MempoolResult mempool_add_tx(Mempool *pool, const uint8_t *data, size_t size, uint64_t now) {
+    Transaction tx;
+    size_t n = codec_decode(&transaction_schema, data, size, &tx);
+    if (!n || n != size) return MEMPOOL_INVALID;
+    
+    // Coinbase transactions only appear in blocks
+    uint64_t in = 0, out = 0;
+    size_t pos = 0;
+    TxInput input;
+    while (codec_list_next(&tx_input_schema, &tx.inputs, &pos, &input)) {
+        if (input.amount > UINT64_MAX - in) return MEMPOOL_INVALID;
+        in += input.amount;
+    }
+    TxOutput output;
+    pos = 0;
+    while (codec_list_next(&tx_output_schema, &tx.outputs, &pos, &output)) {
+        if (output.amount > UINT64_MAX - out) return MEMPOOL_INVALID;
+        out += output.amount;
+    }
+    if (!tx.inputs.count || in < out) return MEMPOOL_INVALID;
+    
+    uint8_t txid[CODEC_HASH_SIZE];
+    if (!tx_hash(&tx, txid)) return MEMPOOL_INVALID;
+    return mempool_add(pool, txid, data, size, in - out, now);
+}
+
+bool mempool_remove(Mempool *pool, const uint8_t *txid) {
+    size_t i = slot_find(&pool->index, txid_hash(pool, txid), txid_match, pool, txid);
+    if (i == SLOT_NONE) return false;
+    entry_remove(pool, pool->index.slots[i].id);
+    return true;
+}
+
+size_t mempool_remove_block(Mempool *pool, const Block *block) {
+    const CodecList *list = &block->transactions;
+    const ByteSlice *items = list->items;
+    size_t removed = 0, pos = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        ByteSlice slice;
+        if (items) slice = items[i];
+        else if (!codec_list_next(NULL, list, &pos, &slice)) break;
+    
+        Transaction tx;
+        uint8_t txid[CODEC_HASH_SIZE];
+        size_t n = codec_decode(&transaction_schema, slice.data, slice.length, &tx);
+        if (n && n == slice.length && tx_hash(&tx, txid) && mempool_remove(pool, txid)) removed++;
+    }
+    return removed;
+}
+
+// Order of heap positions in the template frontier
+static bool frontier_before(const Mempool *p, uint32_t a, uint32_t b) {
+    return rate_above(p, p->best[a], p->best[b]);
+}
+
+size_t mempool_template(const Mempool *pool, size_t max_bytes, const MempoolTx **out, size_t max) {
+    // Best-first walk of the heap: a heap's top k are within the frontier
+    // of the k nodes taken so far, kept in a max-heap of heap positions
+    size_t capacity = 64, frontier_count = 0, n = 0, skips = 0;
+    uint32_t *frontier = malloc(sizeof(uint32_t) * capacity);
+    if (!frontier) return 0;
+    if (pool->count) frontier[frontier_count++] = 0;
+    
+    while (frontier_count && n < max && max_bytes && skips < MEMPOOL_MAX_SKIPS) {
+        uint32_t top = frontier[0];
+        uint32_t last = frontier[--frontier_count];
+        size_t i = 0;
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= frontier_count) break;
+            if (child + 1 < frontier_count && frontier_before(pool, frontier[child + 1], frontier[child])) child++;
+            if (!frontier_before(pool, frontier[child], last)) break;
+            frontier[i] = frontier[child];
+            i = child;
+        }
+        if (frontier_count) frontier[i] = last;
+    
+        const MempoolTx *tx = &entry(pool, pool->best[top])->tx;
+        if (tx->size <= max_bytes) {
+            out[n++] = tx;
+            max_bytes -= tx->size;
+            skips = 0;
+        } else {
+            skips++;
+        }
+    
+        if (frontier_count + 2 > capacity) {
+            uint32_t *grown = realloc(frontier, sizeof(uint32_t) * capacity * 2);
+            if (!grown) break;
+            frontier = grown;
+            capacity *= 2;
+        }
+        for (size_t child = 2 * (size_t)top + 1; child <= 2 * (size_t)top + 2 && child < pool->count; child++) {
+            size_t j = frontier_count++;
+            while (j > 0 && frontier_before(pool, child, frontier[(j - 1) / 2])) {
+                frontier[j] = frontier[(j - 1) / 2];
+                j = (j - 1) / 2;
+            }
+            frontier[j] = (uint32_t)child;
+        }
+    }
+    free(frontier);
+    return n;
+}
@@ -0,0 +1,71 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "codec.h"
+
+// Pending transactions
+//
+// Transactions are indexed by txid in an open-addressed table and ordered
+// by fee rate (fee per encoded byte) in two binary heaps: a max-heap that
+// block templates are read from and a min-heap whose root is the next to
+// evict when the pool is over its byte limit. Arrival times fall into
+// buckets of expiry / MEMPOOL_BUCKETS seconds, so expiring old
+// transactions only visits the buckets that have aged out.
+//
+// Dependencies between pending transactions are not tracked; the caller
+// checks inputs against the UTXO set before adding.
+#define MEMPOOL_BUCKETS 64
+#define MEMPOOL_DEFAULT_BYTES (32 * 1024 * 1024)
+#define MEMPOOL_DEFAULT_EXPIRY (72 * 3600)
+
+typedef struct {
+    uint8_t txid[CODEC_HASH_SIZE];
+    uint64_t fee;
+    uint32_t size;                  // Encoded bytes
+    uint64_t time;                  // Arrival, in the caller's clock
+    const uint8_t *data;            // Copy of the encoding, if one was given
+} MempoolTx;
+
+typedef enum {
+    MEMPOOL_ADDED,
+    MEMPOOL_DUPLICATE,
+    MEMPOOL_INVALID,                // Does not decode, or spends less than it creates
+    MEMPOOL_FULL                    // Fee rate too low to displace anything
+} MempoolResult;
+
+typedef struct Mempool Mempool;
+
+Mempool* mempool_create(size_t max_bytes, uint64_t expiry);
+void mempool_destroy(Mempool *pool);
+size_t mempool_count(const Mempool *pool);
+size_t mempool_bytes(const Mempool *pool);
+
+// Pointers into the pool are valid until the next add or remove
+const MempoolTx* mempool_find(const Mempool *pool, const uint8_t *txid);
+
+// Add a transaction of `size` bytes; `data` (may be NULL) is copied. If
+// the pool would go over its limit, transactions with a lower fee rate
+// are evicted, cheapest first; if that is not enough nothing is evicted
+// and the result is MEMPOOL_FULL. Times must not go backwards: an earlier
+// `now` is treated as the latest time seen.
+MempoolResult mempool_add(Mempool *pool, const uint8_t *txid, const uint8_t *data, size_t size, uint64_t fee,
+                          uint64_t now);
+// Add an encoded transaction, taking its fee as inputs minus outputs
+MempoolResult mempool_add_tx(Mempool *pool, const uint8_t *data, size_t size, uint64_t now);
+bool mempool_remove(Mempool *pool, const uint8_t *txid);
+// Remove the transactions a block confirmed; returns how many were pending
+size_t mempool_remove_block(Mempool *pool, const Block *block);
+// Drop transactions older than the expiry. Expiry is bucketed, so a
+// transaction goes between expiry and expiry plus one bucket after it
+// arrived. Returns how many were dropped.
+size_t mempool_expire(Mempool *pool, uint64_t now);
+
+// Highest fee-rate transactions fitting in `max_bytes`, best first.
+// Transactions too large for the space left are skipped. Reads the heap
+// without changing it, in O(k log k) for k transactions visited.
+size_t mempool_template(const Mempool *pool, size_t max_bytes, const MempoolTx **out, size_t max);
+
+#endif /* MEMPOOL_H */
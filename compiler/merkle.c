@@ -0,0 +1,277 @@
+#include "merkle.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Parent hashes go through sha256_finish_many: the two children are
+// adjacent in their level, so each parent's 64-byte input is read in place
+// and several parents are hashed at once on the lane-parallel kernels.
+#define MERKLE_BATCH 64
+// Levels smaller than this are hashed on one thread
+#define MERKLE_PARALLEL_MIN 2048
+
+static SHA256Midstate merkle_iv;
+static pthread_once_t merkle_iv_once = PTHREAD_ONCE_INIT;
+
+static void merkle_iv_init(void) {
+    sha256_midstate(NULL, 0, &merkle_iv);
+}
+
+static int merkle_threads(int threads) {
+    if (threads > 0) return threads;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static bool level_reserve(MerkleLevel *level, size_t count) {
+    if (count <= level->capacity) return true;
+    size_t capacity = level->capacity ? level->capacity : 16;
+    while (capacity < count) capacity *= 2;
+    MerkleHash *nodes = realloc(level->nodes, sizeof(MerkleHash) * capacity);
+    if (!nodes) return false;
+    level->nodes = nodes;
+    level->capacity = capacity;
+    return true;
+}
+
+// Hash parents [start, end) of `child` into `parent`
+static void hash_parents(const MerkleLevel *child, MerkleHash *parent, size_t start, size_t end) {
+    const unsigned char *inputs[MERKLE_BATCH];
+    unsigned char odd[2 * MERKLE_HASH_SIZE];
+    
+    for (size_t base = start; base < end; base += MERKLE_BATCH) {
+        size_t n = end - base < MERKLE_BATCH ? end - base : MERKLE_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            size_t left = 2 * (base + i);
+            if (left + 1 < child->count) {
+                inputs[i] = child->nodes[left];
+            } else {
+                memcpy(odd, child->nodes[left], MERKLE_HASH_SIZE);
+                memcpy(odd + MERKLE_HASH_SIZE, child->nodes[left], MERKLE_HASH_SIZE);
+                inputs[i] = odd;
+            }
+        }
+        sha256_finish_many(&merkle_iv, inputs, 2 * MERKLE_HASH_SIZE, &parent[base], n);
+    }
+}
+
+MerkleTree* merkle_create(void) {
+    pthread_once(&merkle_iv_once, merkle_iv_init);
+    return calloc(1, sizeof(MerkleTree));
+}
+
+void merkle_destroy(MerkleTree *tree) {
+    if (tree) {
+        for (int i = 0; i < MERKLE_MAX_DEPTH; i++) free(tree->levels[i].nodes);
+        free(tree);
+    }
+}
+
+size_t merkle_leaf_count(const MerkleTree *tree) {
+    return tree->height ? tree->levels[0].count : 0;
+}
+
+// One build's workers. They are started once per build and hash their
+// share of every level big enough to split, meeting after each level. The
+// smaller levels at the top are finished by the caller alone.
+typedef struct {
+    MerkleTree *tree;
+    int shares;                     // Each split level is divided this many ways
+    int split_height;               // Levels [1, split_height) are split
+    pthread_mutex_t lock;
+    pthread_cond_t level_done;
+    int arrived;                    // Threads finished with the current level
+    int participants;               // The caller and the workers that started
+    unsigned level;                 // Bumped each time all have arrived
+} BuildJob;
+
+typedef struct {
+    BuildJob *build;
+    int share;
+} BuildWorker;
+
+static void hash_share(BuildJob *b, int h, int share) {
+    const MerkleLevel *child = &b->tree->levels[h - 1];
+    MerkleLevel *parent = &b->tree->levels[h];
+    hash_parents(child, parent->nodes, parent->count * share / b->shares, parent->count * (share + 1) / b->shares);
+}
+
+// Wait until every participant has finished the current level
+static void build_meet(BuildJob *b) {
+    pthread_mutex_lock(&b->lock);
+    unsigned level = b->level;
+    if (++b->arrived == b->participants) {
+        b->arrived = 0;
+        b->level++;
+        pthread_cond_broadcast(&b->level_done);
+    } else {
+        while (b->level == level) pthread_cond_wait(&b->level_done, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void* build_worker(void *arg) {
+    BuildWorker *w = arg;
+    for (int h = 1; h < w->build->split_height; h++) {
+        hash_share(w->build, h, w->share);
+        build_meet(w->build);
+    }
+    return NULL;
+}
+
+bool merkle_build(MerkleTree *tree, const MerkleHash *leaves, size_t count, int threads) {
+    // Size every level first
+    tree->height = 0;
+    for (size_t n = count; n > 0; n = n == 1 ? 0 : (n + 1) / 2) {
+        if (tree->height == MERKLE_MAX_DEPTH || !level_reserve(&tree->levels[tree->height], n)) {
+            tree->height = 0;
+            return false;
+        }
+        tree->levels[tree->height++].count = n;
+    }
+    if (count == 0) return true;
+    memcpy(tree->levels[0].nodes, leaves, sizeof(MerkleHash) * count);
+    
+    BuildJob build = { .tree = tree, .shares = merkle_threads(threads), .split_height = 1 };
+    while (build.split_height < tree->height && tree->levels[build.split_height].count >= MERKLE_PARALLEL_MIN) {
+        build.split_height++;
+    }
+    if (build.shares > 1 && build.split_height > 1) {
+        BuildWorker workers[build.shares];
+        pthread_t ids[build.shares];
+        bool started[build.shares];
+        pthread_mutex_init(&build.lock, NULL);
+        pthread_cond_init(&build.level_done, NULL);
+        build.participants = build.shares;
+    
+        // No worker can get past a level before the caller arrives, so the
+        // count can still drop for threads that failed to start
+        for (int i = 1; i < build.shares; i++) {
+            workers[i] = (BuildWorker){ &build, i };
+            started[i] = pthread_create(&ids[i], NULL, build_worker, &workers[i]) == 0;
+            if (!started[i]) {
+                pthread_mutex_lock(&build.lock);
+                build.participants--;
+                pthread_mutex_unlock(&build.lock);
+            }
+        }
+        // The caller takes the first share and any share whose thread
+        // failed to start
+        for (int h = 1; h < build.split_height; h++) {
+            hash_share(&build, h, 0);
+            for (int i = 1; i < build.shares; i++) {
+                if (!started[i]) hash_share(&build, h, i);
+            }
+            build_meet(&build);
+        }
+        for (int i = 1; i < build.shares; i++) {
+            if (started[i]) pthread_join(ids[i], NULL);
+        }
+        pthread_cond_destroy(&build.level_done);
+        pthread_mutex_destroy(&build.lock);
+    } else {
+        build.split_height = 1;
+    }
+    
+    for (int h = build.split_height; h < tree->height; h++) {
+        hash_parents(&tree->levels[h - 1], tree->levels[h].nodes, 0, tree->levels[h].count);
+    }
+    return true;
+}
+
+bool merkle_append(MerkleTree *tree, const MerkleHash leaf) {
+    size_t index = merkle_leaf_count(tree);
+    if (!level_reserve(&tree->levels[0], index + 1)) return false;
+    memcpy(tree->levels[0].nodes[index], leaf, MERKLE_HASH_SIZE);
+    tree->levels[0].count = index + 1;
+    if (tree->height == 0) tree->height = 1;
+    
+    // Rehash the new leaf's ancestors, growing levels where needed
+    for (int h = 1; tree->levels[h - 1].count > 1; h++) {
+        if (h == MERKLE_MAX_DEPTH) return false;
+        MerkleLevel *parent = &tree->levels[h];
+        size_t count = (tree->levels[h - 1].count + 1) / 2;
+        if (!level_reserve(parent, count)) return false;
+        parent->count = count;
+        index /= 2;
+        hash_parents(&tree->levels[h - 1], parent->nodes, index, index + 1);
+        if (h >= tree->height) tree->height = h + 1;
+    }
+    return true;
+}
+
+bool merkle_root(const MerkleTree *tree, MerkleHash root) {
+    if (tree->height == 0) return false;
+    memcpy(root, tree->levels[tree->height - 1].nodes[0], MERKLE_HASH_SIZE);
+    return true;
+}
+
+int merkle_proof(const MerkleTree *tree, size_t index, MerkleHash *siblings, int max) {
+    if (index >= merkle_leaf_count(tree) || tree->height - 1 > max) return -1;
+    
+    for (int h = 0; h < tree->height - 1; h++) {
+        const MerkleLevel *level = &tree->levels[h];
+        size_t sibling = index ^ 1;
+        // The last node of an odd level is paired with itself
+        if (sibling >= level->count) sibling = index;
+        memcpy(siblings[h], level->nodes[sibling], MERKLE_HASH_SIZE);
+        index /= 2;
+    }
+    return tree->height - 1;
+}
+
+bool merkle_verify(const MerkleHash leaf, size_t index, const MerkleHash *siblings, int depth,
+                   const MerkleHash root) {
+    unsigned char pair[2 * MERKLE_HASH_SIZE];
+    MerkleHash node;
+    memcpy(node, leaf, MERKLE_HASH_SIZE);
+    
+    for (int h = 0; h < depth; h++) {
+        if (index & 1) {
+            memcpy(pair, siblings[h], MERKLE_HASH_SIZE);
+            memcpy(pair + MERKLE_HASH_SIZE, node, MERKLE_HASH_SIZE);
+        } else {
+            memcpy(pair, node, MERKLE_HASH_SIZE);
+            memcpy(pair + MERKLE_HASH_SIZE, siblings[h], MERKLE_HASH_SIZE);
+        }
+        sha256(pair, sizeof(pair), node);
+        index /= 2;
+    }
+    return index == 0 && memcmp(node, root, MERKLE_HASH_SIZE) == 0;
+}
+
+typedef struct {
+    const struct iovec *items;
+    MerkleHash *leaves;
+    size_t start;
+    size_t end;
+} LeafJob;
+
+static void* leaf_worker(void *arg) {
+    LeafJob *job = arg;
+    for (size_t i = job->start; i < job->end; i++) {
+        sha256_iov(&job->items[i], 1, job->leaves[i]);
+    }
+    return NULL;
+}
+
+void merkle_hash_leaves(const struct iovec *items, size_t count, MerkleHash *leaves, int threads) {
+    threads = merkle_threads(threads);
+    if (count < MERKLE_PARALLEL_MIN) threads = 1;
+    
+    LeafJob jobs[threads];
+    pthread_t ids[threads];
+    bool started[threads];
+    for (int i = 0; i < threads; i++) {
+        jobs[i] = (LeafJob){ items, leaves, count * i / threads, count * (i + 1) / threads };
+        started[i] = i > 0 && pthread_create(&ids[i], NULL, leaf_worker, &jobs[i]) == 0;
+    }
+    // The caller takes the first share and any share whose thread failed
+    for (int i = 0; i < threads; i++) {
+        if (!started[i]) leaf_worker(&jobs[i]);
+    }
+    for (int i = 1; i < threads; i++) {
+        if (started[i]) pthread_join(ids[i], NULL);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "crypto.h"
+
+// Binary Merkle tree over 32-byte leaf hashes. An internal node is
+// SHA-256(left || right); a level with an odd number of nodes pairs its
+// last node with itself. A single leaf is its own root.
+//
+// Every level is kept, so appending a leaf rehashes only the O(log n)
+// nodes on its path and a proof is one lookup per level.
+#define MERKLE_HASH_SIZE SHA256_DIGEST_LENGTH
+#define MERKLE_MAX_DEPTH 64
+
+typedef uint8_t MerkleHash[MERKLE_HASH_SIZE];
+
+typedef struct {
+    MerkleHash *nodes;
+    size_t count;
+    size_t capacity;
+} MerkleLevel;
+
+typedef struct {
+    MerkleLevel levels[MERKLE_MAX_DEPTH];   // levels[0] holds the leaves
+    int height;                             // Levels in use
+} MerkleTree;
+
+MerkleTree* merkle_create(void);
+void merkle_destroy(MerkleTree *tree);
+size_t merkle_leaf_count(const MerkleTree *tree);
+
+// Replace the tree's contents with `count` leaves, hashing each level
+// across `threads` threads (<= 0 uses all online CPUs)
+bool merkle_build(MerkleTree *tree, const MerkleHash *leaves, size_t count, int threads);
+// Add one leaf, updating only the path to the root
+bool merkle_append(MerkleTree *tree, const MerkleHash leaf);
+// Root hash; false for an empty tree
+bool merkle_root(const MerkleTree *tree, MerkleHash root);
+
+// Sibling hashes from the leaf up; returns how many were written (the
+// tree's depth), or -1 if the index is out of range or max is too small
+int merkle_proof(const MerkleTree *tree, size_t index, MerkleHash *siblings, int max);
+bool merkle_verify(const MerkleHash leaf, size_t index, const MerkleHash *siblings, int depth,
+                   const MerkleHash root);
+
+// SHA-256 of each item into leaves[i], across `threads` threads
+void merkle_hash_leaves(const struct iovec *items, size_t count, MerkleHash *leaves, int threads);
+
+#endif /* MERKLE_H */
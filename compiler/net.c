@@ -0,0 +1,679 @@
+#define _GNU_SOURCE         // accept4
+#include "net.h"
+#include "crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define NET_RING_MIN 4096           // Power of two
+#define NET_READ_CHUNK 16384        // Read per readable event, for fairness between peers
+#define NET_EVENTS 256              // epoll_wait batch
+#define NET_ACCEPT_BATCH 16         // Accepts per wakeup, so other loops get a share
+#define NET_QUEUE_MIN 16            // Power of two
+#define NET_IOV_MAX 64              // Frames per writev
+
+// Bytes live in [head, tail); positions only grow and are taken modulo
+// the capacity
+typedef struct {
+    uint8_t *data;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} NetRing;
+
+// A frame, header included, shared by every queue it is on
+struct NetBuffer {
+    atomic_uint refs;
+    size_t size;
+    uint8_t data[];
+};
+
+// Output queue: a ring of frame references, the first `offset` bytes of
+// the head frame already written
+typedef struct {
+    NetBuffer **frames;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    size_t offset;
+    size_t bytes;                   // Not yet written
+} NetQueue;
+
+typedef struct {
+    NetBuffer *buffer;
+    const NetPeer *except;
+} NetPost;
+
+typedef struct NetLoop NetLoop;
+
+struct NetPeer {
+    NetLoop *loop;
+    int fd;
+    uint32_t events;                // Interest registered with epoll
+    bool connecting;
+    bool paused;                    // Not reading until output drains
+    bool closed;
+    NetRing in;
+    NetQueue out;
+    void *context;
+    NetPeer *prev;                  // Loop's peer list
+    NetPeer *next;
+    NetPeer *next_closed;
+};
+
+struct NetLoop {
+    NetReactor *reactor;
+    int epoll_fd;
+    int wake_fd;                    // eventfd written by net_reactor_stop
+    pthread_t thread;
+    pthread_mutex_t lock;           // Guards `peers` and `posts`
+    NetPeer *peers;
+    NetPost *posts;                 // Broadcasts from net_broadcast
+    size_t post_count;
+    size_t post_capacity;
+    NetPeer *closed;                // Freed after the current event batch
+    uint8_t *scratch;               // Payloads that wrap around the input ring
+    NetStats stats;
+};
+
+struct NetReactor {
+    NetLoop loops[NET_MAX_LOOPS];
+    int loop_count;
+    NetHandlers handlers;
+    int listen_fd;
+    atomic_bool stopping;
+    atomic_uint next_loop;
+};
+
+static size_t ring_used(const NetRing *r) {
+    return r->tail - r->head;
+}
+
+// Make room for `extra` more bytes, growing to a power of two and
+// straightening the contents
+static bool ring_reserve(NetRing *r, size_t extra) {
+    size_t used = ring_used(r);
+    if (used + extra <= r->capacity) return true;
+    size_t capacity = r->capacity ? r->capacity : NET_RING_MIN;
+    while (capacity < used + extra) capacity *= 2;
+    uint8_t *data = malloc(capacity);
+    if (!data) return false;
+    for (size_t i = 0; i < used; ) {
+        size_t at = (r->head + i) % r->capacity;
+        size_t n = r->capacity - at < used - i ? r->capacity - at : used - i;
+        memcpy(data + i, r->data + at, n);
+        i += n;
+    }
+    free(r->data);
+    r->data = data;
+    r->capacity = capacity;
+    r->head = 0;
+    r->tail = used;
+    return true;
+}
+
+// Up to two segments covering the free space
+static int ring_free_segments(const NetRing *r, struct iovec *iov) {
+    size_t length = r->capacity - ring_used(r);
+    if (!length) return 0;
+    size_t at = r->tail % r->capacity;
+    size_t first = r->capacity - at < length ? r->capacity - at : length;
+    iov[0] = (struct iovec){ r->data + at, first };
+    if (first == length) return 1;
+    iov[1] = (struct iovec){ r->data, length - first };
+    return 2;
+}
+
+static void ring_copy_out(const NetRing *r, size_t offset, void *dst, size_t n) {
+    size_t at = (r->head + offset) % r->capacity;
+    size_t first = r->capacity - at < n ? r->capacity - at : n;
+    memcpy(dst, r->data + at, first);
+    memcpy((uint8_t*)dst + first, r->data, n - first);
+}
+
+static uint32_t frame_checksum(const uint8_t *payload, size_t length) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    sha256(payload, length, digest);
+    return digest[0] | digest[1] << 8 | digest[2] << 16 | (uint32_t)digest[3] << 24;
+}
+
+NetBuffer* net_buffer_create(uint8_t type, const void *payload, size_t length) {
+    if (length > NET_MAX_FRAME) return NULL;
+    NetBuffer *buffer = malloc(sizeof(NetBuffer) + NET_HEADER_SIZE + length);
+    if (!buffer) return NULL;
+    atomic_init(&buffer->refs, 1);
+    buffer->size = NET_HEADER_SIZE + length;
+    uint32_t checksum = frame_checksum(payload, length);
+    uint8_t header[NET_HEADER_SIZE] = {
+        type, (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16),
+        (uint8_t)checksum, (uint8_t)(checksum >> 8), (uint8_t)(checksum >> 16), (uint8_t)(checksum >> 24)
+    };
+    memcpy(buffer->data, header, sizeof(header));
+    if (length) memcpy(buffer->data + NET_HEADER_SIZE, payload, length);
+    return buffer;
+}
+
+NetBuffer* net_buffer_retain(NetBuffer *buffer) {
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+    return buffer;
+}
+
+void net_buffer_release(NetBuffer *buffer) {
+    if (buffer && atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1) free(buffer);
+}
+
+static bool queue_push(NetQueue *q, NetBuffer *buffer) {
+    if (q->tail - q->head == q->capacity) {
+        size_t capacity = q->capacity ? q->capacity * 2 : NET_QUEUE_MIN;
+        NetBuffer **frames = malloc(sizeof(NetBuffer*) * capacity);
+        if (!frames) return false;
+        for (size_t i = q->head; i < q->tail; i++) frames[i - q->head] = q->frames[i % q->capacity];
+        free(q->frames);
+        q->frames = frames;
+        q->tail -= q->head;
+        q->head = 0;
+        q->capacity = capacity;
+    }
+    q->frames[q->tail++ % q->capacity] = net_buffer_retain(buffer);
+    q->bytes += buffer->size;
+    return true;
+}
+
+// Drop `n` written bytes from the front of the queue
+static void queue_consume(NetQueue *q, size_t n) {
+    q->bytes -= n;
+    while (n) {
+        NetBuffer *first = q->frames[q->head % q->capacity];
+        size_t left = first->size - q->offset;
+        if (n < left) {
+            q->offset += n;
+            return;
+        }
+        n -= left;
+        q->offset = 0;
+        q->head++;
+        net_buffer_release(first);
+    }
+}
+
+static void queue_free(NetQueue *q) {
+    for (size_t i = q->head; i < q->tail; i++) net_buffer_release(q->frames[i % q->capacity]);
+    free(q->frames);
+}
+
+static void peer_update_events(NetPeer *peer) {
+    uint32_t events = peer->paused || peer->connecting ? 0 : EPOLLIN;
+    if (peer->connecting || peer->out.bytes) events |= EPOLLOUT;
+    if (events == peer->events) return;
+    struct epoll_event ev = { .events = events, .data.ptr = peer };
+    epoll_ctl(peer->loop->epoll_fd, EPOLL_CTL_MOD, peer->fd, &ev);
+    peer->events = events;
+}
+
+// Take a peer out of the loop's list, wherever other threads have put it
+static void peer_unlink(NetLoop *loop, NetPeer *peer) {
+    pthread_mutex_lock(&loop->lock);
+    if (peer->prev) peer->prev->next = peer->next;
+    else loop->peers = peer->next;
+    if (peer->next) peer->next->prev = peer->prev;
+    pthread_mutex_unlock(&loop->lock);
+}
+
+static NetPeer* peer_add(NetLoop *loop, int fd, bool connecting, void *context) {
+    NetPeer *peer = calloc(1, sizeof(NetPeer));
+    if (!peer) return NULL;
+    peer->loop = loop;
+    peer->fd = fd;
+    peer->connecting = connecting;
+    peer->context = context;
+    peer->events = connecting ? EPOLLOUT : EPOLLIN;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    pthread_mutex_lock(&loop->lock);
+    peer->next = loop->peers;
+    if (loop->peers) loop->peers->prev = peer;
+    loop->peers = peer;
+    pthread_mutex_unlock(&loop->lock);
+    
+    // The loop may see events for the peer as soon as it is registered
+    struct epoll_event ev = { .events = peer->events, .data.ptr = peer };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        // Peers added since may sit in front of this one
+        peer_unlink(loop, peer);
+        free(peer);
+        return NULL;
+    }
+    return peer;
+}
+
+static void peer_free(NetPeer *peer) {
+    free(peer->in.data);
+    queue_free(&peer->out);
+    free(peer);
+}
+
+void net_close(NetPeer *peer) {
+    if (peer->closed) return;
+    NetLoop *loop = peer->loop;
+    peer->closed = true;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, peer->fd, NULL);
+    close(peer->fd);
+    peer_unlink(loop, peer);
+    
+    // Later events in this batch may still point at the peer
+    peer->next_closed = loop->closed;
+    loop->closed = peer;
+    NetHandlers *h = &loop->reactor->handlers;
+    if (h->on_close) h->on_close(peer, h->user);
+}
+
+static void peer_fail(NetPeer *peer) {
+    peer->loop->stats.errors++;
+    net_close(peer);
+}
+
+// Write as much queued output as the socket takes
+static void peer_flush(NetPeer *peer) {
+    NetStats *stats = &peer->loop->stats;
+    NetQueue *q = &peer->out;
+    while (q->bytes) {
+        // Gather frames straight from their shared buffers
+        struct iovec iov[NET_IOV_MAX];
+        int count = 0;
+        for (size_t i = q->head; i < q->tail && count < NET_IOV_MAX; i++) {
+            NetBuffer *frame = q->frames[i % q->capacity];
+            size_t skip = i == q->head ? q->offset : 0;
+            iov[count++] = (struct iovec){ frame->data + skip, frame->size - skip };
+        }
+        ssize_t n = writev(peer->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) peer_fail(peer);
+            break;
+        }
+        queue_consume(q, n);
+        stats->bytes_out += n;
+    }
+    if (peer->closed) return;
+    if (peer->paused && q->bytes <= NET_WRITE_LOW) peer->paused = false;
+    peer_update_events(peer);
+}
+
+bool net_send(NetPeer *peer, uint8_t type, const void *payload, size_t length) {
+    if (peer->closed || length > NET_MAX_FRAME || peer->out.bytes + NET_HEADER_SIZE + length > NET_WRITE_LIMIT) {
+        return false;
+    }
+    NetBuffer *buffer = net_buffer_create(type, payload, length);
+    if (!buffer) return false;
+    bool queued = net_send_buffer(peer, buffer);
+    net_buffer_release(buffer);
+    return queued;
+}
+
+bool net_send_buffer(NetPeer *peer, NetBuffer *buffer) {
+    size_t pending = peer->out.bytes;
+    if (peer->closed || pending + buffer->size > NET_WRITE_LIMIT || !queue_push(&peer->out, buffer)) return false;
+    peer->loop->stats.frames_out++;
+    
+    if (peer->out.bytes >= NET_WRITE_HIGH && !peer->paused) {
+        peer->paused = true;
+        peer->loop->stats.paused++;
+    }
+    // Try at once when nothing was queued; otherwise EPOLLOUT is already set
+    if (!pending && !peer->connecting) peer_flush(peer);
+    else peer_update_events(peer);
+    return true;
+}
+
+// Deliver every complete frame in the input ring
+static void peer_parse(NetPeer *peer) {
+    NetLoop *loop = peer->loop;
+    NetHandlers *h = &loop->reactor->handlers;
+    NetRing *in = &peer->in;
+    while (!peer->closed && ring_used(in) >= NET_HEADER_SIZE) {
+        uint8_t header[NET_HEADER_SIZE];
+        ring_copy_out(in, 0, header, sizeof(header));
+        size_t length = header[1] | header[2] << 8 | (size_t)header[3] << 16;
+        uint32_t checksum = header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24;
+        if (length > NET_MAX_FRAME || header[0] == 0) {
+            peer_fail(peer);
+            return;
+        }
+        if (ring_used(in) < NET_HEADER_SIZE + length) {
+            // Room for the rest of the frame before reading again
+            if (!ring_reserve(in, NET_HEADER_SIZE + length - ring_used(in))) peer_fail(peer);
+            return;
+        }
+    
+        size_t at = (in->head + NET_HEADER_SIZE) % in->capacity;
+        const uint8_t *payload = in->data + at;
+        if (at + length > in->capacity) {
+            ring_copy_out(in, NET_HEADER_SIZE, loop->scratch, length);
+            payload = loop->scratch;
+        }
+        if (frame_checksum(payload, length) != checksum) {
+            peer_fail(peer);
+            return;
+        }
+        in->head += NET_HEADER_SIZE + length;
+        loop->stats.frames_in++;
+        if (h->on_frame) h->on_frame(peer, header[0], payload, length, h->user);
+    }
+    if (!peer->closed && !ring_used(in)) in->head = in->tail = 0;
+}
+
+static void peer_read(NetPeer *peer) {
+    NetRing *in = &peer->in;
+    if (!ring_reserve(in, ring_used(in) ? 1 : NET_READ_CHUNK)) {
+        peer_fail(peer);
+        return;
+    }
+    struct iovec iov[2];
+    int count = ring_free_segments(in, iov);
+    if (iov[0].iov_len > NET_READ_CHUNK) {
+        iov[0].iov_len = NET_READ_CHUNK;
+        count = 1;
+    } else if (count == 2 && iov[0].iov_len + iov[1].iov_len > NET_READ_CHUNK) {
+        iov[1].iov_len = NET_READ_CHUNK - iov[0].iov_len;
+    }
+    ssize_t n = readv(peer->fd, iov, count);
+    if (n == 0) {
+        net_close(peer);
+        return;
+    }
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) peer_fail(peer);
+        return;
+    }
+    in->tail += n;
+    peer->loop->stats.bytes_in += n;
+    peer_parse(peer);
+}
+
+static void peer_connected(NetPeer *peer) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
+        peer_fail(peer);
+        return;
+    }
+    peer->connecting = false;
+    NetHandlers *h = &peer->loop->reactor->handlers;
+    if (h->on_open) h->on_open(peer, h->user);
+    if (!peer->closed) peer_flush(peer);
+}
+
+static void loop_accept(NetLoop *loop) {
+    NetReactor *r = loop->reactor;
+    for (int i = 0; i < NET_ACCEPT_BATCH; i++) {
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // Another loop may have taken the connection
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        NetPeer *peer = peer_add(loop, fd, false, NULL);
+        if (!peer) {
+            close(fd);
+            continue;
+        }
+        loop->stats.accepted++;
+        if (r->handlers.on_open) r->handlers.on_open(peer, r->handlers.user);
+    }
+}
+
+// Queue posted broadcasts on every open peer of the loop
+static void loop_deliver(NetLoop *loop) {
+    pthread_mutex_lock(&loop->lock);
+    NetPost *posts = loop->posts;
+    size_t count = loop->post_count;
+    loop->posts = NULL;
+    loop->post_count = loop->post_capacity = 0;
+    pthread_mutex_unlock(&loop->lock);
+    
+    for (size_t i = 0; i < count; i++) {
+        // Peers are only unlinked on this thread and net_connect only adds
+        // at the head, so the list can be walked without the lock
+        pthread_mutex_lock(&loop->lock);
+        NetPeer *peer = loop->peers;
+        pthread_mutex_unlock(&loop->lock);
+        while (peer) {
+            NetPeer *next = peer->next;
+            if (peer != posts[i].except && !peer->connecting) net_send_buffer(peer, posts[i].buffer);
+            peer = next;
+        }
+        net_buffer_release(posts[i].buffer);
+    }
+    free(posts);
+}
+
+static void *loop_run(void *arg) {
+    NetLoop *loop = arg;
+    NetReactor *r = loop->reactor;
+    struct epoll_event events[NET_EVENTS];
+    while (!atomic_load(&r->stopping)) {
+        int n = epoll_wait(loop->epoll_fd, events, NET_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            printf("Error: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+            if (ptr == &loop->wake_fd) {
+                uint64_t value;
+                if (read(loop->wake_fd, &value, sizeof(value)) < 0) continue;
+                loop_deliver(loop);
+            } else if (ptr == &r->listen_fd) {
+                loop_accept(loop);
+            } else {
+                NetPeer *peer = ptr;
+                if (peer->closed) continue;
+                if (peer->connecting) {
+                    if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) peer_connected(peer);
+                    continue;
+                }
+                if (ev & EPOLLERR) {
+                    peer_fail(peer);
+                    continue;
+                }
+                if (ev & (EPOLLIN | EPOLLHUP)) peer_read(peer);
+                if (!peer->closed && (ev & EPOLLOUT)) peer_flush(peer);
+            }
+        }
+        while (loop->closed) {
+            NetPeer *peer = loop->closed;
+            loop->closed = peer->next_closed;
+            peer_free(peer);
+        }
+    }
+    return NULL;
+}
+
+NetReactor* net_reactor_create(int loops, const NetHandlers *handlers) {
+    if (loops <= 0 || loops > NET_MAX_LOOPS) return NULL;
+    NetReactor *r = calloc(1, sizeof(NetReactor));
+    if (!r) return NULL;
+    r->handlers = *handlers;
+    r->listen_fd = -1;
+    atomic_init(&r->stopping, false);
+    atomic_init(&r->next_loop, 0);
+    for (int i = 0; i < loops; i++) {
+        NetLoop *loop = &r->loops[i];
+        loop->reactor = r;
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->scratch = malloc(NET_MAX_FRAME);
+        pthread_mutex_init(&loop->lock, NULL);
+        r->loop_count++;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &loop->wake_fd };
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0 || !loop->scratch ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+            printf("Error: Failed to create event loop\n");
+            net_reactor_destroy(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+void net_reactor_destroy(NetReactor *reactor) {
+    if (!reactor) return;
+    for (int i = 0; i < reactor->loop_count; i++) {
+        NetLoop *loop = &reactor->loops[i];
+        while (loop->peers) {
+            NetPeer *peer = loop->peers;
+            loop->peers = peer->next;
+            close(peer->fd);
+            peer_free(peer);
+        }
+        while (loop->closed) {
+            NetPeer *peer = loop->closed;
+            loop->closed = peer->next_closed;
+            peer_free(peer);
+        }
+        for (size_t j = 0; j < loop->post_count; j++) net_buffer_release(loop->posts[j].buffer);
+        free(loop->posts);
+        if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+        if (loop->wake_fd >= 0) close(loop->wake_fd);
+        free(loop->scratch);
+        pthread_mutex_destroy(&loop->lock);
+    }
+    if (reactor->listen_fd >= 0) close(reactor->listen_fd);
+    free(reactor);
+}
+
+static bool parse_address(const char *host, uint16_t port, struct sockaddr_in *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (!host) {
+        addr->sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1;
+}
+
+uint16_t net_listen(NetReactor *reactor, const char *host, uint16_t port) {
+    struct sockaddr_in addr;
+    if (reactor->listen_fd >= 0 || !parse_address(host, port, &addr)) return 0;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 0;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+        printf("Error: Cannot listen on port %u: %s\n", port, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    
+    // Each connection wakes one loop
+    reactor->listen_fd = fd;
+    for (int i = 0; i < reactor->loop_count; i++) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &reactor->listen_fd };
+        if (epoll_ctl(reactor->loops[i].epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+NetPeer* net_connect(NetReactor *reactor, const char *host, uint16_t port, void *context) {
+    struct sockaddr_in addr;
+    if (!parse_address(host, port, &addr)) return NULL;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return NULL;
+    }
+    // Completion is reported as writability whether or not it finished here
+    unsigned index = atomic_fetch_add(&reactor->next_loop, 1) % reactor->loop_count;
+    NetPeer *peer = peer_add(&reactor->loops[index], fd, true, context);
+    if (!peer) close(fd);
+    return peer;
+}
+
+bool net_reactor_run(NetReactor *reactor) {
+    int started = 1;
+    for (; started < reactor->loop_count; started++) {
+        NetLoop *loop = &reactor->loops[started];
+        if (pthread_create(&loop->thread, NULL, loop_run, loop) != 0) {
+            printf("Error: Failed to start event loop thread\n");
+            net_reactor_stop(reactor);
+            break;
+        }
+    }
+    loop_run(&reactor->loops[0]);
+    for (int i = 1; i < started; i++) pthread_join(reactor->loops[i].thread, NULL);
+    return started == reactor->loop_count;
+}
+
+void net_reactor_stop(NetReactor *reactor) {
+    atomic_store(&reactor->stopping, true);
+    uint64_t one = 1;
+    for (int i = 0; i < reactor->loop_count; i++) {
+        if (write(reactor->loops[i].wake_fd, &one, sizeof(one)) < 0) continue;
+    }
+}
+
+void net_reactor_stats(const NetReactor *reactor, NetStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < reactor->loop_count; i++) {
+        const NetStats *s = &reactor->loops[i].stats;
+        stats->accepted += s->accepted;
+        stats->frames_in += s->frames_in;
+        stats->frames_out += s->frames_out;
+        stats->bytes_in += s->bytes_in;
+        stats->bytes_out += s->bytes_out;
+        stats->paused += s->paused;
+        stats->errors += s->errors;
+    }
+}
+
+bool net_broadcast(NetReactor *reactor, NetBuffer *buffer, const NetPeer *except) {
+    bool posted = true;
+    for (int i = 0; i < reactor->loop_count; i++) {
+        NetLoop *loop = &reactor->loops[i];
+        pthread_mutex_lock(&loop->lock);
+        if (loop->post_count == loop->post_capacity) {
+            size_t capacity = loop->post_capacity ? loop->post_capacity * 2 : 16;
+            NetPost *grown = realloc(loop->posts, sizeof(NetPost) * capacity);
+            if (grown) {
+                loop->posts = grown;
+                loop->post_capacity = capacity;
+            }
+        }
+        bool room = loop->post_count < loop->post_capacity;
+        if (room) loop->posts[loop->post_count++] = (NetPost){ net_buffer_retain(buffer), except };
+        pthread_mutex_unlock(&loop->lock);
+    
+        uint64_t one = 1;
+        posted &= room && write(loop->wake_fd, &one, sizeof(one)) == sizeof(one);
+    }
+    return posted;
+}
+
+size_t net_pending(const NetPeer *peer) {
+    return peer->out.bytes;
+}
+
+void* net_peer_context(const NetPeer *peer) {
+    return peer->context;
+}
+
+void net_peer_set_context(NetPeer *peer, void *context) {
+    peer->context = context;
+}
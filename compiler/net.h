@@ -0,0 +1,111 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Event-driven peer connections
+//
+// A reactor runs one or more event loops, each an epoll instance on its
+// own thread. Every loop waits on the shared listening socket, so
+// accepted peers spread across loops, and a peer stays on the loop that
+// owns it for its lifetime. Sockets are non-blocking and level-triggered.
+//
+// Messages are framed as an 8-byte header followed by the payload:
+//
+//   type (1) | payload length (3, little-endian) | checksum (4)
+//
+// where the checksum is the first 4 bytes of the payload's SHA-256. Each
+// peer reads into a ring buffer that grows as needed. Output is a ring of
+// references to immutable, refcounted frames, written with writev
+// straight from the frames, so a broadcast is framed once and shared by
+// every peer it is queued on. A peer whose output backs up past
+// NET_WRITE_HIGH stops being read from until it drains below
+// NET_WRITE_LOW, so a slow reader cannot make the node buffer without
+// bound.
+#define NET_HEADER_SIZE 8
+#define NET_MAX_FRAME (1024 * 1024)         // MAX_MESSAGE_SIZE in network.cry
+#define NET_WRITE_HIGH (4 * 1024 * 1024)
+#define NET_WRITE_LOW (1024 * 1024)
+#define NET_WRITE_LIMIT (16 * 1024 * 1024)  // net_send fails past this
+#define NET_MAX_LOOPS 64
+
+// MSG_* in network.cry
+enum {
+    NET_MSG_HANDSHAKE = 0x01,
+    NET_MSG_BLOCK = 0x02,
+    NET_MSG_TX = 0x03,
+    NET_MSG_PEERS = 0x04,
+    NET_MSG_PING = 0x05,
+    NET_MSG_PONG = 0x06,
+    NET_MSG_GET_BLOCKS = 0x07,
+    NET_MSG_GET_TX = 0x08,
+    NET_MSG_GOSSIP = 0x09           // Batch of gossip records; see gossip.h
+};
+
+typedef struct NetReactor NetReactor;
+typedef struct NetPeer NetPeer;
+typedef struct NetBuffer NetBuffer;
+
+// Called on the thread of the loop that owns the peer; with several loops
+// they run concurrently for different peers. A frame's payload is valid
+// until the callback returns. on_close is called for every peer, opened
+// or not, once it is closed by either side or by an error.
+typedef struct {
+    void (*on_open)(NetPeer *peer, void *user);
+    void (*on_frame)(NetPeer *peer, uint8_t type, const uint8_t *payload, size_t length, void *user);
+    void (*on_close)(NetPeer *peer, void *user);
+    void *user;
+} NetHandlers;
+
+typedef struct {
+    uint64_t accepted;
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t paused;                // Times a peer stopped being read from
+    uint64_t errors;                // Peers dropped for bad frames or socket errors
+} NetStats;
+
+NetReactor* net_reactor_create(int loops, const NetHandlers *handlers);
+void net_reactor_destroy(NetReactor *reactor);
+
+// Listen on an IPv4 address (NULL for any); port 0 picks one. Returns the
+// port, or 0 on failure.
+uint16_t net_listen(NetReactor *reactor, const char *host, uint16_t port);
+// Start connecting; on_open follows once connected. Safe to call from any
+// thread, but while the reactor runs the peer may be closed and freed
+// before this returns, so use the context to find it in the callbacks.
+NetPeer* net_connect(NetReactor *reactor, const char *host, uint16_t port, void *context);
+
+// Run every loop, one on the calling thread, until net_reactor_stop
+bool net_reactor_run(NetReactor *reactor);
+// Safe to call from any thread or callback
+void net_reactor_stop(NetReactor *reactor);
+// Totals over all loops; exact once the reactor has stopped
+void net_reactor_stats(const NetReactor *reactor, NetStats *stats);
+
+// Queue a frame. Only from the thread of the peer's loop, i.e. inside its
+// callbacks. False if the peer is closed, the payload is too large or
+// its output is past NET_WRITE_LIMIT.
+bool net_send(NetPeer *peer, uint8_t type, const void *payload, size_t length);
+// Frame a payload once for sending to many peers; starts with one
+// reference, which the caller releases when done with it
+NetBuffer* net_buffer_create(uint8_t type, const void *payload, size_t length);
+NetBuffer* net_buffer_retain(NetBuffer *buffer);
+void net_buffer_release(NetBuffer *buffer);
+// Queue a shared frame by reference; same rules as net_send
+bool net_send_buffer(NetPeer *peer, NetBuffer *buffer);
+// Queue a frame on every open peer except `except`, from any thread. Each
+// loop queues it on its own peers when it next wakes. `except` is only
+// compared by address.
+bool net_broadcast(NetReactor *reactor, NetBuffer *buffer, const NetPeer *except);
+// Close at once, dropping unsent output. Same thread rule as net_send.
+void net_close(NetPeer *peer);
+size_t net_pending(const NetPeer *peer);   // Output bytes not yet written
+void* net_peer_context(const NetPeer *peer);
+void net_peer_set_context(NetPeer *peer, void *context);
+
+#endif /* NET_H */
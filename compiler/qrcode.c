@@ -3,6 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QR_HAVE_X86 1
+#endif
 
 // QR Code constants
 #define MAX_VERSION 40
@@ -11,6 +19,11 @@
 #define MAX_DENSITY 0.8
 #define MAX_NOISE 0.2
 
+// Nonces handed to a mining worker per claim
+#define MINING_CHUNK_SIZE 256
+// Candidates a mining worker builds and hashes together
+#define MINING_LANES 8
+
 // Internal helper functions
 static void initialize_modules(QRCode *qr);
 static void add_finder_patterns(QRCode *qr);
@@ -18,16 +31,18 @@ static void add_alignment_patterns(QRCode *qr);
 static void add_timing_patterns(QRCode *qr);
 static void add_format_info(QRCode *qr);
 static void add_data(QRCode *qr, const uint8_t *data, size_t length);
+static size_t data_positions(const QRCode *qr, size_t bits, uint32_t *positions);
+static int version_for_length(size_t length);
+static void render(QRCode *qr, const uint8_t *data, size_t length);
+static bool metrics_ok(const QRCode *qr);
+static bool hash_meets_target(const uint8_t *hash, const uint8_t *target);
+static void pack_rows(const QRCode *qr, uint64_t *rows, int row_words);
+static int count_set(const uint64_t *rows, int size, int row_words);
+static int count_noise(const uint64_t *rows, int size, int row_words);
 
 QRCode* qrcode_create(const uint8_t *data, size_t length, QRCodeECC ecc) {
     // Calculate required version for data length
-    int version = 1;
-    while (version <= MAX_VERSION) {
-        int capacity = qrcode_get_size_for_version(version) * qrcode_get_size_for_version(version) / 8;
-        if (capacity >= length) break;
-        version++;
-    }
-    
+    int version = version_for_length(length);
     if (version > MAX_VERSION) return NULL;
     
     // Allocate QR Code structure
@@ -46,17 +61,7 @@ QRCode* qrcode_create(const uint8_t *data, size_t length, QRCodeECC ecc) {
         return NULL;
     }
     
-    // Initialize QR Code
-    initialize_modules(qr);
-    add_finder_patterns(qr);
-    add_alignment_patterns(qr);
-    add_timing_patterns(qr);
-    add_format_info(qr);
-    add_data(qr, data, length);
-    
-    // Calculate metrics
-    qr->density = qrcode_calculate_density(qr);
-    qr->noise = qrcode_calculate_noise(qr);
+    render(qr, data, length);
     
     return qr;
 }
@@ -71,65 +76,36 @@ void qrcode_destroy(QRCode *qr) {
 bool qrcode_validate_pow(const QRCode *qr, const uint8_t *target) {
     if (!qr || !target) return false;
     
-    // Check density requirements
-    if (qr->density < MIN_DENSITY || qr->density > MAX_DENSITY) return false;
-    
-    // Check noise ratio
-    if (qr->noise > MAX_NOISE) return false;
+    // Cheapest checks first: both metrics are precomputed, so the hash is
+    // the only full pass over the matrix and only runs for survivors
+    if (!metrics_ok(qr)) return false;
     
     // Calculate QR code hash
     uint8_t hash[SHA256_DIGEST_LENGTH];
     sha256((uint8_t*)qr->modules, qr->size * qr->size, hash);
     
-    // Compare with target
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        if (hash[i] > target[i]) return false;
-        if (hash[i] < target[i]) return true;
-    }
-    
-    return true;
+    return hash_meets_target(hash, target);
 }
 
 float qrcode_calculate_density(const QRCode *qr) {
     if (!qr) return 0.0f;
     
-    int set_modules = 0;
-    size_t total_modules = qr->size * qr->size;
+    uint64_t rows[QR_MAX_SIZE * QR_MAX_ROW_WORDS];
+    int row_words = (qr->size + 63) / 64;
+    pack_rows(qr, rows, row_words);
     
-    for (size_t i = 0; i < total_modules; i++) {
-        if (qr->modules[i]) set_modules++;
-    }
-    
-    return (float)set_modules / total_modules;
+    size_t total_modules = qr->size * qr->size;
+    return (float)count_set(rows, qr->size, row_words) / total_modules;
 }
 
 float qrcode_calculate_noise(const QRCode *qr) {
     if (!qr) return 1.0f;
     
-    int noise_count = 0;
-    
-    // Check each module against its neighbors
-    for (int y = 1; y < qr->size - 1; y++) {
-        for (int x = 1; x < qr->size - 1; x++) {
-            bool current = qr->modules[y * qr->size + x];
-            int different_neighbors = 0;
-            
-            // Check 8 neighboring modules
-            for (int dy = -1; dy <= 1; dy++) {
-                for (int dx = -1; dx <= 1; dx++) {
-                    if (dx == 0 && dy == 0) continue;
-                    
-                    bool neighbor = qr->modules[(y + dy) * qr->size + (x + dx)];
-                    if (neighbor != current) different_neighbors++;
-                }
-            }
-            
-            // If more than 5 different neighbors, consider it noise
-            if (different_neighbors > 5) noise_count++;
-        }
-    }
+    uint64_t rows[QR_MAX_SIZE * QR_MAX_ROW_WORDS];
+    int row_words = (qr->size + 63) / 64;
+    pack_rows(qr, rows, row_words);
     
-    return (float)noise_count / (qr->size * qr->size);
+    return (float)count_noise(rows, qr->size, row_words) / (qr->size * qr->size);
 }
 
 void qrcode_print(const QRCode *qr) {
@@ -183,49 +159,366 @@ bool qrcode_check_mining_criteria(const QRCode *qr, float min_density, float max
 }
 
 uint8_t* qrcode_generate_pow_nonce(const uint8_t *block_header, size_t length, const uint8_t *target) {
-    printf("Starting mining function\n");
     uint8_t *nonce = malloc(32);
     if (!nonce) {
         printf("Failed to allocate nonce\n");
         return NULL;
     }
     
-    uint64_t attempt = 0;
-    bool found = false;
-    // Remove max_attempts limit for real mining
-    while (!found) {
-        if (attempt % 1000 == 0) {
-            printf("Mining attempt: %lu\n", (unsigned long)attempt);
+    QRMiningStats stats;
+    if (!qrcode_mine_parallel(block_header, length, target, 0, 0, &stats)) {
+        free(nonce);
+        return NULL;
+    }
+    
+    printf("Found valid nonce: %lu (%.0f H/s on %d threads)\n",
+           (unsigned long)stats.nonce, stats.hashes_per_sec, stats.threads);
+    memset(nonce, 0, 32);
+    memcpy(nonce, &stats.nonce, 8);
+    
+    return nonce;
+}
+
+QRTemplate* qrcode_template_create(const uint8_t *block_header, size_t length, QRCodeECC ecc) {
+    if (!block_header && length) return NULL;
+    
+    size_t total_len = length + QR_NONCE_BITS / 8;
+    int version = version_for_length(total_len);
+    if (version > MAX_VERSION) return NULL;
+    
+    QRTemplate *tpl = malloc(sizeof(QRTemplate));
+    if (!tpl) return NULL;
+    
+    tpl->version = version;
+    tpl->size = qrcode_get_size_for_version(version);
+    tpl->ecc = ecc;
+    tpl->header_length = length;
+    tpl->nonce_modules = 0;
+    
+    size_t matrix_size = (size_t)tpl->size * tpl->size;
+    size_t total_bits = total_len * 8;
+    tpl->base = malloc(matrix_size);
+    uint32_t *positions = malloc(sizeof(uint32_t) * total_bits);
+    uint8_t *data = calloc(total_len, 1);
+    if (!tpl->base || !positions || !data) {
+        free(positions);
+        free(data);
+        qrcode_template_destroy(tpl);
+        return NULL;
+    }
+    
+    // Render with an all-zero nonce; zero bits leave their modules clear
+    memcpy(data, block_header, length);
+    QRCode qr = { version, tpl->size, ecc, tpl->base, 0.0f, 0.0f };
+    initialize_modules(&qr);
+    add_finder_patterns(&qr);
+    add_alignment_patterns(&qr);
+    add_timing_patterns(&qr);
+    add_format_info(&qr);
+    
+    // Data placement only depends on the function patterns, so where each
+    // bit lands is known before any data is written
+    size_t placed = data_positions(&qr, total_bits, positions);
+    add_data(&qr, data, total_len);
+    
+    size_t first_nonce_module = matrix_size;
+    for (size_t bit = length * 8; bit < placed; bit++) {
+        tpl->nonce_index[tpl->nonce_modules] = positions[bit];
+        tpl->nonce_bit[tpl->nonce_modules] = bit - length * 8;
+        tpl->nonce_modules++;
+        if (positions[bit] < first_nonce_module) first_nonce_module = positions[bit];
+    }
+    
+    // Every candidate shares the matrix bytes before the first nonce module
+    tpl->prefix_length = sha256_midstate(tpl->base, first_nonce_module, &tpl->prefix_state);
+    
+    free(positions);
+    free(data);
+    return tpl;
+}
+
+void qrcode_template_destroy(QRTemplate *tpl) {
+    if (tpl) {
+        free(tpl->base);
+        free(tpl);
+    }
+}
+
+bool qrcode_candidate_init(QRCandidate *candidate, const QRTemplate *tpl) {
+    size_t matrix_size = (size_t)tpl->size * tpl->size;
+    candidate->row_words = (tpl->size + 63) / 64;
+    candidate->qr.modules = malloc(matrix_size);
+    candidate->rows = malloc(sizeof(uint64_t) * tpl->size * candidate->row_words);
+    if (!candidate->qr.modules || !candidate->rows) {
+        qrcode_candidate_free(candidate);
+        return false;
+    }
+    
+    candidate->qr.version = tpl->version;
+    candidate->qr.size = tpl->size;
+    candidate->qr.ecc = tpl->ecc;
+    memcpy(candidate->qr.modules, tpl->base, matrix_size);
+    pack_rows(&candidate->qr, candidate->rows, candidate->row_words);
+    
+    candidate->set_modules = count_set(candidate->rows, tpl->size, candidate->row_words);
+    candidate->noise_modules = count_noise(candidate->rows, tpl->size, candidate->row_words);
+    candidate->qr.density = (float)candidate->set_modules / matrix_size;
+    candidate->qr.noise = (float)candidate->noise_modules / matrix_size;
+    return true;
+}
+
+void qrcode_candidate_free(QRCandidate *candidate) {
+    free(candidate->qr.modules);
+    free(candidate->rows);
+    candidate->qr.modules = NULL;
+    candidate->rows = NULL;
+}
+
+static void noise_row(const uint64_t *rows, int y, int row_words, uint64_t *out);
+
+void qrcode_template_set_nonce(const QRTemplate *tpl, QRCandidate *candidate, uint64_t nonce) {
+    // Same byte layout the header + nonce buffer would have
+    uint8_t bytes[QR_NONCE_BITS / 8];
+    memcpy(bytes, &nonce, sizeof(bytes));
+    
+    QRCode *qr = &candidate->qr;
+    int size = qr->size;
+    int row_words = candidate->row_words;
+    uint32_t flips[QR_NONCE_BITS];
+    int flip_count = 0;
+    
+    for (int i = 0; i < tpl->nonce_modules; i++) {
+        int bit = tpl->nonce_bit[i];
+        uint8_t value = (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+        if (qr->modules[tpl->nonce_index[i]] != value) {
+            flips[flip_count++] = tpl->nonce_index[i];
+        }
+    }
+    if (flip_count == 0) return;
+    
+    // Only interior modules within one step of a flip can change their
+    // noise state. Collect them as per-row masks, keeping the dirty rows
+    // in a short list so the masks never need a full clear.
+    uint64_t dirty[QR_MAX_SIZE * QR_MAX_ROW_WORDS];
+    int dirty_rows[QR_MAX_SIZE];
+    bool row_listed[QR_MAX_SIZE] = { false };
+    int dirty_count = 0;
+    
+    for (int f = 0; f < flip_count; f++) {
+        int y = flips[f] / size;
+        int x = flips[f] % size;
+        for (int yy = y - 1; yy <= y + 1; yy++) {
+            if (yy < 1 || yy > size - 2) continue;
+            if (!row_listed[yy]) {
+                row_listed[yy] = true;
+                dirty_rows[dirty_count++] = yy;
+                memset(&dirty[yy * row_words], 0, sizeof(uint64_t) * row_words);
+            }
+            for (int xx = x - 1; xx <= x + 1; xx++) {
+                if (xx < 1 || xx > size - 2) continue;
+                dirty[yy * row_words + xx / 64] |= 1ULL << (xx % 64);
+            }
+        }
+    }
+    
+    uint64_t noise[QR_MAX_ROW_WORDS];
+    int noise_delta = 0;
+    for (int d = 0; d < dirty_count; d++) {
+        int y = dirty_rows[d];
+        noise_row(candidate->rows, y, row_words, noise);
+        for (int w = 0; w < row_words; w++) {
+            noise_delta -= __builtin_popcountll(noise[w] & dirty[y * row_words + w]);
+        }
+    }
+    
+    for (int f = 0; f < flip_count; f++) {
+        int y = flips[f] / size;
+        int x = flips[f] % size;
+        qr->modules[flips[f]] ^= 1;
+        candidate->rows[y * row_words + x / 64] ^= 1ULL << (x % 64);
+        candidate->set_modules += qr->modules[flips[f]] ? 1 : -1;
+    }
+    
+    for (int d = 0; d < dirty_count; d++) {
+        int y = dirty_rows[d];
+        noise_row(candidate->rows, y, row_words, noise);
+        for (int w = 0; w < row_words; w++) {
+            noise_delta += __builtin_popcountll(noise[w] & dirty[y * row_words + w]);
+        }
+    }
+    candidate->noise_modules += noise_delta;
+    
+    size_t total_modules = (size_t)size * size;
+    qr->density = (float)candidate->set_modules / total_modules;
+    qr->noise = (float)candidate->noise_modules / total_modules;
+}
+
+bool qrcode_candidate_validate(const QRTemplate *tpl, const QRCandidate *candidate, const uint8_t *target) {
+    if (!metrics_ok(&candidate->qr)) return false;
+    
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    size_t matrix_size = (size_t)tpl->size * tpl->size;
+    sha256_finish(&tpl->prefix_state, candidate->qr.modules + tpl->prefix_length,
+                  matrix_size - tpl->prefix_length, hash);
+    return hash_meets_target(hash, target);
+}
+
+int qrcode_candidates_first_valid(const QRTemplate *tpl, const QRCandidate *candidates, int count,
+                                  const uint8_t *target) {
+    const unsigned char *tails[MINING_LANES];
+    uint8_t hashes[MINING_LANES][SHA256_DIGEST_LENGTH];
+    int lane[MINING_LANES];
+    size_t tail_len = (size_t)tpl->size * tpl->size - tpl->prefix_length;
+    
+    for (int base = 0; base < count; base += MINING_LANES) {
+        int pending = 0;
+        for (int i = base; i < count && i < base + MINING_LANES; i++) {
+            if (!metrics_ok(&candidates[i].qr)) continue;
+            tails[pending] = candidates[i].qr.modules + tpl->prefix_length;
+            lane[pending++] = i;
+        }
+        if (pending == 0) continue;
+    
+        sha256_finish_many(&tpl->prefix_state, tails, tail_len, hashes, pending);
+        for (int p = 0; p < pending; p++) {
+            if (hash_meets_target(hashes[p], target)) return lane[p];
         }
-        
-        // Create test data with nonce
-        size_t test_len = length + 8;
-        uint8_t *test_data = malloc(test_len);
-        if (!test_data) {
-            printf("Failed to allocate test_data\n");
-            free(nonce);
+    }
+    
+    return -1;
+}
+
+// Shared state for one parallel nonce search
+typedef struct {
+    const QRTemplate *tpl;
+    const uint8_t *target;
+    uint64_t limit;                 // Exclusive upper bound on nonces
+    _Atomic uint64_t next_chunk;    // First nonce of the next unclaimed chunk
+    _Atomic uint64_t best;          // Lowest valid nonce so far
+    atomic_bool found;
+    atomic_bool failed;             // A worker could not allocate its buffers
+    _Atomic uint64_t attempts;
+} MiningJob;
+
+static void record_valid_nonce(MiningJob *job, uint64_t nonce) {
+    uint64_t best = atomic_load(&job->best);
+    while (nonce < best && !atomic_compare_exchange_weak(&job->best, &best, nonce)) {
+        // `best` reloaded by the failed exchange
+    }
+    atomic_store(&job->found, true);
+}
+
+static void *mining_worker(void *arg) {
+    MiningJob *job = arg;
+    
+    // Per-worker candidates, one per hashing lane, patched in place.
+    // Lane i always carries nonces congruent to i, so consecutive patches
+    // of the same candidate still differ in only a few bits.
+    QRCandidate candidates[MINING_LANES];
+    for (int i = 0; i < MINING_LANES; i++) {
+        if (!qrcode_candidate_init(&candidates[i], job->tpl)) {
+            atomic_store(&job->failed, true);
+            while (i-- > 0) qrcode_candidate_free(&candidates[i]);
             return NULL;
         }
-        
-        memcpy(test_data, block_header, length);
-        memcpy(test_data + length, &attempt, 8);
-        
-        // Generate QR code
-        QRCode *qr = qrcode_create(test_data, test_len, QR_ECLEVEL_H);
-        if (qr) {
-            if (qrcode_validate_pow(qr, target)) {
-                printf("Found valid nonce: %lu\n", (unsigned long)attempt);
-                memcpy(nonce, &attempt, 8);
-                found = true;
+    }
+    
+    uint64_t attempts = 0;
+    for (;;) {
+        uint64_t start = atomic_fetch_add(&job->next_chunk, MINING_CHUNK_SIZE);
+        if (start >= job->limit || start > atomic_load_explicit(&job->best, memory_order_relaxed)) break;
+    
+        uint64_t end = job->limit - start < MINING_CHUNK_SIZE ? job->limit : start + MINING_CHUNK_SIZE;
+        for (uint64_t group = start; group < end; group += MINING_LANES) {
+            // Anything above the current best can no longer win
+            if (group > atomic_load_explicit(&job->best, memory_order_relaxed)) break;
+    
+            int lanes = end - group < MINING_LANES ? (int)(end - group) : MINING_LANES;
+            for (int i = 0; i < lanes; i++) {
+                qrcode_template_set_nonce(job->tpl, &candidates[i], group + i);
+            }
+            attempts += lanes;
+    
+            // Lanes are checked in nonce order, so the first hit is the lowest
+            int hit = qrcode_candidates_first_valid(job->tpl, candidates, lanes, job->target);
+            if (hit >= 0) {
+                record_valid_nonce(job, group + hit);
+                break;
             }
-            qrcode_destroy(qr);
         }
-        
-        free(test_data);
-        attempt++;
+        if (atomic_load(&job->failed)) break;
     }
     
-    return nonce;
+    atomic_fetch_add(&job->attempts, attempts);
+    for (int i = 0; i < MINING_LANES; i++) qrcode_candidate_free(&candidates[i]);
+    return NULL;
+}
+
+int qrcode_default_mining_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool qrcode_mine_parallel(const uint8_t *block_header, size_t length, const uint8_t *target,
+                          int threads, uint64_t max_attempts, QRMiningStats *stats) {
+    if (stats) memset(stats, 0, sizeof(*stats));
+    if (!block_header || !target) return false;
+    
+    QRTemplate *tpl = qrcode_template_create(block_header, length, QR_ECLEVEL_H);
+    if (!tpl) return false;
+    
+    if (threads <= 0) threads = qrcode_default_mining_threads();
+    
+    MiningJob job;
+    job.tpl = tpl;
+    job.target = target;
+    job.limit = max_attempts ? max_attempts : UINT64_MAX;
+    atomic_init(&job.next_chunk, 0);
+    atomic_init(&job.best, UINT64_MAX);
+    atomic_init(&job.found, false);
+    atomic_init(&job.failed, false);
+    atomic_init(&job.attempts, 0);
+    
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    if (!workers) {
+        qrcode_template_destroy(tpl);
+        return false;
+    }
+    
+    double start = monotonic_seconds();
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, mining_worker, &job) != 0) break;
+        started++;
+    }
+    if (started == 0) {
+        // No threads available, search on the calling thread instead
+        mining_worker(&job);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double elapsed = monotonic_seconds() - start;
+    free(workers);
+    qrcode_template_destroy(tpl);
+    
+    bool found = atomic_load(&job.found);
+    if (stats) {
+        stats->found = found;
+        stats->nonce = found ? atomic_load(&job.best) : 0;
+        stats->attempts = atomic_load(&job.attempts);
+        stats->threads = started ? started : 1;
+        stats->elapsed = elapsed;
+        stats->hashes_per_sec = elapsed > 0 ? stats->attempts / elapsed : 0;
+    }
+    
+    return found;
 }
 
 bool qrcode_is_valid_version(int version) {
@@ -238,6 +531,231 @@ int qrcode_get_size_for_version(int version) {
 }
 
 // Internal implementation of helper functions
+static int version_for_length(size_t length) {
+    int version = MIN_VERSION;
+    while (version <= MAX_VERSION) {
+        size_t size = qrcode_get_size_for_version(version);
+        if (size * size / 8 >= length) break;
+        version++;
+    }
+    return version;
+}
+
+// Draw every pattern and the payload into qr->modules, which must already
+// hold size*size bytes, then refresh the metrics
+static void render(QRCode *qr, const uint8_t *data, size_t length) {
+    initialize_modules(qr);
+    add_finder_patterns(qr);
+    add_alignment_patterns(qr);
+    add_timing_patterns(qr);
+    add_format_info(qr);
+    add_data(qr, data, length);
+    
+    uint64_t rows[QR_MAX_SIZE * QR_MAX_ROW_WORDS];
+    int row_words = (qr->size + 63) / 64;
+    pack_rows(qr, rows, row_words);
+    
+    size_t total_modules = qr->size * qr->size;
+    qr->density = (float)count_set(rows, qr->size, row_words) / total_modules;
+    qr->noise = (float)count_noise(rows, qr->size, row_words) / total_modules;
+}
+
+static bool metrics_ok(const QRCode *qr) {
+    // Check density requirements
+    if (qr->density < MIN_DENSITY || qr->density > MAX_DENSITY) return false;
+    
+    // Check noise ratio
+    return qr->noise <= MAX_NOISE;
+}
+
+// Hashes compare as big-endian numbers; equal to the target passes
+static bool hash_meets_target(const uint8_t *hash, const uint8_t *target) {
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+        if (hash[i] > target[i]) return false;
+        if (hash[i] < target[i]) return true;
+    }
+    
+    return true;
+}
+
+// Pack the byte matrix into rows of 64-bit words, one bit per module.
+// Any non-zero byte counts as a set module.
+static void pack_rows_scalar(const QRCode *qr, uint64_t *rows, int row_words) {
+    for (int y = 0; y < qr->size; y++) {
+        const uint8_t *src = &qr->modules[y * qr->size];
+        uint64_t *dst = &rows[y * row_words];
+        memset(dst, 0, sizeof(uint64_t) * row_words);
+        for (int x = 0; x < qr->size; x++) {
+            if (src[x]) dst[x / 64] |= 1ULL << (x % 64);
+        }
+    }
+}
+
+#ifdef QR_HAVE_X86
+// movemask turns 16 (SSE2) or 32 (AVX2) byte comparisons into bits at once;
+// chunks start on multiples of their width so they never straddle a word
+__attribute__((target("sse2")))
+static void pack_rows_sse2(const QRCode *qr, uint64_t *rows, int row_words) {
+    const __m128i zero = _mm_setzero_si128();
+    for (int y = 0; y < qr->size; y++) {
+        const uint8_t *src = &qr->modules[y * qr->size];
+        uint64_t *dst = &rows[y * row_words];
+        memset(dst, 0, sizeof(uint64_t) * row_words);
+        int x = 0;
+        for (; x + 16 <= qr->size; x += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+            uint64_t bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF;
+            dst[x / 64] |= bits << (x % 64);
+        }
+        for (; x < qr->size; x++) {
+            if (src[x]) dst[x / 64] |= 1ULL << (x % 64);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void pack_rows_avx2(const QRCode *qr, uint64_t *rows, int row_words) {
+    const __m256i zero = _mm256_setzero_si256();
+    for (int y = 0; y < qr->size; y++) {
+        const uint8_t *src = &qr->modules[y * qr->size];
+        uint64_t *dst = &rows[y * row_words];
+        memset(dst, 0, sizeof(uint64_t) * row_words);
+        int x = 0;
+        for (; x + 32 <= qr->size; x += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + x));
+            uint64_t bits = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) & 0xFFFFFFFFULL;
+            dst[x / 64] |= bits << (x % 64);
+        }
+        for (; x < qr->size; x++) {
+            if (src[x]) dst[x / 64] |= 1ULL << (x % 64);
+        }
+    }
+}
+#endif
+
+static QRPackKernel pack_kernel = QR_PACK_SCALAR;
+
+static bool pack_kernel_supported(QRPackKernel kernel) {
+    switch (kernel) {
+        case QR_PACK_SCALAR: return true;
+#ifdef QR_HAVE_X86
+        case QR_PACK_SSE2: return __builtin_cpu_supports("sse2");
+        case QR_PACK_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+#ifdef QR_HAVE_X86
+// Pick the widest packing kernel the CPU supports
+__attribute__((constructor))
+static void detect_pack_kernel(void) {
+    __builtin_cpu_init();
+    pack_kernel = pack_kernel_supported(QR_PACK_AVX2) ? QR_PACK_AVX2 :
+                  pack_kernel_supported(QR_PACK_SSE2) ? QR_PACK_SSE2 : QR_PACK_SCALAR;
+}
+#endif
+
+QRPackKernel qrcode_pack_kernel(void) {
+    return pack_kernel;
+}
+
+bool qrcode_use_pack_kernel(QRPackKernel kernel) {
+    if (!pack_kernel_supported(kernel)) return false;
+    pack_kernel = kernel;
+    return true;
+}
+
+const char* qrcode_pack_kernel_name(QRPackKernel kernel) {
+    static const char *const names[QR_PACK_KERNELS] = { "scalar", "sse2", "avx2" };
+    return kernel < QR_PACK_KERNELS ? names[kernel] : "unknown";
+}
+
+static void pack_rows(const QRCode *qr, uint64_t *rows, int row_words) {
+#ifdef QR_HAVE_X86
+    if (pack_kernel == QR_PACK_AVX2) {
+        pack_rows_avx2(qr, rows, row_words);
+        return;
+    }
+    if (pack_kernel == QR_PACK_SSE2) {
+        pack_rows_sse2(qr, rows, row_words);
+        return;
+    }
+#endif
+    pack_rows_scalar(qr, rows, row_words);
+}
+
+static int count_set(const uint64_t *rows, int size, int row_words) {
+    int count = 0;
+    for (int i = 0; i < size * row_words; i++) {
+        count += __builtin_popcountll(rows[i]);
+    }
+    return count;
+}
+
+// Noise flags for row y: bit x is set when more than 5 of the module's 8
+// neighbours differ from it. Each neighbour direction is a shifted copy of
+// the row above, the row itself or the row below, XORed with the row, and
+// the eight difference masks are summed in bit-sliced form.
+static void noise_row(const uint64_t *rows, int y, int row_words, uint64_t *out) {
+    const uint64_t *above = &rows[(y - 1) * row_words];
+    const uint64_t *cur = &rows[y * row_words];
+    const uint64_t *below = &rows[(y + 1) * row_words];
+    
+    for (int w = 0; w < row_words; w++) {
+        uint64_t c = cur[w];
+        const uint64_t *lines[3] = { above, cur, below };
+        uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    
+        for (int l = 0; l < 3; l++) {
+            const uint64_t *r = lines[l];
+            // Value of the left (x - 1) and right (x + 1) neighbour at bit x
+            uint64_t left = (r[w] << 1) | (w > 0 ? r[w - 1] >> 63 : 0);
+            uint64_t right = (r[w] >> 1) | (w + 1 < row_words ? r[w + 1] << 63 : 0);
+            uint64_t diffs[3] = { left ^ c, r[w] ^ c, right ^ c };
+    
+            for (int d = 0; d < 3; d++) {
+                if (l == 1 && d == 1) continue;  // The module itself
+                uint64_t carry0 = s0 & diffs[d];
+                s0 ^= diffs[d];
+                uint64_t carry1 = s1 & carry0;
+                s1 ^= carry0;
+                uint64_t carry2 = s2 & carry1;
+                s2 ^= carry1;
+                s3 |= carry2;
+            }
+        }
+    
+        // Counts 6, 7 and 8 are 0110, 0111 and 1000
+        out[w] = s3 | (s2 & s1);
+    }
+}
+
+static int count_noise(const uint64_t *rows, int size, int row_words) {
+    // Only interior modules (1 .. size - 2) are scored
+    uint64_t interior[QR_MAX_ROW_WORDS];
+    for (int w = 0; w < row_words; w++) {
+        int lo = w * 64, hi = lo + 63;
+        uint64_t mask = ~0ULL;
+        if (lo < 1) mask &= ~1ULL;
+        if (hi > size - 2) {
+            int keep = size - 2 - lo + 1;
+            mask &= keep <= 0 ? 0 : (keep >= 64 ? ~0ULL : (1ULL << keep) - 1);
+        }
+        interior[w] = mask;
+    }
+    
+    int count = 0;
+    uint64_t noise[QR_MAX_ROW_WORDS];
+    for (int y = 1; y < size - 1; y++) {
+        noise_row(rows, y, row_words, noise);
+        for (int w = 0; w < row_words; w++) {
+            count += __builtin_popcountll(noise[w] & interior[w]);
+        }
+    }
+    return count;
+}
+
 static void initialize_modules(QRCode *qr) {
     memset(qr->modules, 0, qr->size * qr->size);
 }
@@ -253,7 +771,7 @@ static void add_finder_patterns(QRCode *qr) {
     for (int p = 0; p < 3; p++) {
         int row = positions[p][0];
         int col = positions[p][1];
-        
+    
         // Draw 7x7 finder pattern
         for (int r = 0; r < 7; r++) {
             for (int c = 0; c < 7; c++) {
@@ -312,11 +830,11 @@ static void add_data(QRCode *qr, const uint8_t *data, size_t length) {
     int up = true;
     size_t data_idx = 0;
     
-    while (pos >= 0 && data_idx < length) {
+    while (pos >= 0 && data_idx < length * 8) {
         int row = up ? qr->size - 1 : 0;
         int row_end = up ? -1 : qr->size;
         int row_step = up ? -1 : 1;
-        
+    
         for (; row != row_end; row += row_step) {
             for (int col = pos; col > pos - 2 && col >= 0; col--) {
                 if (!qr->modules[row * qr->size + col]) {
@@ -326,8 +844,37 @@ static void add_data(QRCode *qr, const uint8_t *data, size_t length) {
                 }
             }
         }
-        
+    
         pos -= 2;
         up = !up;
     }
 }
+
+// Walk the same path as add_data over the function patterns and record the
+// module index each data bit would be written to. Returns how many of the
+// requested bits fit in the matrix.
+static size_t data_positions(const QRCode *qr, size_t bits, uint32_t *positions) {
+    int pos = qr->size - 1;
+    int up = true;
+    size_t data_idx = 0;
+    
+    while (pos >= 0 && data_idx < bits) {
+        int row = up ? qr->size - 1 : 0;
+        int row_end = up ? -1 : qr->size;
+        int row_step = up ? -1 : 1;
+    
+        for (; row != row_end; row += row_step) {
+            for (int col = pos; col > pos - 2 && col >= 0; col--) {
+                if (!qr->modules[row * qr->size + col]) {
+                    positions[data_idx++] = row * qr->size + col;
+                    if (data_idx >= bits) return data_idx;
+                }
+            }
+        }
+    
+        pos -= 2;
+        up = !up;
+    }
+    
+    return data_idx;
+}
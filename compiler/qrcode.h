@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "crypto.h"
 
 // QR Code error correction levels
 typedef enum {
@@ -36,10 +37,95 @@ float qrcode_calculate_noise(const QRCode *qr);
 void qrcode_print(const QRCode *qr);
 char* qrcode_get_ascii(const QRCode *qr);
 
+// Bits of nonce appended to the block header for each mining candidate
+#define QR_NONCE_BITS 64
+
+// Precomputed matrix for a fixed block header. Function patterns and header
+// bits never change between nonces, so a candidate is produced by copying
+// `base` once and then patching only the modules the nonce bits land on.
+typedef struct {
+    int version;
+    int size;
+    QRCodeECC ecc;
+    size_t header_length;
+    uint8_t *base;                          // Patterns and header, nonce bits clear
+    int nonce_modules;                      // Nonce bits that fit in the matrix
+    uint32_t nonce_index[QR_NONCE_BITS];    // Module index of each placed nonce bit
+    uint8_t nonce_bit[QR_NONCE_BITS];       // Bit offset within the serialized nonce
+    SHA256Midstate prefix_state;            // Hash state over the unchanging prefix
+    size_t prefix_length;                   // Matrix bytes covered by prefix_state
+} QRTemplate;
+
+// Bit-packed rows: bit x of row y is bit (x % 64) of word y * row_words + x / 64
+#define QR_MAX_SIZE 177
+#define QR_MAX_ROW_WORDS ((QR_MAX_SIZE + 63) / 64)
+
+// Mining candidate built from a QRTemplate. `qr.modules` is kept in sync
+// for hashing and printing, while density and noise are maintained from
+// the packed rows as running counts that only change around flipped modules.
+typedef struct {
+    QRCode qr;
+    uint64_t *rows;         // size * row_words packed modules
+    int row_words;
+    int set_modules;        // Running popcount of the matrix
+    int noise_modules;      // Running count of noisy interior modules
+} QRCandidate;
+
+// Parallel mining statistics
+typedef struct {
+    bool found;             // Whether a valid nonce was found
+    uint64_t nonce;         // Lowest valid nonce in the searched range
+    uint64_t attempts;      // Candidates evaluated across all workers
+    int threads;            // Worker threads used
+    double elapsed;         // Wall-clock seconds
+    double hashes_per_sec;  // attempts / elapsed
+} QRMiningStats;
+
 // Mining-specific functions
 bool qrcode_check_mining_criteria(const QRCode *qr, float min_density, float max_noise);
 uint8_t* qrcode_generate_pow_nonce(const uint8_t *block_header, size_t length, const uint8_t *target);
 
+// Search nonces [0, max_attempts) on `threads` workers (<= 0 uses all online
+// CPUs, max_attempts 0 searches the whole 64-bit space). Workers claim chunks
+// of the nonce space in increasing order and keep going until their next
+// nonce is above the best one found, so the result is always the lowest
+// valid nonce regardless of thread count or scheduling.
+bool qrcode_mine_parallel(const uint8_t *block_header, size_t length, const uint8_t *target,
+                          int threads, uint64_t max_attempts, QRMiningStats *stats);
+int qrcode_default_mining_threads(void);
+
+// Incremental candidate building. qrcode_candidate_init allocates the
+// caller's buffers and fills them from the template once, after which each
+// qrcode_template_set_nonce only rewrites the nonce modules that changed
+// and updates the metrics by delta.
+QRTemplate* qrcode_template_create(const uint8_t *block_header, size_t length, QRCodeECC ecc);
+void qrcode_template_destroy(QRTemplate *tpl);
+bool qrcode_candidate_init(QRCandidate *candidate, const QRTemplate *tpl);
+void qrcode_candidate_free(QRCandidate *candidate);
+void qrcode_template_set_nonce(const QRTemplate *tpl, QRCandidate *candidate, uint64_t nonce);
+// Same result as qrcode_validate_pow, hashing only the part of the matrix
+// after the template's cached prefix. The batch form hashes every candidate
+// that passes the metrics together and returns the index of the first valid
+// one, or -1.
+bool qrcode_candidate_validate(const QRTemplate *tpl, const QRCandidate *candidate, const uint8_t *target);
+int qrcode_candidates_first_valid(const QRTemplate *tpl, const QRCandidate *candidates, int count,
+                                  const uint8_t *target);
+
+// Row packing kernels behind the density and noise metrics. The widest
+// one the CPU has is picked at startup; qrcode_use_pack_kernel switches to
+// another so they can be compared, and must not race with QR work on other
+// threads.
+typedef enum {
+    QR_PACK_SCALAR,
+    QR_PACK_SSE2,
+    QR_PACK_AVX2,
+    QR_PACK_KERNELS
+} QRPackKernel;
+
+QRPackKernel qrcode_pack_kernel(void);
+bool qrcode_use_pack_kernel(QRPackKernel kernel);   // False if the CPU lacks it
+const char* qrcode_pack_kernel_name(QRPackKernel kernel);
+
 // Utility functions
 void qrcode_get_module(const QRCode *qr, int x, int y, bool *module);
 void qrcode_set_module(QRCode *qr, int x, int y, bool value);
@@ -0,0 +1,216 @@
+#include "seen.h"
+#include "slots.h"
+#include "expiry.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SEEN_MAX_HASHES 8
+
+// Entry ids start at 1 so 0 can mean none
+typedef struct {
+    uint8_t id[SEEN_ID_SIZE];
+    uint64_t time;                  // Inserted, in the caller's clock
+    uint32_t hash;
+    ExpiryLink link;                // Bucket list; `link.next` links free entries
+    uint32_t older;                 // Recency list
+    uint32_t newer;
+} SeenEntry;
+
+struct SeenSet {
+    SeenEntry *entries;
+    uint32_t capacity;
+    uint32_t used;                  // Entry ids handed out so far
+    uint32_t free_entry;
+    size_t count;
+    
+    SlotTable index;                // Sized for `capacity` when created
+    
+    uint32_t newest;                // Ends of the recency list
+    uint32_t oldest;
+    
+    uint64_t *filters[2];           // NULL without a filter
+    size_t filter_mask;             // Words per generation minus one
+    int hashes;
+    int current;                    // Generation new IDs go into
+    size_t inserted;                // IDs inserted into the current generation
+    
+    ExpiryRing ring;
+    SeenStats stats;
+};
+
+static SeenEntry* entry(const SeenSet *s, uint32_t e) {
+    return &s->entries[e - 1];
+}
+
+static ExpiryLink* entry_link(void *owner, uint32_t e) {
+    return &entry(owner, e)->link;
+}
+
+// Peers choose message IDs, so the table hashes all of one with its seed
+static uint32_t id_hash(const SeenSet *s, const uint8_t *id) {
+    return slot_hash(&s->index, id, SEEN_ID_SIZE, 0);
+}
+
+static bool id_match(const void *owner, uint32_t e, const void *id) {
+    return memcmp(entry(owner, e)->id, id, SEEN_ID_SIZE) == 0;
+}
+
+// Each ID sets `hashes` bits within a single 64-bit word, so a lookup or
+// insert touches one cache line per generation. IDs that a peer crafts to
+// share bits only cost table lookups, which are keyed.
+static void filter_hashes(const SeenSet *s, const uint8_t *id, size_t *word, uint64_t *mask) {
+    uint64_t h1, h2;
+    memcpy(&h1, id + 8, sizeof(h1));
+    memcpy(&h2, id + 16, sizeof(h2));
+    *word = h1 & s->filter_mask;
+    *mask = 0;
+    for (int i = 0; i < s->hashes; i++, h2 >>= 6) *mask |= 1ull << (h2 & 63);
+}
+
+static bool filter_test(const uint64_t *words, size_t word, uint64_t mask) {
+    return (words[word] & mask) == mask;
+}
+
+static void recency_push(SeenSet *s, uint32_t e) {
+    SeenEntry *x = entry(s, e);
+    x->older = s->newest;
+    x->newer = 0;
+    if (s->newest) entry(s, s->newest)->newer = e;
+    else s->oldest = e;
+    s->newest = e;
+}
+
+static void recency_unlink(SeenSet *s, uint32_t e) {
+    SeenEntry *x = entry(s, e);
+    if (x->older) entry(s, x->older)->newer = x->newer;
+    else s->oldest = x->newer;
+    if (x->newer) entry(s, x->newer)->older = x->older;
+    else s->newest = x->older;
+}
+
+static void entry_remove(SeenSet *s, uint32_t e) {
+    SeenEntry *x = entry(s, e);
+    slot_remove(&s->index, slot_find(&s->index, x->hash, id_match, s, x->id));
+    expiry_unlink(&s->ring, e, x->time);
+    recency_unlink(s, e);
+    x->link.next = s->free_entry;
+    s->free_entry = e;
+    s->count--;
+}
+
+SeenSet* seen_create(size_t capacity, uint64_t expiry, size_t filter_bits) {
+    if (capacity == 0 || capacity > UINT32_MAX / 2) return NULL;
+    SeenSet *s = calloc(1, sizeof(SeenSet));
+    if (!s) return NULL;
+    s->capacity = (uint32_t)capacity;
+    s->entries = malloc(sizeof(SeenEntry) * capacity);
+    bool indexed = slot_table_init(&s->index, 0) && slot_reserve(&s->index, capacity);
+    if (filter_bits) {
+        size_t bits = 64;
+        while (bits < filter_bits) bits *= 2;
+        s->filters[0] = calloc(bits / 64 * 2, sizeof(uint64_t));
+        s->filters[1] = s->filters[0] + bits / 64;
+        s->filter_mask = bits / 64 - 1;
+        // k = ln 2 * bits per ID is optimal for a full generation
+        s->hashes = (int)(0.693 * bits / capacity + 0.5);
+        if (s->hashes < 1) s->hashes = 1;
+        if (s->hashes > SEEN_MAX_HASHES) s->hashes = SEEN_MAX_HASHES;
+    }
+    if (!s->entries || !indexed || !expiry_init(&s->ring, expiry, SEEN_BUCKETS, entry_link, s) ||
+        (filter_bits && !s->filters[0])) {
+        seen_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void seen_destroy(SeenSet *set) {
+    if (!set) return;
+    free(set->entries);
+    slot_table_free(&set->index);
+    expiry_free(&set->ring);
+    free(set->filters[0]);
+    free(set);
+}
+
+size_t seen_count(const SeenSet *set) {
+    return set->count;
+}
+
+size_t seen_expire(SeenSet *set, uint64_t now) {
+    expiry_advance(&set->ring, now);
+    size_t dropped = 0;
+    for (uint32_t e; (e = expiry_stale(&set->ring)); dropped++) entry_remove(set, e);
+    set->stats.expired += dropped;
+    return dropped;
+}
+
+bool seen_contains(const SeenSet *set, const uint8_t *id) {
+    if (set->filters[0]) {
+        size_t word;
+        uint64_t mask;
+        filter_hashes(set, id, &word, &mask);
+        if (!filter_test(set->filters[0], word, mask) && !filter_test(set->filters[1], word, mask)) return false;
+    }
+    return slot_find(&set->index, id_hash(set, id), id_match, set, id) != SLOT_NONE;
+}
+
+bool seen_check(SeenSet *set, const uint8_t *id, uint64_t now) {
+    seen_expire(set, now);
+    uint32_t hash = id_hash(set, id);
+    size_t word = 0;
+    uint64_t mask = 0;
+    bool maybe = true, current = false;
+    if (set->filters[0]) {
+        filter_hashes(set, id, &word, &mask);
+        current = filter_test(set->filters[set->current], word, mask);
+        maybe = current || filter_test(set->filters[!set->current], word, mask);
+    }
+    
+    if (maybe) {
+        size_t i = slot_find(&set->index, hash, id_match, set, id);
+        if (i != SLOT_NONE) {
+            uint32_t e = set->index.slots[i].id;
+            recency_unlink(set, e);
+            recency_push(set, e);
+            // Seen again, so it must stay in the filter for another generation
+            if (set->filters[0] && !current) set->filters[set->current][word] |= mask;
+            set->stats.hits++;
+            return true;
+        }
+    } else {
+        set->stats.filtered++;
+    }
+    set->stats.misses++;
+    
+    if (set->count == set->capacity) {
+        entry_remove(set, set->oldest);
+        set->stats.evicted++;
+    }
+    uint32_t e = set->free_entry;
+    if (e) set->free_entry = entry(set, e)->link.next;
+    else e = ++set->used;
+    SeenEntry *x = entry(set, e);
+    memcpy(x->id, id, SEEN_ID_SIZE);
+    x->time = set->ring.latest;
+    x->hash = hash;
+    slot_insert(&set->index, e, hash);
+    expiry_append(&set->ring, e, x->time);
+    recency_push(set, e);
+    set->count++;
+    
+    if (set->filters[0]) {
+        if (set->inserted == set->capacity) {
+            set->current = !set->current;
+            memset(set->filters[set->current], 0, sizeof(uint64_t) * (set->filter_mask + 1));
+            set->inserted = 0;
+        }
+        set->filters[set->current][word] |= mask;
+        set->inserted++;
+    }
+    return false;
+}
+
+void seen_stats(const SeenSet *set, SeenStats *stats) {
+    *stats = set->stats;
+}
@@ -0,0 +1,58 @@
+#ifndef SEEN_H
+#define SEEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Recently seen gossip messages
+//
+// A fixed number of message IDs, indexed in an open-addressed table sized
+// when the set is created, so nothing is allocated after that. IDs are
+// kept in least-recently-seen order and the least recent is dropped to
+// make room at capacity. Arrival times fall into a wheel of buckets of
+// expiry / SEEN_BUCKETS seconds, so expiring old IDs only visits the
+// buckets that have aged out rather than every entry.
+//
+// An optional Bloom filter answers most lookups of new IDs without
+// touching the table. Bloom filters cannot delete, so it is kept as two
+// generations: IDs are added to the current one when inserted or seen
+// again, lookups test both, and once `capacity` IDs have been inserted
+// the older generation is cleared and becomes the current one. Any ID
+// still in the set was last seen within that many insertions, so it is
+// always in one of the two.
+#define SEEN_ID_SIZE 32             // bytes32 message_id in gossip_protocol.cry
+#define SEEN_BUCKETS 60             // One-minute buckets for the default expiry
+#define SEEN_DEFAULT_CAPACITY 10000 // MAX_CACHE_SIZE
+#define SEEN_DEFAULT_EXPIRY 3600    // CACHE_TIMEOUT
+
+typedef struct {
+    uint64_t hits;                  // Lookups of an ID already in the set
+    uint64_t misses;                // Lookups that inserted a new ID
+    uint64_t filtered;              // Misses the filter answered alone
+    uint64_t evicted;               // Dropped to make room at capacity
+    uint64_t expired;               // Dropped for age
+} SeenStats;
+
+typedef struct SeenSet SeenSet;
+
+// `filter_bits` per generation, 0 for no filter; rounded up to a power of
+// two. About 10 bits per ID of capacity keeps false positives near 1%.
+SeenSet* seen_create(size_t capacity, uint64_t expiry, size_t filter_bits);
+void seen_destroy(SeenSet *set);
+size_t seen_count(const SeenSet *set);
+
+// Whether the ID was seen within the expiry; if not, it is inserted. A
+// hit makes the ID the most recently seen but does not extend its
+// expiry, which runs from when it was first inserted. Times must not go
+// backwards: an earlier `now` is treated as the latest time seen.
+bool seen_check(SeenSet *set, const uint8_t *id, uint64_t now);
+// Lookup without inserting, reordering or counting
+bool seen_contains(const SeenSet *set, const uint8_t *id);
+// Drop IDs older than the expiry. Expiry is bucketed, so an ID goes
+// between expiry and expiry plus one bucket after it was inserted.
+// seen_check does this as it goes. Returns how many were dropped.
+size_t seen_expire(SeenSet *set, uint64_t now);
+void seen_stats(const SeenSet *set, SeenStats *stats);
+
+#endif /* SEEN_H */
@@ -0,0 +1,94 @@
+#include "slots.h"
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/rand.h>
+
+bool slot_table_init(SlotTable *t, size_t capacity) {
+    size_t slots = 16;
+    while (slots < capacity) slots *= 2;
+    t->slots = calloc(slots, sizeof(Slot));
+    t->capacity = slots;
+    if (!t->slots || RAND_bytes((unsigned char*)&t->seed, sizeof(t->seed)) != 1) {
+        slot_table_free(t);
+        return false;
+    }
+    return true;
+}
+
+void slot_table_free(SlotTable *t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->capacity = 0;
+}
+
+static uint64_t hash_mix(uint64_t h, uint64_t word) {
+    h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+uint32_t slot_hash(const SlotTable *t, const void *key, size_t len, uint64_t extra) {
+    const uint8_t *p = key;
+    uint64_t h = t->seed;
+    uint64_t word;
+    for (; len >= sizeof(word); p += sizeof(word), len -= sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        h = hash_mix(h, word);
+    }
+    if (len) {
+        word = 0;
+        memcpy(&word, p, len);
+        h = hash_mix(h, word);
+    }
+    h = hash_mix(h, extra) * 0xbf58476d1ce4e5b9ull;
+    return (uint32_t)(h >> 32);
+}
+
+size_t slot_find(const SlotTable *t, uint32_t hash, SlotMatch match, const void *owner, const void *key) {
+    size_t mask = t->capacity - 1;
+    for (size_t i = hash & mask; t->slots[i].id; i = (i + 1) & mask) {
+        if (t->slots[i].hash == hash && match(owner, t->slots[i].id, key)) return i;
+    }
+    return SLOT_NONE;
+}
+
+static void slot_place(Slot *slots, size_t capacity, Slot slot) {
+    size_t mask = capacity - 1;
+    size_t i = slot.hash & mask;
+    while (slots[i].id) i = (i + 1) & mask;
+    slots[i] = slot;
+}
+
+void slot_insert(SlotTable *t, uint32_t id, uint32_t hash) {
+    slot_place(t->slots, t->capacity, (Slot){ id, hash });
+}
+
+void slot_remove(SlotTable *t, size_t i) {
+    size_t mask = t->capacity - 1;
+    for (size_t j = (i + 1) & mask; t->slots[j].id; j = (j + 1) & mask) {
+        size_t home = t->slots[j].hash & mask;
+        // Move the entry back if its home is not in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].id = 0;
+}
+
+bool slot_reserve(SlotTable *t, size_t count) {
+    size_t capacity = t->capacity;
+    while (count * 4 > capacity * 3) capacity *= 2;
+    if (capacity == t->capacity) return true;
+    // Ids are 32-bit, so no table needs more slots than this
+    if (capacity > (size_t)UINT32_MAX + 1) return false;
+    
+    Slot *slots = calloc(capacity, sizeof(Slot));
+    if (!slots) return false;
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->slots[i].id) slot_place(slots, capacity, t->slots[i]);
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->capacity = capacity;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Open-addressed index over entries kept elsewhere
+//
+// A slot holds an entry id (0 for an empty slot) and the entry's hash, so
+// probing and growth never touch the entries themselves. Probing is
+// linear over a power-of-two table, and deletion shifts later slots back
+// instead of leaving tombstones.
+//
+// Keys mostly come from peers, who could pick them to collide on any
+// fixed bytes. slot_hash mixes every byte of a key with a seed drawn at
+// random for each table, so which keys collide cannot be planned.
+typedef struct {
+    uint32_t id;
+    uint32_t hash;
+} Slot;
+
+typedef struct {
+    Slot *slots;
+    size_t capacity;                // A power of two
+    uint64_t seed;
+} SlotTable;
+
+#define SLOT_NONE SIZE_MAX
+
+// Whether entry `id` of `owner` has `key`
+typedef bool (*SlotMatch)(const void *owner, uint32_t id, const void *key);
+
+// `capacity` is rounded up to a power of two
+bool slot_table_init(SlotTable *t, size_t capacity);
+void slot_table_free(SlotTable *t);
+// Hash of a key's bytes and an extra word, keyed by the table's seed
+uint32_t slot_hash(const SlotTable *t, const void *key, size_t len, uint64_t extra);
+
+// Slot holding the entry that matches `key`, or SLOT_NONE
+size_t slot_find(const SlotTable *t, uint32_t hash, SlotMatch match, const void *owner, const void *key);
+// The table must have a free slot
+void slot_insert(SlotTable *t, uint32_t id, uint32_t hash);
+void slot_remove(SlotTable *t, size_t i);
+// Grow, in one rehash, so `count` entries keep the table at most 3/4 full
+bool slot_reserve(SlotTable *t, size_t count);
+
+#endif /* SLOTS_H */
@@ -0,0 +1,441 @@
+#include "sync.h"
+#include "merkle.h"
+#include "qrcode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define SYNC_HEADER_MAX 1024        // Encoded header with an empty qr_nonce
+
+enum {
+    SLOT_EMPTY,                     // Not requested, or to be requested again
+    SLOT_REQUESTED,
+    SLOT_RECEIVED,                  // Waiting for or being validated
+    SLOT_VALID
+};
+
+typedef struct {
+    uint8_t state;
+    int peer;                       // Requested from, or sent by
+    uint8_t *data;
+    size_t length;
+    uint8_t hash[CODEC_HASH_SIZE];
+    uint8_t prev_hash[CODEC_HASH_SIZE];
+} SyncSlot;
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    uint32_t outstanding;           // Blocks not yet received
+    uint64_t deadline;
+} SyncWindow;
+
+typedef struct {
+    bool active;
+    bool misbehaved;                // To be dropped by the next sync_schedule
+    uint32_t window_count;
+    SyncWindow *windows;
+} SyncPeer;
+
+typedef struct {
+    int peer;
+    uint32_t start;
+    uint32_t count;
+} SyncRequest;
+
+struct SyncPipeline {
+    SyncConfig config;
+    SyncHandlers handlers;
+    pthread_mutex_t lock;           // Guards everything below but the config
+    pthread_cond_t work;
+    pthread_t *workers;
+    int worker_count;
+    bool stop;
+    
+    SyncSlot *slots;                // Height h is slot h % buffer
+    uint32_t next_apply;
+    uint32_t next_request;          // Lowest height never requested
+    uint32_t end;
+    bool retry;                     // Some heights below next_request are empty
+    bool applying;                  // A thread is inside the apply handler
+    uint8_t tip[CODEC_HASH_SIZE];
+    
+    uint32_t *queue;                // Heights waiting for a worker
+    uint32_t queue_head;
+    uint32_t queue_count;
+    
+    SyncPeer peers[SYNC_MAX_PEERS];
+    int next_peer;                  // Where the next round of requests starts
+    SyncRequest *requests;          // Built under the lock, sent after it
+    SyncStats stats;
+};
+
+static SyncSlot* slot(SyncPipeline *s, uint32_t height) {
+    return &s->slots[height % s->config.buffer];
+}
+
+size_t sync_pow_header(const Block *block, uint8_t *out, size_t capacity) {
+    Block header = *block;
+    header.qr_nonce = (ByteSlice){ NULL, 0 };
+    return codec_encode(&block_header_schema, &header, out, capacity);
+}
+
+bool sync_validate_block(const uint8_t *data, size_t length, const uint8_t *target, uint8_t *hash, Block *block) {
+    Block decoded;
+    if (!block) block = &decoded;
+    size_t n = codec_decode(&block_schema, data, length, block);
+    if (!n || n != length || block->qr_nonce.length != SYNC_QR_NONCE_SIZE) return false;
+    
+    // Merkle root over the transaction hashes; zeros for no transactions
+    const CodecList *list = &block->transactions;
+    MerkleHash root = { 0 };
+    if (list->count) {
+        MerkleHash *leaves = malloc(sizeof(MerkleHash) * list->count);
+        MerkleTree *tree = merkle_create();
+        bool ok = leaves && tree;
+        size_t pos = 0;
+        for (size_t i = 0; ok && i < list->count; i++) {
+            ByteSlice slice;
+            Transaction tx;
+            ok = codec_list_next(NULL, list, &pos, &slice) &&
+                 codec_decode(&transaction_schema, slice.data, slice.length, &tx) == slice.length &&
+                 tx_hash(&tx, leaves[i]);
+        }
+        ok = ok && merkle_build(tree, leaves, list->count, 1) && merkle_root(tree, root);
+        free(leaves);
+        merkle_destroy(tree);
+        if (!ok) return false;
+    }
+    if (memcmp(root, block->merkle_root, MERKLE_HASH_SIZE) != 0) return false;
+    
+    // The proof of work is the QR code of the header followed by the nonce
+    uint8_t preimage[SYNC_HEADER_MAX + SYNC_QR_NONCE_SIZE];
+    size_t header = sync_pow_header(block, preimage, SYNC_HEADER_MAX);
+    if (!header) return false;
+    memcpy(preimage + header, block->qr_nonce.data, SYNC_QR_NONCE_SIZE);
+    QRCode *qr = qrcode_create(preimage, header + SYNC_QR_NONCE_SIZE, QR_ECLEVEL_H);
+    bool valid = qr && qrcode_validate_pow(qr, target);
+    qrcode_destroy(qr);
+    return valid && block_hash(block, hash);
+}
+
+// Give a peer's unfinished heights back to be requested again
+static void peer_release(SyncPipeline *s, int peer) {
+    SyncPeer *p = &s->peers[peer];
+    for (uint32_t w = 0; w < p->window_count; w++) {
+        for (uint32_t h = p->windows[w].start; h < p->windows[w].start + p->windows[w].count; h++) {
+            SyncSlot *x = slot(s, h);
+            if (x->state == SLOT_REQUESTED && x->peer == peer) {
+                x->state = SLOT_EMPTY;
+                s->retry = true;
+            }
+        }
+    }
+    p->window_count = 0;
+}
+
+static void mark_invalid(SyncPipeline *s, uint32_t height) {
+    SyncSlot *x = slot(s, height);
+    s->stats.invalid++;
+    s->peers[x->peer].misbehaved = true;
+    free(x->data);
+    x->data = NULL;
+    x->state = SLOT_EMPTY;
+    s->retry = true;
+}
+
+// Apply every validated block at the front of the buffer. Called with
+// the lock held; the apply handler runs without it.
+static void apply_ready(SyncPipeline *s) {
+    while (!s->applying && s->next_apply < s->end) {
+        uint32_t height = s->next_apply;
+        SyncSlot *x = slot(s, height);
+        if (x->state != SLOT_VALID) break;
+        s->applying = true;
+        pthread_mutex_unlock(&s->lock);
+        bool ok = memcmp(x->prev_hash, s->tip, CODEC_HASH_SIZE) == 0 &&
+                  s->handlers.apply(height, x->hash, x->data, x->length, s->handlers.user);
+        pthread_mutex_lock(&s->lock);
+        s->applying = false;
+        if (!ok) {
+            mark_invalid(s, height);
+            break;
+        }
+        memcpy(s->tip, x->hash, CODEC_HASH_SIZE);
+        free(x->data);
+        x->data = NULL;
+        x->state = SLOT_EMPTY;
+        s->next_apply++;
+        s->stats.applied++;
+    }
+}
+
+// Validate a received block and record the result. Called without the
+// lock; the slot is not touched by anything else while it is received.
+static void validate(SyncPipeline *s, uint32_t height) {
+    SyncSlot *x = slot(s, height);
+    Block block;
+    uint8_t hash[CODEC_HASH_SIZE];
+    bool ok = sync_validate_block(x->data, x->length, s->config.target, hash, &block) && block.index == height;
+    pthread_mutex_lock(&s->lock);
+    if (ok) {
+        memcpy(x->hash, hash, CODEC_HASH_SIZE);
+        if (block.prev_hash) memcpy(x->prev_hash, block.prev_hash, CODEC_HASH_SIZE);
+        else memset(x->prev_hash, 0, CODEC_HASH_SIZE);
+        x->state = SLOT_VALID;
+    } else {
+        mark_invalid(s, height);
+    }
+    apply_ready(s);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void* worker_main(void *arg) {
+    SyncPipeline *s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->stop && s->queue_count == 0) pthread_cond_wait(&s->work, &s->lock);
+        if (s->stop) break;
+        uint32_t height = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % s->config.buffer;
+        s->queue_count--;
+        pthread_mutex_unlock(&s->lock);
+        validate(s, height);
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+void sync_config_default(SyncConfig *config) {
+    memset(config, 0, sizeof(SyncConfig));
+    config->window = SYNC_DEFAULT_WINDOW;
+    config->in_flight = SYNC_DEFAULT_IN_FLIGHT;
+    config->buffer = SYNC_DEFAULT_BUFFER;
+    config->threads = 0;
+    config->timeout = SYNC_DEFAULT_TIMEOUT;
+}
+
+SyncPipeline* sync_create(const SyncConfig *config, const SyncHandlers *handlers, uint32_t height,
+                          const uint8_t *tip_hash, uint32_t end) {
+    if (!config->window || !config->in_flight || config->buffer < config->window || height > end) return NULL;
+    SyncPipeline *s = calloc(1, sizeof(SyncPipeline));
+    if (!s) return NULL;
+    s->config = *config;
+    s->handlers = *handlers;
+    s->next_apply = s->next_request = height;
+    s->end = end;
+    if (tip_hash) memcpy(s->tip, tip_hash, CODEC_HASH_SIZE);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    
+    int threads = config->threads > 0 ? config->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    s->worker_count = threads > 1 ? threads : 0;
+    s->slots = calloc(config->buffer, sizeof(SyncSlot));
+    s->queue = malloc(sizeof(uint32_t) * config->buffer);
+    s->requests = malloc(sizeof(SyncRequest) * SYNC_MAX_PEERS * config->in_flight);
+    s->workers = calloc(s->worker_count + 1, sizeof(pthread_t));
+    bool ok = s->slots && s->queue && s->requests && s->workers;
+    for (int i = 0; ok && i < SYNC_MAX_PEERS; i++) {
+        s->peers[i].windows = malloc(sizeof(SyncWindow) * config->in_flight);
+        ok = s->peers[i].windows != NULL;
+    }
+    int started = 0;
+    while (ok && started < s->worker_count && pthread_create(&s->workers[started], NULL, worker_main, s) == 0) {
+        started++;
+    }
+    if (!ok || started < s->worker_count) {
+        s->worker_count = started;
+        sync_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void sync_destroy(SyncPipeline *sync) {
+    if (!sync) return;
+    pthread_mutex_lock(&sync->lock);
+    sync->stop = true;
+    pthread_cond_broadcast(&sync->work);
+    pthread_mutex_unlock(&sync->lock);
+    for (int i = 0; i < sync->worker_count; i++) pthread_join(sync->workers[i], NULL);
+    if (sync->slots) {
+        for (uint32_t i = 0; i < sync->config.buffer; i++) free(sync->slots[i].data);
+    }
+    for (int i = 0; i < SYNC_MAX_PEERS; i++) free(sync->peers[i].windows);
+    pthread_mutex_destroy(&sync->lock);
+    pthread_cond_destroy(&sync->work);
+    free(sync->slots);
+    free(sync->queue);
+    free(sync->requests);
+    free(sync->workers);
+    free(sync);
+}
+
+bool sync_add_peer(SyncPipeline *sync, int peer) {
+    if (peer < 0 || peer >= SYNC_MAX_PEERS) return false;
+    pthread_mutex_lock(&sync->lock);
+    SyncPeer *p = &sync->peers[peer];
+    p->active = true;
+    p->misbehaved = false;
+    pthread_mutex_unlock(&sync->lock);
+    return true;
+}
+
+void sync_remove_peer(SyncPipeline *sync, int peer) {
+    if (peer < 0 || peer >= SYNC_MAX_PEERS) return;
+    pthread_mutex_lock(&sync->lock);
+    peer_release(sync, peer);
+    sync->peers[peer].active = false;
+    pthread_mutex_unlock(&sync->lock);
+}
+
+void sync_block(SyncPipeline *sync, int peer, const uint8_t *data, size_t length, uint64_t now) {
+    // Only the height is needed to place the block; the rest is checked
+    // by a worker
+    Block block;
+    bool known = peer >= 0 && peer < SYNC_MAX_PEERS;
+    size_t n = known ? codec_decode(&block_schema, data, length, &block) : 0;
+    // An empty payload decodes to nothing, so it is invalid too
+    bool decoded = n && n == length;
+    uint8_t *copy = decoded ? malloc(length) : NULL;
+    pthread_mutex_lock(&sync->lock);
+    sync->stats.received++;
+    SyncPeer *p = decoded ? &sync->peers[peer] : NULL;
+    SyncSlot *x = NULL;
+    if (p && block.index >= sync->next_apply && block.index < sync->next_request) {
+        x = slot(sync, block.index);
+        if (x->state != SLOT_REQUESTED || x->peer != peer) x = NULL;
+    }
+    if (!x || !copy) {
+        if (!decoded) {
+            sync->stats.invalid++;
+            if (known) sync->peers[peer].misbehaved = true;
+        } else {
+            sync->stats.duplicates++;
+        }
+        pthread_mutex_unlock(&sync->lock);
+        free(copy);
+        return;
+    }
+    
+    // Progress on a window pushes its deadline back
+    for (uint32_t w = 0; w < p->window_count; w++) {
+        SyncWindow *window = &p->windows[w];
+        if (block.index - window->start < window->count) {
+            window->deadline = now + sync->config.timeout;
+            if (--window->outstanding == 0) p->windows[w] = p->windows[--p->window_count];
+            break;
+        }
+    }
+    memcpy(copy, data, length);
+    x->data = copy;
+    x->length = length;
+    x->state = SLOT_RECEIVED;
+    
+    if (sync->worker_count) {
+        sync->queue[(sync->queue_head + sync->queue_count++) % sync->config.buffer] = block.index;
+        pthread_cond_signal(&sync->work);
+        pthread_mutex_unlock(&sync->lock);
+    } else {
+        pthread_mutex_unlock(&sync->lock);
+        validate(sync, block.index);
+    }
+}
+
+// The next run of heights to request: empty ones left behind by dropped
+// peers and bad blocks first, then new ones up to the end of the buffer
+static bool next_window(SyncPipeline *s, uint32_t *start, uint32_t *count) {
+    uint32_t window = s->config.window;
+    if (s->retry) {
+        for (uint32_t h = s->next_apply; h < s->next_request; h++) {
+            if (slot(s, h)->state != SLOT_EMPTY) continue;
+            uint32_t n = 1;
+            while (n < window && h + n < s->next_request && slot(s, h + n)->state == SLOT_EMPTY) n++;
+            *start = h;
+            *count = n;
+            return true;
+        }
+        s->retry = false;
+    }
+    uint32_t limit = s->next_apply + s->config.buffer < s->end ? s->next_apply + s->config.buffer : s->end;
+    if (s->next_request >= limit) return false;
+    *start = s->next_request;
+    *count = limit - s->next_request < window ? limit - s->next_request : window;
+    s->next_request += *count;
+    return true;
+}
+
+void sync_schedule(SyncPipeline *sync, uint64_t now) {
+    int dropped[SYNC_MAX_PEERS];
+    int drop_count = 0;
+    size_t request_count = 0;
+    pthread_mutex_lock(&sync->lock);
+    for (int i = 0; i < SYNC_MAX_PEERS; i++) {
+        SyncPeer *p = &sync->peers[i];
+        if (!p->active) continue;
+        for (uint32_t w = 0; w < p->window_count && !p->misbehaved; w++) {
+            if (p->windows[w].deadline > now) continue;
+            sync->stats.timeouts++;
+            p->misbehaved = true;
+        }
+        if (p->misbehaved) {
+            peer_release(sync, i);
+            p->active = false;
+            dropped[drop_count++] = i;
+        }
+    }
+    
+    // One window per peer per round, so the work spreads across peers
+    for (bool progress = true; progress;) {
+        progress = false;
+        for (int k = 0; k < SYNC_MAX_PEERS; k++) {
+            int i = (sync->next_peer + k) % SYNC_MAX_PEERS;
+            SyncPeer *p = &sync->peers[i];
+            uint32_t start, count;
+            if (!p->active || p->window_count == sync->config.in_flight || !next_window(sync, &start, &count)) {
+                continue;
+            }
+            for (uint32_t h = start; h < start + count; h++) {
+                slot(sync, h)->state = SLOT_REQUESTED;
+                slot(sync, h)->peer = i;
+            }
+            p->windows[p->window_count++] = (SyncWindow){ start, count, count, now + sync->config.timeout };
+            sync->requests[request_count++] = (SyncRequest){ i, start, count };
+            sync->stats.requested += count;
+            progress = true;
+        }
+    }
+    sync->next_peer = (sync->next_peer + 1) % SYNC_MAX_PEERS;
+    pthread_mutex_unlock(&sync->lock);
+    
+    for (int i = 0; i < drop_count; i++) {
+        if (sync->handlers.drop) sync->handlers.drop(dropped[i], sync->handlers.user);
+    }
+    for (size_t i = 0; i < request_count; i++) {
+        SyncRequest *r = &sync->requests[i];
+        if (!sync->handlers.request(r->peer, r->start, r->count, sync->handlers.user)) {
+            pthread_mutex_lock(&sync->lock);
+            sync->peers[r->peer].misbehaved = true;
+            pthread_mutex_unlock(&sync->lock);
+        }
+    }
+}
+
+uint32_t sync_height(const SyncPipeline *sync) {
+    pthread_mutex_lock((pthread_mutex_t*)&sync->lock);
+    uint32_t height = sync->next_apply;
+    pthread_mutex_unlock((pthread_mutex_t*)&sync->lock);
+    return height;
+}
+
+bool sync_done(const SyncPipeline *sync) {
+    return sync_height(sync) >= sync->end;
+}
+
+void sync_stats(const SyncPipeline *sync, SyncStats *stats) {
+    pthread_mutex_lock((pthread_mutex_t*)&sync->lock);
+    *stats = sync->stats;
+    pthread_mutex_unlock((pthread_mutex_t*)&sync->lock);
+}
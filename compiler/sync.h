@@ -0,0 +1,91 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "codec.h"
+
+// Initial block download
+//
+// The heights still missing are split into windows that are requested
+// from every peer at once, several windows per peer, with MSG_GET_BLOCKS.
+// Blocks arrive in any order into a buffer of `buffer` heights starting at
+// the next one to apply; nothing past its end is requested, so a slow
+// peer holds back at most a buffer's worth of blocks. Arrived blocks are
+// checked (encoding, Merkle root, QR proof of work) on a pool of worker
+// threads while later ones are still downloading, and applied strictly in
+// height order once each links to the block before it.
+//
+// A peer that sends a block that fails those checks, or leaves a window
+// without progress for `timeout` ms, is dropped and its heights are
+// requested again from the others.
+//
+// The pipeline is transport-agnostic. The caller sends requests and
+// feeds in blocks on one thread, and calls sync_schedule on that thread
+// whenever blocks arrive and at least every few ms while waiting.
+#define SYNC_MAX_PEERS 64
+#define SYNC_DEFAULT_WINDOW 16
+#define SYNC_DEFAULT_IN_FLIGHT 4
+#define SYNC_DEFAULT_BUFFER 1024
+#define SYNC_DEFAULT_TIMEOUT 5000
+#define SYNC_QR_NONCE_SIZE 8        // qr_nonce holds the mined 64-bit nonce
+
+typedef struct {
+    uint32_t window;                // Blocks per MSG_GET_BLOCKS
+    uint32_t in_flight;             // Windows outstanding per peer
+    uint32_t buffer;                // Heights between the next to apply and the last requested
+    int threads;                    // Validation workers (<= 0 for one per CPU); 1 validates inline
+    uint64_t timeout;               // ms a window may go without a block
+    uint8_t target[CODEC_HASH_SIZE];    // Proof of work target
+} SyncConfig;
+
+// `request` sends MSG_GET_BLOCKS; false drops the peer. `apply` is called
+// once per height, in order, from a worker thread when there are workers;
+// false rejects the block and drops the peer that sent it. `drop` tells
+// the caller to disconnect a peer; it is called from sync_schedule.
+typedef struct {
+    bool (*request)(int peer, uint32_t start, uint32_t count, void *user);
+    bool (*apply)(uint32_t height, const uint8_t *hash, const uint8_t *data, size_t length, void *user);
+    void (*drop)(int peer, void *user);
+    void *user;
+} SyncHandlers;
+
+typedef struct {
+    uint64_t requested;             // Heights requested, retries included
+    uint64_t received;
+    uint64_t duplicates;            // Unrequested, late or repeated blocks, ignored
+    uint64_t invalid;               // Blocks that failed a check or did not link
+    uint64_t timeouts;              // Windows given up on
+    uint64_t applied;
+} SyncStats;
+
+typedef struct SyncPipeline SyncPipeline;
+
+// Fill in the defaults; the target is left for the caller
+void sync_config_default(SyncConfig *config);
+// Download heights [height, end) onto a chain whose tip has `tip_hash`
+// (NULL for zeros, below the genesis block)
+SyncPipeline* sync_create(const SyncConfig *config, const SyncHandlers *handlers, uint32_t height,
+                          const uint8_t *tip_hash, uint32_t end);
+void sync_destroy(SyncPipeline *sync);
+
+// Peers are numbered by the caller, below SYNC_MAX_PEERS
+bool sync_add_peer(SyncPipeline *sync, int peer);
+void sync_remove_peer(SyncPipeline *sync, int peer);
+// A MSG_BLOCK payload from a peer; `now` in ms
+void sync_block(SyncPipeline *sync, int peer, const uint8_t *data, size_t length, uint64_t now);
+// Drop misbehaving and stalled peers and send the requests there is room for
+void sync_schedule(SyncPipeline *sync, uint64_t now);
+uint32_t sync_height(const SyncPipeline *sync);    // Next height to apply
+bool sync_done(const SyncPipeline *sync);
+void sync_stats(const SyncPipeline *sync, SyncStats *stats);
+
+// Bytes the QR proof of work is mined over: the block header encoded
+// with an empty qr_nonce. Returns the length, or 0 if it does not fit.
+size_t sync_pow_header(const Block *block, uint8_t *out, size_t capacity);
+// Decode a block and check its Merkle root and proof of work. Fills in
+// its hash, and the decoded view of `data` if `block` is not NULL.
+bool sync_validate_block(const uint8_t *data, size_t length, const uint8_t *target, uint8_t *hash, Block *block);
+
+#endif /* SYNC_H */
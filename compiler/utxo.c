@@ -0,0 +1,414 @@
+#include "utxo.h"
+#include "slots.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UTXO_CHUNK 4096             // Pool entries per chunk
+#define UTXO_MIN_SLOTS 1024         // Grown past 3/4 full
+
+// Ordered indexes over the pool, both treaps sharing each node's priority
+enum {
+    BY_VALUE,                       // Amount, then id
+    BY_OWNER,                       // Pubkey hash, then amount, then id
+    INDEXES
+};
+
+// Pool entry. Ids start at 1 so 0 can mean none.
+typedef struct {
+    Utxo utxo;
+    uint32_t child[INDEXES][2];     // Left and right; child[BY_VALUE][0] links free entries
+    uint32_t priority;
+    bool live;
+} UtxoNode;
+
+// Position in an index; id 0 sorts before every entry with the same
+// owner and amount and UINT32_MAX after them
+typedef struct {
+    const uint8_t *pubkey_hash;
+    size_t pubkey_hash_len;
+    uint64_t amount;
+    uint32_t id;
+} IndexKey;
+
+typedef struct {
+    const uint8_t *tx_hash;
+    uint32_t output_index;
+} Outpoint;
+
+struct UtxoSet {
+    UtxoNode **chunks;
+    size_t chunk_count;
+    uint32_t used;                  // Ids handed out so far
+    uint32_t free_node;
+    
+    SlotTable index;                // By outpoint
+    size_t count;
+    
+    uint32_t roots[INDEXES];
+    uint32_t seed;
+    uint64_t total;
+    
+    // Per-block scratch for utxo_apply_block
+    Transaction *txs;
+    uint8_t (*tx_hashes)[CODEC_HASH_SIZE];
+    size_t tx_capacity;
+};
+
+static UtxoNode* node(const UtxoSet *s, uint32_t id) {
+    return &s->chunks[(id - 1) / UTXO_CHUNK][(id - 1) % UTXO_CHUNK];
+}
+
+static uint32_t node_alloc(UtxoSet *s) {
+    if (s->free_node) {
+        uint32_t id = s->free_node;
+        s->free_node = node(s, id)->child[BY_VALUE][0];
+        return id;
+    }
+    if (s->used == UINT32_MAX) return 0;
+    if (s->used % UTXO_CHUNK == 0) {
+        UtxoNode **chunks = realloc(s->chunks, sizeof(UtxoNode*) * (s->chunk_count + 1));
+        if (!chunks) return 0;
+        s->chunks = chunks;
+        if (!(chunks[s->chunk_count] = malloc(sizeof(UtxoNode) * UTXO_CHUNK))) return 0;
+        s->chunk_count++;
+    }
+    return ++s->used;
+}
+
+static void node_free(UtxoSet *s, uint32_t id) {
+    UtxoNode *n = node(s, id);
+    n->live = false;
+    n->child[BY_VALUE][0] = s->free_node;
+    s->free_node = id;
+}
+
+// Outpoints name transactions that peers create, so the table hashes the
+// whole txid with its seed
+static uint32_t outpoint_hash(const UtxoSet *s, const Outpoint *o) {
+    return slot_hash(&s->index, o->tx_hash, CODEC_HASH_SIZE, o->output_index);
+}
+
+static bool outpoint_match(const void *owner, uint32_t id, const void *key) {
+    const Outpoint *o = key;
+    const Utxo *u = &node(owner, id)->utxo;
+    return u->output_index == o->output_index && memcmp(u->tx_hash, o->tx_hash, CODEC_HASH_SIZE) == 0;
+}
+
+// Slot holding the outpoint, or SLOT_NONE
+static size_t outpoint_find(const UtxoSet *s, const Outpoint *o, uint32_t hash) {
+    return slot_find(&s->index, hash, outpoint_match, s, o);
+}
+
+static IndexKey key_of(const UtxoSet *s, uint32_t id) {
+    const Utxo *u = &node(s, id)->utxo;
+    return (IndexKey){ u->pubkey_hash, u->pubkey_hash_len, u->amount, id };
+}
+
+// Order of `k` against entry `id` in an index; ties are broken by id so
+// every entry's key is distinct
+static int key_compare(const UtxoSet *s, int index, const IndexKey *k, uint32_t id) {
+    const Utxo *u = &node(s, id)->utxo;
+    if (index == BY_OWNER) {
+        if (k->pubkey_hash_len != u->pubkey_hash_len) return k->pubkey_hash_len < u->pubkey_hash_len ? -1 : 1;
+        int c = memcmp(k->pubkey_hash, u->pubkey_hash, u->pubkey_hash_len);
+        if (c) return c;
+    }
+    if (k->amount != u->amount) return k->amount < u->amount ? -1 : 1;
+    return k->id < id ? -1 : k->id > id;
+}
+
+static uint32_t treap_insert(UtxoSet *s, int index, uint32_t root, uint32_t id, const IndexKey *k) {
+    if (!root) return id;
+    UtxoNode *r = node(s, root);
+    int side = key_compare(s, index, k, root) > 0;
+    r->child[index][side] = treap_insert(s, index, r->child[index][side], id, k);
+    uint32_t child = r->child[index][side];
+    UtxoNode *c = node(s, child);
+    if (c->priority > r->priority) {
+        r->child[index][side] = c->child[index][!side];
+        c->child[index][!side] = root;
+        return child;
+    }
+    return root;
+}
+
+// Join two treaps where every key in `a` is below every key in `b`
+static uint32_t treap_merge(UtxoSet *s, int index, uint32_t a, uint32_t b) {
+    if (!a) return b;
+    if (!b) return a;
+    UtxoNode *na = node(s, a), *nb = node(s, b);
+    if (na->priority > nb->priority) {
+        na->child[index][1] = treap_merge(s, index, na->child[index][1], b);
+        return a;
+    }
+    nb->child[index][0] = treap_merge(s, index, a, nb->child[index][0]);
+    return b;
+}
+
+static uint32_t treap_remove(UtxoSet *s, int index, uint32_t root, uint32_t id, const IndexKey *k) {
+    if (!root) return 0;
+    UtxoNode *r = node(s, root);
+    if (root == id) return treap_merge(s, index, r->child[index][0], r->child[index][1]);
+    int side = key_compare(s, index, k, root) > 0;
+    r->child[index][side] = treap_remove(s, index, r->child[index][side], id, k);
+    return root;
+}
+
+// Smallest entry at or above `k`, or 0
+static uint32_t treap_ceiling(const UtxoSet *s, int index, const IndexKey *k) {
+    uint32_t found = 0;
+    for (uint32_t id = s->roots[index]; id;) {
+        int c = key_compare(s, index, k, id);
+        if (c <= 0) found = id;
+        id = node(s, id)->child[index][c > 0];
+    }
+    return found;
+}
+
+// Largest entry strictly below `k`, or 0
+static uint32_t treap_below(const UtxoSet *s, int index, const IndexKey *k) {
+    uint32_t found = 0;
+    for (uint32_t id = s->roots[index]; id;) {
+        int c = key_compare(s, index, k, id);
+        if (c > 0) found = id;
+        id = node(s, id)->child[index][c > 0];
+    }
+    return found;
+}
+
+UtxoSet* utxo_set_create(void) {
+    UtxoSet *s = calloc(1, sizeof(UtxoSet));
+    if (!s) return NULL;
+    s->seed = 0x2545f491;
+    if (!slot_table_init(&s->index, UTXO_MIN_SLOTS)) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void utxo_set_destroy(UtxoSet *set) {
+    if (set) {
+        for (size_t i = 0; i < set->chunk_count; i++) free(set->chunks[i]);
+        free(set->chunks);
+        slot_table_free(&set->index);
+        free(set->txs);
+        free(set->tx_hashes);
+        free(set);
+    }
+}
+
+size_t utxo_count(const UtxoSet *set) {
+    return set->count;
+}
+
+uint64_t utxo_total(const UtxoSet *set) {
+    return set->total;
+}
+
+const Utxo* utxo_find(const UtxoSet *set, const uint8_t *tx_hash, uint32_t output_index) {
+    Outpoint o = { tx_hash, output_index };
+    size_t i = outpoint_find(set, &o, outpoint_hash(set, &o));
+    return i != SLOT_NONE ? &node(set, set->index.slots[i].id)->utxo : NULL;
+}
+
+bool utxo_add(UtxoSet *set, const Utxo *utxo) {
+    Outpoint o = { utxo->tx_hash, utxo->output_index };
+    uint32_t hash = outpoint_hash(set, &o);
+    if (outpoint_find(set, &o, hash) != SLOT_NONE) return false;
+    if (!slot_reserve(&set->index, set->count + 1)) return false;
+    uint32_t id = node_alloc(set);
+    if (!id) return false;
+    
+    UtxoNode *n = node(set, id);
+    n->utxo = *utxo;
+    memset(n->child, 0, sizeof(n->child));
+    // xorshift32
+    set->seed ^= set->seed << 13;
+    set->seed ^= set->seed >> 17;
+    set->seed ^= set->seed << 5;
+    n->priority = set->seed;
+    n->live = true;
+    
+    slot_insert(&set->index, id, hash);
+    IndexKey k = key_of(set, id);
+    for (int x = 0; x < INDEXES; x++) set->roots[x] = treap_insert(set, x, set->roots[x], id, &k);
+    set->count++;
+    set->total += utxo->amount;
+    return true;
+}
+
+bool utxo_spend(UtxoSet *set, const uint8_t *tx_hash, uint32_t output_index, Utxo *spent) {
+    Outpoint o = { tx_hash, output_index };
+    size_t i = outpoint_find(set, &o, outpoint_hash(set, &o));
+    if (i == SLOT_NONE) return false;
+    uint32_t id = set->index.slots[i].id;
+    UtxoNode *n = node(set, id);
+    if (spent) *spent = n->utxo;
+    
+    slot_remove(&set->index, i);
+    IndexKey k = key_of(set, id);
+    for (int x = 0; x < INDEXES; x++) set->roots[x] = treap_remove(set, x, set->roots[x], id, &k);
+    set->count--;
+    set->total -= n->utxo.amount;
+    node_free(set, id);
+    return true;
+}
+
+static bool undo_reserve(UtxoUndo *undo, size_t count) {
+    if (count <= undo->capacity) return true;
+    size_t capacity = undo->capacity ? undo->capacity : 64;
+    while (capacity < count) capacity *= 2;
+    UtxoChange *changes = realloc(undo->changes, sizeof(UtxoChange) * capacity);
+    if (!changes) return false;
+    undo->changes = changes;
+    undo->capacity = capacity;
+    return true;
+}
+
+// The undo log is reserved for the whole block up front, so logging a
+// change cannot fail
+static void undo_push(UtxoUndo *undo, const Utxo *utxo, bool spent) {
+    undo->changes[undo->count++] = (UtxoChange){ *utxo, spent };
+}
+
+// Apply one transaction; returns what is wrong with it, or NULL
+static const char* apply_tx(UtxoSet *s, const Transaction *tx, const uint8_t *txid, bool first, UtxoUndo *undo) {
+    if (tx->inputs.count == 0 && !first) return "has no inputs";
+    uint64_t in_total = 0, out_total = 0;
+    size_t pos = 0;
+    
+    TxInput input;
+    while (codec_list_next(&tx_input_schema, &tx->inputs, &pos, &input)) {
+        Utxo spent;
+        if (!utxo_spend(s, input.tx_hash, input.output_index, &spent)) return "spends a missing output";
+        undo_push(undo, &spent, true);
+        if (input.amount != spent.amount) return "misstates an input amount";
+        if (in_total + spent.amount < in_total) return "overflows its input total";
+        in_total += spent.amount;
+    }
+    
+    TxOutput output;
+    uint32_t index = 0;
+    pos = 0;
+    while (codec_list_next(&tx_output_schema, &tx->outputs, &pos, &output)) {
+        if (output.address.length > UTXO_SCRIPT_MAX) return "has an oversized output address";
+        Utxo utxo;
+        memcpy(utxo.tx_hash, txid, CODEC_HASH_SIZE);
+        utxo.output_index = index++;
+        utxo.amount = output.amount;
+        utxo.pubkey_hash_len = output.address.length;
+        memcpy(utxo.pubkey_hash, output.address.data, output.address.length);
+        if (!utxo_add(s, &utxo)) return "repeats an unspent output";
+        undo_push(undo, &utxo, false);
+        if (out_total + output.amount < out_total) return "overflows its output total";
+        out_total += output.amount;
+    }
+    
+    if (tx->inputs.count && out_total > in_total) return "spends more than its inputs";
+    return NULL;
+}
+
+bool utxo_apply_block(UtxoSet *s, const Block *block, UtxoUndo *undo) {
+    const CodecList *list = &block->transactions;
+    size_t n = list->count;
+    undo->count = 0;
+    if (n > s->tx_capacity) {
+        Transaction *txs = realloc(s->txs, sizeof(Transaction) * n);
+        if (txs) s->txs = txs;
+        uint8_t (*hashes)[CODEC_HASH_SIZE] = realloc(s->tx_hashes, CODEC_HASH_SIZE * n);
+        if (hashes) s->tx_hashes = hashes;
+        if (!txs || !hashes) return false;
+        s->tx_capacity = n;
+    }
+    
+    // Decode and hash every transaction first, then size the hash table
+    // and undo log once for the whole block
+    size_t pos = 0, changes = 0, outputs = 0;
+    for (size_t i = 0; i < n; i++) {
+        ByteSlice slice;
+        if (list->items) slice = ((const ByteSlice*)list->items)[i];
+        else if (!codec_list_next(NULL, list, &pos, &slice)) slice.length = 0;
+        if (!slice.length || codec_decode(&transaction_schema, slice.data, slice.length, &s->txs[i]) != slice.length) {
+            printf("Error: transaction %zu of block %u is malformed\n", i, block->index);
+            return false;
+        }
+        tx_hash(&s->txs[i], s->tx_hashes[i]);
+        outputs += s->txs[i].outputs.count;
+        changes += s->txs[i].inputs.count + s->txs[i].outputs.count;
+    }
+    if (!slot_reserve(&s->index, s->count + outputs) || !undo_reserve(undo, changes)) return false;
+    
+    for (size_t i = 0; i < n; i++) {
+        const char *problem = apply_tx(s, &s->txs[i], s->tx_hashes[i], i == 0, undo);
+        if (problem) {
+            printf("Error: transaction %zu of block %u %s\n", i, block->index, problem);
+            utxo_undo_block(s, undo);
+            undo->count = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool utxo_undo_block(UtxoSet *set, const UtxoUndo *undo) {
+    bool ok = true;
+    for (size_t i = undo->count; i-- > 0;) {
+        const UtxoChange *c = &undo->changes[i];
+        if (c->spent) ok &= utxo_add(set, &c->utxo);
+        else ok &= utxo_spend(set, c->utxo.tx_hash, c->utxo.output_index, NULL);
+    }
+    return ok;
+}
+
+void utxo_undo_free(UtxoUndo *undo) {
+    free(undo->changes);
+    *undo = (UtxoUndo){ NULL, 0, 0 };
+}
+
+static bool owned_by(const Utxo *u, const uint8_t *pubkey_hash, size_t len) {
+    return !pubkey_hash || (u->pubkey_hash_len == len && memcmp(u->pubkey_hash, pubkey_hash, len) == 0);
+}
+
+// Filtered selection walks the owner index, which keeps one owner's
+// outputs together in value order, so it never visits anyone else's
+size_t utxo_select(const UtxoSet *set, uint64_t target, const uint8_t *pubkey_hash, size_t pubkey_hash_len,
+                   const Utxo **out, size_t max, uint64_t *selected) {
+    int index = pubkey_hash ? BY_OWNER : BY_VALUE;
+    if (max == 0) return 0;
+    
+    // The first output worth at least the target
+    IndexKey k = { pubkey_hash, pubkey_hash_len, target, 0 };
+    uint32_t id = treap_ceiling(set, index, &k);
+    if (id && owned_by(&node(set, id)->utxo, pubkey_hash, pubkey_hash_len)) {
+        out[0] = &node(set, id)->utxo;
+        *selected = out[0]->amount;
+        return 1;
+    }
+    
+    // No single output is enough: take the largest first
+    uint64_t sum = 0;
+    size_t count = 0;
+    k = (IndexKey){ pubkey_hash, pubkey_hash_len, UINT64_MAX, UINT32_MAX };
+    while (count < max && (id = treap_below(set, index, &k)) != 0) {
+        const Utxo *u = &node(set, id)->utxo;
+        if (!owned_by(u, pubkey_hash, pubkey_hash_len)) break;
+        out[count++] = u;
+        sum = sum + u->amount < sum ? UINT64_MAX : sum + u->amount;
+        if (sum >= target) {
+            *selected = sum;
+            return count;
+        }
+        k = key_of(set, id);
+    }
+    return 0;
+}
+
+const Utxo* utxo_next(const UtxoSet *set, size_t *cursor) {
+    while (*cursor < set->used) {
+        const UtxoNode *n = node(set, ++*cursor);
+        if (n->live) return &n->utxo;
+    }
+    return NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef UTXO_H
+#define UTXO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "codec.h"
+
+// Unspent output set
+//
+// Outputs live in a pool of fixed-size entries. An open-addressed hash
+// table indexes them by outpoint (txid, output index), and two treaps
+// order them by value and by owner then value for coin selection. Blocks are applied as a unit: every
+// change is logged to an undo record, a block that fails validation is
+// rolled back from that log, and the same record undoes the block in a
+// reorg.
+#define UTXO_SCRIPT_MAX 32
+
+typedef struct {
+    uint8_t tx_hash[CODEC_HASH_SIZE];
+    uint32_t output_index;
+    uint64_t amount;
+    uint8_t pubkey_hash_len;
+    uint8_t pubkey_hash[UTXO_SCRIPT_MAX];
+} Utxo;
+
+typedef struct {
+    Utxo utxo;
+    bool spent;                     // Spent by the block, else created by it
+} UtxoChange;
+
+// Changes a block made, in order
+typedef struct {
+    UtxoChange *changes;
+    size_t count;
+    size_t capacity;
+} UtxoUndo;
+
+typedef struct UtxoSet UtxoSet;
+
+UtxoSet* utxo_set_create(void);
+void utxo_set_destroy(UtxoSet *set);
+size_t utxo_count(const UtxoSet *set);
+uint64_t utxo_total(const UtxoSet *set);
+
+// Lookup by outpoint; NULL if unspent output does not exist. The pointer
+// is valid until the output is spent.
+const Utxo* utxo_find(const UtxoSet *set, const uint8_t *tx_hash, uint32_t output_index);
+// Add an output; false if it already exists
+bool utxo_add(UtxoSet *set, const Utxo *utxo);
+// Remove an output, copying it to `spent` if given; false if missing
+bool utxo_spend(UtxoSet *set, const uint8_t *tx_hash, uint32_t output_index, Utxo *spent);
+
+// Apply every transaction in a decoded block. Inputs must exist and carry
+// their output's amount, and each transaction must not create value; only
+// the first transaction may have no inputs. On success the block's
+// changes are in `undo` (cleared first); on failure the set is unchanged.
+bool utxo_apply_block(UtxoSet *set, const Block *block, UtxoUndo *undo);
+// Reverse a block applied with utxo_apply_block
+bool utxo_undo_block(UtxoSet *set, const UtxoUndo *undo);
+void utxo_undo_free(UtxoUndo *undo);
+
+// Coin selection over outputs paying `pubkey_hash` (any owner if NULL):
+// the smallest single output covering `target` if there is one, else the
+// largest outputs until the target is met. Returns how many were written
+// to `out`, or 0 if at most `max` outputs cannot cover the target.
+size_t utxo_select(const UtxoSet *set, uint64_t target, const uint8_t *pubkey_hash, size_t pubkey_hash_len,
+                   const Utxo **out, size_t max, uint64_t *selected);
+
+// Visit every output; start *cursor at 0. Returns NULL at the end.
+const Utxo* utxo_next(const UtxoSet *set, size_t *cursor);
+
+#endif /* UTXO_H */